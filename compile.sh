@@ -1,5 +1,7 @@
 sudo apt-get install libsqlite3-dev
 sudo apt-get install libmysqlclient-dev
+sudo apt-get install libpq-dev
+sudo apt-get install zlib1g-dev
 
-g++ -std=c++14 -o netflow_collector netflow_collector.cpp ini.cpp -lsqlite3 -lmysqlclient -lpthread
+g++ -std=c++14 -O2 -o netflow_collector netflow_collector.cpp ini.cpp -lsqlite3 -lmysqlclient -lpq -lz -lpthread
 
@@ -4,19 +4,40 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <deque>
+#include <limits>
+#include <algorithm>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <type_traits>
 #include <cstring>
 #include <fstream>
 #include <iomanip>    // For hex output
+#include <sstream>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>  // For struct iovec (recvmmsg)
 #include <netinet/in.h>
+#include <linux/filter.h> // For the SO_REUSEPORT steering program
+#include <linux/io_uring.h> // For the io_uring receive engine
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <fcntl.h>    // For open()
+#include <sys/stat.h>
+#include <dirent.h>
+#include <signal.h>
 #include <syslog.h>   // For logging
 #include <errno.h>    // For errno
 #include <ctime>      // For time conversion
+#include <immintrin.h> // For the SSE4/AVX2 batch decoder
+#include <new>
+#include <cstdlib>
 
 // Include headers for INI parser and SQLite3
 #include "ini.h"
@@ -24,6 +45,10 @@
 
 // For MySQL
 #include <mysql/mysql.h>
+// For PostgreSQL
+#include <postgresql/libpq-fe.h>
+#include <endian.h>   // For htobe64() in the binary COPY rows
+#include <zlib.h>
 
 // Version and author information
 #define VERSION "2.1"
@@ -62,59 +87,372 @@ struct NetFlowV9FieldSpecifier {
     uint16_t length;
 };
 
+// Structures for IPFIX (RFC 7011)
+struct IPFIXHeader {
+    uint16_t version;
+    uint16_t length;                // Whole message including this header
+    uint32_t export_time;
+    uint32_t sequence_number;
+    uint32_t observation_domain_id;
+};
+
+// Set Header (Set ID 2 = templates, 3 = options templates, 256+ = data)
+struct IPFIXSetHeader {
+    uint16_t set_id;
+    uint16_t length;
+};
+
+// Template Record header; Options Template Records add a scope field count
+struct IPFIXTemplateRecord {
+    uint16_t template_id;
+    uint16_t field_count;
+};
+
+// Field Specifier, followed by a 4-byte enterprise number when the top bit of element_id is set
+struct IPFIXFieldSpecifier {
+    uint16_t element_id;
+    uint16_t length;
+};
+
 #pragma pack(pop)
 
 // Configuration structures
+// One sink of a fan-out ('type' listing several sinks)
+struct SinkConfig {
+    std::string type;
+    std::string policy;             // "block", "drop" or "spill" when the queue is full
+    int queue_rows;                 // Rows queued to the sink before the policy applies
+    int batch_rows;                 // Rows per batch handed from a receiver to the sink
+    int spill_size;                 // MiB of spool segments with policy "spill"
+    int replay_rate;                // Max. rows/s replayed from the spool (0 = unlimited)
+};
+
 struct DatabaseConfig {
     std::string type;
+    std::vector<SinkConfig> sinks;  // The sinks listed in 'type'
+    int sink_flush_interval;        // Max. age of a receiver's partly filled batch in ms
+    std::string sink_spill_path;    // Directory of the spools of sinks with policy "spill"
     std::string sqlite_path;
+    int sqlite_batch_size;          // Rows per transaction
+    int sqlite_flush_interval;      // Milliseconds before a partly filled transaction is committed
+    std::string sqlite_journal_mode;
+    std::string sqlite_synchronous;
+    int sqlite_cache_size;          // PRAGMA cache_size (pages, or KiB if negative; 0 = SQLite default)
+    int sqlite_mmap_size;           // PRAGMA mmap_size in MiB (0 = no memory-mapped I/O)
+    int sqlite_queue_rows;          // Rows queued to the writer thread before producers wait
     std::string csv_path;
+    int csv_buffer_size;            // KiB of rows buffered before a write
+    int csv_flush_interval;         // Max. age of buffered rows in ms
+    int csv_rotate_interval;        // Seconds per file, csv_path is a strftime() pattern (0 = one file)
+    std::string csv_compress;       // "none" or "gzip"
+    int csv_compress_level;         // zlib level 1-9
     std::string mysql_host;
     int mysql_port;
     std::string mysql_user;
     std::string mysql_password;
     std::string mysql_database;
+    int mysql_batch_size;           // Rows per multi-row INSERT
+    int mysql_flush_interval;       // Max. age of a partly filled INSERT or load in ms
+    std::string mysql_mode;         // "insert" (multi-row INSERT) or "load" (LOAD DATA LOCAL INFILE)
+    int mysql_load_size;            // KiB of rows buffered per LOAD DATA in "load" mode
+    int mysql_connections;          // Writer pool connections (0 = a connection per receiver)
+    int mysql_queue_rows;           // Rows queued to the pool before producers wait
+    int mysql_health_interval;      // Seconds between pings of an idle pool connection
+    std::string postgres_conninfo;  // libpq connection string
+    int postgres_connections;       // Writer pool connections (0 = a connection per receiver)
+    int postgres_copy_rows;         // Max. rows per COPY (one transaction)
+    int postgres_flush_interval;    // Max. age of an open COPY in ms
+    int postgres_queue_rows;        // Rows queued to the pool before producers wait
+    std::string nfcapd_path;        // Directory of the nfcapd files
+    int nfcapd_rotate_interval;     // Seconds per file, a multiple of 60
+    int nfcapd_flush_interval;      // Max. age of a partly filled data block in ms
+    std::string native_path;        // strftime() pattern of the segment files
+    int native_rotate_interval;     // Seconds per segment (0 = one segment per run)
+    int native_block_rows;          // Rows per column block
+    int native_queue_rows;          // Rows queued to the segment writer before producers wait
+    std::string arrow_path;         // strftime() pattern of the Arrow files
+    std::string arrow_format;       // "file" (Feather v2) or "stream"
+    int arrow_rotate_interval;      // Seconds per file (0 = one file per run)
+    int arrow_batch_rows;           // Rows per record batch
+    int arrow_queue_rows;           // Rows queued to the Arrow writer before producers wait
+};
+
+// Flow aggregation before storage ([Aggregation] section)
+const uint8_t AGGREGATE_SOURCE_IP = 1;
+const uint8_t AGGREGATE_DESTINATION_IP = 2;
+const uint8_t AGGREGATE_SOURCE_PORT = 4;
+const uint8_t AGGREGATE_DESTINATION_PORT = 8;
+const uint8_t AGGREGATE_PROTOCOL = 16;
+
+struct AggregationConfig {
+    uint8_t key_fields = 0;         // AGGREGATE_* bits, 0 = aggregation off
+    int active_timeout = 60;        // Seconds until a long-lived aggregate is emitted
+    int inactive_timeout = 15;      // Seconds without flows until an aggregate is emitted
+    int memory_size = 64;           // MiB per receiver for the aggregates
 };
 
 struct SondaConfig {
     std::string name;
     std::string version;
     std::string filter_address; // Used to filter incoming packets by source IP
+    in_addr_t filter_addr;      // filter_address parsed once (INADDR_ANY if empty)
     int port;
+    int threads;                // Number of SO_REUSEPORT sockets/receive threads on the port
+    bool steer_by_exporter;     // Pin each exporter to one socket with a reuseport BPF program
 };
 
+// IPv4 or IPv6 address of a flow; IPv4 is kept IPv4-mapped (::ffff:a.b.c.d)
+struct FlowAddress {
+    uint8_t bytes[16] = {};
+    uint8_t version = 0;        // 4 or 6, 0 if the record has no such address
+};
+
+// Decoded flow record: fixed size and free of heap allocations; text is only
+// produced by sinks that need it. Timestamps are nanoseconds since the epoch
+// (0 = not exported), ProbeID is the index of the probe in sondaConfigs.
 struct FlowData {
-    std::string SourceIP;
-    std::string DestinationIP;
-    int SourcePort;
-    int DestinationPort;
-    uint8_t Protocol;
-    uint32_t PacketCount;
-    uint32_t ByteCount;
-    std::string FlowStart;
-    std::string FlowEnd;
-    std::string SourceSond;
+    FlowAddress SourceIP;
+    FlowAddress DestinationIP;
+    uint16_t SourcePort = 0;
+    uint16_t DestinationPort = 0;
+    uint8_t Protocol = 0;
+    uint64_t PacketCount = 0;
+    uint64_t ByteCount = 0;
+    uint64_t FlowStart = 0;
+    uint64_t FlowEnd = 0;
+    uint16_t ProbeID = 0;
     // Add additional fields as needed
 };
 
+inline void setIPv4(FlowAddress& address, const void* bytes) {
+    std::memset(address.bytes, 0, 10);
+    address.bytes[10] = 0xFF;
+    address.bytes[11] = 0xFF;
+    std::memcpy(address.bytes + 12, bytes, 4);
+    address.version = 4;
+}
+
+inline void setIPv6(FlowAddress& address, const void* bytes) {
+    std::memcpy(address.bytes, bytes, 16);
+    address.version = 6;
+}
+
+// Function to format an address as text (empty if the record has none)
+inline const char* formatAddress(const FlowAddress& address, char (&text)[INET6_ADDRSTRLEN]) {
+    text[0] = '\0';
+    if (address.version == 4) {
+        inet_ntop(AF_INET, address.bytes + 12, text, sizeof(text));
+    } else if (address.version == 6) {
+        inet_ntop(AF_INET6, address.bytes, text, sizeof(text));
+    }
+    return text;
+}
+
+// Function to format a timestamp as "YYYY-MM-DD HH:MM:SS.mmm" UTC (empty if not exported)
+inline const char* formatTimestamp(uint64_t nanoseconds, char (&text)[32]) {
+    text[0] = '\0';
+    if (nanoseconds != 0) {
+        time_t seconds = static_cast<time_t>(nanoseconds / 1000000000ULL);
+        struct tm utc;
+        gmtime_r(&seconds, &utc);
+        size_t n = strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &utc);
+        snprintf(text + n, sizeof(text) - n, ".%03u", static_cast<unsigned>(nanoseconds / 1000000ULL % 1000));
+    }
+    return text;
+}
+
+// Function to write an unsigned number in decimal; returns the end of the text
+inline char* writeDecimal(char* out, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (n) {
+        *out++ = digits[--n];
+    }
+    return out;
+}
+
+// Function to append an unsigned number in decimal to a text buffer
+inline void appendDecimal(std::string& out, uint64_t value) {
+    char digits[20];
+    out.append(digits, writeDecimal(digits, value));
+}
+
+// Function to write an address as formatAddress() does; returns the end of the text
+inline char* writeAddress(char* out, const FlowAddress& address) {
+    if (address.version == 4) {
+        out = writeDecimal(out, address.bytes[12]);
+        for (int i = 13; i < 16; ++i) {
+            *out++ = '.';
+            out = writeDecimal(out, address.bytes[i]);
+        }
+    } else if (address.version == 6) {
+        inet_ntop(AF_INET6, address.bytes, out, INET6_ADDRSTRLEN);
+        out += strlen(out);
+    }
+    return out;
+}
+
+// Timestamps as formatTimestamp() writes them. The date and time of the
+// previous call are reused within the same second.
+class TimestampWriter {
+private:
+    time_t second = -1;
+    char prefix[32];    // "YYYY-MM-DD HH:MM:SS"
+    size_t prefixLength = 0;
+
+public:
+    // Function to write a timestamp; returns the end of the text (nothing if not exported)
+    char* write(char* out, uint64_t nanoseconds) {
+        if (nanoseconds == 0) {
+            return out;
+        }
+        time_t seconds = static_cast<time_t>(nanoseconds / 1000000000ULL);
+        if (seconds != second) {
+            struct tm utc;
+            gmtime_r(&seconds, &utc);
+            prefixLength = strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &utc);
+            second = seconds;
+        }
+        memcpy(out, prefix, prefixLength);
+        out += prefixLength;
+        unsigned milliseconds = static_cast<unsigned>(nanoseconds / 1000000ULL % 1000);
+        out[0] = '.';
+        out[1] = static_cast<char>('0' + milliseconds / 100);
+        out[2] = static_cast<char>('0' + milliseconds / 10 % 10);
+        out[3] = static_cast<char>('0' + milliseconds % 10);
+        return out + 4;
+    }
+};
+
+// Function to get the name of a probe from FlowData::ProbeID
+const std::string& probeName(uint16_t probeID);
+
+// Cleared by SIGINT/SIGTERM; writer pools stop making producers wait then
+extern std::atomic<bool> running;
+
 // Abstract class for database operations
 class DatabaseHandler {
 public:
+    virtual ~DatabaseHandler() {}
     virtual bool connect() = 0;
     virtual bool insertFlowData(const FlowData& data) = 0;
+    // Function to insert a contiguous run of flows, e.g. all records of one
+    // decoded flowset; handlers override it with their bulk path
+    virtual bool insertFlowBatch(const FlowData* flows, size_t count) {
+        bool ok = true;
+        for (size_t i = 0; i < count; ++i) {
+            ok = insertFlowData(flows[i]) && ok;
+        }
+        return ok;
+    }
+    // Function to write the rows buffered so far (commit, send or hand over)
+    virtual bool flush() { return true; }
     virtual void close() = 0;
     virtual bool initializeTable() = 0;
     virtual bool checkConnection() = 0; // Function to check connection
+    // Called by the thread inserting into this handler after decoding and
+    // also while idle, at least once a second, so buffered rows can be
+    // written once they are old enough
+    virtual void tick() {}
 };
 
 // Implementation for SQLite
+// Rows are inserted with one prepared statement into an explicit transaction
+// that is committed after sqlite_batch_size rows or sqlite_flush_interval ms.
 class SQLiteHandler : public DatabaseHandler {
 private:
     sqlite3* db;
     std::string dbPath;
+    DatabaseConfig config;
+    sqlite3_stmt* insertStmt;       // Prepared once in connect()
+    bool inTransaction;
+    size_t pendingRows;             // Rows inserted in the open transaction
+    std::chrono::steady_clock::time_point transactionStart;
+    uint64_t commitCount;
+
+    bool execute(const std::string& sql) {
+        char* errMsg = nullptr;
+        if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
+            std::cerr << "SQLite error in '" << sql << "': " << (errMsg ? errMsg : sqlite3_errmsg(db)) << std::endl;
+            syslog(LOG_ERR, "SQLite error in '%s': %s", sql.c_str(), errMsg ? errMsg : sqlite3_errmsg(db));
+            sqlite3_free(errMsg);
+            return false;
+        }
+        return true;
+    }
+
+    // Function to apply the PRAGMA settings of the [Database] section
+    bool applySettings() {
+        sqlite3_busy_timeout(db, 5000); // Other receivers of the same database may hold the write lock
+        if (!execute("PRAGMA journal_mode=" + config.sqlite_journal_mode + ";") ||
+            !execute("PRAGMA synchronous=" + config.sqlite_synchronous + ";")) {
+            return false;
+        }
+        if (config.sqlite_cache_size != 0 && !execute("PRAGMA cache_size=" + std::to_string(config.sqlite_cache_size) + ";")) {
+            return false;
+        }
+        if (config.sqlite_mmap_size > 0 &&
+            !execute("PRAGMA mmap_size=" + std::to_string(static_cast<int64_t>(config.sqlite_mmap_size) * 1024 * 1024) + ";")) {
+            return false;
+        }
+        return true;
+    }
+
+    // Function to commit the open transaction; rows of a failed commit are rolled back and lost
+    bool commit() {
+        if (!inTransaction) {
+            return true;
+        }
+        inTransaction = false;
+        size_t rows = pendingRows;
+        pendingRows = 0;
+        ++commitCount;
+        if (!execute("COMMIT;")) {
+            execute("ROLLBACK;");
+            std::cerr << "Lost " << rows << " rows of the failed SQLite transaction." << std::endl;
+            syslog(LOG_ERR, "Lost %zu rows of the failed SQLite transaction.", rows);
+            return false;
+        }
+        return true;
+    }
+
+    // Function to insert one row in the open transaction
+    bool insertRow(const FlowData& data) {
+        sqlite3_stmt* stmt = insertStmt;
+        char sourceIP[INET6_ADDRSTRLEN], destinationIP[INET6_ADDRSTRLEN], flowStart[32], flowEnd[32];
+        sqlite3_bind_text(stmt, 1, formatAddress(data.SourceIP, sourceIP), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, formatAddress(data.DestinationIP, destinationIP), -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 3, data.SourcePort);
+        sqlite3_bind_int(stmt, 4, data.DestinationPort);
+        sqlite3_bind_int(stmt, 5, data.Protocol);
+        sqlite3_bind_int64(stmt, 6, static_cast<sqlite3_int64>(data.PacketCount));
+        sqlite3_bind_int64(stmt, 7, static_cast<sqlite3_int64>(data.ByteCount));
+        sqlite3_bind_text(stmt, 8, formatTimestamp(data.FlowStart, flowStart), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 9, formatTimestamp(data.FlowEnd, flowEnd), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 10, probeName(data.ProbeID).c_str(), -1, SQLITE_STATIC);
+
+        int rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (rc != SQLITE_DONE) {
+            std::cerr << "Error inserting data: " << sqlite3_errmsg(db) << std::endl;
+            syslog(LOG_ERR, "Error inserting data: %s", sqlite3_errmsg(db));
+            return false;
+        }
+        return true;
+    }
 
 public:
-    SQLiteHandler(const std::string& dbPath) : db(nullptr), dbPath(dbPath) {}
+    SQLiteHandler(const DatabaseConfig& config)
+        : db(nullptr), dbPath(config.sqlite_path), config(config), insertStmt(nullptr), inTransaction(false), pendingRows(0),
+          commitCount(0) {}
+
+    ~SQLiteHandler() override {
+        close();
+    }
 
     bool connect() override {
         if (sqlite3_open(dbPath.c_str(), &db) != SQLITE_OK) {
@@ -122,10 +460,19 @@ public:
             syslog(LOG_ERR, "Cannot open SQLite database: %s", sqlite3_errmsg(db));
             return false;
         }
+        if (!applySettings()) {
+            return false;
+        }
         // Initialize table
         if (!initializeTable()) {
             return false;
         }
+        const char* sqlInsert = "INSERT INTO NetFlowData (SourceIP, DestinationIP, SourcePort, DestinationPort, Protocol, PacketCount, ByteCount, FlowStart, FlowEnd, SourceSond) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+        if (sqlite3_prepare_v2(db, sqlInsert, -1, &insertStmt, nullptr) != SQLITE_OK) {
+            std::cerr << "Error preparing insert statement: " << sqlite3_errmsg(db) << std::endl;
+            syslog(LOG_ERR, "Error preparing insert statement: %s", sqlite3_errmsg(db));
+            return false;
+        }
         syslog(LOG_INFO, "Connected to SQLite database: %s", dbPath.c_str());
         return true;
     }
@@ -184,53 +531,526 @@ public:
     }
 
     bool insertFlowData(const FlowData& data) override {
-        // Implement data insertion into SQLite database
-        std::string sqlInsert = "INSERT INTO NetFlowData (SourceIP, DestinationIP, SourcePort, DestinationPort, Protocol, PacketCount, ByteCount, FlowStart, FlowEnd, SourceSond) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
-        sqlite3_stmt* stmt;
-        if (sqlite3_prepare_v2(db, sqlInsert.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            std::cerr << "Error preparing insert statement: " << sqlite3_errmsg(db) << std::endl;
-            syslog(LOG_ERR, "Error preparing insert statement: %s", sqlite3_errmsg(db));
-            return false;
-        }
+        return insertFlowBatch(&data, 1);
+    }
 
-        sqlite3_bind_text(stmt, 1, data.SourceIP.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 2, data.DestinationIP.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 3, data.SourcePort);
-        sqlite3_bind_int(stmt, 4, data.DestinationPort);
-        sqlite3_bind_int(stmt, 5, data.Protocol);
-        sqlite3_bind_int(stmt, 6, data.PacketCount);
-        sqlite3_bind_int(stmt, 7, data.ByteCount);
-        sqlite3_bind_text(stmt, 8, data.FlowStart.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 9, data.FlowEnd.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 10, data.SourceSond.c_str(), -1, SQLITE_STATIC);
+    // The rows are inserted into the open transaction with the prepared
+    // statement; the commit check runs once per batch
+    bool insertFlowBatch(const FlowData* flows, size_t count) override {
+        if (!inTransaction) {
+            if (!execute("BEGIN;")) {
+                return false;
+            }
+            inTransaction = true;
+            transactionStart = std::chrono::steady_clock::now();
+        }
+        size_t inserted = 0;
+        for (size_t i = 0; i < count; ++i) {
+            inserted += insertRow(flows[i]);
+        }
+        bool ok = inserted == count;
+        pendingRows += inserted;
+        if (pendingRows >= static_cast<size_t>(config.sqlite_batch_size)) {
+            return commit() && ok;
+        }
+        return ok;
+    }
 
-        if (sqlite3_step(stmt) != SQLITE_DONE) {
-            std::cerr << "Error inserting data: " << sqlite3_errmsg(db) << std::endl;
-            syslog(LOG_ERR, "Error inserting data: %s", sqlite3_errmsg(db));
-            sqlite3_finalize(stmt);
-            return false;
+    void tick() override {
+        if (inTransaction && std::chrono::steady_clock::now() - transactionStart >= std::chrono::milliseconds(config.sqlite_flush_interval)) {
+            commit();
         }
+    }
 
-        sqlite3_finalize(stmt);
-        return true;
+    // Function to commit the rows inserted so far
+    bool flush() override {
+        return commit();
+    }
+
+    uint64_t commits() const {
+        return commitCount;
     }
 
     void close() override {
         if (db) {
+            commit();
+            sqlite3_finalize(insertStmt);
+            insertStmt = nullptr;
             sqlite3_close(db);
             db = nullptr;
         }
     }
 };
 
+// Rows handed from a receiver to a writer thread
+struct FlowBatch {
+    std::vector<FlowData> rows;
+    FlowBatch* next = nullptr;
+};
+
+// Writer threads shared by all receivers (the SQLite writer, the MySQL pool)
+class FlowBatchSink {
+public:
+    virtual ~FlowBatchSink() {}
+    virtual bool start() = 0;                   // Connect and start the threads; later calls return the first result
+    virtual void submit(FlowBatch* batch) = 0;  // Takes ownership; waits while the sink is too far behind
+    virtual bool checkConnection() = 0;
+};
+
+// Per-receiver handler for a FlowBatchSink: collects rows and passes them on
+// after batchRows rows or flushInterval ms
+class BatchQueueHandler : public DatabaseHandler {
+private:
+    FlowBatchSink& sink;
+    size_t batchRows;
+    int flushInterval;
+    FlowBatch* batch;
+    std::chrono::steady_clock::time_point batchStart;
+
+    void submit() {
+        if (batch) {
+            sink.submit(batch);
+            batch = nullptr;
+        }
+    }
+
+public:
+    BatchQueueHandler(FlowBatchSink& sink, size_t batchRows, int flushInterval)
+        : sink(sink), batchRows(batchRows), flushInterval(flushInterval), batch(nullptr) {}
+
+    ~BatchQueueHandler() override {
+        delete batch;
+    }
+
+    bool connect() override {
+        return sink.start();
+    }
+
+    bool checkConnection() override {
+        return sink.checkConnection();
+    }
+
+    bool initializeTable() override {
+        // The writer creates the table when it connects
+        return true;
+    }
+
+    bool insertFlowData(const FlowData& data) override {
+        if (!batch) {
+            batch = new FlowBatch();
+            batch->rows.reserve(batchRows);
+            batchStart = std::chrono::steady_clock::now();
+        }
+        batch->rows.push_back(data);
+        if (batch->rows.size() >= batchRows) {
+            submit();
+        }
+        return true;
+    }
+
+    // The flows are copied into the batch in one piece per batch
+    bool insertFlowBatch(const FlowData* flows, size_t count) override {
+        while (count) {
+            if (!batch) {
+                batch = new FlowBatch();
+                batch->rows.reserve(batchRows);
+                batchStart = std::chrono::steady_clock::now();
+            }
+            size_t n = std::min(count, batchRows - batch->rows.size());
+            batch->rows.insert(batch->rows.end(), flows, flows + n);
+            flows += n;
+            count -= n;
+            if (batch->rows.size() >= batchRows) {
+                submit();
+            }
+        }
+        return true;
+    }
+
+    bool flush() override {
+        submit();
+        return true;
+    }
+
+    void tick() override {
+        if (batch && std::chrono::steady_clock::now() - batchStart >= std::chrono::milliseconds(flushInterval)) {
+            submit();
+        }
+    }
+
+    void close() override {
+        submit();
+    }
+};
+
+// Shared SQLite writer
+// One thread owns the only connection to the database, so probes no longer
+// compete for the file lock. Receivers collect rows in a BatchQueueHandler
+// and hand whole batches to the writer through a lock-free multi-producer
+// stack. The writer takes everything queued at once and commits it in one
+// transaction (group commit). Producers wait while sqlite_queue_rows rows
+// are queued, which pushes back to the datagram queues.
+class SQLiteWriter : public FlowBatchSink {
+private:
+    DatabaseConfig config;
+    SQLiteHandler handler;
+    size_t queueLimit;
+    std::atomic<FlowBatch*> head;       // Batches pushed by the producers, newest first
+    std::atomic<size_t> queuedRows;
+    std::atomic<int> waitingProducers;
+    std::atomic<bool> stopping;
+    std::mutex mutex;
+    std::condition_variable wakeWriter;
+    std::condition_variable wakeProducers;
+    std::thread thread;
+    bool started;
+    bool connected;
+
+    // The writer commits once per drained group, so its transactions are
+    // bounded by the queue limit rather than by sqlite_batch_size
+    static DatabaseConfig writerConfig(DatabaseConfig config) {
+        config.sqlite_batch_size = std::max(config.sqlite_batch_size, config.sqlite_queue_rows);
+        return config;
+    }
+
+    void run() {
+        while (true) {
+            FlowBatch* list = head.exchange(nullptr, std::memory_order_acquire);
+            if (!list) {
+                if (stopping) {
+                    break; // Producers have closed and everything is written
+                }
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeWriter.wait_for(lock, std::chrono::milliseconds(100),
+                                    [this] { return head.load(std::memory_order_relaxed) != nullptr || stopping; });
+                continue;
+            }
+
+            // Oldest batch first
+            FlowBatch* ordered = nullptr;
+            while (list) {
+                FlowBatch* next = list->next;
+                list->next = ordered;
+                ordered = list;
+                list = next;
+            }
+
+            size_t taken = 0;
+            while (ordered) {
+                handler.insertFlowBatch(ordered->rows.data(), ordered->rows.size());
+                taken += ordered->rows.size();
+                batches.fetch_add(1, std::memory_order_relaxed);
+                FlowBatch* next = ordered->next;
+                delete ordered;
+                ordered = next;
+            }
+            handler.flush();
+            rows.fetch_add(taken, std::memory_order_relaxed);
+            commits.store(handler.commits(), std::memory_order_relaxed);
+
+            queuedRows.fetch_sub(taken, std::memory_order_seq_cst);
+            if (waitingProducers.load(std::memory_order_seq_cst) > 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                wakeProducers.notify_all();
+            }
+        }
+        handler.close();
+        commits.store(handler.commits(), std::memory_order_relaxed);
+    }
+
+public:
+    // Statistics
+    std::atomic<uint64_t> rows;
+    std::atomic<uint64_t> batches;
+    std::atomic<uint64_t> commits;
+    std::atomic<uint64_t> producerWaits;     // Submissions that had to wait for the writer
+    std::atomic<uint64_t> waitMicroseconds;
+    std::atomic<size_t> queuePeakRows;
+
+    explicit SQLiteWriter(const DatabaseConfig& config)
+        : config(config), handler(writerConfig(config)), queueLimit(config.sqlite_queue_rows), head(nullptr), queuedRows(0), waitingProducers(0),
+          stopping(false), started(false), connected(false), rows(0), batches(0), commits(0), producerWaits(0),
+          waitMicroseconds(0), queuePeakRows(0) {}
+
+    ~SQLiteWriter() override {
+        stop();
+    }
+
+    // Function to connect and start the writer thread (once; later calls return the first result)
+    bool start() override {
+        if (!started) {
+            started = true;
+            connected = handler.connect();
+            if (connected) {
+                thread = std::thread(&SQLiteWriter::run, this);
+            }
+        }
+        return connected;
+    }
+
+    // Function to write what is queued and stop; call after all producers have closed
+    void stop() {
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                wakeWriter.notify_one();
+            }
+            thread.join();
+        }
+    }
+
+    // Producer side: queue a batch (ownership passes to the writer)
+    void submit(FlowBatch* batch) override {
+        size_t count = batch->rows.size();
+        if (queuedRows.load(std::memory_order_seq_cst) >= queueLimit) {
+            auto start = std::chrono::steady_clock::now();
+            producerWaits.fetch_add(1, std::memory_order_relaxed);
+            waitingProducers.fetch_add(1, std::memory_order_seq_cst);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeProducers.wait(lock, [this] { return queuedRows.load(std::memory_order_seq_cst) < queueLimit || stopping; });
+            }
+            waitingProducers.fetch_sub(1, std::memory_order_seq_cst);
+            waitMicroseconds.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count(),
+                                       std::memory_order_relaxed);
+        }
+
+        size_t queued = queuedRows.fetch_add(count, std::memory_order_seq_cst) + count;
+        if (queued > queuePeakRows.load(std::memory_order_relaxed)) {
+            queuePeakRows.store(queued, std::memory_order_relaxed);
+        }
+
+        FlowBatch* old = head.load(std::memory_order_relaxed);
+        do {
+            batch->next = old;
+        } while (!head.compare_exchange_weak(old, batch, std::memory_order_release, std::memory_order_relaxed));
+        if (!old) {
+            // The writer may be asleep on an empty queue
+            std::lock_guard<std::mutex> lock(mutex);
+            wakeWriter.notify_one();
+        }
+    }
+
+    bool checkConnection() override {
+        return SQLiteHandler(config).checkConnection();
+    }
+
+    size_t queued() const {
+        return queuedRows.load(std::memory_order_relaxed);
+    }
+};
+
+std::unique_ptr<SQLiteWriter> sqliteWriter; // Created with the first SQLite receiver handler
+
+// Rows written by LOAD DATA in "load" mode, summed over all MySQL handlers
+struct MySQLLoadStats {
+    std::atomic<uint64_t> loads{0};
+    std::atomic<uint64_t> rows{0};
+    std::atomic<uint64_t> latencyMicroseconds{0};
+    std::atomic<uint64_t> maxLatencyMicroseconds{0};
+    std::atomic<uint64_t> failedRows{0};
+};
+
+MySQLLoadStats mysqlLoadStats;
+
 // Implementation for MySQL
 class MySQLHandler : public DatabaseHandler {
 private:
     MYSQL* conn;
     DatabaseConfig dbConfig;
+    bool bulkLoad;              // mysql_mode = load
+    std::string statement;      // Multi-row INSERT, or tab-separated rows for LOAD DATA
+    size_t statementRows;
+    size_t maxStatement;        // Bytes, below the server's max_allowed_packet
+    size_t loadOffset;          // Bytes of 'statement' already passed to LOAD DATA
+    bool transactional;         // Autocommit off, see writeBatch()
+    bool quiet;                 // No table status on stdout, see setQuiet()
+    unsigned int lastErrno;     // Error of the last failed write
+    std::chrono::steady_clock::time_point statementStart;
+    std::vector<std::string> quotedProbes; // Escaped probe names by ProbeID
+
+    static const char* insertPrefix() {
+        return "INSERT INTO NetFlowData (SourceIP, DestinationIP, SourcePort, DestinationPort, Protocol, PacketCount, ByteCount, FlowStart, FlowEnd, SourceSond) VALUES ";
+    }
+
+    static const char* loadStatement() {
+        return "LOAD DATA LOCAL INFILE 'netflow' INTO TABLE NetFlowData (SourceIP, DestinationIP, SourcePort, DestinationPort, Protocol, PacketCount, ByteCount, FlowStart, FlowEnd, SourceSond)";
+    }
+
+    // Local infile callbacks: the client library reads the "file" of a
+    // LOAD DATA LOCAL statement from the buffered rows instead of the disk
+    static int infileInit(void** state, const char*, void* handler) {
+        static_cast<MySQLHandler*>(handler)->loadOffset = 0;
+        *state = handler;
+        return 0;
+    }
+
+    static int infileRead(void* state, char* buffer, unsigned int length) {
+        MySQLHandler* handler = static_cast<MySQLHandler*>(state);
+        size_t count = std::min<size_t>(length, handler->statement.size() - handler->loadOffset);
+        memcpy(buffer, handler->statement.data() + handler->loadOffset, count);
+        handler->loadOffset += count;
+        return static_cast<int>(count);
+    }
+
+    static void infileEnd(void*) {}
+
+    static int infileError(void*, char* message, unsigned int length) {
+        snprintf(message, length, "Cannot read buffered flow rows");
+        return 2000; // CR_UNKNOWN_ERROR
+    }
+
+    // Function to read max_allowed_packet and size the INSERT statements to it
+    void readPacketLimit() {
+        maxStatement = 1024 * 1024;
+        if (mysql_query(conn, "SELECT @@max_allowed_packet")) {
+            return;
+        }
+        MYSQL_RES* result = mysql_store_result(conn);
+        if (result) {
+            MYSQL_ROW row = mysql_fetch_row(result);
+            if (row && row[0]) {
+                unsigned long long packet = strtoull(row[0], nullptr, 10);
+                if (packet > 64 * 1024) {
+                    maxStatement = static_cast<size_t>(std::min(packet - 16 * 1024, 64ULL * 1024 * 1024));
+                }
+            }
+            mysql_free_result(result);
+        }
+    }
+
+    // Function to get the probe name escaped for a string literal
+    const std::string& quotedProbe(uint16_t probeID) {
+        if (probeID >= quotedProbes.size()) {
+            quotedProbes.resize(probeID + 1);
+        }
+        std::string& quoted = quotedProbes[probeID];
+        if (quoted.empty()) {
+            const std::string& name = probeName(probeID);
+            std::vector<char> escaped(name.size() * 2 + 1);
+            unsigned long length = mysql_real_escape_string(conn, escaped.data(), name.data(), name.size());
+            quoted.assign(escaped.data(), length);
+        }
+        return quoted;
+    }
+
+    // Function to append one tab-separated row for LOAD DATA (default
+    // FIELDS/LINES options: tab, newline and backslash are escaped)
+    void appendLoadRow(const FlowData& data) {
+        char sourceIP[INET6_ADDRSTRLEN], destinationIP[INET6_ADDRSTRLEN], flowStart[32], flowEnd[32];
+        statement += formatAddress(data.SourceIP, sourceIP);
+        statement += '\t';
+        statement += formatAddress(data.DestinationIP, destinationIP);
+        statement += '\t';
+        appendDecimal(statement, data.SourcePort);
+        statement += '\t';
+        appendDecimal(statement, data.DestinationPort);
+        statement += '\t';
+        appendDecimal(statement, data.Protocol);
+        statement += '\t';
+        appendDecimal(statement, data.PacketCount);
+        statement += '\t';
+        appendDecimal(statement, data.ByteCount);
+        statement += '\t';
+        statement += formatTimestamp(data.FlowStart, flowStart);
+        statement += '\t';
+        statement += formatTimestamp(data.FlowEnd, flowEnd);
+        statement += '\t';
+        for (char c : probeName(data.ProbeID)) {
+            if (c == '\t' || c == '\n' || c == '\\') {
+                statement += '\\';
+                c = c == '\t' ? 't' : c == '\n' ? 'n' : c;
+            }
+            statement += c;
+        }
+        statement += '\n';
+        ++statementRows;
+    }
+
+    // Function to append one row to the INSERT
+    void appendRow(const FlowData& data) {
+        char sourceIP[INET6_ADDRSTRLEN], destinationIP[INET6_ADDRSTRLEN], flowStart[32], flowEnd[32];
+        statement += statementRows ? ",('" : "('";
+        statement += formatAddress(data.SourceIP, sourceIP);
+        statement += "','";
+        statement += formatAddress(data.DestinationIP, destinationIP);
+        statement += "',";
+        appendDecimal(statement, data.SourcePort);
+        statement += ',';
+        appendDecimal(statement, data.DestinationPort);
+        statement += ',';
+        appendDecimal(statement, data.Protocol);
+        statement += ',';
+        appendDecimal(statement, data.PacketCount);
+        statement += ',';
+        appendDecimal(statement, data.ByteCount);
+        statement += ",'";
+        statement += formatTimestamp(data.FlowStart, flowStart);
+        statement += "','";
+        statement += formatTimestamp(data.FlowEnd, flowEnd);
+        statement += "','";
+        statement += quotedProbe(data.ProbeID);
+        statement += "')";
+        ++statementRows;
+    }
+
+    void discardStatement() {
+        statement.assign(bulkLoad ? "" : insertPrefix());
+        statementRows = 0;
+    }
+
+    // Function to stream the buffered rows through LOAD DATA LOCAL INFILE
+    bool loadRows() {
+        size_t rows = statementRows;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = mysql_query(conn, loadStatement()) == 0;
+        uint64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        if (ok) {
+            mysqlLoadStats.loads.fetch_add(1, std::memory_order_relaxed);
+            mysqlLoadStats.rows.fetch_add(rows, std::memory_order_relaxed);
+            mysqlLoadStats.latencyMicroseconds.fetch_add(latency, std::memory_order_relaxed);
+            uint64_t peak = mysqlLoadStats.maxLatencyMicroseconds.load(std::memory_order_relaxed);
+            while (latency > peak && !mysqlLoadStats.maxLatencyMicroseconds.compare_exchange_weak(peak, latency, std::memory_order_relaxed)) {
+            }
+        } else {
+            mysqlLoadStats.failedRows.fetch_add(rows, std::memory_order_relaxed);
+            lastErrno = mysql_errno(conn);
+            std::cerr << "Error loading data: " << mysql_error(conn) << " (" << rows << " rows not written)" << std::endl;
+            syslog(LOG_ERR, "Error loading data: %s (%zu rows not written)", mysql_error(conn), rows);
+        }
+        discardStatement();
+        return ok;
+    }
+
+    // Function to send the collected rows
+    bool flushStatement() {
+        if (statementRows == 0) {
+            return true;
+        }
+        if (bulkLoad) {
+            return loadRows();
+        }
+        size_t rows = statementRows;
+        bool ok = mysql_real_query(conn, statement.data(), statement.size()) == 0;
+        if (!ok) {
+            lastErrno = mysql_errno(conn);
+            std::cerr << "Error inserting data: " << mysql_error(conn) << " (" << rows << " rows not written)" << std::endl;
+            syslog(LOG_ERR, "Error inserting data: %s (%zu rows not written)", mysql_error(conn), rows);
+        }
+        discardStatement();
+        return ok;
+    }
 
 public:
-    MySQLHandler(const DatabaseConfig& config) : conn(nullptr), dbConfig(config) {}
+    MySQLHandler(const DatabaseConfig& config)
+        : conn(nullptr), dbConfig(config), bulkLoad(config.mysql_mode == "load"), statement(bulkLoad ? "" : insertPrefix()),
+          statementRows(0), maxStatement(1024 * 1024), loadOffset(0),
+          transactional(false), quiet(false), lastErrno(0) {}
+
+    ~MySQLHandler() override {
+        close();
+    }
 
     bool connect() override {
         conn = mysql_init(nullptr);
@@ -239,6 +1059,10 @@ public:
             syslog(LOG_ERR, "mysql_init() failed.");
             return false;
         }
+        if (bulkLoad) {
+            unsigned int enable = 1;
+            mysql_options(conn, MYSQL_OPT_LOCAL_INFILE, &enable);
+        }
 
         if (mysql_real_connect(conn, dbConfig.mysql_host.c_str(), dbConfig.mysql_user.c_str(),
                                dbConfig.mysql_password.c_str(), dbConfig.mysql_database.c_str(),
@@ -246,6 +1070,7 @@ public:
             std::cerr << "mysql_real_connect() failed: " << mysql_error(conn) << std::endl;
             syslog(LOG_ERR, "mysql_real_connect() failed: %s", mysql_error(conn));
             mysql_close(conn);
+            conn = nullptr;
             return false;
         }
 
@@ -254,6 +1079,16 @@ public:
             return false;
         }
 
+        if (transactional) {
+            mysql_autocommit(conn, 0);
+        }
+        if (bulkLoad) {
+            mysql_set_local_infile_handler(conn, infileInit, infileRead, infileEnd, infileError, this);
+            statement.reserve(static_cast<size_t>(dbConfig.mysql_load_size) * 1024 + 256);
+        } else {
+            readPacketLimit();
+            statement.reserve(maxStatement);
+        }
         syslog(LOG_INFO, "Connected to MySQL database: %s", dbConfig.mysql_database.c_str());
         return true;
     }
@@ -272,6 +1107,7 @@ public:
             std::cerr << "mysql_real_connect() failed: " << mysql_error(conn) << std::endl;
             syslog(LOG_ERR, "mysql_real_connect() failed: %s", mysql_error(conn));
             mysql_close(conn);
+            conn = nullptr;
             return false;
         }
 
@@ -314,25 +1150,144 @@ public:
                 mysql_free_result(result);
                 return false;
             }
-            std::cout << "Table NetFlowData created in MySQL database." << std::endl;
+            if (!quiet) {
+                std::cout << "Table NetFlowData created in MySQL database." << std::endl;
+            }
             syslog(LOG_INFO, "Table NetFlowData created in MySQL database.");
         } else {
-            std::cout << "Table NetFlowData already exists in MySQL database." << std::endl;
+            if (!quiet) {
+                std::cout << "Table NetFlowData already exists in MySQL database." << std::endl;
+            }
             syslog(LOG_INFO, "Table NetFlowData already exists in MySQL database.");
         }
         mysql_free_result(result);
         return true;
     }
 
+    // Rows are collected into one multi-row INSERT that is sent after
+    // mysql_batch_size rows, before it would exceed max_allowed_packet, or
+    // from tick() after mysql_flush_interval ms
+    // In "load" mode the rows are buffered as text and loaded after
+    // mysql_load_size KiB or mysql_flush_interval ms
     bool insertFlowData(const FlowData& data) override {
-        // Implement data insertion into MySQL database
-        std::string sqlInsert = "INSERT INTO NetFlowData (SourceIP, DestinationIP, SourcePort, DestinationPort, Protocol, PacketCount, ByteCount, FlowStart, FlowEnd, SourceSond) VALUES ('" +
-                                data.SourceIP + "', '" + data.DestinationIP + "', " + std::to_string(data.SourcePort) + ", " + std::to_string(data.DestinationPort) + ", " +
-                                std::to_string(data.Protocol) + ", " + std::to_string(data.PacketCount) + ", " + std::to_string(data.ByteCount) + ", '" + data.FlowStart + "', '" +
-                                data.FlowEnd + "', '" + data.SourceSond + "');";
-        if (mysql_query(conn, sqlInsert.c_str())) {
-            std::cerr << "Error inserting data: " << mysql_error(conn) << std::endl;
-            syslog(LOG_ERR, "Error inserting data: %s", mysql_error(conn));
+        size_t mark = statement.size();
+        if (statementRows == 0) {
+            statementStart = std::chrono::steady_clock::now();
+        }
+        if (bulkLoad) {
+            appendLoadRow(data);
+            if (statement.size() >= static_cast<size_t>(dbConfig.mysql_load_size) * 1024) {
+                return loadRows();
+            }
+            return true;
+        }
+        appendRow(data);
+        if (statement.size() > maxStatement && statementRows > 1) {
+            // Send the rows before this one and start over with it
+            std::string row = statement.substr(mark + 1);
+            statement.resize(mark);
+            --statementRows;
+            bool ok = flushStatement();
+            statementStart = std::chrono::steady_clock::now();
+            statement += row;
+            ++statementRows;
+            return ok;
+        }
+        if (statementRows >= static_cast<size_t>(dbConfig.mysql_batch_size)) {
+            return flushStatement();
+        }
+        return true;
+    }
+
+    // In "load" mode the rows are appended to the load buffer and its size is
+    // checked once per batch; INSERT statements are still split per row to
+    // stay below max_allowed_packet. Stops at the first failed write.
+    bool insertFlowBatch(const FlowData* flows, size_t count) override {
+        if (!bulkLoad) {
+            for (size_t i = 0; i < count; ++i) {
+                if (!MySQLHandler::insertFlowData(flows[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (count && statementRows == 0) {
+            statementStart = std::chrono::steady_clock::now();
+        }
+        for (size_t i = 0; i < count; ++i) {
+            appendLoadRow(flows[i]);
+        }
+        if (statement.size() >= static_cast<size_t>(dbConfig.mysql_load_size) * 1024) {
+            return loadRows();
+        }
+        return true;
+    }
+
+    bool flush() override {
+        return flushStatement();
+    }
+
+    void tick() override {
+        if (statementRows && std::chrono::steady_clock::now() - statementStart >= std::chrono::milliseconds(dbConfig.mysql_flush_interval)) {
+            flushStatement();
+        }
+    }
+
+    // Function to turn autocommit off at connect, for writeBatch()
+    void useTransactions() {
+        transactional = true;
+    }
+
+    // Function to leave the table status off stdout (syslog still gets it), for pool connections
+    void setQuiet(bool value) {
+        quiet = value;
+    }
+
+    // Function to write a batch of rows in one transaction. On failure
+    // nothing is committed and retryable() tells whether to try again.
+    bool writeBatch(const std::vector<FlowData>& rows) {
+        lastErrno = 0;
+        bool ok = insertFlowBatch(rows.data(), rows.size()) && flushStatement();
+        if (ok && mysql_commit(conn)) {
+            lastErrno = mysql_errno(conn);
+            std::cerr << "Error committing data: " << mysql_error(conn) << std::endl;
+            syslog(LOG_ERR, "Error committing data: %s", mysql_error(conn));
+            ok = false;
+        }
+        if (!ok) {
+            discardStatement();
+            mysql_rollback(conn);
+        }
+        return ok;
+    }
+
+    // Function to tell whether the last failed write may succeed when
+    // repeated: a lost connection, a deadlock or a lock wait timeout
+    bool retryable() const {
+        switch (lastErrno) {
+            case 2002: // CR_CONNECTION_ERROR
+            case 2003: // CR_CONN_HOST_ERROR
+            case 2006: // CR_SERVER_GONE_ERROR
+            case 2013: // CR_SERVER_LOST
+            case 2055: // CR_SERVER_LOST_EXTENDED
+            case 1205: // ER_LOCK_WAIT_TIMEOUT
+            case 1213: // ER_LOCK_DEADLOCK
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Function to check that the connection is alive
+    bool ping() {
+        return conn && mysql_ping(conn) == 0;
+    }
+
+    // Function to run a statement on the open connection
+    bool execute(const char* sql) {
+        if (mysql_query(conn, sql)) {
+            std::cerr << "MySQL error: " << mysql_error(conn) << std::endl;
+            syslog(LOG_ERR, "MySQL error: %s", mysql_error(conn));
             return false;
         }
         return true;
@@ -340,457 +1295,8814 @@ public:
 
     void close() override {
         if (conn) {
+            flushStatement();
             mysql_close(conn);
             conn = nullptr;
         }
     }
 };
 
-// Implementation for CSV
-class CSVHandler : public DatabaseHandler {
+// MySQL writer pool
+// mysql_connections worker threads, each with its own connection, take
+// batches from one queue shared by all receivers and write every batch in
+// one transaction, so the server can commit on several cores while the
+// receive threads never wait for a query. A batch counts as in flight until
+// it is committed. If the write fails with a lost connection, a deadlock or
+// a lock wait timeout, the batch goes back to the head of the queue and the
+// worker reconnects with exponential backoff. Idle connections are checked
+// with mysql_ping() every mysql_health_interval seconds.
+class MySQLWriterPool : public FlowBatchSink {
 private:
-    std::string csvPath;
+    static const int BACKOFF_MIN_MS = 500;
+    static const int BACKOFF_MAX_MS = 60000;
 
-public:
-    CSVHandler(const std::string& csvPath) : csvPath(csvPath) {}
+    DatabaseConfig config;
+    std::deque<FlowBatch*> queue;
+    size_t queuedRows;
+    size_t queueLimit;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::vector<std::thread> workers;
+    std::atomic<bool> stopping;
+    bool started;
+    bool connected;
+    std::string sessionSQL;     // Run on every new worker connection
 
-    bool connect() override {
-        // Check if file exists
-        std::ifstream file(csvPath);
-        if (!file.good()) {
-            // File does not exist, create it with header
-            std::ofstream outFile(csvPath);
-            if (!outFile.is_open()) {
-                std::cerr << "Cannot create CSV file: " << csvPath << std::endl;
-                syslog(LOG_ERR, "Cannot create CSV file: %s", csvPath.c_str());
-                return false;
-            }
-            // Write header
-            outFile << "SourceIP,DestinationIP,SourcePort,DestinationPort,Protocol,PacketCount,ByteCount,FlowStart,FlowEnd,SourceSond\n";
-            outFile.close();
-            std::cout << "CSV file created: " << csvPath << std::endl;
-            syslog(LOG_INFO, "CSV file created: %s", csvPath.c_str());
+    // Workers send each batch as one statement where the packet size allows
+    static DatabaseConfig workerConfig(DatabaseConfig config) {
+        config.mysql_batch_size = 1000000;
+        return config;
+    }
+
+    // Function to take the oldest batch; nullptr after the timeout or when stopping with an empty queue
+    FlowBatch* take(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait_for(lock, timeout, [this] { return !queue.empty() || stopping; });
+        if (queue.empty()) {
+            return nullptr;
+        }
+        FlowBatch* batch = queue.front();
+        queue.pop_front();
+        queuedRows -= batch->rows.size();
+        inFlightBatches.fetch_add(1, std::memory_order_relaxed);
+        inFlightRows.fetch_add(batch->rows.size(), std::memory_order_relaxed);
+        notFull.notify_all();
+        return batch;
+    }
+
+    // Function to account for a batch that left the pool (written or dropped)
+    void finish(FlowBatch* batch, bool written) {
+        size_t count = batch->rows.size();
+        inFlightBatches.fetch_sub(1, std::memory_order_relaxed);
+        inFlightRows.fetch_sub(count, std::memory_order_relaxed);
+        if (written) {
+            rows.fetch_add(count, std::memory_order_relaxed);
+            batches.fetch_add(1, std::memory_order_relaxed);
         } else {
-            // CSV file exists, proceed to use it
-            std::cout << "CSV file is ready: " << csvPath << std::endl;
-            syslog(LOG_INFO, "CSV file is ready: %s", csvPath.c_str());
+            lostRows.fetch_add(count, std::memory_order_relaxed);
         }
-        return true;
+        delete batch;
+    }
+
+    // Function to put a batch back at the head of the queue for another try
+    void requeue(FlowBatch* batch) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_front(batch);
+        queuedRows += batch->rows.size();
+        inFlightBatches.fetch_sub(1, std::memory_order_relaxed);
+        inFlightRows.fetch_sub(batch->rows.size(), std::memory_order_relaxed);
+        requeuedBatches.fetch_add(1, std::memory_order_relaxed);
+        notEmpty.notify_one();
+    }
+
+    // Function to connect a worker (quietly when 'quiet'; the table check message is printed once)
+    bool connectWorker(MySQLHandler& handler, bool quiet) {
+        handler.setQuiet(quiet);
+        bool up = handler.connect();
+        return up && (sessionSQL.empty() || handler.execute(sessionSQL.c_str()));
+    }
+
+    void run(std::unique_ptr<MySQLHandler> handler, bool up) {
+        auto lastUsed = std::chrono::steady_clock::now();
+        int backoff = BACKOFF_MIN_MS;
+        while (true) {
+            if (!up) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    notEmpty.wait_for(lock, std::chrono::milliseconds(backoff), [this] { return stopping.load(); });
+                }
+                handler->close();
+                up = connectWorker(*handler, true);
+                if (!up) {
+                    backoff = std::min(backoff * 2, int(BACKOFF_MAX_MS)); // By value: the constant has no definition
+                    if (stopping) {
+                        break; // Queued batches are counted as lost by stop()
+                    }
+                    continue;
+                }
+                reconnects.fetch_add(1, std::memory_order_relaxed);
+                connectionsUp.fetch_add(1, std::memory_order_relaxed);
+                syslog(LOG_INFO, "Reconnected to MySQL database: %s", config.mysql_database.c_str());
+                backoff = BACKOFF_MIN_MS;
+                lastUsed = std::chrono::steady_clock::now();
+            }
+
+            FlowBatch* batch = take(std::chrono::milliseconds(1000));
+            auto now = std::chrono::steady_clock::now();
+            if (!batch) {
+                if (stopping) {
+                    break;
+                }
+                if (now - lastUsed >= std::chrono::seconds(config.mysql_health_interval)) {
+                    lastUsed = now;
+                    if (!handler->ping()) {
+                        healthFailures.fetch_add(1, std::memory_order_relaxed);
+                        connectionsUp.fetch_sub(1, std::memory_order_relaxed);
+                        up = false;
+                    }
+                }
+                continue;
+            }
+
+            lastUsed = now;
+            if (handler->writeBatch(batch->rows)) {
+                finish(batch, true);
+            } else if (handler->retryable()) {
+                requeue(batch);
+                if (!handler->ping()) {
+                    connectionsUp.fetch_sub(1, std::memory_order_relaxed);
+                    up = false;
+                }
+            } else {
+                finish(batch, false);
+            }
+        }
+        if (up) {
+            connectionsUp.fetch_sub(1, std::memory_order_relaxed);
+        }
+        handler->close();
+    }
+
+public:
+    // Statistics
+    std::atomic<uint64_t> rows;
+    std::atomic<uint64_t> batches;
+    std::atomic<uint64_t> lostRows;          // Dropped after a non-retryable error or at shutdown
+    std::atomic<uint64_t> inFlightBatches;   // Taken by a worker and not yet committed
+    std::atomic<uint64_t> inFlightRows;
+    std::atomic<uint64_t> requeuedBatches;
+    std::atomic<uint64_t> reconnects;
+    std::atomic<uint64_t> healthFailures;
+    std::atomic<int> connectionsUp;
+    std::atomic<uint64_t> producerWaits;
+    std::atomic<uint64_t> waitMicroseconds;
+    std::atomic<size_t> queuePeakRows;
+
+    explicit MySQLWriterPool(const DatabaseConfig& config, const std::string& sessionSQL = "")
+        : config(workerConfig(config)), queuedRows(0), queueLimit(config.mysql_queue_rows), stopping(false), started(false),
+          connected(false), sessionSQL(sessionSQL), rows(0), batches(0), lostRows(0), inFlightBatches(0), inFlightRows(0), requeuedBatches(0),
+          reconnects(0), healthFailures(0), connectionsUp(0), producerWaits(0), waitMicroseconds(0), queuePeakRows(0) {}
+
+    ~MySQLWriterPool() override {
+        stop();
+    }
+
+    // Function to connect and start the workers. The first connection is
+    // made here so a wrong configuration fails at startup; the others
+    // connect from their threads and retry in the background.
+    bool start() override {
+        if (started) {
+            return connected;
+        }
+        started = true;
+        for (int i = 0; i < config.mysql_connections; ++i) {
+            std::unique_ptr<MySQLHandler> handler(new MySQLHandler(config));
+            handler->useTransactions();
+            bool up = connectWorker(*handler, i > 0);
+            if (i == 0) {
+                if (!up) {
+                    return false;
+                }
+                connected = true;
+            }
+            if (up) {
+                connectionsUp.fetch_add(1, std::memory_order_relaxed);
+            }
+            workers.emplace_back(&MySQLWriterPool::run, this, std::move(handler), up);
+        }
+        return connected;
+    }
+
+    // Function to write what is queued and stop; call after all producers have closed
+    void stop() {
+        if (workers.empty()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            notEmpty.notify_all();
+            notFull.notify_all();
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        // Left over when no connection could be made
+        size_t lost = 0;
+        for (FlowBatch* batch : queue) {
+            lost += batch->rows.size();
+            delete batch;
+        }
+        queue.clear();
+        queuedRows = 0;
+        if (lost) {
+            lostRows.fetch_add(lost, std::memory_order_relaxed);
+            std::cerr << "MySQL writer pool stopped without a connection: " << lost << " rows lost" << std::endl;
+            syslog(LOG_ERR, "MySQL writer pool stopped without a connection: %zu rows lost", lost);
+        }
+    }
+
+    void submit(FlowBatch* batch) override {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (queuedRows >= queueLimit && !stopping && running) {
+            auto start = std::chrono::steady_clock::now();
+            producerWaits.fetch_add(1, std::memory_order_relaxed);
+            // The signal handler cannot notify, so a shutdown is noticed within 100 ms:
+            // with the database down, nothing else would release the decode threads
+            while (queuedRows >= queueLimit && !stopping && running) {
+                notFull.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            waitMicroseconds.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count(),
+                                       std::memory_order_relaxed);
+        }
+        queue.push_back(batch);
+        queuedRows += batch->rows.size();
+        if (queuedRows > queuePeakRows.load(std::memory_order_relaxed)) {
+            queuePeakRows.store(queuedRows, std::memory_order_relaxed);
+        }
+        notEmpty.notify_one();
     }
 
     bool checkConnection() override {
-        std::ofstream outFile(csvPath, std::ios::app);
-        if (!outFile.is_open()) {
-            std::cerr << "Cannot open CSV file: " << csvPath << std::endl;
-            syslog(LOG_ERR, "Cannot open CSV file: %s", csvPath.c_str());
+        return MySQLHandler(config).checkConnection();
+    }
+
+    size_t queued() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queuedRows;
+    }
+
+    int connections() const {
+        return config.mysql_connections;
+    }
+};
+
+std::unique_ptr<MySQLWriterPool> mysqlPool; // Created with the first MySQL receiver handler
+
+// Rows written by binary COPY, summed over all PostgreSQL handlers
+struct PostgresCopyStats {
+    std::atomic<uint64_t> copies{0};
+    std::atomic<uint64_t> rows{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> commitMicroseconds{0};    // From the end of the data to the server's reply
+    std::atomic<uint64_t> failedRows{0};
+};
+
+PostgresCopyStats postgresCopyStats;
+
+// Implementation for PostgreSQL
+// Rows are streamed with COPY NetFlowData FROM STDIN (FORMAT binary): each
+// row is encoded straight from FlowData into PostgreSQL's binary tuple format
+// (inet, int, bigint, timestamptz and varchar values, NULL for a missing
+// address or timestamp), so the server parses no SQL and no text per row.
+// A COPY stays open while rows arrive and is handed to libpq in chunks of
+// POSTGRES_SEND_SIZE bytes, so the rows travel to the server while the next
+// ones are encoded; it is ended and committed after postgres_copy_rows rows
+// or postgres_flush_interval ms. The table must have the column types of
+// postgres.sql, binary COPY does not convert between types.
+class PostgresHandler : public DatabaseHandler {
+private:
+    static const size_t POSTGRES_SEND_SIZE = 256 * 1024;
+    static const uint64_t POSTGRES_EPOCH_SHIFT = 946684800000000ULL; // Microseconds from 1970 to 2000-01-01
+
+    PGconn* conn;
+    DatabaseConfig dbConfig;
+    std::vector<char> buffer;       // Encoded rows not yet passed to libpq
+    size_t used;
+    bool copying;
+    size_t copyRows;
+    uint64_t copyBytes;
+    std::chrono::steady_clock::time_point copyStart;
+    bool connectionLost;            // Set when the last failed write lost the connection
+    bool quiet;                     // No table status on stdout, see setQuiet()
+
+    static const char* copyStatement() {
+        return "COPY NetFlowData (SourceIP, DestinationIP, SourcePort, DestinationPort, Protocol, PacketCount, ByteCount, FlowStart, FlowEnd, SourceSond) FROM STDIN (FORMAT binary)";
+    }
+
+    // Function to get the last error of a connection without libpq's trailing newline
+    static std::string errorText(const PGconn* connection) {
+        std::string text = PQerrorMessage(connection);
+        while (!text.empty() && (text.back() == '\n' || text.back() == ' ')) {
+            text.pop_back();
+        }
+        return text;
+    }
+
+    static char* put16(char* p, uint16_t value) {
+        value = htons(value);
+        memcpy(p, &value, 2);
+        return p + 2;
+    }
+
+    static char* put32(char* p, uint32_t value) {
+        value = htonl(value);
+        memcpy(p, &value, 4);
+        return p + 4;
+    }
+
+    static char* put64(char* p, uint64_t value) {
+        value = htobe64(value);
+        memcpy(p, &value, 8);
+        return p + 8;
+    }
+
+    // inet: family, netmask bits, is_cidr, address length, address
+    static char* putAddress(char* p, const FlowAddress& address) {
+        if (!address.version) {
+            return put32(p, 0xFFFFFFFF); // NULL
+        }
+        bool ipv4 = address.version == 4;
+        p = put32(p, ipv4 ? 8 : 20);
+        *p++ = ipv4 ? 2 : 3;    // PGSQL_AF_INET, PGSQL_AF_INET6
+        *p++ = static_cast<char>(ipv4 ? 32 : 128);
+        *p++ = 0;
+        *p++ = ipv4 ? 4 : 16;
+        memcpy(p, ipv4 ? address.bytes + 12 : address.bytes, ipv4 ? 4 : 16);
+        return p + (ipv4 ? 4 : 16);
+    }
+
+    // timestamptz: microseconds since 2000-01-01 UTC
+    static char* putTimestamp(char* p, uint64_t nanoseconds) {
+        if (!nanoseconds) {
+            return put32(p, 0xFFFFFFFF); // NULL
+        }
+        p = put32(p, 8);
+        return put64(p, nanoseconds / 1000 - POSTGRES_EPOCH_SHIFT);
+    }
+
+    void appendRow(const FlowData& data) {
+        const std::string& probe = probeName(data.ProbeID);
+        if (buffer.size() - used < 128 + probe.size()) {
+            buffer.resize(std::max(buffer.size() * 2, used + 128 + probe.size()));
+        }
+        char* p = buffer.data() + used;
+        p = put16(p, 10);
+        p = putAddress(p, data.SourceIP);
+        p = putAddress(p, data.DestinationIP);
+        p = put32(p, 4);
+        p = put32(p, data.SourcePort);
+        p = put32(p, 4);
+        p = put32(p, data.DestinationPort);
+        p = put32(p, 2);
+        p = put16(p, data.Protocol);
+        p = put32(p, 8);
+        p = put64(p, data.PacketCount);
+        p = put32(p, 8);
+        p = put64(p, data.ByteCount);
+        p = putTimestamp(p, data.FlowStart);
+        p = putTimestamp(p, data.FlowEnd);
+        p = put32(p, static_cast<uint32_t>(probe.size()));
+        memcpy(p, probe.data(), probe.size());
+        used = p + probe.size() - buffer.data();
+    }
+
+    // Function to report a failed COPY and leave it; its rows are not written
+    void failCopy(const char* what) {
+        connectionLost = PQstatus(conn) != CONNECTION_OK;
+        postgresCopyStats.failedRows.fetch_add(copyRows, std::memory_order_relaxed);
+        std::cerr << what << ": " << errorText(conn) << " (" << copyRows << " rows not written)" << std::endl;
+        syslog(LOG_ERR, "%s: %s (%zu rows not written)", what, errorText(conn).c_str(), copyRows);
+        copying = false;
+        copyRows = 0;
+        used = 0;
+        // Collect what is left of the failed command, ending a COPY the server still waits for
+        while (PGresult* result = PQgetResult(conn)) {
+            ExecStatusType status = PQresultStatus(result);
+            PQclear(result);
+            if ((status == PGRES_COPY_IN && PQputCopyEnd(conn, "rows not written") != 1) || PQstatus(conn) != CONNECTION_OK) {
+                break;
+            }
+        }
+    }
+
+    bool startCopy() {
+        PGresult* result = PQexec(conn, copyStatement());
+        bool ok = PQresultStatus(result) == PGRES_COPY_IN;
+        PQclear(result);
+        if (!ok) {
+            failCopy("Error starting COPY");
             return false;
         }
-        std::cout << "CSV file is accessible: " << csvPath << std::endl;
-        syslog(LOG_INFO, "CSV file is accessible: %s", csvPath.c_str());
-        outFile.close();
+        static const char header[19] = { 'P', 'G', 'C', 'O', 'P', 'Y', '\n', '\377', '\r', '\n', '\0', 0, 0, 0, 0, 0, 0, 0, 0 };
+        memcpy(buffer.data(), header, sizeof(header));
+        used = sizeof(header);
+        copying = true;
+        copyRows = 0;
+        copyBytes = 0;
+        copyStart = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    // Function to pass the encoded rows to libpq, which sends them on
+    bool sendBuffer() {
+        if (PQputCopyData(conn, buffer.data(), static_cast<int>(used)) != 1) {
+            failCopy("Error sending COPY data");
+            return false;
+        }
+        copyBytes += used;
+        used = 0;
+        return true;
+    }
+
+public:
+    PostgresHandler(const DatabaseConfig& config)
+        : conn(nullptr), dbConfig(config), buffer(POSTGRES_SEND_SIZE + 4096), used(0), copying(false), copyRows(0), copyBytes(0),
+          connectionLost(false), quiet(false) {}
+
+    ~PostgresHandler() override {
+        close();
+    }
+
+    bool connect() override {
+        conn = PQconnectdb(dbConfig.postgres_conninfo.c_str());
+        if (PQstatus(conn) != CONNECTION_OK) {
+            std::cerr << "PostgreSQL connection failed: " << errorText(conn) << std::endl;
+            syslog(LOG_ERR, "PostgreSQL connection failed: %s", errorText(conn).c_str());
+            PQfinish(conn);
+            conn = nullptr;
+            return false;
+        }
+        if (!initializeTable()) {
+            return false;
+        }
+        syslog(LOG_INFO, "Connected to PostgreSQL database: %s", PQdb(conn));
         return true;
     }
 
+    bool checkConnection() override {
+        PGconn* check = PQconnectdb(dbConfig.postgres_conninfo.c_str());
+        bool ok = PQstatus(check) == CONNECTION_OK;
+        if (ok) {
+            std::cout << "Successfully connected to PostgreSQL database." << std::endl;
+            syslog(LOG_INFO, "Successfully connected to PostgreSQL database.");
+        } else {
+            std::cerr << "PostgreSQL connection failed: " << errorText(check) << std::endl;
+            syslog(LOG_ERR, "PostgreSQL connection failed: %s", errorText(check).c_str());
+        }
+        PQfinish(check);
+        return ok;
+    }
+
     bool initializeTable() override {
-        // No additional initialization needed for CSV
+        // Check if table exists (unquoted names are folded to lower case)
+        PGresult* result = PQexec(conn, "SELECT to_regclass('netflowdata')");
+        if (PQresultStatus(result) != PGRES_TUPLES_OK) {
+            std::cerr << "Error checking table existence: " << errorText(conn) << std::endl;
+            syslog(LOG_ERR, "Error checking table existence: %s", errorText(conn).c_str());
+            PQclear(result);
+            return false;
+        }
+        bool exists = !PQgetisnull(result, 0, 0);
+        PQclear(result);
+        if (exists) {
+            if (!quiet) {
+                std::cout << "Table NetFlowData already exists in PostgreSQL database." << std::endl;
+            }
+            syslog(LOG_INFO, "Table NetFlowData already exists in PostgreSQL database.");
+            return true;
+        }
+
+        // Table does not exist, create it using postgres.sql
+        std::ifstream sqlFile("postgres.sql");
+        if (!sqlFile.is_open()) {
+            std::cerr << "Cannot open postgres.sql file for table creation." << std::endl;
+            syslog(LOG_ERR, "Cannot open postgres.sql file for table creation.");
+            return false;
+        }
+        std::string sqlCreate((std::istreambuf_iterator<char>(sqlFile)), std::istreambuf_iterator<char>());
+        result = PQexec(conn, sqlCreate.c_str());
+        bool ok = PQresultStatus(result) == PGRES_COMMAND_OK;
+        PQclear(result);
+        if (!ok) {
+            std::cerr << "Error creating table: " << errorText(conn) << std::endl;
+            syslog(LOG_ERR, "Error creating table: %s", errorText(conn).c_str());
+            return false;
+        }
+        if (!quiet) {
+            std::cout << "Table NetFlowData created in PostgreSQL database." << std::endl;
+        }
+        syslog(LOG_INFO, "Table NetFlowData created in PostgreSQL database.");
         return true;
     }
 
+    // Function to add a row to the open COPY, starting one if needed
+    bool appendFlowData(const FlowData& data) {
+        if (!copying && !startCopy()) {
+            return false;
+        }
+        appendRow(data);
+        ++copyRows;
+        return used < POSTGRES_SEND_SIZE || sendBuffer();
+    }
+
     bool insertFlowData(const FlowData& data) override {
-        // Implement data insertion into CSV
-        std::ofstream outFile(csvPath, std::ios::app);
-        if (!outFile.is_open()) {
-            std::cerr << "Cannot open CSV file for appending: " << csvPath << std::endl;
-            syslog(LOG_ERR, "Cannot open CSV file for appending: %s", csvPath.c_str());
+        return insertFlowBatch(&data, 1);
+    }
+
+    bool insertFlowBatch(const FlowData* flows, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            if (!appendFlowData(flows[i])) {
+                return false;
+            }
+            if (copyRows >= static_cast<size_t>(dbConfig.postgres_copy_rows) && !endCopy()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool flush() override {
+        return endCopy();
+    }
+
+    // Function to end the open COPY; the rows are committed when the server confirms it
+    bool endCopy() {
+        if (!copying) {
+            return true;
+        }
+        char* p = buffer.data() + used;
+        put16(p, 0xFFFF); // End of the binary data
+        used += 2;
+        if (!sendBuffer()) {
+            return false;
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (PQputCopyEnd(conn, nullptr) != 1) {
+            failCopy("Error ending COPY");
             return false;
         }
-        // Write data in CSV format
-        outFile << data.SourceIP << ','
-                << data.DestinationIP << ','
-                << data.SourcePort << ','
-                << data.DestinationPort << ','
-                << static_cast<int>(data.Protocol) << ','
-                << data.PacketCount << ','
-                << data.ByteCount << ','
-                << data.FlowStart << ','
-                << data.FlowEnd << ','
-                << data.SourceSond << '\n';
-        outFile.close();
-        return true;
+        PGresult* result = PQgetResult(conn);
+        bool ok = PQresultStatus(result) == PGRES_COMMAND_OK;
+        PQclear(result);
+        if (!ok) {
+            failCopy("Error copying data");
+            return false;
+        }
+        while ((result = PQgetResult(conn))) {
+            PQclear(result);
+        }
+        postgresCopyStats.copies.fetch_add(1, std::memory_order_relaxed);
+        postgresCopyStats.rows.fetch_add(copyRows, std::memory_order_relaxed);
+        postgresCopyStats.bytes.fetch_add(copyBytes, std::memory_order_relaxed);
+        postgresCopyStats.commitMicroseconds.fetch_add(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+        copying = false;
+        copyRows = 0;
+        return true;
+    }
+
+    void tick() override {
+        if (copying && std::chrono::steady_clock::now() - copyStart >= std::chrono::milliseconds(dbConfig.postgres_flush_interval)) {
+            endCopy();
+        }
+    }
+
+    // Function to write batches of rows in one COPY. On failure nothing is
+    // committed and lostConnection() tells whether to try again.
+    bool writeBatches(const std::vector<FlowBatch*>& batches) {
+        connectionLost = false;
+        for (const FlowBatch* batch : batches) {
+            for (const FlowData& row : batch->rows) {
+                if (!appendFlowData(row)) {
+                    return false;
+                }
+            }
+        }
+        return endCopy();
+    }
+
+    bool lostConnection() const {
+        return connectionLost;
+    }
+
+    // Function to leave the table status off stdout (syslog still gets it), for pool connections
+    void setQuiet(bool value) {
+        quiet = value;
+    }
+
+    // Function to run a statement on the open connection
+    bool execute(const char* sql) {
+        PGresult* result = PQexec(conn, sql);
+        bool ok = PQresultStatus(result) == PGRES_COMMAND_OK;
+        PQclear(result);
+        if (!ok) {
+            std::cerr << "PostgreSQL error: " << errorText(conn) << std::endl;
+            syslog(LOG_ERR, "PostgreSQL error: %s", errorText(conn).c_str());
+        }
+        return ok;
+    }
+
+    void close() override {
+        if (conn) {
+            endCopy();
+            PQfinish(conn);
+            conn = nullptr;
+        }
+    }
+};
+
+// PostgreSQL writer pool
+// postgres_connections worker threads, each with its own connection, take
+// the queued batches of up to postgres_copy_rows rows at once and write
+// them in one binary COPY, so the receive threads never wait for the server
+// and every commit round trip carries many batches. While one worker waits
+// for its commit, the others keep streaming. If the connection is lost the
+// batches go back to the head of the queue and the worker reconnects with
+// exponential backoff; rows the server rejects are counted as lost.
+class PostgresWriterPool : public FlowBatchSink {
+private:
+    static const int BACKOFF_MIN_MS = 500;
+    static const int BACKOFF_MAX_MS = 60000;
+
+    DatabaseConfig config;
+    std::deque<FlowBatch*> queue;
+    size_t queuedRows;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::vector<std::thread> workers;
+    std::atomic<bool> stopping;
+    bool started;
+    bool connected;
+    std::string sessionSQL;     // Run on every new worker connection
+
+    // Function to take the oldest batches, up to postgres_copy_rows rows; empty after the timeout
+    void take(std::vector<FlowBatch*>& taken, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait_for(lock, timeout, [this] { return !queue.empty() || stopping; });
+        size_t count = 0;
+        while (!queue.empty() && (taken.empty() || count + queue.front()->rows.size() <= static_cast<size_t>(config.postgres_copy_rows))) {
+            FlowBatch* batch = queue.front();
+            queue.pop_front();
+            count += batch->rows.size();
+            taken.push_back(batch);
+        }
+        queuedRows -= count;
+        inFlightRows.fetch_add(count, std::memory_order_relaxed);
+        notFull.notify_all();
+    }
+
+    // Function to account for batches that left the pool (written or dropped)
+    void finish(std::vector<FlowBatch*>& taken, bool written) {
+        size_t count = 0;
+        for (FlowBatch* batch : taken) {
+            count += batch->rows.size();
+            delete batch;
+        }
+        taken.clear();
+        inFlightRows.fetch_sub(count, std::memory_order_relaxed);
+        if (written) {
+            rows.fetch_add(count, std::memory_order_relaxed);
+        } else {
+            lostRows.fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+
+    // Function to put batches back at the head of the queue for another try
+    void requeue(std::vector<FlowBatch*>& taken) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t count = 0;
+        for (size_t i = taken.size(); i-- > 0;) {
+            queue.push_front(taken[i]);
+            count += taken[i]->rows.size();
+        }
+        taken.clear();
+        queuedRows += count;
+        inFlightRows.fetch_sub(count, std::memory_order_relaxed);
+        requeuedRows.fetch_add(count, std::memory_order_relaxed);
+        notEmpty.notify_one();
+    }
+
+    // Function to connect a worker (quietly when 'quiet'; the table check message is printed once)
+    bool connectWorker(PostgresHandler& handler, bool quiet) {
+        handler.setQuiet(quiet);
+        bool up = handler.connect();
+        return up && (sessionSQL.empty() || handler.execute(sessionSQL.c_str()));
+    }
+
+    void run(std::unique_ptr<PostgresHandler> handler, bool up) {
+        int backoff = BACKOFF_MIN_MS;
+        std::vector<FlowBatch*> taken;
+        while (true) {
+            if (!up) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    notEmpty.wait_for(lock, std::chrono::milliseconds(backoff), [this] { return stopping.load(); });
+                }
+                handler->close();
+                up = connectWorker(*handler, true);
+                if (!up) {
+                    backoff = std::min(backoff * 2, int(BACKOFF_MAX_MS)); // By value: the constant has no definition
+                    if (stopping) {
+                        break; // Queued batches are counted as lost by stop()
+                    }
+                    continue;
+                }
+                reconnects.fetch_add(1, std::memory_order_relaxed);
+                connectionsUp.fetch_add(1, std::memory_order_relaxed);
+                syslog(LOG_INFO, "Reconnected to PostgreSQL database");
+                backoff = BACKOFF_MIN_MS;
+            }
+
+            take(taken, std::chrono::milliseconds(1000));
+            if (taken.empty()) {
+                if (stopping) {
+                    break;
+                }
+                continue;
+            }
+            if (handler->writeBatches(taken)) {
+                finish(taken, true);
+            } else if (handler->lostConnection()) {
+                requeue(taken);
+                connectionsUp.fetch_sub(1, std::memory_order_relaxed);
+                up = false;
+            } else {
+                finish(taken, false);
+            }
+        }
+        if (up) {
+            connectionsUp.fetch_sub(1, std::memory_order_relaxed);
+        }
+        handler->close();
+    }
+
+public:
+    // Statistics
+    std::atomic<uint64_t> rows;
+    std::atomic<uint64_t> lostRows;          // Rejected by the server or left at shutdown
+    std::atomic<uint64_t> inFlightRows;      // Taken by a worker and not yet committed
+    std::atomic<uint64_t> requeuedRows;
+    std::atomic<uint64_t> reconnects;
+    std::atomic<int> connectionsUp;
+    std::atomic<uint64_t> producerWaits;
+    std::atomic<size_t> queuePeakRows;
+
+    explicit PostgresWriterPool(const DatabaseConfig& config, const std::string& sessionSQL = "")
+        : config(config), queuedRows(0), stopping(false), started(false), connected(false), sessionSQL(sessionSQL), rows(0), lostRows(0),
+          inFlightRows(0), requeuedRows(0), reconnects(0), connectionsUp(0), producerWaits(0), queuePeakRows(0) {}
+
+    ~PostgresWriterPool() override {
+        stop();
+    }
+
+    // Function to connect and start the workers; the first connection is
+    // made here so a wrong configuration fails at startup
+    bool start() override {
+        if (started) {
+            return connected;
+        }
+        started = true;
+        for (int i = 0; i < config.postgres_connections; ++i) {
+            std::unique_ptr<PostgresHandler> handler(new PostgresHandler(config));
+            bool up = connectWorker(*handler, i > 0);
+            if (i == 0) {
+                if (!up) {
+                    return false;
+                }
+                connected = true;
+            }
+            if (up) {
+                connectionsUp.fetch_add(1, std::memory_order_relaxed);
+            }
+            workers.emplace_back(&PostgresWriterPool::run, this, std::move(handler), up);
+        }
+        return connected;
+    }
+
+    // Function to write what is queued and stop; call after all producers have closed
+    void stop() {
+        if (workers.empty()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            notEmpty.notify_all();
+            notFull.notify_all();
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        // Left over when no connection could be made
+        size_t lost = 0;
+        for (FlowBatch* batch : queue) {
+            lost += batch->rows.size();
+            delete batch;
+        }
+        queue.clear();
+        queuedRows = 0;
+        if (lost) {
+            lostRows.fetch_add(lost, std::memory_order_relaxed);
+            std::cerr << "PostgreSQL writer pool stopped without a connection: " << lost << " rows lost" << std::endl;
+            syslog(LOG_ERR, "PostgreSQL writer pool stopped without a connection: %zu rows lost", lost);
+        }
+    }
+
+    void submit(FlowBatch* batch) override {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (queuedRows >= static_cast<size_t>(config.postgres_queue_rows) && !stopping && running) {
+            producerWaits.fetch_add(1, std::memory_order_relaxed);
+            // Ends within 100 ms of a shutdown, as in MySQLWriterPool::submit()
+            while (queuedRows >= static_cast<size_t>(config.postgres_queue_rows) && !stopping && running) {
+                notFull.wait_for(lock, std::chrono::milliseconds(100));
+            }
+        }
+        queue.push_back(batch);
+        queuedRows += batch->rows.size();
+        if (queuedRows > queuePeakRows.load(std::memory_order_relaxed)) {
+            queuePeakRows.store(queuedRows, std::memory_order_relaxed);
+        }
+        notEmpty.notify_one();
+    }
+
+    bool checkConnection() override {
+        return PostgresHandler(config).checkConnection();
+    }
+
+    size_t queued() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queuedRows;
+    }
+
+    int connections() const {
+        return config.postgres_connections;
+    }
+};
+
+std::unique_ptr<PostgresWriterPool> postgresPool; // Created with the first PostgreSQL receiver handler
+
+// Function to find where the extension of a file name starts (its end if it has none)
+size_t extensionOffset(const std::string& path) {
+    size_t dot = path.rfind('.');
+    size_t slash = path.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return path.size();
+    }
+    return dot;
+}
+
+// Function to name the file of a rotation period: 'pattern' expanded by
+// strftime() for the start of the period (UTC). A pattern without
+// conversions gets the period added before the extension.
+std::string periodFileName(const std::string& pattern, int rotateInterval, time_t periodStart) {
+    if (!rotateInterval) {
+        return pattern;
+    }
+    std::string format = pattern;
+    if (format.find('%') == std::string::npos) {
+        format.insert(extensionOffset(format), "-%Y%m%d-%H%M%S");
+    }
+    struct tm utc;
+    gmtime_r(&periodStart, &utc);
+    char text[4096];
+    size_t length = strftime(text, sizeof(text), format.c_str(), &utc);
+    return std::string(text, length);
+}
+
+// Function to create a new file named 'name'. A finished file cannot be
+// appended to, so if the name is taken (a restart within the same period)
+// "-1", "-2", ... is added before the extension. Returns the descriptor
+// (-1 on error, errno set) and stores the name used in 'path'.
+int createNewFile(const std::string& name, std::string& path) {
+    int fd = -1;
+    for (int sequence = 0; ; ++sequence) {
+        path = name;
+        if (sequence) {
+            path.insert(extensionOffset(path), "-" + std::to_string(sequence));
+        }
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0 || errno != EEXIST || sequence == 1000) {
+            break;
+        }
+    }
+    return fd;
+}
+
+// CSV file writer for rotation and compression
+// One thread owns the output file. Receivers pass it whole buffers of
+// formatted rows, and it writes them, through a streaming gzip compressor
+// with csv_compress = gzip. Every csv_rotate_interval seconds it finishes
+// the file and starts the next one, named by strftime(csv_path) for the
+// start of the period (UTC). Opening, compressing and finishing files never
+// happen on a receive thread.
+class CSVFileWriter {
+private:
+    static const size_t MAX_QUEUED = 64;    // Buffers waiting for the writer thread
+    static const size_t MAX_SPARE = 8;      // Written buffers kept for reuse
+
+    DatabaseConfig config;
+    bool gzip;
+    std::deque<std::vector<char>> queue;
+    std::vector<std::vector<char>> spare;
+    std::mutex mutex;
+    std::condition_variable wakeWriter;
+    std::condition_variable wakeProducers;
+    bool stopping;
+    std::thread thread;
+    bool started;
+    bool connected;
+
+    // Current file, used by the writer thread only
+    int fd;
+    std::string path;
+    time_t periodEnd;
+    z_stream stream;
+    std::vector<unsigned char> compressed;
+
+    // Function to name the file of a period from csv_path
+    std::string fileName(time_t periodStart) const {
+        std::string name = periodFileName(config.csv_path, config.csv_rotate_interval, periodStart);
+        if (gzip && (name.size() < 3 || name.compare(name.size() - 3, 3, ".gz") != 0)) {
+            name += ".gz";
+        }
+        return name;
+    }
+
+    bool writeAll(const void* data, size_t length) {
+        const char* p = static_cast<const char*>(data);
+        while (length) {
+            ssize_t n = ::write(fd, p, length);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Cannot write CSV file: " << path << ": " << strerror(errno) << std::endl;
+                syslog(LOG_ERR, "Cannot write CSV file: %s: %s", path.c_str(), strerror(errno));
+                return false;
+            }
+            p += n;
+            length -= n;
+        }
+        return true;
+    }
+
+    // Function to pass rows through the compressor (or straight to the file)
+    bool writeOut(const char* data, size_t length, int flush = Z_NO_FLUSH) {
+        bytesIn.fetch_add(length, std::memory_order_relaxed);
+        if (!gzip) {
+            bytesOut.fetch_add(length, std::memory_order_relaxed);
+            return writeAll(data, length);
+        }
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream.avail_in = static_cast<uInt>(length);
+        int result;
+        do {
+            stream.next_out = compressed.data();
+            stream.avail_out = static_cast<uInt>(compressed.size());
+            result = deflate(&stream, flush);
+            size_t produced = compressed.size() - stream.avail_out;
+            bytesOut.fetch_add(produced, std::memory_order_relaxed);
+            if (produced && !writeAll(compressed.data(), produced)) {
+                return false;
+            }
+        } while (stream.avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+        return true;
+    }
+
+    // Function to open the file of the period containing 'now'
+    bool openFile(time_t now) {
+        time_t periodStart = now;
+        periodEnd = std::numeric_limits<time_t>::max();
+        if (config.csv_rotate_interval) {
+            periodStart = now - now % config.csv_rotate_interval;
+            periodEnd = periodStart + config.csv_rotate_interval;
+        }
+        path = fileName(periodStart);
+        fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "Cannot open CSV file: " << path << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot open CSV file: %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        if (gzip) {
+            // Appending to an existing file adds another gzip member
+            memset(&stream, 0, sizeof(stream));
+            deflateInit2(&stream, config.csv_compress_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size == 0) {
+            static const char header[] = "SourceIP,DestinationIP,SourcePort,DestinationPort,Protocol,PacketCount,ByteCount,FlowStart,FlowEnd,SourceSond\n";
+            writeOut(header, sizeof(header) - 1);
+        }
+        files.fetch_add(1, std::memory_order_relaxed);
+        std::cout << "CSV file opened: " << path << std::endl;
+        syslog(LOG_INFO, "CSV file opened: %s", path.c_str());
+        return true;
+    }
+
+    // Function to finish and close the current file
+    void finishFile() {
+        if (gzip) {
+            writeOut(nullptr, 0, Z_FINISH);
+            deflateEnd(&stream);
+        }
+        ::close(fd);
+        fd = -1;
+        syslog(LOG_INFO, "CSV file closed: %s", path.c_str());
+    }
+
+    void run() {
+        while (true) {
+            std::vector<char> chunk;
+            bool have = false;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(1);
+                if (fd >= 0 && config.csv_rotate_interval) {
+                    deadline = std::min(deadline, std::chrono::system_clock::from_time_t(periodEnd));
+                }
+                wakeWriter.wait_until(lock, deadline, [this] { return !queue.empty() || stopping; });
+                if (!queue.empty()) {
+                    chunk = std::move(queue.front());
+                    queue.pop_front();
+                    have = true;
+                    wakeProducers.notify_all();
+                } else if (stopping) {
+                    break;
+                }
+            }
+
+            time_t now = time(nullptr);
+            if (fd >= 0 && now >= periodEnd) {
+                finishFile(); // The next file is opened with its first rows
+            }
+            if (have) {
+                if (fd >= 0 || openFile(now)) {
+                    writeOut(chunk.data(), chunk.size());
+                } else {
+                    lostBytes.fetch_add(chunk.size(), std::memory_order_relaxed);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (spare.size() < MAX_SPARE) {
+                    spare.push_back(std::move(chunk));
+                }
+            }
+        }
+        if (fd >= 0) {
+            finishFile();
+        }
+    }
+
+public:
+    // Statistics
+    std::atomic<uint64_t> files;
+    std::atomic<uint64_t> bytesIn;           // CSV text
+    std::atomic<uint64_t> bytesOut;          // Written to the files
+    std::atomic<uint64_t> lostBytes;         // No file could be opened
+    std::atomic<uint64_t> producerWaits;
+
+    explicit CSVFileWriter(const DatabaseConfig& config)
+        : config(config), gzip(config.csv_compress == "gzip"), stopping(false), started(false), connected(false), fd(-1),
+          periodEnd(0), compressed(256 * 1024), files(0), bytesIn(0), bytesOut(0), lostBytes(0), producerWaits(0) {}
+
+    ~CSVFileWriter() {
+        stop();
+    }
+
+    // Function to open the first file and start the writer thread (once; later calls return the first result)
+    bool start() {
+        if (!started) {
+            started = true;
+            connected = openFile(time(nullptr));
+            if (connected) {
+                thread = std::thread(&CSVFileWriter::run, this);
+            }
+        }
+        return connected;
+    }
+
+    // Function to write what is queued, finish the file and stop; call after all producers have closed
+    void stop() {
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                wakeWriter.notify_one();
+            }
+            thread.join();
+        }
+    }
+
+    // Function to check that the file of the current period can be opened
+    bool checkConnection() {
+        std::string name = fileName(time(nullptr) - (config.csv_rotate_interval ? time(nullptr) % config.csv_rotate_interval : 0));
+        int checkFd = open(name.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (checkFd < 0) {
+            std::cerr << "Cannot open CSV file: " << name << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot open CSV file: %s: %s", name.c_str(), strerror(errno));
+            return false;
+        }
+        ::close(checkFd);
+        std::cout << "CSV file is accessible: " << name << std::endl;
+        syslog(LOG_INFO, "CSV file is accessible: %s", name.c_str());
+        return true;
+    }
+
+    // Producer side: queue a buffer of whole rows and get an empty one back
+    void submit(std::vector<char>& chunk) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (queue.size() >= MAX_QUEUED && !stopping) {
+            producerWaits.fetch_add(1, std::memory_order_relaxed);
+            wakeProducers.wait(lock, [this] { return queue.size() < MAX_QUEUED || stopping; });
+        }
+        queue.push_back(std::move(chunk));
+        wakeWriter.notify_one();
+        chunk.clear();
+        if (!spare.empty()) {
+            chunk = std::move(spare.back());
+            spare.pop_back();
+        }
+    }
+
+    size_t queued() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queue.size();
+    }
+};
+
+std::unique_ptr<CSVFileWriter> csvWriter; // Used when csv_rotate_interval or csv_compress is set
+
+// Implementation for CSV
+// The file stays open in append mode. Rows are formatted into a userspace
+// buffer and written after csv_buffer_size KiB or csv_flush_interval ms,
+// always as whole rows, so receivers sharing the file never split a line.
+// With rotation or compression the buffers go to the CSVFileWriter instead.
+class CSVHandler : public DatabaseHandler {
+private:
+    // Longest row apart from the probe name
+    static const size_t MAX_ROW = 2 * INET6_ADDRSTRLEN + 5 * 20 + 2 * 32 + 16;
+
+    std::string csvPath;
+    size_t bufferSize;
+    int flushInterval;
+    int fd;
+    std::vector<char> buffer;
+    size_t used;
+    std::chrono::steady_clock::time_point firstRow;
+    TimestampWriter flowStartWriter;
+    TimestampWriter flowEndWriter;
+    CSVFileWriter* writer;
+
+    // Function to format one row into the buffer, writing the buffer first if the row might not fit
+    bool appendRow(const FlowData& data) {
+        const std::string& name = probeName(data.ProbeID);
+        if (buffer.size() - used < MAX_ROW + name.size()) {
+            if (!flush()) {
+                return false;
+            }
+            if (buffer.size() < MAX_ROW + name.size()) {
+                buffer.resize(MAX_ROW + name.size());
+            }
+        }
+        if (used == 0) {
+            firstRow = std::chrono::steady_clock::now();
+        }
+
+        // Write data in CSV format
+        char* out = buffer.data() + used;
+        out = writeAddress(out, data.SourceIP);
+        *out++ = ',';
+        out = writeAddress(out, data.DestinationIP);
+        *out++ = ',';
+        out = writeDecimal(out, data.SourcePort);
+        *out++ = ',';
+        out = writeDecimal(out, data.DestinationPort);
+        *out++ = ',';
+        out = writeDecimal(out, data.Protocol);
+        *out++ = ',';
+        out = writeDecimal(out, data.PacketCount);
+        *out++ = ',';
+        out = writeDecimal(out, data.ByteCount);
+        *out++ = ',';
+        out = flowStartWriter.write(out, data.FlowStart);
+        *out++ = ',';
+        out = flowEndWriter.write(out, data.FlowEnd);
+        *out++ = ',';
+        memcpy(out, name.data(), name.size());
+        out += name.size();
+        *out++ = '\n';
+        used = out - buffer.data();
+        return true;
+    }
+
+public:
+    CSVHandler(const DatabaseConfig& config, CSVFileWriter* writer = nullptr)
+        : csvPath(config.csv_path), bufferSize(static_cast<size_t>(config.csv_buffer_size) * 1024),
+          flushInterval(config.csv_flush_interval), fd(-1), used(0), writer(writer) {}
+
+    ~CSVHandler() override {
+        close();
+    }
+
+    bool connect() override {
+        if (writer) {
+            buffer.resize(bufferSize + MAX_ROW);
+            return writer->start();
+        }
+        // Check if file exists
+        bool exists = access(csvPath.c_str(), F_OK) == 0;
+        fd = open(csvPath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "Cannot open CSV file: " << csvPath << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot open CSV file: %s: %s", csvPath.c_str(), strerror(errno));
+            return false;
+        }
+        buffer.resize(bufferSize + MAX_ROW);
+        if (!exists) {
+            // File did not exist, write header
+            static const char header[] = "SourceIP,DestinationIP,SourcePort,DestinationPort,Protocol,PacketCount,ByteCount,FlowStart,FlowEnd,SourceSond\n";
+            memcpy(buffer.data(), header, sizeof(header) - 1);
+            used = sizeof(header) - 1;
+            if (!flush()) {
+                return false;
+            }
+            std::cout << "CSV file created: " << csvPath << std::endl;
+            syslog(LOG_INFO, "CSV file created: %s", csvPath.c_str());
+        } else {
+            // CSV file exists, proceed to use it
+            std::cout << "CSV file is ready: " << csvPath << std::endl;
+            syslog(LOG_INFO, "CSV file is ready: %s", csvPath.c_str());
+        }
+        return true;
+    }
+
+    bool checkConnection() override {
+        if (writer) {
+            return writer->checkConnection();
+        }
+        std::ofstream outFile(csvPath, std::ios::app);
+        if (!outFile.is_open()) {
+            std::cerr << "Cannot open CSV file: " << csvPath << std::endl;
+            syslog(LOG_ERR, "Cannot open CSV file: %s", csvPath.c_str());
+            return false;
+        }
+        std::cout << "CSV file is accessible: " << csvPath << std::endl;
+        syslog(LOG_INFO, "CSV file is accessible: %s", csvPath.c_str());
+        outFile.close();
+        return true;
+    }
+
+    bool initializeTable() override {
+        // No additional initialization needed for CSV
+        return true;
+    }
+
+    bool insertFlowData(const FlowData& data) override {
+        if (!appendRow(data)) {
+            return false;
+        }
+        if (used >= bufferSize) {
+            return flush();
+        }
+        return true;
+    }
+
+    // The rows are formatted into the buffer and its size is checked once per batch
+    bool insertFlowBatch(const FlowData* flows, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            if (!appendRow(flows[i])) {
+                return false;
+            }
+        }
+        if (used >= bufferSize) {
+            return flush();
+        }
+        return true;
+    }
+
+    // Function to write the buffered rows to the file
+    bool flush() override {
+        if (writer) {
+            if (used) {
+                buffer.resize(used);
+                writer->submit(buffer);
+                buffer.resize(bufferSize + MAX_ROW);
+                used = 0;
+            }
+            return true;
+        }
+        size_t offset = 0;
+        while (offset < used) {
+            ssize_t n = ::write(fd, buffer.data() + offset, used - offset);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Cannot write CSV file: " << csvPath << ": " << strerror(errno) << std::endl;
+                syslog(LOG_ERR, "Cannot write CSV file: %s: %s", csvPath.c_str(), strerror(errno));
+                used = 0;
+                return false;
+            }
+            offset += n;
+        }
+        used = 0;
+        return true;
+    }
+
+    void tick() override {
+        if (used && std::chrono::steady_clock::now() - firstRow >= std::chrono::milliseconds(flushInterval)) {
+            flush();
+        }
+    }
+
+    void close() override {
+        if (writer) {
+            flush();
+        } else if (fd >= 0) {
+            flush();
+            ::close(fd);
+            fd = -1;
+        }
+    }
+};
+
+// nfcapd files (type = nfcapd)
+// Files in the nfdump 1.7 layout (LAYOUT_VERSION_2, uncompressed blocks of
+// V3 records) that nfdump reads like files of nfcapd. Each flow is a V3
+// record with a generic flow element and an IPv4 or IPv6 flow element.
+// All numbers are in host byte order, as nfdump writes them.
+#pragma pack(push, 1)
+
+struct NfdumpFileHeader {
+    uint16_t magic;             // 0xA50C
+    uint16_t version;           // 2
+    uint32_t nfdversion;        // Version of nfdump that wrote the file
+    uint64_t created;
+    uint8_t compression;        // 0 = not compressed
+    uint8_t encryption;
+    uint16_t appendixBlocks;
+    uint32_t unused;
+    uint64_t offAppendix;
+    uint32_t blockSize;         // Largest data block
+    uint32_t numBlocks;         // Data blocks, without the appendix
+};
+
+struct NfdumpDataBlock {
+    uint32_t numRecords;
+    uint32_t size;              // Bytes after this header
+    uint16_t type;              // 2 = appendix records, 3 = V3 records
+    uint16_t flags;
+};
+
+struct NfdumpRecordHeader {
+    uint16_t type;
+    uint16_t size;
+};
+
+struct NfdumpV3Header {
+    uint16_t type;              // 11
+    uint16_t size;              // Including the elements
+    uint8_t numElements;
+    uint8_t reserved[7];        // Engine, exporter, flags and NetFlow version; 0 = unknown
+};
+
+struct NfdumpElementHeader {
+    uint16_t type;
+    uint16_t length;            // Including this header
+};
+
+struct NfdumpGenericFlow {
+    uint64_t msecFirst;
+    uint64_t msecLast;
+    uint64_t msecReceived;
+    uint64_t inPackets;
+    uint64_t inBytes;
+    uint16_t srcPort;
+    uint16_t dstPort;
+    uint8_t proto;
+    uint8_t tcpFlags;
+    uint8_t fwdStatus;
+    uint8_t srcTos;
+};
+
+struct NfdumpIPv4Flow {
+    uint32_t srcAddr;
+    uint32_t dstAddr;
+};
+
+struct NfdumpIPv6Flow {
+    uint64_t srcAddr[2];
+    uint64_t dstAddr[2];
+};
+
+// Summary in the appendix, shown by nfdump -I
+struct NfdumpStatRecord {
+    uint64_t numflows;
+    uint64_t numbytes;
+    uint64_t numpackets;
+    uint64_t numflows_tcp;
+    uint64_t numflows_udp;
+    uint64_t numflows_icmp;
+    uint64_t numflows_other;
+    uint64_t numbytes_tcp;
+    uint64_t numbytes_udp;
+    uint64_t numbytes_icmp;
+    uint64_t numbytes_other;
+    uint64_t numpackets_tcp;
+    uint64_t numpackets_udp;
+    uint64_t numpackets_icmp;
+    uint64_t numpackets_other;
+    uint64_t firstseen;         // Milliseconds
+    uint64_t lastseen;
+    uint64_t sequence_failure;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(NfdumpFileHeader) == 40, "nfdump file header is 40 bytes");
+static_assert(sizeof(NfdumpGenericFlow) == 48, "nfdump generic flow element is 48 bytes");
+static_assert(sizeof(NfdumpStatRecord) == 144, "nfdump stat record is 144 bytes");
+
+static const uint16_t NFDUMP_MAGIC = 0xA50C;
+static const uint16_t NFDUMP_LAYOUT_VERSION_2 = 2;
+static const uint32_t NFDUMP_VERSION = 0x01070000;
+static const uint16_t NFDUMP_DATA_BLOCK_TYPE_2 = 2;
+static const uint16_t NFDUMP_DATA_BLOCK_TYPE_3 = 3;
+static const uint16_t NFDUMP_V3_RECORD = 11;
+static const uint16_t NFDUMP_TYPE_IDENT = 0x8001;
+static const uint16_t NFDUMP_TYPE_STAT = 0x8002;
+static const uint16_t NFDUMP_EX_GENERIC_FLOW = 1;
+static const uint16_t NFDUMP_EX_IPV4_FLOW = 2;
+static const uint16_t NFDUMP_EX_IPV6_FLOW = 3;
+static const size_t NFDUMP_BLOCK_SIZE = 1024 * 1024;   // nfdump's WRITE_BUFFSIZE
+static const size_t NFDUMP_MAX_RECORD = sizeof(NfdumpV3Header) + 2 * sizeof(NfdumpElementHeader) +
+                                        sizeof(NfdumpGenericFlow) + sizeof(NfdumpIPv6Flow);
+
+// Function to add one block's summary to a file's summary
+inline void addNfdumpStat(NfdumpStatRecord& total, const NfdumpStatRecord& add) {
+    total.numflows += add.numflows;
+    total.numbytes += add.numbytes;
+    total.numpackets += add.numpackets;
+    total.numflows_tcp += add.numflows_tcp;
+    total.numflows_udp += add.numflows_udp;
+    total.numflows_icmp += add.numflows_icmp;
+    total.numflows_other += add.numflows_other;
+    total.numbytes_tcp += add.numbytes_tcp;
+    total.numbytes_udp += add.numbytes_udp;
+    total.numbytes_icmp += add.numbytes_icmp;
+    total.numbytes_other += add.numbytes_other;
+    total.numpackets_tcp += add.numpackets_tcp;
+    total.numpackets_udp += add.numpackets_udp;
+    total.numpackets_icmp += add.numpackets_icmp;
+    total.numpackets_other += add.numpackets_other;
+    if (add.numflows) {
+        total.firstseen = total.numflows == add.numflows ? add.firstseen : std::min(total.firstseen, add.firstseen);
+        total.lastseen = std::max(total.lastseen, add.lastseen);
+    }
+}
+
+// A data block of V3 records, filled by an NfcapdHandler
+struct NfcapdBlock {
+    std::vector<uint8_t> data;  // NfdumpDataBlock followed by the records
+    NfdumpStatRecord stat;
+};
+
+// nfcapd file writer
+// One thread owns the files, like nfcapd: it writes to nfcapd.current.PID
+// in nfcapd_path and every nfcapd_rotate_interval seconds finishes it with
+// the summary appendix, renames it to nfcapd.YYYYMMDDhhmm (the start of the
+// period, local time) and starts the next one, also when no flows came in.
+// Receivers hand it whole data blocks.
+class NfcapdFileWriter {
+private:
+    static const size_t MAX_QUEUED = 64;    // Blocks waiting for the writer thread
+    static const size_t MAX_SPARE = 8;      // Written blocks kept for reuse
+
+    DatabaseConfig config;
+    std::deque<NfcapdBlock> queue;
+    std::vector<std::vector<uint8_t>> spare;
+    std::mutex mutex;
+    std::condition_variable wakeWriter;
+    std::condition_variable wakeProducers;
+    bool stopping;
+    std::thread thread;
+    bool started;
+    bool connected;
+
+    // Current file, used by the writer thread only
+    int fd;
+    std::string currentPath;
+    time_t periodStart;
+    time_t periodEnd;
+    NfdumpFileHeader header;
+    NfdumpStatRecord stat;
+
+    bool writeAll(const void* data, size_t length) {
+        const char* p = static_cast<const char*>(data);
+        while (length) {
+            ssize_t n = ::write(fd, p, length);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Cannot write nfcapd file: " << currentPath << ": " << strerror(errno) << std::endl;
+                syslog(LOG_ERR, "Cannot write nfcapd file: %s: %s", currentPath.c_str(), strerror(errno));
+                return false;
+            }
+            p += n;
+            length -= n;
+        }
+        return true;
+    }
+
+    // Function to start the file of the period containing 'now'
+    bool openFile(time_t now) {
+        periodStart = now - now % config.nfcapd_rotate_interval;
+        periodEnd = periodStart + config.nfcapd_rotate_interval;
+        currentPath = config.nfcapd_path + "/nfcapd.current." + std::to_string(getpid());
+        fd = open(currentPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "Cannot open nfcapd file: " << currentPath << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot open nfcapd file: %s: %s", currentPath.c_str(), strerror(errno));
+            return false;
+        }
+        memset(&header, 0, sizeof(header));
+        header.magic = NFDUMP_MAGIC;
+        header.version = NFDUMP_LAYOUT_VERSION_2;
+        header.nfdversion = NFDUMP_VERSION;
+        header.created = now;
+        header.blockSize = NFDUMP_BLOCK_SIZE;
+        memset(&stat, 0, sizeof(stat));
+        if (!writeAll(&header, sizeof(header))) {
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    // Function to write the appendix and the final header, and rename the file for its period
+    void finishFile() {
+        // Appendix: one block with the ident and the summary
+        static const char ident[] = "netflow_collector";
+        const size_t identSize = (sizeof(NfdumpRecordHeader) + sizeof(ident) + 3) & ~size_t(3);
+        std::vector<uint8_t> appendix(sizeof(NfdumpDataBlock) + identSize + sizeof(NfdumpRecordHeader) + sizeof(stat));
+        NfdumpDataBlock* block = reinterpret_cast<NfdumpDataBlock*>(appendix.data());
+        block->numRecords = 2;
+        block->size = static_cast<uint32_t>(appendix.size() - sizeof(NfdumpDataBlock));
+        block->type = NFDUMP_DATA_BLOCK_TYPE_2;
+        uint8_t* p = appendix.data() + sizeof(NfdumpDataBlock);
+        NfdumpRecordHeader record = { NFDUMP_TYPE_IDENT, static_cast<uint16_t>(identSize) };
+        memcpy(p, &record, sizeof(record));
+        memcpy(p + sizeof(record), ident, sizeof(ident));
+        p += identSize;
+        record = { NFDUMP_TYPE_STAT, static_cast<uint16_t>(sizeof(NfdumpRecordHeader) + sizeof(stat)) };
+        memcpy(p, &record, sizeof(record));
+        memcpy(p + sizeof(record), &stat, sizeof(stat));
+
+        off_t end = lseek(fd, 0, SEEK_END);
+        if (end > 0 && writeAll(appendix.data(), appendix.size())) {
+            header.offAppendix = end;
+            header.appendixBlocks = 1;
+        }
+        if (pwrite(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+            std::cerr << "Cannot write nfcapd file: " << currentPath << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot write nfcapd file: %s: %s", currentPath.c_str(), strerror(errno));
+        }
+        ::close(fd);
+        fd = -1;
+
+        // nfcapd names files by the start of the period in local time; a file
+        // of the same period from before a restart is kept
+        struct tm local;
+        localtime_r(&periodStart, &local);
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%Y%m%d%H%M", &local);
+        std::string name = config.nfcapd_path + "/nfcapd." + stamp;
+        for (int sequence = 1; access(name.c_str(), F_OK) == 0 && sequence <= 1000; ++sequence) {
+            name = config.nfcapd_path + "/nfcapd." + stamp + "-" + std::to_string(sequence);
+        }
+        if (rename(currentPath.c_str(), name.c_str()) != 0) {
+            std::cerr << "Cannot rename nfcapd file: " << currentPath << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot rename nfcapd file: %s: %s", currentPath.c_str(), strerror(errno));
+            return;
+        }
+        files.fetch_add(1, std::memory_order_relaxed);
+        syslog(LOG_INFO, "nfcapd file closed: %s (%llu flows)", name.c_str(), static_cast<unsigned long long>(stat.numflows));
+    }
+
+    void run() {
+        while (true) {
+            NfcapdBlock block;
+            bool have = false;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                auto deadline = std::min(std::chrono::system_clock::now() + std::chrono::seconds(1),
+                                         std::chrono::system_clock::from_time_t(periodEnd));
+                wakeWriter.wait_until(lock, deadline, [this] { return !queue.empty() || stopping; });
+                if (!queue.empty()) {
+                    block = std::move(queue.front());
+                    queue.pop_front();
+                    have = true;
+                    wakeProducers.notify_all();
+                } else if (stopping) {
+                    break;
+                }
+            }
+
+            time_t now = time(nullptr);
+            if (now >= periodEnd) {
+                // Rotate even without flows, so nfdump -R finds every period
+                if (fd >= 0) {
+                    finishFile();
+                }
+                openFile(now);
+            }
+            if (have) {
+                const NfdumpDataBlock* blockHeader = reinterpret_cast<const NfdumpDataBlock*>(block.data.data());
+                if (fd >= 0 && writeAll(block.data.data(), block.data.size())) {
+                    header.numBlocks++;
+                    addNfdumpStat(stat, block.stat);
+                    flows.fetch_add(blockHeader->numRecords, std::memory_order_relaxed);
+                    bytes.fetch_add(block.data.size(), std::memory_order_relaxed);
+                } else {
+                    lostFlows.fetch_add(blockHeader->numRecords, std::memory_order_relaxed);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (spare.size() < MAX_SPARE) {
+                    spare.push_back(std::move(block.data));
+                }
+            }
+        }
+        if (fd >= 0) {
+            finishFile();
+        }
+    }
+
+public:
+    // Statistics
+    std::atomic<uint64_t> files;
+    std::atomic<uint64_t> flows;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> lostFlows;        // No file could be opened or written
+    std::atomic<uint64_t> producerWaits;
+
+    explicit NfcapdFileWriter(const DatabaseConfig& config)
+        : config(config), stopping(false), started(false), connected(false), fd(-1), periodStart(0), periodEnd(0),
+          files(0), flows(0), bytes(0), lostFlows(0), producerWaits(0) {}
+
+    ~NfcapdFileWriter() {
+        stop();
+    }
+
+    // Function to open the first file and start the writer thread (once; later calls return the first result)
+    bool start() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!started) {
+            started = true;
+            connected = openFile(time(nullptr));
+            if (connected) {
+                std::cout << "nfcapd files: " << config.nfcapd_path << std::endl;
+                syslog(LOG_INFO, "nfcapd files: %s", config.nfcapd_path.c_str());
+                thread = std::thread(&NfcapdFileWriter::run, this);
+            }
+        }
+        return connected;
+    }
+
+    // Function to write what is queued, finish the file and stop; call after all producers have closed
+    void stop() {
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                wakeWriter.notify_one();
+            }
+            thread.join();
+        }
+    }
+
+    // Function to check that files can be created in nfcapd_path
+    bool checkConnection() {
+        if (access(config.nfcapd_path.c_str(), W_OK) != 0) {
+            std::cerr << "Cannot create nfcapd files in: " << config.nfcapd_path << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot create nfcapd files in: %s: %s", config.nfcapd_path.c_str(), strerror(errno));
+            return false;
+        }
+        std::cout << "nfcapd directory is accessible: " << config.nfcapd_path << std::endl;
+        syslog(LOG_INFO, "nfcapd directory is accessible: %s", config.nfcapd_path.c_str());
+        return true;
+    }
+
+    // Producer side: queue a filled block and get an empty buffer back
+    void submit(NfcapdBlock& block) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (queue.size() >= MAX_QUEUED && !stopping) {
+            producerWaits.fetch_add(1, std::memory_order_relaxed);
+            wakeProducers.wait(lock, [this] { return queue.size() < MAX_QUEUED || stopping; });
+        }
+        queue.push_back(std::move(block));
+        wakeWriter.notify_one();
+        block.data.clear();
+        if (!spare.empty()) {
+            block.data = std::move(spare.back());
+            spare.pop_back();
+        }
+    }
+
+    size_t queued() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queue.size();
+    }
+};
+
+std::unique_ptr<NfcapdFileWriter> nfcapdWriter; // Created with the first nfcapd receiver handler
+
+// Implementation for nfcapd files
+// Rows are encoded as V3 records straight into a data block, which goes to
+// the NfcapdFileWriter when it is full or after nfcapd_flush_interval ms.
+// Flows without timestamps get the time they were received, so nfdump time
+// windows (-t) still select them.
+class NfcapdHandler : public DatabaseHandler {
+private:
+    NfcapdFileWriter& writer;
+    int flushInterval;
+    NfcapdBlock block;
+    size_t used;                // Bytes of block.data in use, 0 = no block started
+    std::chrono::steady_clock::time_point firstRow;
+
+    NfdumpDataBlock* blockHeader() {
+        return reinterpret_cast<NfdumpDataBlock*>(block.data.data());
+    }
+
+    // Function to get the receive time in ms, used for flows without timestamps
+    static uint64_t receivedTime() {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+    }
+
+    // Function to append one flow as a V3 record, starting a block if needed
+    void appendRecord(const FlowData& data, uint64_t received) {
+        if (!used) {
+            block.data.resize(NFDUMP_BLOCK_SIZE);
+            memset(block.data.data(), 0, sizeof(NfdumpDataBlock));
+            blockHeader()->type = NFDUMP_DATA_BLOCK_TYPE_3;
+            memset(&block.stat, 0, sizeof(block.stat));
+            used = sizeof(NfdumpDataBlock);
+            firstRow = std::chrono::steady_clock::now();
+        }
+
+        bool ipv6 = data.SourceIP.version == 6 || data.DestinationIP.version == 6;
+
+        uint8_t* p = block.data.data() + used;
+        NfdumpV3Header* record = reinterpret_cast<NfdumpV3Header*>(p);
+        memset(record, 0, sizeof(*record));
+        record->type = NFDUMP_V3_RECORD;
+        record->numElements = 2;
+        p += sizeof(NfdumpV3Header);
+
+        NfdumpElementHeader element = { NFDUMP_EX_GENERIC_FLOW, sizeof(NfdumpElementHeader) + sizeof(NfdumpGenericFlow) };
+        memcpy(p, &element, sizeof(element));
+        NfdumpGenericFlow* flow = reinterpret_cast<NfdumpGenericFlow*>(p + sizeof(element));
+        flow->msecFirst = data.FlowStart ? data.FlowStart / 1000000 : received;
+        flow->msecLast = data.FlowEnd ? data.FlowEnd / 1000000 : flow->msecFirst;
+        flow->msecReceived = received;
+        flow->inPackets = data.PacketCount;
+        flow->inBytes = data.ByteCount;
+        flow->srcPort = data.SourcePort;
+        flow->dstPort = data.DestinationPort;
+        flow->proto = data.Protocol;
+        flow->tcpFlags = 0;
+        flow->fwdStatus = 0;
+        flow->srcTos = 0;
+        p += element.length;
+
+        if (ipv6) {
+            // IPv4 addresses of a mixed record stay IPv4-mapped
+            element = { NFDUMP_EX_IPV6_FLOW, sizeof(NfdumpElementHeader) + sizeof(NfdumpIPv6Flow) };
+            memcpy(p, &element, sizeof(element));
+            NfdumpIPv6Flow addresses;
+            uint64_t half;
+            for (int i = 0; i < 2; ++i) {
+                memcpy(&half, data.SourceIP.bytes + 8 * i, 8);
+                addresses.srcAddr[i] = be64toh(half);
+                memcpy(&half, data.DestinationIP.bytes + 8 * i, 8);
+                addresses.dstAddr[i] = be64toh(half);
+            }
+            memcpy(p + sizeof(element), &addresses, sizeof(addresses));
+        } else {
+            element = { NFDUMP_EX_IPV4_FLOW, sizeof(NfdumpElementHeader) + sizeof(NfdumpIPv4Flow) };
+            memcpy(p, &element, sizeof(element));
+            NfdumpIPv4Flow addresses;
+            uint32_t address;
+            memcpy(&address, data.SourceIP.bytes + 12, 4);
+            addresses.srcAddr = ntohl(address);
+            memcpy(&address, data.DestinationIP.bytes + 12, 4);
+            addresses.dstAddr = ntohl(address);
+            memcpy(p + sizeof(element), &addresses, sizeof(addresses));
+        }
+        p += element.length;
+        record->size = static_cast<uint16_t>(p - reinterpret_cast<uint8_t*>(record));
+        used = p - block.data.data();
+        blockHeader()->numRecords++;
+
+        NfdumpStatRecord& stat = block.stat;
+        if (data.Protocol == 6) {
+            stat.numflows_tcp++;
+            stat.numbytes_tcp += data.ByteCount;
+            stat.numpackets_tcp += data.PacketCount;
+        } else if (data.Protocol == 17) {
+            stat.numflows_udp++;
+            stat.numbytes_udp += data.ByteCount;
+            stat.numpackets_udp += data.PacketCount;
+        } else if (data.Protocol == 1 || data.Protocol == 58) {
+            stat.numflows_icmp++;
+            stat.numbytes_icmp += data.ByteCount;
+            stat.numpackets_icmp += data.PacketCount;
+        } else {
+            stat.numflows_other++;
+            stat.numbytes_other += data.ByteCount;
+            stat.numpackets_other += data.PacketCount;
+        }
+        if (stat.numflows++ == 0 || flow->msecFirst < stat.firstseen) {
+            stat.firstseen = flow->msecFirst;
+        }
+        stat.lastseen = std::max(stat.lastseen, flow->msecLast);
+        stat.numbytes += data.ByteCount;
+        stat.numpackets += data.PacketCount;
+
+        if (used + NFDUMP_MAX_RECORD > NFDUMP_BLOCK_SIZE) {
+            flush();
+        }
+    }
+
+public:
+    NfcapdHandler(const DatabaseConfig& config, NfcapdFileWriter& writer)
+        : writer(writer), flushInterval(config.nfcapd_flush_interval), used(0) {}
+
+    ~NfcapdHandler() override {
+        close();
+    }
+
+    bool connect() override {
+        return writer.start();
+    }
+
+    bool checkConnection() override {
+        return writer.checkConnection();
+    }
+
+    bool initializeTable() override {
+        // Files are created by the writer
+        return true;
+    }
+
+    bool insertFlowData(const FlowData& data) override {
+        appendRecord(data, receivedTime());
+        return true;
+    }
+
+    // One receive time for all flows of the batch
+    bool insertFlowBatch(const FlowData* flows, size_t count) override {
+        uint64_t received = receivedTime();
+        for (size_t i = 0; i < count; ++i) {
+            appendRecord(flows[i], received);
+        }
+        return true;
+    }
+
+    bool flush() override {
+        if (used) {
+            blockHeader()->size = static_cast<uint32_t>(used - sizeof(NfdumpDataBlock));
+            block.data.resize(used);
+            writer.submit(block);
+            used = 0;
+        }
+        return true;
+    }
+
+    void tick() override {
+        if (used && std::chrono::steady_clock::now() - firstRow >= std::chrono::milliseconds(flushInterval)) {
+            flush();
+        }
+    }
+
+    void close() override {
+        flush();
+    }
+};
+
+// Native columnar segments (type = native)
+// Flows are archived in segment files, one per native_rotate_interval
+// seconds, named by strftime(native_path) like rotated CSV files. A segment
+// is a run of blocks of up to native_block_rows rows, and a block stores
+// every field as a column of its own, so similar values sit together and
+// encode small, and a reader only decodes the columns it needs. The footer
+// indexes the blocks with the min/max of each column, so a reader can skip
+// blocks outside a time range or without a given port.
+//
+//   segment := "NFSEG001" block* footer footerSize:u32 "NFSEGEND"
+//   block   := "NFBLOCK1" rows:u32 (encoding:u8 size:u32){NATIVE_COLUMNS} column*
+//   footer  := probeCount:u16 (nameSize:u16 name)* blockCount:u32
+//              (offset:u64 rows:u32 (min:u64 max:u64){NATIVE_COLUMNS})*
+//
+// Numbers are little-endian, columns are in NativeColumn order. Encodings:
+//   NATIVE_DELTA       varint(zigzag(value - value of the previous row)) - timestamps
+//   NATIVE_VARINT      varint(value) - counters
+//   NATIVE_DICTIONARY  count:varint value:varint{count}, then the index of each row's
+//                      value, 1 byte if count <= 256, else 2 bytes - ports, protocol, probe
+//   NATIVE_ADDRESS     4 bytes per IPv4 row, 16 per IPv6 row, nothing for rows without
+//                      the address; the versions column (source << 4 | destination) tells which
+// Address columns have min/max 0. The footer is written when a segment is
+// finished; a segment without one (the collector was killed) can still be
+// read block by block.
+enum NativeColumn {
+    NATIVE_FLOW_START,
+    NATIVE_FLOW_END,
+    NATIVE_VERSIONS,
+    NATIVE_SOURCE_IP,
+    NATIVE_DESTINATION_IP,
+    NATIVE_SOURCE_PORT,
+    NATIVE_DESTINATION_PORT,
+    NATIVE_PROTOCOL,
+    NATIVE_PACKET_COUNT,
+    NATIVE_BYTE_COUNT,
+    NATIVE_PROBE_ID,
+    NATIVE_COLUMNS
+};
+
+enum NativeEncoding : uint8_t {
+    NATIVE_DELTA = 1,
+    NATIVE_VARINT = 2,
+    NATIVE_DICTIONARY = 3,
+    NATIVE_ADDRESS = 4
+};
+
+static const char NATIVE_SEGMENT_MAGIC[] = "NFSEG001";
+static const char NATIVE_BLOCK_MAGIC[] = "NFBLOCK1";
+static const char NATIVE_END_MAGIC[] = "NFSEGEND";
+static const size_t NATIVE_BLOCK_HEADER = 8 + 4 + NATIVE_COLUMNS * 5;
+
+// Position and min/max of one block of a segment
+struct NativeBlockInfo {
+    uint64_t offset = 0;
+    uint32_t rows = 0;
+    uint64_t min[NATIVE_COLUMNS] = {};
+    uint64_t max[NATIVE_COLUMNS] = {};
+};
+
+inline uint8_t* writeVarint(uint8_t* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    *out++ = static_cast<uint8_t>(value);
+    return out;
+}
+
+// Returns the end of the varint, null if it is truncated or too long
+inline const uint8_t* readVarint(const uint8_t* in, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && in < end; shift += 7) {
+        uint8_t byte = *in++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return in;
+        }
+    }
+    return nullptr;
+}
+
+inline void putLittleEndian(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+inline uint64_t getLittleEndian(const uint8_t* in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+// Encodes blocks of rows column by column; buffers are reused between blocks
+class NativeBlockEncoder {
+private:
+    std::vector<uint8_t> columns[NATIVE_COLUMNS];
+    uint8_t encodings[NATIVE_COLUMNS];
+    std::vector<int32_t> dictionaryIndex;   // Value -> index in the block's dictionary (-1 = not in it)
+    std::vector<uint16_t> dictionary;
+    std::vector<uint16_t> indexes;
+
+    template <typename Get>
+    void encodeDelta(const std::vector<FlowData>& rows, int column, NativeBlockInfo& info, Get get) {
+        std::vector<uint8_t>& out = columns[column];
+        out.resize(rows.size() * 10);
+        uint8_t* p = out.data();
+        uint64_t previous = 0;
+        uint64_t min = std::numeric_limits<uint64_t>::max();
+        uint64_t max = 0;
+        for (const FlowData& row : rows) {
+            uint64_t value = get(row);
+            uint64_t delta = value - previous;
+            p = writeVarint(p, (delta << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(delta) >> 63));
+            previous = value;
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+        out.resize(p - out.data());
+        encodings[column] = NATIVE_DELTA;
+        info.min[column] = min;
+        info.max[column] = max;
+    }
+
+    template <typename Get>
+    void encodeVarint(const std::vector<FlowData>& rows, int column, NativeBlockInfo& info, Get get) {
+        std::vector<uint8_t>& out = columns[column];
+        out.resize(rows.size() * 10);
+        uint8_t* p = out.data();
+        uint64_t min = std::numeric_limits<uint64_t>::max();
+        uint64_t max = 0;
+        for (const FlowData& row : rows) {
+            uint64_t value = get(row);
+            p = writeVarint(p, value);
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+        out.resize(p - out.data());
+        encodings[column] = NATIVE_VARINT;
+        info.min[column] = min;
+        info.max[column] = max;
+    }
+
+    // Values must fit in 16 bits
+    template <typename Get>
+    void encodeDictionary(const std::vector<FlowData>& rows, int column, NativeBlockInfo& info, Get get) {
+        dictionary.clear();
+        indexes.resize(rows.size());
+        uint16_t min = std::numeric_limits<uint16_t>::max();
+        uint16_t max = 0;
+        for (size_t i = 0; i < rows.size(); ++i) {
+            uint16_t value = get(rows[i]);
+            int32_t& slot = dictionaryIndex[value];
+            if (slot < 0) {
+                slot = static_cast<int32_t>(dictionary.size());
+                dictionary.push_back(value);
+                min = std::min(min, value);
+                max = std::max(max, value);
+            }
+            indexes[i] = static_cast<uint16_t>(slot);
+        }
+        for (uint16_t value : dictionary) {
+            dictionaryIndex[value] = -1;
+        }
+
+        std::vector<uint8_t>& out = columns[column];
+        out.resize(10 + dictionary.size() * 3 + rows.size() * 2);
+        uint8_t* p = writeVarint(out.data(), dictionary.size());
+        for (uint16_t value : dictionary) {
+            p = writeVarint(p, value);
+        }
+        if (dictionary.size() <= 256) {
+            for (uint16_t index : indexes) {
+                *p++ = static_cast<uint8_t>(index);
+            }
+        } else {
+            for (uint16_t index : indexes) {
+                *p++ = static_cast<uint8_t>(index);
+                *p++ = static_cast<uint8_t>(index >> 8);
+            }
+        }
+        out.resize(p - out.data());
+        encodings[column] = NATIVE_DICTIONARY;
+        info.min[column] = min;
+        info.max[column] = max;
+    }
+
+    void encodeAddresses(const std::vector<FlowData>& rows, int column, const FlowAddress FlowData::*member) {
+        std::vector<uint8_t>& out = columns[column];
+        out.resize(rows.size() * 16);
+        uint8_t* p = out.data();
+        for (const FlowData& row : rows) {
+            const FlowAddress& address = row.*member;
+            if (address.version == 4) {
+                std::memcpy(p, address.bytes + 12, 4);
+                p += 4;
+            } else if (address.version == 6) {
+                std::memcpy(p, address.bytes, 16);
+                p += 16;
+            }
+        }
+        out.resize(p - out.data());
+        encodings[column] = NATIVE_ADDRESS;
+    }
+
+public:
+    NativeBlockEncoder() : dictionaryIndex(65536, -1) {}
+
+    // Function to append the block of 'rows' to 'out'; sets the rows and min/max of 'info'
+    void encode(const std::vector<FlowData>& rows, std::vector<uint8_t>& out, NativeBlockInfo& info) {
+        info.rows = static_cast<uint32_t>(rows.size());
+        encodeDelta(rows, NATIVE_FLOW_START, info, [](const FlowData& f) { return f.FlowStart; });
+        encodeDelta(rows, NATIVE_FLOW_END, info, [](const FlowData& f) { return f.FlowEnd; });
+        encodeDictionary(rows, NATIVE_VERSIONS, info, [](const FlowData& f) {
+            return static_cast<uint16_t>(f.SourceIP.version << 4 | f.DestinationIP.version);
+        });
+        encodeAddresses(rows, NATIVE_SOURCE_IP, &FlowData::SourceIP);
+        encodeAddresses(rows, NATIVE_DESTINATION_IP, &FlowData::DestinationIP);
+        encodeDictionary(rows, NATIVE_SOURCE_PORT, info, [](const FlowData& f) { return f.SourcePort; });
+        encodeDictionary(rows, NATIVE_DESTINATION_PORT, info, [](const FlowData& f) { return f.DestinationPort; });
+        encodeDictionary(rows, NATIVE_PROTOCOL, info, [](const FlowData& f) { return static_cast<uint16_t>(f.Protocol); });
+        encodeVarint(rows, NATIVE_PACKET_COUNT, info, [](const FlowData& f) { return f.PacketCount; });
+        encodeVarint(rows, NATIVE_BYTE_COUNT, info, [](const FlowData& f) { return f.ByteCount; });
+        encodeDictionary(rows, NATIVE_PROBE_ID, info, [](const FlowData& f) { return f.ProbeID; });
+
+        out.insert(out.end(), NATIVE_BLOCK_MAGIC, NATIVE_BLOCK_MAGIC + 8);
+        putLittleEndian(out, info.rows, 4);
+        for (int column = 0; column < NATIVE_COLUMNS; ++column) {
+            out.push_back(encodings[column]);
+            putLittleEndian(out, columns[column].size(), 4);
+        }
+        for (int column = 0; column < NATIVE_COLUMNS; ++column) {
+            out.insert(out.end(), columns[column].begin(), columns[column].end());
+        }
+    }
+};
+
+// Native segment writer
+// One thread owns the current segment. Receivers collect rows in a
+// BatchQueueHandler and queue whole batches; the writer fills a block,
+// encodes and writes it, and finishes the segment with its footer at the
+// end of every period. A segment that got no rows is removed. Producers
+// wait while native_queue_rows rows are queued.
+class NativeSegmentWriter : public FlowBatchSink {
+private:
+    DatabaseConfig config;
+    std::vector<std::string> probeNames;    // Stored in the footer, by ProbeID
+    std::deque<FlowBatch*> queue;
+    size_t queuedRows;
+    std::mutex mutex;
+    std::condition_variable wakeWriter;
+    std::condition_variable wakeProducers;
+    bool stopping;
+    std::thread thread;
+    bool started;
+    bool connected;
+
+    // Current segment, used by the writer thread only
+    int fd;
+    std::string path;
+    time_t periodEnd;
+    uint64_t fileSize;
+    std::vector<FlowData> block;
+    std::vector<NativeBlockInfo> blockIndex;
+    NativeBlockEncoder encoder;
+    std::vector<uint8_t> encoded;
+
+    bool writeAll(const void* data, size_t length) {
+        const char* p = static_cast<const char*>(data);
+        while (length) {
+            ssize_t n = ::write(fd, p, length);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Cannot write native segment: " << path << ": " << strerror(errno) << std::endl;
+                syslog(LOG_ERR, "Cannot write native segment: %s: %s", path.c_str(), strerror(errno));
+                return false;
+            }
+            p += n;
+            length -= n;
+        }
+        return true;
+    }
+
+    // Function to create the segment of the period containing 'now'
+    // (with "-1", "-2", ... after a restart within the same period)
+    bool openSegment(time_t now) {
+        time_t periodStart = now;
+        periodEnd = std::numeric_limits<time_t>::max();
+        if (config.native_rotate_interval) {
+            periodStart = now - now % config.native_rotate_interval;
+            periodEnd = periodStart + config.native_rotate_interval;
+        }
+        fd = createNewFile(periodFileName(config.native_path, config.native_rotate_interval, periodStart), path);
+        if (fd < 0) {
+            std::cerr << "Cannot create native segment: " << path << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot create native segment: %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        blockIndex.clear();
+        fileSize = 8;
+        if (!writeAll(NATIVE_SEGMENT_MAGIC, 8)) {
+            ::close(fd);
+            fd = -1;
+            unlink(path.c_str());
+            return false;
+        }
+        std::cout << "Native segment opened: " << path << std::endl;
+        syslog(LOG_INFO, "Native segment opened: %s", path.c_str());
+        return true;
+    }
+
+    // Function to encode and write the rows collected for the current block
+    void writeBlock() {
+        if (block.empty()) {
+            return;
+        }
+        NativeBlockInfo info;
+        encoded.clear();
+        encoder.encode(block, encoded, info);
+        info.offset = fileSize;
+        if (writeAll(encoded.data(), encoded.size())) {
+            fileSize += encoded.size();
+            blockIndex.push_back(info);
+            blocks.fetch_add(1, std::memory_order_relaxed);
+            rows.fetch_add(block.size(), std::memory_order_relaxed);
+            bytes.fetch_add(encoded.size(), std::memory_order_relaxed);
+        } else {
+            lostRows.fetch_add(block.size(), std::memory_order_relaxed);
+            // Cut off a partly written block, so the segment stays readable
+            if (ftruncate(fd, fileSize) == 0) {
+                lseek(fd, fileSize, SEEK_SET);
+            }
+        }
+        block.clear();
+    }
+
+    // Function to write the last block and the footer and close the segment
+    void finishSegment() {
+        writeBlock();
+        if (blockIndex.empty()) {
+            ::close(fd);
+            fd = -1;
+            unlink(path.c_str());
+            return;
+        }
+        std::vector<uint8_t> footer;
+        putLittleEndian(footer, probeNames.size(), 2);
+        for (const std::string& name : probeNames) {
+            putLittleEndian(footer, name.size(), 2);
+            footer.insert(footer.end(), name.begin(), name.end());
+        }
+        putLittleEndian(footer, blockIndex.size(), 4);
+        uint64_t segmentRows = 0;
+        for (const NativeBlockInfo& info : blockIndex) {
+            putLittleEndian(footer, info.offset, 8);
+            putLittleEndian(footer, info.rows, 4);
+            for (int column = 0; column < NATIVE_COLUMNS; ++column) {
+                putLittleEndian(footer, info.min[column], 8);
+                putLittleEndian(footer, info.max[column], 8);
+            }
+            segmentRows += info.rows;
+        }
+        uint64_t footerSize = footer.size();
+        putLittleEndian(footer, footerSize, 4);
+        footer.insert(footer.end(), NATIVE_END_MAGIC, NATIVE_END_MAGIC + 8);
+        writeAll(footer.data(), footer.size());
+        ::close(fd);
+        fd = -1;
+        segments.fetch_add(1, std::memory_order_relaxed);
+        syslog(LOG_INFO, "Native segment closed: %s (%zu blocks, %llu rows)", path.c_str(), blockIndex.size(),
+               static_cast<unsigned long long>(segmentRows));
+    }
+
+    void run() {
+        while (true) {
+            std::deque<FlowBatch*> taken;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(1);
+                if (fd >= 0 && config.native_rotate_interval) {
+                    deadline = std::min(deadline, std::chrono::system_clock::from_time_t(periodEnd));
+                }
+                wakeWriter.wait_until(lock, deadline, [this] { return !queue.empty() || stopping; });
+                if (queue.empty() && stopping) {
+                    break;
+                }
+                taken.swap(queue);
+                queuedRows = 0;
+                wakeProducers.notify_all();
+            }
+
+            time_t now = time(nullptr);
+            if (fd >= 0 && now >= periodEnd) {
+                finishSegment(); // The next segment is created with its first rows
+            }
+            for (FlowBatch* batch : taken) {
+                if (fd < 0 && !openSegment(now)) {
+                    lostRows.fetch_add(batch->rows.size(), std::memory_order_relaxed);
+                } else {
+                    for (const FlowData& row : batch->rows) {
+                        block.push_back(row);
+                        if (block.size() >= static_cast<size_t>(config.native_block_rows)) {
+                            writeBlock();
+                        }
+                    }
+                }
+                delete batch;
+            }
+        }
+        if (fd >= 0) {
+            finishSegment();
+        }
+    }
+
+public:
+    // Statistics
+    std::atomic<uint64_t> segments;         // Finished segments
+    std::atomic<uint64_t> blocks;
+    std::atomic<uint64_t> rows;
+    std::atomic<uint64_t> bytes;            // Block bytes written
+    std::atomic<uint64_t> lostRows;         // No segment could be created or written
+    std::atomic<uint64_t> producerWaits;
+    std::atomic<size_t> queuePeakRows;
+
+    NativeSegmentWriter(const DatabaseConfig& config, const std::vector<std::string>& probeNames)
+        : config(config), probeNames(probeNames), queuedRows(0), stopping(false), started(false), connected(false), fd(-1),
+          periodEnd(0), fileSize(0), segments(0), blocks(0), rows(0), bytes(0), lostRows(0), producerWaits(0), queuePeakRows(0) {
+        block.reserve(config.native_block_rows);
+    }
+
+    ~NativeSegmentWriter() override {
+        stop();
+    }
+
+    // Function to create the first segment and start the writer thread (once; later calls return the first result)
+    bool start() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!started) {
+            started = true;
+            connected = openSegment(time(nullptr));
+            if (connected) {
+                thread = std::thread(&NativeSegmentWriter::run, this);
+            }
+        }
+        return connected;
+    }
+
+    // Function to write what is queued, finish the segment and stop; call after all producers have closed
+    void stop() {
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                wakeWriter.notify_one();
+            }
+            thread.join();
+        }
+    }
+
+    // Function to check that segments can be created in the directory of native_path
+    bool checkConnection() override {
+        time_t now = time(nullptr);
+        std::string name = periodFileName(config.native_path, config.native_rotate_interval,
+                                          now - (config.native_rotate_interval ? now % config.native_rotate_interval : 0));
+        size_t slash = name.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : name.substr(0, slash);
+        if (access(directory.c_str(), W_OK) != 0) {
+            std::cerr << "Cannot create native segments in: " << directory << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot create native segments in: %s: %s", directory.c_str(), strerror(errno));
+            return false;
+        }
+        std::cout << "Native segment directory is accessible: " << directory << std::endl;
+        syslog(LOG_INFO, "Native segment directory is accessible: %s", directory.c_str());
+        return true;
+    }
+
+    void submit(FlowBatch* batch) override {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!connected || stopping) {
+            lostRows.fetch_add(batch->rows.size(), std::memory_order_relaxed);
+            delete batch;
+            return;
+        }
+        if (queuedRows >= static_cast<size_t>(config.native_queue_rows)) {
+            producerWaits.fetch_add(1, std::memory_order_relaxed);
+            wakeProducers.wait(lock, [this] { return queuedRows < static_cast<size_t>(config.native_queue_rows) || stopping; });
+        }
+        queuedRows += batch->rows.size();
+        if (queuedRows > queuePeakRows.load(std::memory_order_relaxed)) {
+            queuePeakRows.store(queuedRows, std::memory_order_relaxed);
+        }
+        queue.push_back(batch);
+        wakeWriter.notify_one();
+    }
+
+    size_t queued() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queuedRows;
+    }
+};
+
+std::unique_ptr<NativeSegmentWriter> nativeWriter; // Created with the first native receiver handler
+
+// Native segment reader
+// The file is mapped read-only and blocks are decoded straight from the
+// mapping. Blocks are listed from the footer, or found by walking the block
+// headers if the segment was never finished (min/max are then unknown:
+// 0 and the maximum value).
+class NativeSegmentReader {
+private:
+    const uint8_t* data;
+    size_t size;
+    bool footer;
+    std::vector<NativeBlockInfo> blockList;
+    std::vector<std::string> probeNames;
+
+    // Function to read the footer; false if there is none or it is damaged
+    bool readFooter() {
+        if (size < 8 + 12 || std::memcmp(data + size - 8, NATIVE_END_MAGIC, 8) != 0) {
+            return false;
+        }
+        uint64_t footerSize = getLittleEndian(data + size - 12, 4);
+        if (footerSize > size - 8 - 12) {
+            return false;
+        }
+        const uint8_t* p = data + size - 12 - footerSize;
+        const uint8_t* end = data + size - 12;
+        uint64_t blocksEnd = p - data;
+        if (end - p < 2) {
+            return false;
+        }
+        size_t probeCount = getLittleEndian(p, 2);
+        p += 2;
+        for (size_t i = 0; i < probeCount; ++i) {
+            if (end - p < 2) {
+                return false;
+            }
+            size_t nameSize = getLittleEndian(p, 2);
+            p += 2;
+            if (static_cast<size_t>(end - p) < nameSize) {
+                return false;
+            }
+            probeNames.emplace_back(reinterpret_cast<const char*>(p), nameSize);
+            p += nameSize;
+        }
+        if (end - p < 4) {
+            return false;
+        }
+        size_t blockCount = getLittleEndian(p, 4);
+        p += 4;
+        const size_t entrySize = 12 + NATIVE_COLUMNS * 16;
+        if (static_cast<size_t>(end - p) != blockCount * entrySize) {
+            return false;
+        }
+        for (size_t i = 0; i < blockCount; ++i) {
+            NativeBlockInfo info;
+            info.offset = getLittleEndian(p, 8);
+            info.rows = static_cast<uint32_t>(getLittleEndian(p + 8, 4));
+            p += 12;
+            for (int column = 0; column < NATIVE_COLUMNS; ++column) {
+                info.min[column] = getLittleEndian(p, 8);
+                info.max[column] = getLittleEndian(p + 8, 8);
+                p += 16;
+            }
+            if (info.offset < 8 || info.offset + NATIVE_BLOCK_HEADER > blocksEnd) {
+                return false;
+            }
+            blockList.push_back(info);
+        }
+        return true;
+    }
+
+    // Function to list the blocks of a segment without a footer, up to the first incomplete one
+    void scanBlocks() {
+        probeNames.clear();
+        blockList.clear();
+        uint64_t offset = 8;
+        while (size - offset >= NATIVE_BLOCK_HEADER && std::memcmp(data + offset, NATIVE_BLOCK_MAGIC, 8) == 0) {
+            NativeBlockInfo info;
+            info.offset = offset;
+            info.rows = static_cast<uint32_t>(getLittleEndian(data + offset + 8, 4));
+            uint64_t blockSize = NATIVE_BLOCK_HEADER;
+            for (int column = 0; column < NATIVE_COLUMNS; ++column) {
+                blockSize += getLittleEndian(data + offset + 12 + column * 5 + 1, 4);
+                info.max[column] = std::numeric_limits<uint64_t>::max();
+            }
+            if (blockSize > size - offset) {
+                break;
+            }
+            blockList.push_back(info);
+            offset += blockSize;
+        }
+    }
+
+    template <typename Set>
+    static bool decodeNumbers(uint8_t encoding, const uint8_t* p, const uint8_t* end, std::vector<FlowData>& rows, Set set) {
+        uint64_t value;
+        if (encoding == NATIVE_DELTA) {
+            uint64_t previous = 0;
+            for (FlowData& row : rows) {
+                if (!(p = readVarint(p, end, value))) {
+                    return false;
+                }
+                previous += (value >> 1) ^ (0 - (value & 1));
+                set(row, previous);
+            }
+        } else if (encoding == NATIVE_VARINT) {
+            for (FlowData& row : rows) {
+                if (!(p = readVarint(p, end, value))) {
+                    return false;
+                }
+                set(row, value);
+            }
+        } else if (encoding == NATIVE_DICTIONARY) {
+            uint64_t count;
+            if (!(p = readVarint(p, end, count)) || count > 65536) {
+                return false;
+            }
+            std::vector<uint64_t> dictionary(count);
+            for (uint64_t i = 0; i < count; ++i) {
+                if (!(p = readVarint(p, end, dictionary[i]))) {
+                    return false;
+                }
+            }
+            size_t width = count <= 256 ? 1 : 2;
+            if (static_cast<size_t>(end - p) != rows.size() * width) {
+                return false;
+            }
+            for (FlowData& row : rows) {
+                size_t index = width == 1 ? p[0] : p[0] | p[1] << 8;
+                p += width;
+                if (index >= count) {
+                    return false;
+                }
+                set(row, dictionary[index]);
+            }
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    static bool decodeAddresses(uint8_t encoding, const uint8_t* p, const uint8_t* end, std::vector<FlowData>& rows,
+                                FlowAddress FlowData::*member) {
+        if (encoding != NATIVE_ADDRESS) {
+            return false;
+        }
+        for (FlowData& row : rows) {
+            FlowAddress& address = row.*member;
+            size_t length = address.version == 4 ? 4 : address.version == 6 ? 16 : 0;
+            if (static_cast<size_t>(end - p) < length) {
+                return false;
+            }
+            if (address.version == 4) {
+                setIPv4(address, p);
+            } else if (address.version == 6) {
+                setIPv6(address, p);
+            }
+            p += length;
+        }
+        return p == end;
+    }
+
+public:
+    NativeSegmentReader() : data(nullptr), size(0), footer(false) {}
+
+    ~NativeSegmentReader() {
+        close();
+    }
+
+    // Function to map a segment and list its blocks
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << "Cannot open native segment: " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < 8) {
+            std::cerr << "Not a native segment: " << path << std::endl;
+            ::close(fd);
+            return false;
+        }
+        void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            std::cerr << "Cannot map native segment: " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        data = static_cast<const uint8_t*>(mapping);
+        size = st.st_size;
+        if (std::memcmp(data, NATIVE_SEGMENT_MAGIC, 8) != 0) {
+            std::cerr << "Not a native segment: " << path << std::endl;
+            close();
+            return false;
+        }
+        footer = readFooter();
+        if (!footer) {
+            scanBlocks();
+        }
+        return true;
+    }
+
+    void close() {
+        if (data) {
+            munmap(const_cast<uint8_t*>(data), size);
+            data = nullptr;
+        }
+        size = 0;
+        footer = false;
+        blockList.clear();
+        probeNames.clear();
+    }
+
+    bool hasFooter() const {
+        return footer;
+    }
+
+    const std::vector<NativeBlockInfo>& blocks() const {
+        return blockList;
+    }
+
+    // Probe names by ProbeID (empty without a footer)
+    const std::vector<std::string>& probes() const {
+        return probeNames;
+    }
+
+    // Function to decode a block into 'rows'; false if it is damaged
+    bool readBlock(size_t index, std::vector<FlowData>& rows) const {
+        const NativeBlockInfo& info = blockList[index];
+        const uint8_t* p = data + info.offset;
+        if (size - info.offset < NATIVE_BLOCK_HEADER || std::memcmp(p, NATIVE_BLOCK_MAGIC, 8) != 0 ||
+            getLittleEndian(p + 8, 4) != info.rows) {
+            return false;
+        }
+        uint8_t encodings[NATIVE_COLUMNS];
+        const uint8_t* starts[NATIVE_COLUMNS + 1];
+        starts[0] = p + NATIVE_BLOCK_HEADER;
+        for (int column = 0; column < NATIVE_COLUMNS; ++column) {
+            encodings[column] = p[12 + column * 5];
+            uint64_t columnSize = getLittleEndian(p + 12 + column * 5 + 1, 4);
+            if (columnSize > static_cast<size_t>(data + size - starts[column])) {
+                return false;
+            }
+            starts[column + 1] = starts[column] + columnSize;
+        }
+
+        rows.assign(info.rows, FlowData());
+        auto decode = [&](int column, void (*set)(FlowData&, uint64_t)) {
+            return decodeNumbers(encodings[column], starts[column], starts[column + 1], rows, set);
+        };
+        return decode(NATIVE_FLOW_START, [](FlowData& f, uint64_t v) { f.FlowStart = v; }) &&
+               decode(NATIVE_FLOW_END, [](FlowData& f, uint64_t v) { f.FlowEnd = v; }) &&
+               decode(NATIVE_VERSIONS, [](FlowData& f, uint64_t v) {
+                   f.SourceIP.version = static_cast<uint8_t>(v >> 4);
+                   f.DestinationIP.version = static_cast<uint8_t>(v & 0x0F);
+               }) &&
+               decodeAddresses(encodings[NATIVE_SOURCE_IP], starts[NATIVE_SOURCE_IP], starts[NATIVE_SOURCE_IP + 1], rows,
+                               &FlowData::SourceIP) &&
+               decodeAddresses(encodings[NATIVE_DESTINATION_IP], starts[NATIVE_DESTINATION_IP], starts[NATIVE_DESTINATION_IP + 1],
+                               rows, &FlowData::DestinationIP) &&
+               decode(NATIVE_SOURCE_PORT, [](FlowData& f, uint64_t v) { f.SourcePort = static_cast<uint16_t>(v); }) &&
+               decode(NATIVE_DESTINATION_PORT, [](FlowData& f, uint64_t v) { f.DestinationPort = static_cast<uint16_t>(v); }) &&
+               decode(NATIVE_PROTOCOL, [](FlowData& f, uint64_t v) { f.Protocol = static_cast<uint8_t>(v); }) &&
+               decode(NATIVE_PACKET_COUNT, [](FlowData& f, uint64_t v) { f.PacketCount = v; }) &&
+               decode(NATIVE_BYTE_COUNT, [](FlowData& f, uint64_t v) { f.ByteCount = v; }) &&
+               decode(NATIVE_PROBE_ID, [](FlowData& f, uint64_t v) { f.ProbeID = static_cast<uint16_t>(v); });
+    }
+};
+
+// Function to print a native segment as CSV rows (--dump=PATH)
+bool dumpNativeSegment(const std::string& path) {
+    NativeSegmentReader reader;
+    if (!reader.open(path)) {
+        return false;
+    }
+    if (!reader.hasFooter()) {
+        std::cerr << "Native segment has no footer (not finished), reading " << reader.blocks().size() << " blocks" << std::endl;
+    }
+    std::string out = "SourceIP,DestinationIP,SourcePort,DestinationPort,Protocol,PacketCount,ByteCount,FlowStart,FlowEnd,SourceSond\n";
+    std::vector<FlowData> rows;
+    TimestampWriter timestampWriter;
+    char line[2 * INET6_ADDRSTRLEN + 5 * 20 + 2 * 32 + 16];
+    for (size_t i = 0; i < reader.blocks().size(); ++i) {
+        if (!reader.readBlock(i, rows)) {
+            std::cerr << "Damaged block " << i << " in native segment: " << path << std::endl;
+            return false;
+        }
+        for (const FlowData& row : rows) {
+            char* p = writeAddress(line, row.SourceIP);
+            *p++ = ',';
+            p = writeAddress(p, row.DestinationIP);
+            *p++ = ',';
+            p = writeDecimal(p, row.SourcePort);
+            *p++ = ',';
+            p = writeDecimal(p, row.DestinationPort);
+            *p++ = ',';
+            p = writeDecimal(p, row.Protocol);
+            *p++ = ',';
+            p = writeDecimal(p, row.PacketCount);
+            *p++ = ',';
+            p = writeDecimal(p, row.ByteCount);
+            *p++ = ',';
+            p = timestampWriter.write(p, row.FlowStart);
+            *p++ = ',';
+            p = timestampWriter.write(p, row.FlowEnd);
+            *p++ = ',';
+            out.append(line, p - line);
+            if (row.ProbeID < reader.probes().size()) {
+                out += reader.probes()[row.ProbeID];
+            } else {
+                appendDecimal(out, row.ProbeID);
+            }
+            out += '\n';
+        }
+        std::cout.write(out.data(), out.size());
+        out.clear();
+    }
+    std::cout.write(out.data(), out.size());
+    std::cout.flush();
+    return static_cast<bool>(std::cout);
+}
+
+// Minimal FlatBuffers builder for the Arrow IPC metadata
+// Like the official builder it fills the buffer from the back, so objects
+// are created before the tables that refer to them and every offset points
+// forward. Positions are counted from the end of the buffer.
+class FlatBufferBuilder {
+private:
+    std::vector<uint8_t> buffer;    // The content is the last 'used' bytes
+    size_t used;
+    size_t minAlign;
+    size_t tableStart;
+    std::vector<std::pair<uint16_t, uint32_t>> tableFields;
+
+    void pushBytes(const void* data, size_t length) {
+        if (buffer.size() - used < length) {
+            std::vector<uint8_t> bigger(std::max(buffer.size() * 2, used + length + 256));
+            memcpy(bigger.data() + bigger.size() - used, buffer.data() + buffer.size() - used, used);
+            buffer.swap(bigger);
+        }
+        used += length;
+        memcpy(buffer.data() + buffer.size() - used, data, length);
+    }
+
+    // Pad so that the size is a multiple of 'alignment' after 'following' more bytes
+    void align(size_t alignment, size_t following = 0) {
+        static const uint8_t zeros[8] = {};
+        minAlign = std::max(minAlign, alignment);
+        pushBytes(zeros, (alignment - (used + following) % alignment) % alignment);
+    }
+
+    void pushOffset(uint32_t target) {
+        align(4);
+        uint32_t offset = static_cast<uint32_t>(used + 4 - target);
+        pushBytes(&offset, 4);
+    }
+
+public:
+    FlatBufferBuilder() : buffer(1024), used(0), minAlign(1), tableStart(0) {}
+
+    uint32_t createString(const std::string& text) {
+        align(4, text.size() + 1);
+        pushBytes("", 1);
+        pushBytes(text.data(), text.size());
+        uint32_t length = static_cast<uint32_t>(text.size());
+        pushBytes(&length, 4);
+        return static_cast<uint32_t>(used);
+    }
+
+    uint32_t createOffsetVector(const std::vector<uint32_t>& targets) {
+        align(4, targets.size() * 4);
+        for (size_t i = targets.size(); i-- > 0;) {
+            pushOffset(targets[i]);
+        }
+        uint32_t count = static_cast<uint32_t>(targets.size());
+        pushBytes(&count, 4);
+        return static_cast<uint32_t>(used);
+    }
+
+    // Vector of structs of 'size' bytes, aligned to 8
+    uint32_t createStructVector(const void* data, size_t count, size_t size) {
+        align(8, count * size);
+        pushBytes(data, count * size);
+        uint32_t length = static_cast<uint32_t>(count);
+        pushBytes(&length, 4);
+        return static_cast<uint32_t>(used);
+    }
+
+    void startTable() {
+        tableFields.clear();
+        tableStart = used;
+    }
+
+    template <typename T>
+    void addScalar(uint16_t field, T value) {
+        align(sizeof(T));
+        pushBytes(&value, sizeof(T));
+        tableFields.emplace_back(field, static_cast<uint32_t>(used));
+    }
+
+    void addOffset(uint16_t field, uint32_t target) {
+        pushOffset(target);
+        tableFields.emplace_back(field, static_cast<uint32_t>(used));
+    }
+
+    // Function to write the table's vtable in front of it; returns the table
+    uint32_t endTable() {
+        align(4);
+        int32_t vtableOffset = 0;
+        pushBytes(&vtableOffset, 4);
+        uint32_t table = static_cast<uint32_t>(used);
+        size_t fieldCount = 0;
+        for (const auto& field : tableFields) {
+            fieldCount = std::max<size_t>(fieldCount, field.first + 1);
+        }
+        std::vector<uint16_t> vtable(2 + fieldCount, 0);
+        vtable[0] = static_cast<uint16_t>(vtable.size() * 2);
+        vtable[1] = static_cast<uint16_t>(table - tableStart);
+        for (const auto& field : tableFields) {
+            vtable[2 + field.first] = static_cast<uint16_t>(table - field.second);
+        }
+        pushBytes(vtable.data(), vtable.size() * 2);
+        vtableOffset = static_cast<int32_t>(used - table);
+        memcpy(buffer.data() + buffer.size() - table, &vtableOffset, 4);
+        return table;
+    }
+
+    // Function to finish the buffer with its root table; the result is padded to a multiple of 8 bytes
+    void finish(uint32_t root, std::vector<uint8_t>& out) {
+        align(std::max<size_t>(minAlign, 8), 4);
+        pushOffset(root);
+        out.assign(buffer.end() - used, buffer.end());
+        used = 0;
+        minAlign = 1;
+    }
+};
+
+// Arrow IPC output (type = arrow)
+// Flows are written as Arrow record batches of arrow_batch_rows rows, in the
+// IPC file format (Feather v2: pyarrow.feather.read_table(),
+// pyarrow.ipc.open_file()) or the IPC stream format (pyarrow.ipc.open_stream()).
+// Files rotate every arrow_rotate_interval seconds and are named by
+// strftime(arrow_path) like rotated CSV files. Columns are filled straight
+// from FlowData, nothing is formatted as text:
+//   SourceIP, DestinationIP       fixed_size_binary(16), IPv4 as IPv4-mapped IPv6, null without an address
+//   SourcePort, DestinationPort   uint16
+//   Protocol                      uint8
+//   PacketCount, ByteCount        uint64
+//   FlowStart, FlowEnd            timestamp[ns, tz=UTC], null if not exported
+//   SourceSond                    dictionary<int16, utf8> of the probe names
+// A file of the file format is only readable once it is finished; one of
+// the stream format can be read up to its last complete batch at any time.
+class ArrowFileWriter : public FlowBatchSink {
+private:
+    enum Column {
+        SOURCE_IP, DESTINATION_IP, SOURCE_PORT, DESTINATION_PORT, PROTOCOL,
+        PACKET_COUNT, BYTE_COUNT, FLOW_START, FLOW_END, SOURCE_SOND, COLUMNS
+    };
+
+    // Arrow IPC flatbuffer enums and structs
+    static const int16_t METADATA_V5 = 4;
+    static const uint8_t HEADER_SCHEMA = 1;
+    static const uint8_t HEADER_DICTIONARY_BATCH = 2;
+    static const uint8_t HEADER_RECORD_BATCH = 3;
+    static const uint8_t TYPE_INT = 2;
+    static const uint8_t TYPE_UTF8 = 5;
+    static const uint8_t TYPE_TIMESTAMP = 10;
+    static const uint8_t TYPE_FIXED_SIZE_BINARY = 15;
+
+    struct FieldNode {
+        int64_t length;
+        int64_t nullCount;
+    };
+
+    struct Buffer {
+        int64_t offset;
+        int64_t length;
+    };
+
+    struct Block {
+        int64_t offset;
+        int32_t metaDataLength;
+        int32_t padding;
+        int64_t bodyLength;
+    };
+
+    // One column of the batch being filled
+    struct ColumnData {
+        size_t width;                   // Bytes per value
+        bool nullable;
+        std::vector<uint8_t> validity;  // Bitmap, bit set = valid
+        std::vector<uint8_t> values;
+        int64_t nulls;
+    };
+
+    DatabaseConfig config;
+    std::vector<std::string> probeNames;
+    bool fileFormat;
+    std::deque<FlowBatch*> queue;
+    size_t queuedRows;
+    std::mutex mutex;
+    std::condition_variable wakeWriter;
+    std::condition_variable wakeProducers;
+    bool stopping;
+    std::thread thread;
+    bool started;
+    bool connected;
+
+    // Current file and batch, used by the writer thread only
+    int fd;
+    std::string path;
+    time_t periodEnd;
+    uint64_t fileSize;
+    uint64_t fileRows;
+    std::vector<Block> dictionaryBlocks;
+    std::vector<Block> batchBlocks;
+    ColumnData columns[COLUMNS];
+    size_t batchRows;
+    FlatBufferBuilder builder;
+    std::vector<uint8_t> metadata;
+
+    bool writeAll(const void* data, size_t length) {
+        const char* p = static_cast<const char*>(data);
+        while (length) {
+            ssize_t n = ::write(fd, p, length);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Cannot write Arrow file: " << path << ": " << strerror(errno) << std::endl;
+                syslog(LOG_ERR, "Cannot write Arrow file: %s: %s", path.c_str(), strerror(errno));
+                return false;
+            }
+            p += n;
+            length -= n;
+        }
+        return true;
+    }
+
+    uint32_t buildInt(int bitWidth, bool isSigned) {
+        builder.startTable();
+        builder.addScalar<int32_t>(0, bitWidth);
+        builder.addScalar<uint8_t>(1, isSigned);
+        return builder.endTable();
+    }
+
+    uint32_t buildField(const std::string& name, bool nullable, uint8_t typeType, uint32_t type, uint32_t dictionary = 0) {
+        uint32_t nameOffset = builder.createString(name);
+        uint32_t children = builder.createOffsetVector({});
+        builder.startTable();
+        builder.addOffset(0, nameOffset);
+        builder.addScalar<uint8_t>(1, nullable);
+        builder.addScalar<uint8_t>(2, typeType);
+        builder.addOffset(3, type);
+        if (dictionary) {
+            builder.addOffset(4, dictionary);
+        }
+        builder.addOffset(5, children);
+        return builder.endTable();
+    }
+
+    uint32_t buildSchema() {
+        std::vector<uint32_t> fields;
+        auto address = [this](const char* name) {
+            builder.startTable();
+            builder.addScalar<int32_t>(0, 16);
+            return buildField(name, true, TYPE_FIXED_SIZE_BINARY, builder.endTable());
+        };
+        auto timestamp = [this](const char* name) {
+            uint32_t timezone = builder.createString("UTC");
+            builder.startTable();
+            builder.addScalar<int16_t>(0, 3); // NANOSECOND
+            builder.addOffset(1, timezone);
+            return buildField(name, true, TYPE_TIMESTAMP, builder.endTable());
+        };
+        fields.push_back(address("SourceIP"));
+        fields.push_back(address("DestinationIP"));
+        fields.push_back(buildField("SourcePort", false, TYPE_INT, buildInt(16, false)));
+        fields.push_back(buildField("DestinationPort", false, TYPE_INT, buildInt(16, false)));
+        fields.push_back(buildField("Protocol", false, TYPE_INT, buildInt(8, false)));
+        fields.push_back(buildField("PacketCount", false, TYPE_INT, buildInt(64, false)));
+        fields.push_back(buildField("ByteCount", false, TYPE_INT, buildInt(64, false)));
+        fields.push_back(timestamp("FlowStart"));
+        fields.push_back(timestamp("FlowEnd"));
+        uint32_t indexType = buildInt(16, true);
+        builder.startTable();
+        builder.addScalar<int64_t>(0, 0); // Dictionary id
+        builder.addOffset(1, indexType);
+        uint32_t dictionary = builder.endTable();
+        builder.startTable();
+        uint32_t utf8 = builder.endTable();
+        fields.push_back(buildField("SourceSond", false, TYPE_UTF8, utf8, dictionary));
+
+        uint32_t fieldVector = builder.createOffsetVector(fields);
+        builder.startTable();
+        builder.addScalar<int16_t>(0, 0); // Little endian
+        builder.addOffset(1, fieldVector);
+        return builder.endTable();
+    }
+
+    uint32_t buildRecordBatch(int64_t length, const std::vector<FieldNode>& nodes, const std::vector<Buffer>& buffers) {
+        uint32_t nodeVector = builder.createStructVector(nodes.data(), nodes.size(), sizeof(FieldNode));
+        uint32_t bufferVector = builder.createStructVector(buffers.data(), buffers.size(), sizeof(Buffer));
+        builder.startTable();
+        builder.addScalar<int64_t>(0, length);
+        builder.addOffset(1, nodeVector);
+        builder.addOffset(2, bufferVector);
+        return builder.endTable();
+    }
+
+    void finishMessage(uint8_t headerType, uint32_t header, int64_t bodyLength) {
+        builder.startTable();
+        builder.addScalar<int16_t>(0, METADATA_V5);
+        builder.addScalar<uint8_t>(1, headerType);
+        builder.addOffset(2, header);
+        builder.addScalar<int64_t>(3, bodyLength);
+        builder.finish(builder.endTable(), metadata);
+    }
+
+    // Function to write an encapsulated message: continuation marker, metadata size, metadata, body
+    bool writeMessage(const std::vector<std::pair<const void*, size_t>>& body, int64_t bodyLength, std::vector<Block>* blocks) {
+        static const uint8_t zeros[8] = {};
+        Block block = { static_cast<int64_t>(fileSize), static_cast<int32_t>(8 + metadata.size()), 0, bodyLength };
+        int32_t prefix[2] = { -1, static_cast<int32_t>(metadata.size()) };
+        if (!writeAll(prefix, sizeof(prefix)) || !writeAll(metadata.data(), metadata.size())) {
+            return false;
+        }
+        for (const auto& part : body) {
+            if (!writeAll(part.first, part.second) || !writeAll(zeros, (8 - part.second % 8) % 8)) {
+                return false;
+            }
+        }
+        fileSize += 8 + metadata.size() + bodyLength;
+        if (blocks) {
+            blocks->push_back(block);
+        }
+        return true;
+    }
+
+    // Function to describe a buffer of the body; bodies are padded to multiples of 8 bytes
+    static void addBuffer(std::vector<Buffer>& buffers, std::vector<std::pair<const void*, size_t>>& body, int64_t& bodyLength,
+                          const void* data, size_t length) {
+        buffers.push_back({ bodyLength, static_cast<int64_t>(length) });
+        if (length) {
+            body.emplace_back(data, length);
+            bodyLength += (length + 7) & ~size_t(7);
+        }
+    }
+
+    bool writeDictionary() {
+        std::vector<int32_t> offsets(1, 0);
+        std::string text;
+        for (const std::string& name : probeNames) {
+            text += name;
+            offsets.push_back(static_cast<int32_t>(text.size()));
+        }
+        std::vector<FieldNode> nodes = { { static_cast<int64_t>(probeNames.size()), 0 } };
+        std::vector<Buffer> buffers;
+        std::vector<std::pair<const void*, size_t>> body;
+        int64_t bodyLength = 0;
+        addBuffer(buffers, body, bodyLength, nullptr, 0);
+        addBuffer(buffers, body, bodyLength, offsets.data(), offsets.size() * 4);
+        addBuffer(buffers, body, bodyLength, text.data(), text.size());
+        uint32_t data = buildRecordBatch(probeNames.size(), nodes, buffers);
+        builder.startTable();
+        builder.addScalar<int64_t>(0, 0); // Dictionary id
+        builder.addOffset(1, data);
+        uint32_t dictionaryBatch = builder.endTable();
+        finishMessage(HEADER_DICTIONARY_BATCH, dictionaryBatch, bodyLength);
+        return writeMessage(body, bodyLength, &dictionaryBlocks);
+    }
+
+    // Function to create the file of the period containing 'now' and write the schema and dictionary
+    bool openFile(time_t now) {
+        time_t periodStart = now;
+        periodEnd = std::numeric_limits<time_t>::max();
+        if (config.arrow_rotate_interval) {
+            periodStart = now - now % config.arrow_rotate_interval;
+            periodEnd = periodStart + config.arrow_rotate_interval;
+        }
+        fd = createNewFile(periodFileName(config.arrow_path, config.arrow_rotate_interval, periodStart), path);
+        if (fd < 0) {
+            std::cerr << "Cannot create Arrow file: " << path << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot create Arrow file: %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        fileSize = 0;
+        fileRows = 0;
+        dictionaryBlocks.clear();
+        batchBlocks.clear();
+        bool ok = true;
+        if (fileFormat) {
+            ok = writeAll("ARROW1\0\0", 8);
+            fileSize = 8;
+        }
+        finishMessage(HEADER_SCHEMA, buildSchema(), 0);
+        ok = ok && writeMessage({}, 0, nullptr) && writeDictionary();
+        if (!ok) {
+            ::close(fd);
+            fd = -1;
+            unlink(path.c_str());
+            return false;
+        }
+        std::cout << "Arrow file opened: " << path << std::endl;
+        syslog(LOG_INFO, "Arrow file opened: %s", path.c_str());
+        return true;
+    }
+
+    void startBatch() {
+        batchRows = 0;
+        for (ColumnData& column : columns) {
+            column.nulls = 0;
+            if (column.nullable) {
+                std::fill(column.validity.begin(), column.validity.end(), 0);
+            }
+        }
+    }
+
+    // Function to write the rows collected in the columns as one record batch
+    void writeBatch() {
+        if (!batchRows) {
+            return;
+        }
+        std::vector<FieldNode> nodes;
+        std::vector<Buffer> buffers;
+        std::vector<std::pair<const void*, size_t>> body;
+        int64_t bodyLength = 0;
+        for (const ColumnData& column : columns) {
+            nodes.push_back({ static_cast<int64_t>(batchRows), column.nulls });
+            addBuffer(buffers, body, bodyLength, column.validity.data(), column.nulls ? (batchRows + 7) / 8 : 0);
+            addBuffer(buffers, body, bodyLength, column.values.data(), batchRows * column.width);
+        }
+        finishMessage(HEADER_RECORD_BATCH, buildRecordBatch(batchRows, nodes, buffers), bodyLength);
+        if (writeMessage(body, bodyLength, &batchBlocks)) {
+            batches.fetch_add(1, std::memory_order_relaxed);
+            rows.fetch_add(batchRows, std::memory_order_relaxed);
+            bytes.fetch_add(8 + metadata.size() + bodyLength, std::memory_order_relaxed);
+            fileRows += batchRows;
+        } else {
+            lostRows.fetch_add(batchRows, std::memory_order_relaxed);
+            // Cut off a partly written batch, so the file stays readable
+            if (ftruncate(fd, fileSize) == 0) {
+                lseek(fd, fileSize, SEEK_SET);
+            }
+        }
+        startBatch();
+    }
+
+    static void setValue(ColumnData& column, size_t row, const void* value) {
+        memcpy(column.values.data() + row * column.width, value, column.width);
+    }
+
+    static void setNullable(ColumnData& column, size_t row, const void* value, bool valid) {
+        memcpy(column.values.data() + row * column.width, value, column.width);
+        if (valid) {
+            column.validity[row >> 3] |= static_cast<uint8_t>(1 << (row & 7));
+        } else {
+            column.nulls++;
+        }
+    }
+
+    void addRow(const FlowData& flow) {
+        size_t row = batchRows++;
+        int16_t probe = static_cast<int16_t>(flow.ProbeID < probeNames.size() ? flow.ProbeID : 0);
+        setNullable(columns[SOURCE_IP], row, flow.SourceIP.bytes, flow.SourceIP.version != 0);
+        setNullable(columns[DESTINATION_IP], row, flow.DestinationIP.bytes, flow.DestinationIP.version != 0);
+        setValue(columns[SOURCE_PORT], row, &flow.SourcePort);
+        setValue(columns[DESTINATION_PORT], row, &flow.DestinationPort);
+        setValue(columns[PROTOCOL], row, &flow.Protocol);
+        setValue(columns[PACKET_COUNT], row, &flow.PacketCount);
+        setValue(columns[BYTE_COUNT], row, &flow.ByteCount);
+        setNullable(columns[FLOW_START], row, &flow.FlowStart, flow.FlowStart != 0);
+        setNullable(columns[FLOW_END], row, &flow.FlowEnd, flow.FlowEnd != 0);
+        setValue(columns[SOURCE_SOND], row, &probe);
+        if (batchRows == static_cast<size_t>(config.arrow_batch_rows)) {
+            writeBatch();
+        }
+    }
+
+    // Function to write the last batch and the end of the file
+    void finishFile() {
+        writeBatch();
+        if (!fileRows) {
+            ::close(fd);
+            fd = -1;
+            unlink(path.c_str());
+            return;
+        }
+        int32_t endOfStream[2] = { -1, 0 };
+        writeAll(endOfStream, sizeof(endOfStream));
+        if (fileFormat) {
+            uint32_t schema = buildSchema();
+            uint32_t dictionaries = builder.createStructVector(dictionaryBlocks.data(), dictionaryBlocks.size(), sizeof(Block));
+            uint32_t recordBatches = builder.createStructVector(batchBlocks.data(), batchBlocks.size(), sizeof(Block));
+            builder.startTable();
+            builder.addScalar<int16_t>(0, METADATA_V5);
+            builder.addOffset(1, schema);
+            builder.addOffset(2, dictionaries);
+            builder.addOffset(3, recordBatches);
+            builder.finish(builder.endTable(), metadata);
+            int32_t footerSize = static_cast<int32_t>(metadata.size());
+            writeAll(metadata.data(), metadata.size());
+            writeAll(&footerSize, 4);
+            writeAll("ARROW1", 6);
+        }
+        ::close(fd);
+        fd = -1;
+        files.fetch_add(1, std::memory_order_relaxed);
+        syslog(LOG_INFO, "Arrow file closed: %s (%zu batches, %llu rows)", path.c_str(), batchBlocks.size(),
+               static_cast<unsigned long long>(fileRows));
+    }
+
+    void run() {
+        while (true) {
+            std::deque<FlowBatch*> taken;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(1);
+                if (fd >= 0 && config.arrow_rotate_interval) {
+                    deadline = std::min(deadline, std::chrono::system_clock::from_time_t(periodEnd));
+                }
+                wakeWriter.wait_until(lock, deadline, [this] { return !queue.empty() || stopping; });
+                if (queue.empty() && stopping) {
+                    break;
+                }
+                taken.swap(queue);
+                queuedRows = 0;
+                wakeProducers.notify_all();
+            }
+
+            time_t now = time(nullptr);
+            if (fd >= 0 && now >= periodEnd) {
+                finishFile(); // The next file is created with its first rows
+            }
+            for (FlowBatch* batch : taken) {
+                if (fd < 0 && !openFile(now)) {
+                    lostRows.fetch_add(batch->rows.size(), std::memory_order_relaxed);
+                } else {
+                    for (const FlowData& row : batch->rows) {
+                        addRow(row);
+                    }
+                }
+                delete batch;
+            }
+        }
+        if (fd >= 0) {
+            finishFile();
+        }
+    }
+
+public:
+    // Statistics
+    std::atomic<uint64_t> files;            // Finished files
+    std::atomic<uint64_t> batches;
+    std::atomic<uint64_t> rows;
+    std::atomic<uint64_t> bytes;            // Record batch messages written
+    std::atomic<uint64_t> lostRows;         // No file could be created or written
+    std::atomic<uint64_t> producerWaits;
+    std::atomic<size_t> queuePeakRows;
+
+    ArrowFileWriter(const DatabaseConfig& config, const std::vector<std::string>& probeNames)
+        : config(config), probeNames(probeNames), fileFormat(config.arrow_format == "file"), queuedRows(0), stopping(false),
+          started(false), connected(false), fd(-1), periodEnd(0), fileSize(0), fileRows(0), batchRows(0), files(0), batches(0),
+          rows(0), bytes(0), lostRows(0), producerWaits(0), queuePeakRows(0) {
+        if (this->probeNames.empty()) {
+            this->probeNames.push_back("");
+        }
+        static const size_t widths[COLUMNS] = { 16, 16, 2, 2, 1, 8, 8, 8, 8, 2 };
+        for (int i = 0; i < COLUMNS; ++i) {
+            columns[i].width = widths[i];
+            columns[i].nullable = i == SOURCE_IP || i == DESTINATION_IP || i == FLOW_START || i == FLOW_END;
+            columns[i].values.resize(config.arrow_batch_rows * widths[i]);
+            if (columns[i].nullable) {
+                columns[i].validity.resize((config.arrow_batch_rows + 7) / 8);
+            }
+        }
+        startBatch();
+    }
+
+    ~ArrowFileWriter() override {
+        stop();
+    }
+
+    // Function to create the first file and start the writer thread (once; later calls return the first result)
+    bool start() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!started) {
+            started = true;
+            connected = openFile(time(nullptr));
+            if (connected) {
+                thread = std::thread(&ArrowFileWriter::run, this);
+            }
+        }
+        return connected;
+    }
+
+    // Function to write what is queued, finish the file and stop; call after all producers have closed
+    void stop() {
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                wakeWriter.notify_one();
+            }
+            thread.join();
+        }
+    }
+
+    // Function to check that files can be created in the directory of arrow_path
+    bool checkConnection() override {
+        time_t now = time(nullptr);
+        std::string name = periodFileName(config.arrow_path, config.arrow_rotate_interval,
+                                          now - (config.arrow_rotate_interval ? now % config.arrow_rotate_interval : 0));
+        size_t slash = name.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : name.substr(0, slash);
+        if (access(directory.c_str(), W_OK) != 0) {
+            std::cerr << "Cannot create Arrow files in: " << directory << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot create Arrow files in: %s: %s", directory.c_str(), strerror(errno));
+            return false;
+        }
+        std::cout << "Arrow file directory is accessible: " << directory << std::endl;
+        syslog(LOG_INFO, "Arrow file directory is accessible: %s", directory.c_str());
+        return true;
+    }
+
+    void submit(FlowBatch* batch) override {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!connected || stopping) {
+            lostRows.fetch_add(batch->rows.size(), std::memory_order_relaxed);
+            delete batch;
+            return;
+        }
+        if (queuedRows >= static_cast<size_t>(config.arrow_queue_rows)) {
+            producerWaits.fetch_add(1, std::memory_order_relaxed);
+            wakeProducers.wait(lock, [this] { return queuedRows < static_cast<size_t>(config.arrow_queue_rows) || stopping; });
+        }
+        queuedRows += batch->rows.size();
+        if (queuedRows > queuePeakRows.load(std::memory_order_relaxed)) {
+            queuePeakRows.store(queuedRows, std::memory_order_relaxed);
+        }
+        queue.push_back(batch);
+        wakeWriter.notify_one();
+    }
+
+    size_t queued() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queuedRows;
+    }
+};
+
+std::unique_ptr<ArrowFileWriter> arrowWriter; // Created with the first Arrow receiver handler
+
+// Disk spool of a sink (sink_policy = spill)
+// Batches a sink cannot take are appended to memory-mapped segment files of
+// SPOOL_SEGMENT_SIZE bytes in <sink_spill_path>/<type>/, named by a
+// sequence number. A segment is a header and then records: a record header
+// with the row count and a CRC-32 of the rows, followed by the rows as
+// FlowData. Records are only appended, and the header keeps the offset of the
+// first record not yet replayed, so after a crash or restart the spool is
+// rebuilt by scanning each segment from that offset until a record is torn or
+// its checksum does not match. Replay takes the oldest record first; replayed
+// segments are deleted. Segments are allocated on disk when created, so a
+// full disk fails the append instead of faulting a page of the mapping. When
+// the spool would outgrow its budget, the oldest segment is dropped.
+#pragma pack(push, 1)
+struct SpoolSegmentHeader {
+    uint32_t magic;             // SPOOL_MAGIC
+    uint32_t version;           // SPOOL_VERSION
+    uint64_t sequence;
+    uint64_t consumed;          // Offset of the first record not yet replayed
+    uint64_t reserved;
+};
+
+struct SpoolRecordHeader {
+    uint32_t magic;             // SPOOL_RECORD_MAGIC, written after the rows
+    uint32_t rows;
+    uint32_t checksum;          // crc32() of the rows
+    uint32_t reserved;
+};
+#pragma pack(pop)
+
+const uint32_t SPOOL_MAGIC = 0x4C505346;        // "FSPL"
+const uint32_t SPOOL_RECORD_MAGIC = 0x43455246; // "FREC"
+const uint32_t SPOOL_VERSION = 1;
+const size_t SPOOL_SEGMENT_SIZE = 16 * 1024 * 1024;
+const size_t SPOOL_RECORD_ROWS = (SPOOL_SEGMENT_SIZE - sizeof(SpoolSegmentHeader) - sizeof(SpoolRecordHeader)) / sizeof(FlowData);
+
+class FlowSpool {
+private:
+    struct Segment {
+        uint64_t sequence;
+        std::string path;
+        int fd;
+        char* map;
+        size_t end;             // Offset after the last record
+        uint64_t rows;          // Rows not yet replayed
+        bool dirty;             // Changed since the last sync()
+
+        SpoolSegmentHeader* header() {
+            return reinterpret_cast<SpoolSegmentHeader*>(map);
+        }
+    };
+
+    std::string directory;
+    size_t maxSegments;
+    std::deque<Segment> segments;   // Oldest first; the last one takes the appends
+    uint64_t pending;               // Rows not yet replayed
+    uint64_t nextSequence;
+    uint64_t peekSequence;          // Record returned by peek()
+    size_t peekOffset;
+
+    static_assert(std::is_trivially_copyable<FlowData>::value, "Spool records hold FlowData as it is in memory");
+
+    std::string segmentPath(uint64_t sequence) const {
+        char name[32];
+        snprintf(name, sizeof(name), "%020llu.spool", static_cast<unsigned long long>(sequence));
+        return directory + "/" + name;
+    }
+
+    // Function to map a segment file; the file must have the segment size
+    bool mapSegment(Segment& segment) {
+        void* map = mmap(nullptr, SPOOL_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0);
+        if (map == MAP_FAILED) {
+            std::cerr << "Cannot map spool segment " << segment.path << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot map spool segment %s: %s", segment.path.c_str(), strerror(errno));
+            return false;
+        }
+        segment.map = static_cast<char*>(map);
+        return true;
+    }
+
+    void removeSegment(Segment& segment) {
+        munmap(segment.map, SPOOL_SEGMENT_SIZE);
+        ::close(segment.fd);
+        unlink(segment.path.c_str());
+    }
+
+    // Function to start a new segment, dropping the oldest one if the budget is used up
+    bool addSegment() {
+        if (segments.size() >= maxSegments) {
+            Segment& oldest = segments.front();
+            droppedRows.fetch_add(oldest.rows, std::memory_order_relaxed);
+            pending -= oldest.rows;
+            std::cerr << "Spool budget reached, dropping " << oldest.rows << " rows: " << oldest.path << std::endl;
+            syslog(LOG_ERR, "Spool budget reached, dropping %llu rows: %s", static_cast<unsigned long long>(oldest.rows), oldest.path.c_str());
+            removeSegment(oldest);
+            segments.pop_front();
+        }
+
+        Segment segment;
+        segment.sequence = nextSequence;
+        segment.path = segmentPath(segment.sequence);
+        segment.fd = ::open(segment.path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (segment.fd < 0) {
+            std::cerr << "Cannot create spool segment " << segment.path << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot create spool segment %s: %s", segment.path.c_str(), strerror(errno));
+            return false;
+        }
+        int error = posix_fallocate(segment.fd, 0, SPOOL_SEGMENT_SIZE);
+        if (error || !mapSegment(segment)) {
+            if (error) {
+                std::cerr << "Cannot allocate spool segment " << segment.path << ": " << strerror(error) << std::endl;
+                syslog(LOG_ERR, "Cannot allocate spool segment %s: %s", segment.path.c_str(), strerror(error));
+            }
+            ::close(segment.fd);
+            unlink(segment.path.c_str());
+            return false;
+        }
+        ++nextSequence;
+        SpoolSegmentHeader* header = segment.header();
+        memset(header, 0, sizeof(*header));
+        header->magic = SPOOL_MAGIC;
+        header->version = SPOOL_VERSION;
+        header->sequence = segment.sequence;
+        header->consumed = sizeof(SpoolSegmentHeader);
+        segment.end = sizeof(SpoolSegmentHeader);
+        segment.rows = 0;
+        segment.dirty = true;
+        segments.push_back(segment);
+        return true;
+    }
+
+    // Function to find the records of a segment left by a previous run
+    bool recoverSegment(Segment& segment) {
+        SpoolSegmentHeader* header = segment.header();
+        if (header->magic != SPOOL_MAGIC || header->version != SPOOL_VERSION || header->consumed < sizeof(SpoolSegmentHeader) ||
+            header->consumed > SPOOL_SEGMENT_SIZE) {
+            return false;
+        }
+        size_t offset = header->consumed;
+        segment.rows = 0;
+        while (offset + sizeof(SpoolRecordHeader) <= SPOOL_SEGMENT_SIZE) {
+            SpoolRecordHeader record;
+            memcpy(&record, segment.map + offset, sizeof(record));
+            const char* rows = segment.map + offset + sizeof(record);
+            if (record.magic != SPOOL_RECORD_MAGIC || record.rows == 0 || record.rows > SPOOL_RECORD_ROWS ||
+                offset + sizeof(record) + record.rows * sizeof(FlowData) > SPOOL_SEGMENT_SIZE ||
+                crc32(0, reinterpret_cast<const Bytef*>(rows), record.rows * sizeof(FlowData)) != record.checksum) {
+                break;
+            }
+            segment.rows += record.rows;
+            offset += sizeof(record) + record.rows * sizeof(FlowData);
+        }
+        segment.end = offset;
+        segment.dirty = false;
+        return true;
+    }
+
+public:
+    // Statistics
+    std::atomic<uint64_t> spooledRows;
+    std::atomic<uint64_t> droppedRows;      // Dropped with the oldest segment
+
+    FlowSpool(const std::string& directory, int maxMiB)
+        : directory(directory), maxSegments(std::max<size_t>(2, static_cast<size_t>(maxMiB) * 1024 * 1024 / SPOOL_SEGMENT_SIZE)),
+          pending(0), nextSequence(1), peekSequence(0), peekOffset(0), spooledRows(0), droppedRows(0) {}
+
+    ~FlowSpool() {
+        sync();
+        for (Segment& segment : segments) {
+            munmap(segment.map, SPOOL_SEGMENT_SIZE);
+            ::close(segment.fd);
+        }
+    }
+
+    // Function to create the spool directory and take over the segments of a previous run
+    bool open() {
+        // sink_spill_path and its parents are created as needed, like mkdir -p
+        for (size_t slash = directory.find('/', 1); slash != std::string::npos; slash = directory.find('/', slash + 1)) {
+            mkdir(directory.substr(0, slash).c_str(), 0755);
+        }
+        if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+            std::cerr << "Cannot create spool directory " << directory << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot create spool directory %s: %s", directory.c_str(), strerror(errno));
+            return false;
+        }
+        std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(directory.c_str()), closedir);
+        if (!dir) {
+            std::cerr << "Cannot read spool directory " << directory << ": " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot read spool directory %s: %s", directory.c_str(), strerror(errno));
+            return false;
+        }
+        std::vector<uint64_t> sequences;
+        while (struct dirent* entry = readdir(dir.get())) {
+            unsigned long long sequence;
+            char extension[8];
+            if (sscanf(entry->d_name, "%20llu.%7s", &sequence, extension) == 2 && strcmp(extension, "spool") == 0 &&
+                entry->d_name == segmentPath(sequence).substr(directory.size() + 1)) {
+                sequences.push_back(sequence);
+            }
+        }
+        std::sort(sequences.begin(), sequences.end());
+
+        for (uint64_t sequence : sequences) {
+            Segment segment;
+            segment.sequence = sequence;
+            segment.path = segmentPath(sequence);
+            segment.fd = ::open(segment.path.c_str(), O_RDWR | O_CLOEXEC);
+            struct stat st;
+            bool usable = segment.fd >= 0 && fstat(segment.fd, &st) == 0 && static_cast<size_t>(st.st_size) == SPOOL_SEGMENT_SIZE &&
+                          mapSegment(segment);
+            if (usable && !recoverSegment(segment)) {
+                munmap(segment.map, SPOOL_SEGMENT_SIZE);
+                usable = false;
+            }
+            if (!usable) {
+                std::cerr << "Ignoring damaged spool segment " << segment.path << std::endl;
+                syslog(LOG_ERR, "Ignoring damaged spool segment %s", segment.path.c_str());
+                if (segment.fd >= 0) {
+                    ::close(segment.fd);
+                }
+                continue;
+            }
+            nextSequence = sequence + 1;
+            if (segment.rows == 0) {
+                removeSegment(segment);
+                continue;
+            }
+            pending += segment.rows;
+            segments.push_back(segment);
+        }
+        if (pending) {
+            std::cout << "Spool " << directory << ": " << pending << " rows to replay" << std::endl;
+            syslog(LOG_INFO, "Spool %s: %llu rows to replay", directory.c_str(), static_cast<unsigned long long>(pending));
+        }
+        return true;
+    }
+
+    // Function to append rows as records; false if they could not be stored
+    bool append(const FlowData* rows, size_t count) {
+        while (count) {
+            size_t n = std::min(count, SPOOL_RECORD_ROWS);
+            size_t length = sizeof(SpoolRecordHeader) + n * sizeof(FlowData);
+            if ((segments.empty() || segments.back().end + length > SPOOL_SEGMENT_SIZE) && !addSegment()) {
+                return false;
+            }
+            Segment& segment = segments.back();
+            char* p = segment.map + segment.end;
+            memcpy(p + sizeof(SpoolRecordHeader), rows, n * sizeof(FlowData));
+            SpoolRecordHeader record;
+            record.magic = SPOOL_RECORD_MAGIC;
+            record.rows = static_cast<uint32_t>(n);
+            record.checksum = crc32(0, reinterpret_cast<const Bytef*>(rows), n * sizeof(FlowData));
+            record.reserved = 0;
+            memcpy(p, &record, sizeof(record));
+            segment.end += length;
+            segment.rows += n;
+            segment.dirty = true;
+            pending += n;
+            spooledRows.fetch_add(n, std::memory_order_relaxed);
+            rows += n;
+            count -= n;
+        }
+        return true;
+    }
+
+    // Function to copy the oldest record not yet replayed; 0 if the spool is empty
+    size_t peek(std::vector<FlowData>& rows) {
+        if (segments.empty()) {
+            return 0;
+        }
+        Segment& segment = segments.front();
+        size_t offset = segment.header()->consumed;
+        if (offset >= segment.end) {
+            return 0;
+        }
+        SpoolRecordHeader record;
+        memcpy(&record, segment.map + offset, sizeof(record));
+        rows.resize(record.rows);
+        memcpy(rows.data(), segment.map + offset + sizeof(record), record.rows * sizeof(FlowData));
+        peekSequence = segment.sequence;
+        peekOffset = offset;
+        return record.rows;
+    }
+
+    // Function to mark the record returned by peek() as replayed
+    void consume() {
+        if (segments.empty() || segments.front().sequence != peekSequence || segments.front().header()->consumed != peekOffset) {
+            return; // The segment was dropped meanwhile
+        }
+        Segment& segment = segments.front();
+        SpoolRecordHeader record;
+        memcpy(&record, segment.map + peekOffset, sizeof(record));
+        segment.header()->consumed = peekOffset + sizeof(record) + record.rows * sizeof(FlowData);
+        segment.rows -= record.rows;
+        segment.dirty = true;
+        pending -= record.rows;
+        if (segment.header()->consumed == segment.end) {
+            // Replayed completely; also the last segment, the next append starts a new one
+            removeSegment(segment);
+            segments.pop_front();
+        }
+    }
+
+    // Function to collect the segments changed since the last call, as file
+    // descriptors of their own that stay valid if a segment is removed meanwhile;
+    // they are written with syncFiles() without holding the spool's lock
+    void takeChanged(std::vector<int>& files) {
+        for (Segment& segment : segments) {
+            if (segment.dirty) {
+                int fd = dup(segment.fd);
+                if (fd >= 0) {
+                    files.push_back(fd);
+                }
+                segment.dirty = false;
+            }
+        }
+    }
+
+    // Function to write segments to disk; the mappings share the page cache
+    // with the files, so fdatasync() writes what was appended through them
+    static void syncFiles(std::vector<int>& files) {
+        for (int fd : files) {
+            fdatasync(fd);
+            ::close(fd);
+        }
+        files.clear();
+    }
+
+    // Function to write the changed segments to disk
+    void sync() {
+        std::vector<int> files;
+        takeChanged(files);
+        syncFiles(files);
+    }
+
+    uint64_t pendingRows() const {
+        return pending;
+    }
+
+    uint64_t diskBytes() const {
+        return segments.size() * SPOOL_SEGMENT_SIZE;
+    }
+};
+
+// Fan-out to several sinks (type = native, postgres)
+// Every sink listed in 'type' gets a SinkQueue: its own bounded queue and
+// writer thread in front of the sink's usual handler, so a slow database
+// never holds up a fast file archive. Receivers copy each flowset into one
+// batch per sink (FanoutHandler). When a sink's queue is full its policy
+// applies: "block" waits as a single sink does (and so slows every sink),
+// "drop" discards the batch and "spill" appends it to the sink's FlowSpool.
+// A single sink gets a SinkQueue as well unless its policy is "block".
+//
+// With a spool, the queue's writer thread writes through a connection of
+// its own instead of the MySQL/PostgreSQL/SQLite writer pool, whose queue
+// would hide a failed database. A batch the sink fails to write stays
+// queued and the writer reconnects the sink after 1, 2, 4 ... 30 s; meanwhile the queue fills and
+// further batches go to the spool. While the spool holds rows, all batches
+// go there, so flows reach the sink in arrival order: the queued ones first,
+// then the spool, oldest first and at most sink_spill_replay_rate rows/s.
+// The spool is kept at shutdown and replayed after the next start.
+class SinkQueue : public FlowBatchSink {
+private:
+    struct QueuedBatch {
+        FlowBatch* batch;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    SinkConfig config;
+    std::unique_ptr<DatabaseHandler> handler;
+    std::unique_ptr<FlowSpool> spool;
+    std::deque<QueuedBatch> queue;
+    std::deque<QueuedBatch> taken;      // Taken from the queue by the writer, oldest first; changed with the mutex held
+    size_t queuedRows;                  // Rows queued or taken and not yet written
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable wakeWriter;
+    std::condition_variable wakeProducers;
+    std::thread thread;
+    bool started;
+    bool connected;
+
+    // Writer thread state
+    bool healthy;                       // False after a failed write until a write succeeds
+    int backoff;                        // ms before the next attempt after a failure
+    std::chrono::steady_clock::time_point retryAt;
+
+    // Function to write rows to the sink; with a spool they are flushed at
+    // once, so a failure is seen while the rows can still be kept
+    bool write(const FlowData* rows, size_t count) {
+        bool ok = handler->insertFlowBatch(rows, count);
+        return spool ? ok && handler->flush() : ok;
+    }
+
+    // Function to note a failed write and schedule the next attempt
+    void failed() {
+        if (healthy) {
+            std::cerr << "Sink " << config.type << " failed, spooling flows" << std::endl;
+            syslog(LOG_ERR, "Sink %s failed, spooling flows", config.type.c_str());
+            healthy = false;
+            backoff = 1000;
+        } else {
+            backoff = std::min(backoff * 2, 30000);
+        }
+        failures.fetch_add(1, std::memory_order_relaxed);
+        retryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff);
+    }
+
+    // Function to note a successful write
+    void succeeded() {
+        if (!healthy) {
+            std::cout << "Sink " << config.type << " recovered" << std::endl;
+            syslog(LOG_INFO, "Sink %s recovered", config.type.c_str());
+            healthy = true;
+        }
+    }
+
+    void run() {
+        std::vector<FlowData> replayed;
+        std::vector<int> changed;           // Spool segments to write to disk
+        double tokens = config.replay_rate; // Rows that may be replayed now
+        auto lastRefill = std::chrono::steady_clock::now();
+        auto lastSync = lastRefill;
+        while (true) {
+            auto now = std::chrono::steady_clock::now();
+            if (config.replay_rate) {
+                tokens = std::min<double>(config.replay_rate, tokens + config.replay_rate * std::chrono::duration<double>(now - lastRefill).count());
+            }
+            lastRefill = now;
+
+            if (spool && now - lastSync >= std::chrono::seconds(1)) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    spool->takeChanged(changed);
+                }
+                FlowSpool::syncFiles(changed); // Without the lock, so producers never wait for the disk
+                lastSync = now;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if (taken.empty()) {
+                taken.swap(queue);
+            }
+            bool due = healthy || now >= retryAt;
+            bool replay = spool && spool->pendingRows() && (config.replay_rate == 0 || tokens > 0) && !stopping;
+            if (stopping && (taken.empty() || !healthy)) {
+                break; // Producers have closed; the spool keeps what could not be written
+            }
+            if (!due || (taken.empty() && !replay)) {
+                wakeWriter.wait_for(lock, std::chrono::milliseconds(100));
+                lock.unlock();
+                if (healthy) {
+                    handler->tick();
+                }
+                continue;
+            }
+            lock.unlock();
+
+            if (!healthy) {
+                // Reconnect before trying again
+                handler->close();
+                if (!handler->connect()) {
+                    failed();
+                    continue;
+                }
+            }
+
+            if (!taken.empty()) {
+                FlowBatch* batch = taken.front().batch;
+                size_t count = batch->rows.size();
+                auto lag = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - taken.front().queued).count();
+                if (static_cast<uint64_t>(lag) > maxLagMilliseconds.load(std::memory_order_relaxed)) {
+                    maxLagMilliseconds.store(lag, std::memory_order_relaxed);
+                }
+                if (!write(batch->rows.data(), count)) {
+                    if (spool) {
+                        failed();
+                        continue;
+                    }
+                    lostRows.fetch_add(count, std::memory_order_relaxed);
+                } else {
+                    succeeded();
+                }
+                rows.fetch_add(count, std::memory_order_relaxed);
+                batches.fetch_add(1, std::memory_order_relaxed);
+                delete batch;
+
+                lock.lock();
+                taken.pop_front();
+                queuedRows -= count;
+                wakeProducers.notify_all();
+            } else {
+                // Replay the oldest spooled record
+                lock.lock();
+                size_t count = spool->peek(replayed);
+                lock.unlock();
+                if (!write(replayed.data(), count)) {
+                    failed();
+                    continue;
+                }
+                succeeded();
+                tokens -= count;
+                replayedRows.fetch_add(count, std::memory_order_relaxed);
+                lock.lock();
+                spool->consume();
+            }
+            if (lock.owns_lock()) {
+                lock.unlock();
+            }
+            handler->tick();
+        }
+
+        // What the sink did not take is kept in the spool for the next start
+        std::lock_guard<std::mutex> lock(mutex);
+        taken.insert(taken.end(), queue.begin(), queue.end());
+        queue.clear();
+        for (QueuedBatch& queued : taken) {
+            if (!spool || !spool->append(queued.batch->rows.data(), queued.batch->rows.size())) {
+                droppedRows.fetch_add(queued.batch->rows.size(), std::memory_order_relaxed);
+            }
+            queuedRows -= queued.batch->rows.size();
+            delete queued.batch;
+        }
+        taken.clear();
+        if (healthy) {
+            handler->close();
+        }
+        if (spool) {
+            spool->sync();
+        }
+    }
+
+public:
+    // Statistics
+    std::atomic<uint64_t> rows;                 // Taken from the queue
+    std::atomic<uint64_t> batches;
+    std::atomic<uint64_t> droppedRows;          // Discarded by policy "drop" or because the spool could not take them
+    std::atomic<uint64_t> replayedRows;         // Written from the spool
+    std::atomic<uint64_t> lostRows;             // Refused by the sink's handler (no spool)
+    std::atomic<uint64_t> failures;             // Failed writes and reconnects with a spool
+    std::atomic<uint64_t> producerWaits;        // Submissions that waited with policy "block"
+    std::atomic<uint64_t> maxLagMilliseconds;   // Longest time a batch was queued
+    std::atomic<size_t> queuePeakRows;
+
+    SinkQueue(const SinkConfig& config, std::unique_ptr<DatabaseHandler> handler, const std::string& spillDirectory)
+        : config(config), handler(std::move(handler)), queuedRows(0), stopping(false), started(false), connected(false), healthy(true),
+          backoff(0), rows(0), batches(0), droppedRows(0), replayedRows(0), lostRows(0), failures(0), producerWaits(0),
+          maxLagMilliseconds(0), queuePeakRows(0) {
+        if (config.policy == "spill") {
+            spool.reset(new FlowSpool(spillDirectory + "/" + config.type, config.spill_size));
+        }
+    }
+
+    ~SinkQueue() override {
+        stop();
+    }
+
+    const std::string& name() const {
+        return config.type;
+    }
+
+    // Function to open the spool, connect the sink and start the writer thread (once)
+    bool start() override {
+        if (started) {
+            return connected;
+        }
+        started = true;
+        if (spool) {
+            // A sink that is down at start is reconnected by the writer; meanwhile flows are spooled
+            connected = spool->open();
+            if (connected && !handler->connect()) {
+                failed();
+            }
+        } else {
+            connected = handler->connect();
+        }
+        if (connected) {
+            thread = std::thread(&SinkQueue::run, this);
+        }
+        return connected;
+    }
+
+    // Function to write what is queued and stop; call after all producers have closed
+    void stop() {
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                wakeWriter.notify_one();
+                wakeProducers.notify_all();
+            }
+            thread.join();
+        }
+    }
+
+    // Producer side: queue a batch, or apply the policy if the queue is full.
+    // While the spool holds rows, batches go to the spool to keep their order.
+    void submit(FlowBatch* batch) override {
+        size_t count = batch->rows.size();
+        std::unique_lock<std::mutex> lock(mutex);
+        bool full = queuedRows >= static_cast<size_t>(config.queue_rows) && !stopping;
+        if (spool && (full || spool->pendingRows())) {
+            if (!spool->append(batch->rows.data(), count)) {
+                droppedRows.fetch_add(count, std::memory_order_relaxed);
+            }
+            lock.unlock();
+            delete batch;
+            return;
+        }
+        if (full) {
+            if (config.policy == "drop") {
+                droppedRows.fetch_add(count, std::memory_order_relaxed);
+                lock.unlock();
+                delete batch;
+                return;
+            }
+            producerWaits.fetch_add(1, std::memory_order_relaxed);
+            wakeProducers.wait(lock, [this] { return queuedRows < static_cast<size_t>(config.queue_rows) || stopping; });
+        }
+
+        queue.push_back({ batch, std::chrono::steady_clock::now() });
+        queuedRows += count;
+        if (queuedRows > queuePeakRows.load(std::memory_order_relaxed)) {
+            queuePeakRows.store(queuedRows, std::memory_order_relaxed);
+        }
+        if (queue.size() == 1) {
+            wakeWriter.notify_one();
+        }
+    }
+
+    bool checkConnection() override {
+        return handler->checkConnection();
+    }
+
+    size_t queued() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queuedRows;
+    }
+
+    // Function to get the age of the oldest batch not yet written in ms (the sink's current lag)
+    uint64_t lagMilliseconds() {
+        std::lock_guard<std::mutex> lock(mutex);
+        const std::deque<QueuedBatch>& oldest = taken.empty() ? queue : taken;
+        if (oldest.empty()) {
+            return 0;
+        }
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - oldest.front().queued).count();
+    }
+
+    bool spooling() const {
+        return spool != nullptr;
+    }
+
+    // Function to get the rows spooled, not yet replayed and dropped by the spool, and its size on disk
+    void spoolStatus(uint64_t& spooled, uint64_t& pending, uint64_t& dropped, uint64_t& bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        spooled = spool ? spool->spooledRows.load(std::memory_order_relaxed) : 0;
+        pending = spool ? spool->pendingRows() : 0;
+        dropped = spool ? spool->droppedRows.load(std::memory_order_relaxed) : 0;
+        bytes = spool ? spool->diskBytes() : 0;
+    }
+};
+
+std::vector<std::unique_ptr<SinkQueue>> sinkQueues; // Created with the first receiver handler of a fan-out
+
+// Per-receiver handler of a fan-out: one batch per sink
+class FanoutHandler : public DatabaseHandler {
+private:
+    std::vector<std::unique_ptr<BatchQueueHandler>> sinks;
+
+public:
+    FanoutHandler(const std::vector<std::unique_ptr<SinkQueue>>& queues, const DatabaseConfig& config) {
+        for (size_t i = 0; i < queues.size(); ++i) {
+            sinks.emplace_back(new BatchQueueHandler(*queues[i], config.sinks[i].batch_rows, config.sink_flush_interval));
+        }
+    }
+
+    ~FanoutHandler() override {
+        close();
+    }
+
+    bool connect() override {
+        for (auto& sink : sinks) {
+            if (!sink->connect()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool checkConnection() override {
+        bool ok = true;
+        for (auto& sink : sinks) {
+            ok = sink->checkConnection() && ok;
+        }
+        return ok;
+    }
+
+    bool initializeTable() override {
+        // Each sink initializes its own table or files when it connects
+        return true;
+    }
+
+    bool insertFlowData(const FlowData& data) override {
+        return insertFlowBatch(&data, 1);
+    }
+
+    bool insertFlowBatch(const FlowData* flows, size_t count) override {
+        for (auto& sink : sinks) {
+            sink->insertFlowBatch(flows, count);
+        }
+        return true;
+    }
+
+    bool flush() override {
+        for (auto& sink : sinks) {
+            sink->flush();
+        }
+        return true;
+    }
+
+    void tick() override {
+        for (auto& sink : sinks) {
+            sink->tick();
+        }
+    }
+
+    void close() override {
+        for (auto& sink : sinks) {
+            sink->close();
+        }
+    }
+};
+
+// Flow aggregation ([Aggregation] keys = ...)
+// Each receiver sums its flows per key before they reach the sink: records
+// with the same key fields (and probe) become one row with the packets and
+// bytes added up, the earliest FlowStart and the latest FlowEnd (the receive
+// time for flows exported without them). Fields that are not part of the
+// key are left empty in the emitted rows. Entries live in an open-addressing
+// hash table (linear probing, deletion by backward shift) over a fixed pool
+// sized from memory_size. A row is emitted once its entry
+// has been active for active_timeout seconds, or has seen no flow for
+// inactive_timeout seconds; both are checked with a timer wheel of one-second
+// slots, where an entry waits in the slot of its earliest deadline and is
+// moved on when that slot comes due before the deadline (a new flow only
+// changes the deadline, not the slot). Deadlines are one slot after the
+// timeout, so a row is never emitted early but may be up to a second late.
+// When the pool is full, the least recently updated entry is emitted early
+// to make room.
+
+// Summed up over all aggregating handlers
+struct AggregationStats {
+    std::atomic<uint64_t> flows{0};             // Flows taken in
+    std::atomic<uint64_t> rows{0};              // Aggregated rows emitted
+    std::atomic<uint64_t> activeTimeouts{0};
+    std::atomic<uint64_t> inactiveTimeouts{0};
+    std::atomic<uint64_t> evictions{0};         // Emitted early because the pool was full
+    std::atomic<int64_t> entries{0};            // Entries in use
+    std::atomic<uint64_t> capacity{0};          // Entries in all pools
+};
+
+AggregationStats aggregationStats;
+
+class AggregatingHandler : public DatabaseHandler {
+private:
+    static const uint32_t NONE = 0xFFFFFFFF;
+
+    // Key fields of a flow, with the fields not in the key zeroed
+    struct Key {
+        uint8_t source[16];
+        uint8_t destination[16];
+        uint16_t sourcePort;
+        uint16_t destinationPort;
+        uint16_t probe;
+        uint8_t sourceVersion;
+        uint8_t destinationVersion;
+        uint8_t protocol;
+        uint8_t padding[7];
+    };
+    static_assert(sizeof(Key) == 48, "Key is hashed as six 64-bit words");
+
+    struct Entry {
+        Key key;
+        uint64_t hash;
+        uint64_t packets;
+        uint64_t bytes;
+        uint64_t start;             // Earliest FlowStart, or receive time of a flow without one
+        uint64_t end;               // Latest FlowEnd, or receive time of a flow without one
+        uint32_t firstSeen;         // Seconds of the monotonic clock
+        uint32_t lastSeen;
+        uint32_t lruPrev;           // Least recently updated first; lruNext also links the free list
+        uint32_t lruNext;
+        uint32_t timerSlot;         // Timer wheel slot, NONE = not scheduled
+        uint32_t timerPrev;         // Entries of the same timer wheel slot
+        uint32_t timerNext;
+    };
+
+    std::unique_ptr<DatabaseHandler> sink;
+    uint8_t keyFields;
+    uint32_t activeTimeout;
+    uint32_t inactiveTimeout;
+    std::vector<Entry> entries;
+    std::vector<uint32_t> slots;    // Hash table of entry indexes, NONE = empty
+    size_t slotMask;
+    uint32_t freeList;
+    uint32_t lruHead;
+    uint32_t lruTail;
+    std::vector<uint32_t> wheel;    // Timer wheel slots, one per second
+    uint32_t wheelTime;             // Last second the wheel was advanced to
+    std::vector<FlowData> emitted;  // Rows waiting to be passed to the sink
+
+    static uint32_t now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return static_cast<uint32_t>(ts.tv_sec);
+    }
+
+    static uint64_t hashKey(const Key& key) {
+        uint64_t words[6];
+        memcpy(words, &key, sizeof(words));
+        uint64_t hash = 0;
+        for (uint64_t word : words) {
+            hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+            hash ^= hash >> 32;
+        }
+        // Finalizer of splitmix64, so the low bits indexing the table depend on every byte
+        hash ^= hash >> 30;
+        hash *= 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 31;
+        return hash;
+    }
+
+    void makeKey(const FlowData& flow, Key& key) const {
+        memset(&key, 0, sizeof(key));
+        if (keyFields & AGGREGATE_SOURCE_IP) {
+            memcpy(key.source, flow.SourceIP.bytes, 16);
+            key.sourceVersion = flow.SourceIP.version;
+        }
+        if (keyFields & AGGREGATE_DESTINATION_IP) {
+            memcpy(key.destination, flow.DestinationIP.bytes, 16);
+            key.destinationVersion = flow.DestinationIP.version;
+        }
+        if (keyFields & AGGREGATE_SOURCE_PORT) {
+            key.sourcePort = flow.SourcePort;
+        }
+        if (keyFields & AGGREGATE_DESTINATION_PORT) {
+            key.destinationPort = flow.DestinationPort;
+        }
+        if (keyFields & AGGREGATE_PROTOCOL) {
+            key.protocol = flow.Protocol;
+        }
+        key.probe = flow.ProbeID;
+    }
+
+    // Function to find the hash table slot holding an entry
+    size_t findSlot(uint32_t index) const {
+        size_t i = entries[index].hash & slotMask;
+        while (slots[i] != index) {
+            i = (i + 1) & slotMask;
+        }
+        return i;
+    }
+
+    // Function to empty a hash table slot, moving later entries of the probe
+    // sequence back so lookups never stop early at a hole
+    void eraseSlot(size_t hole) {
+        size_t i = hole;
+        while (true) {
+            i = (i + 1) & slotMask;
+            if (slots[i] == NONE) {
+                break;
+            }
+            size_t home = entries[slots[i]].hash & slotMask;
+            // The entry may move to the hole unless its home lies cyclically in (hole, i]
+            bool stays = hole <= i ? hole < home && home <= i : hole < home || home <= i;
+            if (!stays) {
+                slots[hole] = slots[i];
+                hole = i;
+            }
+        }
+        slots[hole] = NONE;
+    }
+
+    void lruUnlink(uint32_t index) {
+        Entry& entry = entries[index];
+        (entry.lruPrev == NONE ? lruHead : entries[entry.lruPrev].lruNext) = entry.lruNext;
+        (entry.lruNext == NONE ? lruTail : entries[entry.lruNext].lruPrev) = entry.lruPrev;
+    }
+
+    void lruAppend(uint32_t index) {
+        Entry& entry = entries[index];
+        entry.lruPrev = lruTail;
+        entry.lruNext = NONE;
+        (lruTail == NONE ? lruHead : entries[lruTail].lruNext) = index;
+        lruTail = index;
+    }
+
+    void timerUnlink(uint32_t index) {
+        Entry& entry = entries[index];
+        if (entry.timerSlot == NONE) {
+            return;
+        }
+        if (entry.timerPrev == NONE) {
+            wheel[entry.timerSlot] = entry.timerNext;
+        } else {
+            entries[entry.timerPrev].timerNext = entry.timerNext;
+        }
+        if (entry.timerNext != NONE) {
+            entries[entry.timerNext].timerPrev = entry.timerPrev;
+        }
+    }
+
+    // Function to get the earliest second an entry expires at. Seen times are
+    // whole seconds, so one more second keeps the timeouts from being short.
+    uint32_t deadline(const Entry& entry) const {
+        return std::min(entry.firstSeen + activeTimeout, entry.lastSeen + inactiveTimeout) + 1;
+    }
+
+    void schedule(uint32_t index, uint32_t second) {
+        Entry& entry = entries[index];
+        size_t slot = second & (wheel.size() - 1);
+        entry.timerSlot = static_cast<uint32_t>(slot);
+        entry.timerPrev = NONE;
+        entry.timerNext = wheel[slot];
+        if (wheel[slot] != NONE) {
+            entries[wheel[slot]].timerPrev = index;
+        }
+        wheel[slot] = index;
+    }
+
+    // Function to emit an entry as a row and free it
+    void emit(uint32_t index) {
+        Entry& entry = entries[index];
+        FlowData row;
+        if (entry.key.sourceVersion) {
+            memcpy(row.SourceIP.bytes, entry.key.source, 16);
+            row.SourceIP.version = entry.key.sourceVersion;
+        }
+        if (entry.key.destinationVersion) {
+            memcpy(row.DestinationIP.bytes, entry.key.destination, 16);
+            row.DestinationIP.version = entry.key.destinationVersion;
+        }
+        row.SourcePort = entry.key.sourcePort;
+        row.DestinationPort = entry.key.destinationPort;
+        row.Protocol = entry.key.protocol;
+        row.PacketCount = entry.packets;
+        row.ByteCount = entry.bytes;
+        row.FlowStart = entry.start;
+        row.FlowEnd = entry.end;
+        row.ProbeID = entry.key.probe;
+        emitted.push_back(row);
+
+        eraseSlot(findSlot(index));
+        lruUnlink(index);
+        timerUnlink(index);
+        entry.lruNext = freeList;
+        freeList = index;
+        aggregationStats.entries.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Function to emit the entries whose timeouts have passed
+    void advance(uint32_t second) {
+        if (second - wheelTime > wheel.size()) {
+            wheelTime = second - static_cast<uint32_t>(wheel.size());
+        }
+        while (wheelTime != second) {
+            ++wheelTime;
+            size_t slot = wheelTime & (wheel.size() - 1);
+            uint32_t index = wheel[slot];
+            wheel[slot] = NONE;
+            while (index != NONE) {
+                Entry& entry = entries[index];
+                uint32_t next = entry.timerNext;
+                uint32_t due = deadline(entry);
+                if (static_cast<int32_t>(due - second) > 0) {
+                    schedule(index, due); // Updated since it was scheduled
+                } else {
+                    bool active = entry.firstSeen + activeTimeout <= entry.lastSeen + inactiveTimeout;
+                    (active ? aggregationStats.activeTimeouts : aggregationStats.inactiveTimeouts).fetch_add(1, std::memory_order_relaxed);
+                    entry.timerSlot = NONE; // Already taken off the wheel
+                    emit(index);
+                }
+                index = next;
+            }
+        }
+    }
+
+    // Function to add a flow to its entry, creating the entry if needed
+    void add(const FlowData& flow, const Key& key, uint64_t hash, uint32_t second, uint64_t received) {
+        // Flows without timestamps count as received now, so every row tells its time window
+        uint64_t start = flow.FlowStart ? flow.FlowStart : received;
+        uint64_t end = flow.FlowEnd ? flow.FlowEnd : received;
+        size_t i = hash & slotMask;
+        while (slots[i] != NONE) {
+            Entry& entry = entries[slots[i]];
+            if (entry.hash == hash && memcmp(&entry.key, &key, sizeof(key)) == 0) {
+                entry.packets += flow.PacketCount;
+                entry.bytes += flow.ByteCount;
+                entry.start = std::min(entry.start, start);
+                entry.end = std::max(entry.end, end);
+                // The list stays ordered by lastSeen, so it is enough to move an entry once a second
+                if (entry.lastSeen != second) {
+                    entry.lastSeen = second;
+                    lruUnlink(slots[i]);
+                    lruAppend(slots[i]);
+                }
+                return;
+            }
+            i = (i + 1) & slotMask;
+        }
+
+        if (freeList == NONE) {
+            // Pool full: the least recently updated entry makes room
+            aggregationStats.evictions.fetch_add(1, std::memory_order_relaxed);
+            emit(lruHead);
+            // The emitted entry may have moved this key's free slot
+            i = hash & slotMask;
+            while (slots[i] != NONE) {
+                i = (i + 1) & slotMask;
+            }
+        }
+        uint32_t index = freeList;
+        Entry& entry = entries[index];
+        freeList = entry.lruNext;
+        entry.key = key;
+        entry.hash = hash;
+        entry.packets = flow.PacketCount;
+        entry.bytes = flow.ByteCount;
+        entry.start = start;
+        entry.end = end;
+        entry.firstSeen = second;
+        entry.lastSeen = second;
+        slots[i] = index;
+        lruAppend(index);
+        schedule(index, deadline(entry));
+        aggregationStats.entries.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t freeCount() const {
+        size_t count = 0;
+        for (uint32_t index = freeList; index != NONE; index = entries[index].lruNext) {
+            ++count;
+        }
+        return count;
+    }
+
+    // Function to pass the emitted rows on to the sink
+    bool pass() {
+        if (emitted.empty()) {
+            return true;
+        }
+        aggregationStats.rows.fetch_add(emitted.size(), std::memory_order_relaxed);
+        bool ok = sink->insertFlowBatch(emitted.data(), emitted.size());
+        emitted.clear();
+        return ok;
+    }
+
+public:
+    AggregatingHandler(const AggregationConfig& config, std::unique_ptr<DatabaseHandler> sink)
+        : sink(std::move(sink)), keyFields(config.key_fields), activeTimeout(config.active_timeout), inactiveTimeout(config.inactive_timeout),
+          freeList(NONE), lruHead(NONE), lruTail(NONE), wheelTime(now()) {
+        // The pool and a hash table at most half full share memory_size
+        size_t capacity = static_cast<size_t>(config.memory_size) * 1024 * 1024 / (sizeof(Entry) + 2 * sizeof(uint32_t));
+        capacity = std::max<size_t>(1, std::min<size_t>(capacity, NONE - 1));
+        entries.resize(capacity);
+        for (size_t i = 0; i < capacity; ++i) {
+            entries[i].lruNext = i + 1 < capacity ? static_cast<uint32_t>(i + 1) : NONE;
+        }
+        freeList = 0;
+        size_t tableSize = 2;
+        while (tableSize < 2 * capacity) {
+            tableSize *= 2;
+        }
+        slots.assign(tableSize, uint32_t(NONE));
+        slotMask = tableSize - 1;
+        size_t wheelSize = 2;
+        while (wheelSize <= std::max(activeTimeout, inactiveTimeout) + 1) {
+            wheelSize *= 2;
+        }
+        wheel.assign(wheelSize, uint32_t(NONE));
+        aggregationStats.capacity.fetch_add(capacity, std::memory_order_relaxed);
+    }
+
+    ~AggregatingHandler() override {
+        aggregationStats.entries.fetch_sub(entries.size() - freeCount(), std::memory_order_relaxed);
+        aggregationStats.capacity.fetch_sub(entries.size(), std::memory_order_relaxed);
+    }
+
+    bool connect() override {
+        return sink->connect();
+    }
+
+    bool checkConnection() override {
+        return sink->checkConnection();
+    }
+
+    bool initializeTable() override {
+        return sink->initializeTable();
+    }
+
+    bool insertFlowData(const FlowData& data) override {
+        return insertFlowBatch(&data, 1);
+    }
+
+    bool insertFlowBatch(const FlowData* flows, size_t count) override {
+        uint32_t second = now();
+        advance(second);
+        struct timespec wall;
+        clock_gettime(CLOCK_REALTIME_COARSE, &wall);
+        uint64_t received = static_cast<uint64_t>(wall.tv_sec) * 1000000000ULL + wall.tv_nsec;
+        // Keys are hashed a group at a time, and their table slots and entries
+        // prefetched, so the cache misses of a group overlap
+        const size_t GROUP = 8;
+        Key keys[GROUP];
+        uint64_t hashes[GROUP];
+        for (size_t first = 0; first < count; first += GROUP) {
+            size_t group = std::min(GROUP, count - first);
+            for (size_t i = 0; i < group; ++i) {
+                makeKey(flows[first + i], keys[i]);
+                hashes[i] = hashKey(keys[i]);
+                __builtin_prefetch(&slots[hashes[i] & slotMask]);
+            }
+            for (size_t i = 0; i < group; ++i) {
+                uint32_t index = slots[hashes[i] & slotMask];
+                if (index != NONE) {
+                    __builtin_prefetch(&entries[index]);
+                }
+            }
+            for (size_t i = 0; i < group; ++i) {
+                add(flows[first + i], keys[i], hashes[i], second, received);
+            }
+        }
+        aggregationStats.flows.fetch_add(count, std::memory_order_relaxed);
+        return pass();
+    }
+
+    bool flush() override {
+        return pass() && sink->flush();
+    }
+
+    void tick() override {
+        advance(now());
+        pass();
+        sink->tick();
+    }
+
+    // Every entry is emitted before the sink closes
+    void close() override {
+        while (lruHead != NONE) {
+            emit(lruHead);
+        }
+        pass();
+        sink->close();
+    }
+};
+
+// Global configuration variables
+DatabaseConfig dbConfig;
+AggregationConfig aggregationConfig;
+std::vector<SondaConfig> sondaConfigs;
+
+const std::string& probeName(uint16_t probeID) {
+    static const std::string unknown;
+    return probeID < sondaConfigs.size() ? sondaConfigs[probeID].name : unknown;
+}
+
+// Function to check whether 'type' lists a sink
+bool hasSink(const std::string& type) {
+    for (const SinkConfig& sink : dbConfig.sinks) {
+        if (sink.type == type) {
+            return true;
+        }
+    }
+    return false;
+}
+bool displayPackets = false; // For -d or --display option
+bool enableLogging = false;   // Controlled by 'log' option in .ini file
+int recvBatchSize = 32;       // Datagrams per recvmmsg() call ('recv_batch' option in .ini file)
+std::string receiveEngine = "threads"; // 'engine' option in .ini file: 'threads', 'epoll' or 'io_uring'
+int engineThreads = 1;        // Threads servicing all sockets when engine is not 'threads'
+std::atomic<bool> running(true); // Cleared by SIGINT/SIGTERM to stop the receive loops
+int queueSizeKiB = 4096;      // Per-socket datagram queue to the decode workers ('queue_size', 0 = decode on the receive thread)
+int decodeThreads = 0;        // Decode worker threads ('decode_threads', 0 = one per probe socket)
+int statsInterval = 0;        // Seconds between statistics reports ('stats_interval', 0 = off)
+std::string simdSetting = "auto"; // Batch decoder kernels ('simd': auto, avx2, sse4 or off)
+std::string diagFilePath;     // For --diag=PATH option
+std::mutex diagFileMutex;     // Mutex for thread-safe writing to diag file
+
+// Function to load configuration
+bool loadConfig(const std::string& filename) {
+    INIParser parser(filename);
+    if (!parser.parse()) {
+        std::cerr << "Failed to parse configuration file." << std::endl;
+        syslog(LOG_ERR, "Failed to parse configuration file: %s", filename.c_str());
+        return false;
+    }
+
+    // Load database configuration
+    dbConfig.type = parser.get("Database", "type", "");
+    dbConfig.sinks.clear();
+    std::istringstream types(dbConfig.type);
+    std::string type;
+    while (std::getline(types, type, ',')) {
+        type.erase(0, type.find_first_not_of(" \t"));
+        type.erase(type.find_last_not_of(" \t") + 1);
+        if (hasSink(type)) {
+            std::cerr << "Database type listed twice: " << type << std::endl;
+            syslog(LOG_ERR, "Database type listed twice: %s", type.c_str());
+            return false;
+        }
+        SinkConfig sink;
+        sink.type = type;
+        dbConfig.sinks.push_back(sink);
+    }
+    if (dbConfig.sinks.empty()) {
+        dbConfig.sinks.push_back(SinkConfig()); // Reported as not implemented when the handler is created
+    }
+
+    // Queue and spool of each sink (see SinkQueue); <type>_sink_* overrides sink_*
+    std::string sinkPolicy = parser.get("Database", "sink_policy", "block");
+    int sinkQueueRows = parser.getInteger("Database", "sink_queue_rows", 1000000);
+    int sinkBatchRows = parser.getInteger("Database", "sink_batch_rows", 4096);
+    int sinkSpillSize = parser.getInteger("Database", "sink_spill_size", 1024);
+    int sinkReplayRate = parser.getInteger("Database", "sink_spill_replay_rate", 100000);
+    for (SinkConfig& sink : dbConfig.sinks) {
+        sink.policy = parser.get("Database", sink.type + "_sink_policy", sinkPolicy);
+        if (sink.policy != "block" && sink.policy != "drop" && sink.policy != "spill") {
+            std::cerr << "Invalid " << sink.type << " sink_policy value (allowed block, drop, spill): " << sink.policy << std::endl;
+            syslog(LOG_ERR, "Invalid %s sink_policy value (allowed block, drop, spill): %s", sink.type.c_str(), sink.policy.c_str());
+            return false;
+        }
+        sink.queue_rows = parser.getInteger("Database", sink.type + "_sink_queue_rows", sinkQueueRows);
+        if (sink.queue_rows < 1) {
+            std::cerr << "Invalid " << sink.type << " sink_queue_rows value: " << sink.queue_rows << std::endl;
+            syslog(LOG_ERR, "Invalid %s sink_queue_rows value: %d", sink.type.c_str(), sink.queue_rows);
+            return false;
+        }
+        sink.batch_rows = parser.getInteger("Database", sink.type + "_sink_batch_rows", sinkBatchRows);
+        if (sink.batch_rows < 1 || sink.batch_rows > 1048576) {
+            std::cerr << "Invalid " << sink.type << " sink_batch_rows value (allowed 1-1048576): " << sink.batch_rows << std::endl;
+            syslog(LOG_ERR, "Invalid %s sink_batch_rows value (allowed 1-1048576): %d", sink.type.c_str(), sink.batch_rows);
+            return false;
+        }
+        sink.spill_size = parser.getInteger("Database", sink.type + "_sink_spill_size", sinkSpillSize);
+        if (sink.spill_size < 32) {
+            std::cerr << "Invalid " << sink.type << " sink_spill_size value (min. 32 MiB): " << sink.spill_size << std::endl;
+            syslog(LOG_ERR, "Invalid %s sink_spill_size value (min. 32 MiB): %d", sink.type.c_str(), sink.spill_size);
+            return false;
+        }
+        sink.replay_rate = parser.getInteger("Database", sink.type + "_sink_spill_replay_rate", sinkReplayRate);
+        if (sink.replay_rate < 0) {
+            std::cerr << "Invalid " << sink.type << " sink_spill_replay_rate value: " << sink.replay_rate << std::endl;
+            syslog(LOG_ERR, "Invalid %s sink_spill_replay_rate value: %d", sink.type.c_str(), sink.replay_rate);
+            return false;
+        }
+    }
+    dbConfig.sink_flush_interval = parser.getInteger("Database", "sink_flush_interval", 1000);
+    if (dbConfig.sink_flush_interval < 0) {
+        std::cerr << "Invalid sink_flush_interval value: " << dbConfig.sink_flush_interval << std::endl;
+        syslog(LOG_ERR, "Invalid sink_flush_interval value: %d", dbConfig.sink_flush_interval);
+        return false;
+    }
+    dbConfig.sink_spill_path = parser.get("Database", "sink_spill_path", "");
+    for (const SinkConfig& sink : dbConfig.sinks) {
+        if (sink.policy == "spill" && dbConfig.sink_spill_path.empty()) {
+            std::cerr << "Missing sink_spill_path for sink policy spill" << std::endl;
+            syslog(LOG_ERR, "Missing sink_spill_path for sink policy spill");
+            return false;
+        }
+    }
+    dbConfig.sqlite_path = parser.get("Database", "sqlite_path", "");
+    dbConfig.sqlite_batch_size = parser.getInteger("Database", "sqlite_batch_size", 1000);
+    if (dbConfig.sqlite_batch_size < 1 || dbConfig.sqlite_batch_size > 1000000) {
+        std::cerr << "Invalid sqlite_batch_size value (allowed 1-1000000): " << dbConfig.sqlite_batch_size << std::endl;
+        syslog(LOG_ERR, "Invalid sqlite_batch_size value (allowed 1-1000000): %d", dbConfig.sqlite_batch_size);
+        return false;
+    }
+    dbConfig.sqlite_flush_interval = parser.getInteger("Database", "sqlite_flush_interval", 1000);
+    if (dbConfig.sqlite_flush_interval < 0) {
+        std::cerr << "Invalid sqlite_flush_interval value: " << dbConfig.sqlite_flush_interval << std::endl;
+        syslog(LOG_ERR, "Invalid sqlite_flush_interval value: %d", dbConfig.sqlite_flush_interval);
+        return false;
+    }
+    dbConfig.sqlite_journal_mode = parser.get("Database", "sqlite_journal_mode", "WAL");
+    std::transform(dbConfig.sqlite_journal_mode.begin(), dbConfig.sqlite_journal_mode.end(), dbConfig.sqlite_journal_mode.begin(), ::toupper);
+    const std::vector<std::string> journalModes = { "DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF" };
+    if (std::find(journalModes.begin(), journalModes.end(), dbConfig.sqlite_journal_mode) == journalModes.end()) {
+        std::cerr << "Invalid sqlite_journal_mode value: " << dbConfig.sqlite_journal_mode << std::endl;
+        syslog(LOG_ERR, "Invalid sqlite_journal_mode value: %s", dbConfig.sqlite_journal_mode.c_str());
+        return false;
+    }
+    dbConfig.sqlite_synchronous = parser.get("Database", "sqlite_synchronous", "NORMAL");
+    std::transform(dbConfig.sqlite_synchronous.begin(), dbConfig.sqlite_synchronous.end(), dbConfig.sqlite_synchronous.begin(), ::toupper);
+    const std::vector<std::string> synchronousModes = { "OFF", "NORMAL", "FULL", "EXTRA" };
+    if (std::find(synchronousModes.begin(), synchronousModes.end(), dbConfig.sqlite_synchronous) == synchronousModes.end()) {
+        std::cerr << "Invalid sqlite_synchronous value: " << dbConfig.sqlite_synchronous << std::endl;
+        syslog(LOG_ERR, "Invalid sqlite_synchronous value: %s", dbConfig.sqlite_synchronous.c_str());
+        return false;
+    }
+    dbConfig.sqlite_cache_size = parser.getInteger("Database", "sqlite_cache_size", 0);
+    dbConfig.sqlite_mmap_size = parser.getInteger("Database", "sqlite_mmap_size", 0);
+    if (dbConfig.sqlite_mmap_size < 0) {
+        std::cerr << "Invalid sqlite_mmap_size value: " << dbConfig.sqlite_mmap_size << std::endl;
+        syslog(LOG_ERR, "Invalid sqlite_mmap_size value: %d", dbConfig.sqlite_mmap_size);
+        return false;
+    }
+    dbConfig.sqlite_queue_rows = parser.getInteger("Database", "sqlite_queue_rows", 100000);
+    if (dbConfig.sqlite_queue_rows < 1) {
+        std::cerr << "Invalid sqlite_queue_rows value: " << dbConfig.sqlite_queue_rows << std::endl;
+        syslog(LOG_ERR, "Invalid sqlite_queue_rows value: %d", dbConfig.sqlite_queue_rows);
+        return false;
+    }
+    dbConfig.csv_path = parser.get("Database", "csv_path", "");
+    dbConfig.csv_buffer_size = parser.getInteger("Database", "csv_buffer_size", 1024);
+    if (dbConfig.csv_buffer_size < 1 || dbConfig.csv_buffer_size > 1048576) {
+        std::cerr << "Invalid csv_buffer_size value: " << dbConfig.csv_buffer_size << std::endl;
+        syslog(LOG_ERR, "Invalid csv_buffer_size value: %d", dbConfig.csv_buffer_size);
+        return false;
+    }
+    dbConfig.csv_rotate_interval = parser.getInteger("Database", "csv_rotate_interval", 0);
+    if (dbConfig.csv_rotate_interval < 0) {
+        std::cerr << "Invalid csv_rotate_interval value: " << dbConfig.csv_rotate_interval << std::endl;
+        syslog(LOG_ERR, "Invalid csv_rotate_interval value: %d", dbConfig.csv_rotate_interval);
+        return false;
+    }
+    dbConfig.csv_compress = parser.get("Database", "csv_compress", "none");
+    if (dbConfig.csv_compress != "none" && dbConfig.csv_compress != "gzip") {
+        std::cerr << "Invalid csv_compress value: " << dbConfig.csv_compress << std::endl;
+        syslog(LOG_ERR, "Invalid csv_compress value: %s", dbConfig.csv_compress.c_str());
+        return false;
+    }
+    dbConfig.csv_compress_level = parser.getInteger("Database", "csv_compress_level", 1);
+    if (dbConfig.csv_compress_level < 1 || dbConfig.csv_compress_level > 9) {
+        std::cerr << "Invalid csv_compress_level value: " << dbConfig.csv_compress_level << std::endl;
+        syslog(LOG_ERR, "Invalid csv_compress_level value: %d", dbConfig.csv_compress_level);
+        return false;
+    }
+    dbConfig.csv_flush_interval = parser.getInteger("Database", "csv_flush_interval", 1000);
+    if (dbConfig.csv_flush_interval < 0) {
+        std::cerr << "Invalid csv_flush_interval value: " << dbConfig.csv_flush_interval << std::endl;
+        syslog(LOG_ERR, "Invalid csv_flush_interval value: %d", dbConfig.csv_flush_interval);
+        return false;
+    }
+    dbConfig.mysql_host = parser.get("Database", "mysql_host", "localhost");
+    dbConfig.mysql_port = parser.getInteger("Database", "mysql_port", 3306);
+    dbConfig.mysql_user = parser.get("Database", "mysql_user", "");
+    dbConfig.mysql_password = parser.get("Database", "mysql_password", "");
+    dbConfig.mysql_database = parser.get("Database", "mysql_database", "");
+    dbConfig.mysql_batch_size = parser.getInteger("Database", "mysql_batch_size", 1000);
+    if (dbConfig.mysql_batch_size < 1 || dbConfig.mysql_batch_size > 1000000) {
+        std::cerr << "Invalid mysql_batch_size value: " << dbConfig.mysql_batch_size << std::endl;
+        syslog(LOG_ERR, "Invalid mysql_batch_size value: %d", dbConfig.mysql_batch_size);
+        return false;
+    }
+    dbConfig.mysql_mode = parser.get("Database", "mysql_mode", "insert");
+    if (dbConfig.mysql_mode != "insert" && dbConfig.mysql_mode != "load") {
+        std::cerr << "Invalid mysql_mode value: " << dbConfig.mysql_mode << std::endl;
+        syslog(LOG_ERR, "Invalid mysql_mode value: %s", dbConfig.mysql_mode.c_str());
+        return false;
+    }
+    dbConfig.mysql_load_size = parser.getInteger("Database", "mysql_load_size", 4096);
+    if (dbConfig.mysql_load_size < 1 || dbConfig.mysql_load_size > 1048576) {
+        std::cerr << "Invalid mysql_load_size value: " << dbConfig.mysql_load_size << std::endl;
+        syslog(LOG_ERR, "Invalid mysql_load_size value: %d", dbConfig.mysql_load_size);
+        return false;
+    }
+    dbConfig.mysql_connections = parser.getInteger("Database", "mysql_connections", 2);
+    if (dbConfig.mysql_connections < 0 || dbConfig.mysql_connections > 64) {
+        std::cerr << "Invalid mysql_connections value: " << dbConfig.mysql_connections << std::endl;
+        syslog(LOG_ERR, "Invalid mysql_connections value: %d", dbConfig.mysql_connections);
+        return false;
+    }
+    dbConfig.mysql_queue_rows = parser.getInteger("Database", "mysql_queue_rows", 100000);
+    if (dbConfig.mysql_queue_rows < 1) {
+        std::cerr << "Invalid mysql_queue_rows value: " << dbConfig.mysql_queue_rows << std::endl;
+        syslog(LOG_ERR, "Invalid mysql_queue_rows value: %d", dbConfig.mysql_queue_rows);
+        return false;
+    }
+    dbConfig.mysql_health_interval = parser.getInteger("Database", "mysql_health_interval", 30);
+    if (dbConfig.mysql_health_interval < 1) {
+        std::cerr << "Invalid mysql_health_interval value: " << dbConfig.mysql_health_interval << std::endl;
+        syslog(LOG_ERR, "Invalid mysql_health_interval value: %d", dbConfig.mysql_health_interval);
+        return false;
+    }
+    dbConfig.mysql_flush_interval = parser.getInteger("Database", "mysql_flush_interval", 1000);
+    if (dbConfig.mysql_flush_interval < 0) {
+        std::cerr << "Invalid mysql_flush_interval value: " << dbConfig.mysql_flush_interval << std::endl;
+        syslog(LOG_ERR, "Invalid mysql_flush_interval value: %d", dbConfig.mysql_flush_interval);
+        return false;
+    }
+    dbConfig.postgres_conninfo = parser.get("Database", "postgres_conninfo", "");
+    dbConfig.postgres_connections = parser.getInteger("Database", "postgres_connections", 2);
+    if (dbConfig.postgres_connections < 0 || dbConfig.postgres_connections > 64) {
+        std::cerr << "Invalid postgres_connections value: " << dbConfig.postgres_connections << std::endl;
+        syslog(LOG_ERR, "Invalid postgres_connections value: %d", dbConfig.postgres_connections);
+        return false;
+    }
+    dbConfig.postgres_copy_rows = parser.getInteger("Database", "postgres_copy_rows", 100000);
+    if (dbConfig.postgres_copy_rows < 1) {
+        std::cerr << "Invalid postgres_copy_rows value: " << dbConfig.postgres_copy_rows << std::endl;
+        syslog(LOG_ERR, "Invalid postgres_copy_rows value: %d", dbConfig.postgres_copy_rows);
+        return false;
+    }
+    dbConfig.postgres_flush_interval = parser.getInteger("Database", "postgres_flush_interval", 1000);
+    if (dbConfig.postgres_flush_interval < 0) {
+        std::cerr << "Invalid postgres_flush_interval value: " << dbConfig.postgres_flush_interval << std::endl;
+        syslog(LOG_ERR, "Invalid postgres_flush_interval value: %d", dbConfig.postgres_flush_interval);
+        return false;
+    }
+    dbConfig.postgres_queue_rows = parser.getInteger("Database", "postgres_queue_rows", 1000000);
+    if (dbConfig.postgres_queue_rows < 1) {
+        std::cerr << "Invalid postgres_queue_rows value: " << dbConfig.postgres_queue_rows << std::endl;
+        syslog(LOG_ERR, "Invalid postgres_queue_rows value: %d", dbConfig.postgres_queue_rows);
+        return false;
+    }
+    dbConfig.nfcapd_path = parser.get("Database", "nfcapd_path", "");
+    dbConfig.nfcapd_rotate_interval = parser.getInteger("Database", "nfcapd_rotate_interval", 300);
+    if (dbConfig.nfcapd_rotate_interval < 60 || dbConfig.nfcapd_rotate_interval % 60 != 0) {
+        std::cerr << "Invalid nfcapd_rotate_interval value (a multiple of 60): " << dbConfig.nfcapd_rotate_interval << std::endl;
+        syslog(LOG_ERR, "Invalid nfcapd_rotate_interval value (a multiple of 60): %d", dbConfig.nfcapd_rotate_interval);
+        return false;
+    }
+    dbConfig.nfcapd_flush_interval = parser.getInteger("Database", "nfcapd_flush_interval", 1000);
+    if (dbConfig.nfcapd_flush_interval < 0) {
+        std::cerr << "Invalid nfcapd_flush_interval value: " << dbConfig.nfcapd_flush_interval << std::endl;
+        syslog(LOG_ERR, "Invalid nfcapd_flush_interval value: %d", dbConfig.nfcapd_flush_interval);
+        return false;
+    }
+    if (hasSink("nfcapd") && dbConfig.nfcapd_path.empty()) {
+        std::cerr << "Missing nfcapd_path for database type nfcapd" << std::endl;
+        syslog(LOG_ERR, "Missing nfcapd_path for database type nfcapd");
+        return false;
+    }
+    dbConfig.native_path = parser.get("Database", "native_path", "");
+    dbConfig.native_rotate_interval = parser.getInteger("Database", "native_rotate_interval", 300);
+    if (dbConfig.native_rotate_interval < 0) {
+        std::cerr << "Invalid native_rotate_interval value: " << dbConfig.native_rotate_interval << std::endl;
+        syslog(LOG_ERR, "Invalid native_rotate_interval value: %d", dbConfig.native_rotate_interval);
+        return false;
+    }
+    dbConfig.native_block_rows = parser.getInteger("Database", "native_block_rows", 65536);
+    if (dbConfig.native_block_rows < 1 || dbConfig.native_block_rows > 1048576) {
+        std::cerr << "Invalid native_block_rows value (allowed 1-1048576): " << dbConfig.native_block_rows << std::endl;
+        syslog(LOG_ERR, "Invalid native_block_rows value (allowed 1-1048576): %d", dbConfig.native_block_rows);
+        return false;
+    }
+    dbConfig.native_queue_rows = parser.getInteger("Database", "native_queue_rows", 1000000);
+    if (dbConfig.native_queue_rows < 1) {
+        std::cerr << "Invalid native_queue_rows value: " << dbConfig.native_queue_rows << std::endl;
+        syslog(LOG_ERR, "Invalid native_queue_rows value: %d", dbConfig.native_queue_rows);
+        return false;
+    }
+    if (hasSink("native") && dbConfig.native_path.empty()) {
+        std::cerr << "Missing native_path for database type native" << std::endl;
+        syslog(LOG_ERR, "Missing native_path for database type native");
+        return false;
+    }
+    dbConfig.arrow_path = parser.get("Database", "arrow_path", "");
+    dbConfig.arrow_format = parser.get("Database", "arrow_format", "file");
+    if (dbConfig.arrow_format != "file" && dbConfig.arrow_format != "stream") {
+        std::cerr << "Invalid arrow_format value (allowed file, stream): " << dbConfig.arrow_format << std::endl;
+        syslog(LOG_ERR, "Invalid arrow_format value (allowed file, stream): %s", dbConfig.arrow_format.c_str());
+        return false;
+    }
+    dbConfig.arrow_rotate_interval = parser.getInteger("Database", "arrow_rotate_interval", 300);
+    if (dbConfig.arrow_rotate_interval < 0) {
+        std::cerr << "Invalid arrow_rotate_interval value: " << dbConfig.arrow_rotate_interval << std::endl;
+        syslog(LOG_ERR, "Invalid arrow_rotate_interval value: %d", dbConfig.arrow_rotate_interval);
+        return false;
+    }
+    dbConfig.arrow_batch_rows = parser.getInteger("Database", "arrow_batch_rows", 65536);
+    if (dbConfig.arrow_batch_rows < 1 || dbConfig.arrow_batch_rows > 1048576) {
+        std::cerr << "Invalid arrow_batch_rows value (allowed 1-1048576): " << dbConfig.arrow_batch_rows << std::endl;
+        syslog(LOG_ERR, "Invalid arrow_batch_rows value (allowed 1-1048576): %d", dbConfig.arrow_batch_rows);
+        return false;
+    }
+    dbConfig.arrow_queue_rows = parser.getInteger("Database", "arrow_queue_rows", 1000000);
+    if (dbConfig.arrow_queue_rows < 1) {
+        std::cerr << "Invalid arrow_queue_rows value: " << dbConfig.arrow_queue_rows << std::endl;
+        syslog(LOG_ERR, "Invalid arrow_queue_rows value: %d", dbConfig.arrow_queue_rows);
+        return false;
+    }
+    if (hasSink("arrow") && dbConfig.arrow_path.empty()) {
+        std::cerr << "Missing arrow_path for database type arrow" << std::endl;
+        syslog(LOG_ERR, "Missing arrow_path for database type arrow");
+        return false;
+    }
+
+    // Load general configuration
+    enableLogging = parser.getInteger("General", "log", 0) == 1;
+    recvBatchSize = parser.getInteger("General", "recv_batch", 32);
+    if (recvBatchSize < 1 || recvBatchSize > 1024) {
+        std::cerr << "Invalid recv_batch value (allowed 1-1024): " << recvBatchSize << std::endl;
+        syslog(LOG_ERR, "Invalid recv_batch value (allowed 1-1024): %d", recvBatchSize);
+        return false;
+    }
+    receiveEngine = parser.get("General", "engine", "threads");
+    if (receiveEngine != "threads" && receiveEngine != "epoll" && receiveEngine != "io_uring") {
+        std::cerr << "Receive engine not implemented: " << receiveEngine << std::endl;
+        syslog(LOG_ERR, "Receive engine not implemented: %s", receiveEngine.c_str());
+        return false;
+    }
+    engineThreads = parser.getInteger("General", "engine_threads", 1);
+    if (engineThreads < 1 || engineThreads > 64) {
+        std::cerr << "Invalid engine_threads value (allowed 1-64): " << engineThreads << std::endl;
+        syslog(LOG_ERR, "Invalid engine_threads value (allowed 1-64): %d", engineThreads);
+        return false;
+    }
+    queueSizeKiB = parser.getInteger("General", "queue_size", 4096);
+    if (queueSizeKiB != 0 && (queueSizeKiB < 256 || queueSizeKiB > 1048576 || (queueSizeKiB & (queueSizeKiB - 1)) != 0)) {
+        std::cerr << "Invalid queue_size value (0 or a power of two, 256-1048576 KiB): " << queueSizeKiB << std::endl;
+        syslog(LOG_ERR, "Invalid queue_size value (0 or a power of two, 256-1048576 KiB): %d", queueSizeKiB);
+        return false;
+    }
+    decodeThreads = parser.getInteger("General", "decode_threads", 0);
+    if (decodeThreads < 0 || decodeThreads > 64) {
+        std::cerr << "Invalid decode_threads value (allowed 0-64): " << decodeThreads << std::endl;
+        syslog(LOG_ERR, "Invalid decode_threads value (allowed 0-64): %d", decodeThreads);
+        return false;
+    }
+    statsInterval = parser.getInteger("General", "stats_interval", 0);
+    simdSetting = parser.get("General", "simd", "auto");
+    if (simdSetting != "auto" && simdSetting != "avx2" && simdSetting != "sse4" && simdSetting != "off") {
+        std::cerr << "Invalid simd value (auto, avx2, sse4 or off): " << simdSetting << std::endl;
+        syslog(LOG_ERR, "Invalid simd value (auto, avx2, sse4 or off): %s", simdSetting.c_str());
+        return false;
+    }
+
+    // Load aggregation configuration
+    std::string aggregateKeys = parser.get("Aggregation", "keys", "");
+    aggregationConfig = AggregationConfig();
+    std::istringstream keyList(aggregateKeys);
+    std::string key;
+    while (std::getline(keyList, key, ',')) {
+        key.erase(0, key.find_first_not_of(" \t"));
+        key.erase(key.find_last_not_of(" \t") + 1);
+        if (key == "srcip") {
+            aggregationConfig.key_fields |= AGGREGATE_SOURCE_IP;
+        } else if (key == "dstip") {
+            aggregationConfig.key_fields |= AGGREGATE_DESTINATION_IP;
+        } else if (key == "srcport") {
+            aggregationConfig.key_fields |= AGGREGATE_SOURCE_PORT;
+        } else if (key == "dstport") {
+            aggregationConfig.key_fields |= AGGREGATE_DESTINATION_PORT;
+        } else if (key == "protocol") {
+            aggregationConfig.key_fields |= AGGREGATE_PROTOCOL;
+        } else if (!key.empty()) {
+            std::cerr << "Invalid aggregation key (srcip, dstip, srcport, dstport or protocol): " << key << std::endl;
+            syslog(LOG_ERR, "Invalid aggregation key (srcip, dstip, srcport, dstport or protocol): %s", key.c_str());
+            return false;
+        }
+    }
+    aggregationConfig.active_timeout = parser.getInteger("Aggregation", "active_timeout", 60);
+    if (aggregationConfig.active_timeout < 1 || aggregationConfig.active_timeout > 86400) {
+        std::cerr << "Invalid active_timeout value (allowed 1-86400 s): " << aggregationConfig.active_timeout << std::endl;
+        syslog(LOG_ERR, "Invalid active_timeout value (allowed 1-86400 s): %d", aggregationConfig.active_timeout);
+        return false;
+    }
+    aggregationConfig.inactive_timeout = parser.getInteger("Aggregation", "inactive_timeout", 15);
+    if (aggregationConfig.inactive_timeout < 1 || aggregationConfig.inactive_timeout > 86400) {
+        std::cerr << "Invalid inactive_timeout value (allowed 1-86400 s): " << aggregationConfig.inactive_timeout << std::endl;
+        syslog(LOG_ERR, "Invalid inactive_timeout value (allowed 1-86400 s): %d", aggregationConfig.inactive_timeout);
+        return false;
+    }
+    aggregationConfig.memory_size = parser.getInteger("Aggregation", "memory_size", 64);
+    if (aggregationConfig.memory_size < 1 || aggregationConfig.memory_size > 65536) {
+        std::cerr << "Invalid memory_size value (allowed 1-65536 MiB): " << aggregationConfig.memory_size << std::endl;
+        syslog(LOG_ERR, "Invalid memory_size value (allowed 1-65536 MiB): %d", aggregationConfig.memory_size);
+        return false;
+    }
+
+    // Load probe configurations
+    int sondaCount = parser.getInteger("SondeCount", "count", 0);
+    for (int i = 1; i <= sondaCount; ++i) {
+        std::string section = "Sonda" + std::to_string(i);
+        SondaConfig sonda;
+        sonda.name = parser.get(section, "name", "");
+        sonda.version = parser.get(section, "version", "");
+        sonda.filter_address = parser.get(section, "listen_address", ""); // Use 'listen_address' as 'filter_address'
+        sonda.port = parser.getInteger(section, "port", 0);
+        sonda.threads = parser.getInteger(section, "threads", 1);
+        sonda.steer_by_exporter = parser.get(section, "steering", "hash") == "exporter";
+
+        if (sonda.name.empty() || sonda.port == 0) {
+            std::cerr << "Missing data in configuration for " << section << std::endl;
+            syslog(LOG_ERR, "Missing data in configuration for %s", section.c_str());
+            return false;
+        }
+
+        sonda.filter_addr = htonl(INADDR_ANY);
+        if (!sonda.filter_address.empty()) {
+            struct in_addr addr;
+            if (inet_pton(AF_INET, sonda.filter_address.c_str(), &addr) != 1) {
+                std::cerr << "Invalid listen_address in " << section << ": " << sonda.filter_address << std::endl;
+                syslog(LOG_ERR, "Invalid listen_address in %s: %s", section.c_str(), sonda.filter_address.c_str());
+                return false;
+            }
+            sonda.filter_addr = addr.s_addr;
+        }
+
+        if (sonda.threads < 1 || sonda.threads > 64) {
+            std::cerr << "Invalid threads value in " << section << " (allowed 1-64): " << sonda.threads << std::endl;
+            syslog(LOG_ERR, "Invalid threads value in %s (allowed 1-64): %d", section.c_str(), sonda.threads);
+            return false;
+        }
+
+        sondaConfigs.push_back(sonda);
+    }
+
+    return true;
+}
+
+// Function to create a socket
+// With reusePort set, several sockets can be bound to the same port and the
+// kernel spreads incoming datagrams between them
+int createSocket(int port, bool reusePort = false) {
+    int sockfd;
+    struct sockaddr_in servaddr;
+
+    // Create socket
+    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("Error creating socket");
+        syslog(LOG_ERR, "Error creating socket: %s", strerror(errno));
+        return -1;
+    }
+
+    // Wake up blocked receive calls once a second so the loops can notice shutdown
+    struct timeval timeout;
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (reusePort) {
+        int one = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+            perror("Error setting SO_REUSEPORT");
+            syslog(LOG_ERR, "Error setting SO_REUSEPORT on port %d: %s", port, strerror(errno));
+            close(sockfd);
+            return -1;
+        }
+    }
+
+    // Set address and port
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl(INADDR_ANY); // Bind to all interfaces
+    servaddr.sin_port = htons(port);
+
+    // Bind socket to address and port
+    if (bind(sockfd, (const struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
+        perror("Error binding socket");
+        syslog(LOG_ERR, "Error binding socket on port %d: %s", port, strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+// Function to steer datagrams of a SO_REUSEPORT group by exporter address
+// The classic BPF program returns (IPv4 source address % socketCount), which
+// is the index of the socket (in bind order) that receives the datagram.
+// The kernel falls back to its own 4-tuple hash if the program cannot be run.
+bool attachExporterSteering(int sockfd, int socketCount) {
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_NET_OFF + 12) }, // A = IPv4 source address
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<uint32_t>(socketCount) },     // A %= socketCount
+        { BPF_RET | BPF_A, 0, 0, 0 },                                                 // return A
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        perror("Error attaching reuseport steering program");
+        syslog(LOG_ERR, "Error attaching reuseport steering program: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Templates are scoped per exporter: source address and source ID from the
+// packet header together with the template ID
+struct TemplateKey {
+    uint32_t exporter;
+    uint32_t source_id;
+    uint16_t template_id;
+
+    bool operator<(const TemplateKey& other) const {
+        if (exporter != other.exporter) return exporter < other.exporter;
+        if (source_id != other.source_id) return source_id < other.source_id;
+        return template_id < other.template_id;
+    }
+};
+
+// One template field; IPFIX enterprise-specific elements have a non-zero enterprise number
+struct TemplateField {
+    uint16_t type;
+    uint16_t length;                // VARIABLE_LENGTH for IPFIX variable-length fields
+    uint32_t enterprise;
+};
+
+const uint16_t VARIABLE_LENGTH = 0xFFFF;
+
+typedef std::vector<TemplateField> TemplateFields;
+
+// FlowData members a template field can be decoded into
+enum FlowSlot : uint8_t {
+    SLOT_SOURCE_IP,
+    SLOT_DESTINATION_IP,
+    SLOT_SOURCE_PORT,
+    SLOT_DESTINATION_PORT,
+    SLOT_PROTOCOL,
+    SLOT_PACKET_COUNT,
+    SLOT_BYTE_COUNT,
+    SLOT_COUNT
+};
+
+typedef void (*FieldConverter)(const char* field, uint16_t width, FlowData& flow);
+
+// One field of a compiled template: where it is in the record and how it is stored
+struct DecodeStep {
+    uint16_t offset;
+    uint16_t width;
+    FlowSlot slot;
+    FieldConverter convert;
+};
+
+typedef void (*RecordDecoder)(const char* record, FlowData& flow);
+
+// One field of a template with variable-length fields, walked record by record
+struct FieldWalk {
+    uint16_t length;                // VARIABLE_LENGTH: the record carries the length
+    FieldConverter convert;         // Null for fields that are not stored
+};
+
+// Where each stored field sits in a record, for decoding a flowset column by column
+struct BatchLayout {
+    bool usable = false;        // Every stored field can be gathered
+    int16_t offset[SLOT_COUNT]; // -1 when the template has no such field
+    uint8_t width[SLOT_COUNT];
+};
+
+// Template compiled once when it arrives: fields that are not stored are
+// dropped, so decoding a record is a straight run over the remaining steps.
+// Templates matching a well-known exporter layout use its specialized decoder.
+// Records of templates with variable-length fields have no fixed offsets and
+// are decoded by walking all fields (decodeVariable).
+struct DecodePlan {
+    TemplateFields fields;          // Template as received
+    size_t recordLength;            // Minimum record length if variableLength
+    std::vector<DecodeStep> steps;
+    RecordDecoder fixedDecoder = nullptr; // Specialized decoder of a known layout
+    int knownLayout = -1;                 // Index into knownLayouts, -1 for the generic steps
+    BatchLayout batch;
+    bool options = false;           // Options template: records describe the exporter, not flows
+    bool variableLength = false;
+    std::vector<FieldWalk> walk;    // All fields, used if variableLength
+
+    void decode(const char* record, FlowData& flow) const {
+        if (fixedDecoder) {
+            fixedDecoder(record, flow);
+            return;
+        }
+        for (const DecodeStep& step : steps) {
+            step.convert(record + step.offset, step.width, flow);
+        }
+    }
+
+    // Function to decode a record with variable-length fields; returns its length, 0 if truncated
+    size_t decodeVariable(const char* record, size_t available, FlowData& flow) const;
+};
+
+// Big-endian unsigned integer of any width up to 8 bytes
+inline uint64_t readBigEndian(const char* p, uint16_t width) {
+    uint64_t v = 0;
+    for (uint16_t i = 0; i < width; ++i) {
+        v = (v << 8) | static_cast<uint8_t>(p[i]);
+    }
+    return v;
+}
+
+// Big-endian unsigned integer of a fixed width, specialized for 1, 2, 4 and 8 bytes
+template <int Width> inline uint64_t readBigEndian(const char* p) { return readBigEndian(p, Width); }
+template <> inline uint64_t readBigEndian<1>(const char* p) { return static_cast<uint8_t>(*p); }
+template <> inline uint64_t readBigEndian<2>(const char* p) { uint16_t v; std::memcpy(&v, p, 2); return ntohs(v); }
+template <> inline uint64_t readBigEndian<4>(const char* p) { uint32_t v; std::memcpy(&v, p, 4); return ntohl(v); }
+template <> inline uint64_t readBigEndian<8>(const char* p) { uint64_t v; std::memcpy(&v, p, 8); return be64toh(v); }
+
+template <typename T, T FlowData::*Member, int Width>
+void convertUnsigned(const char* field, uint16_t, FlowData& flow) {
+    flow.*Member = static_cast<T>(readBigEndian<Width>(field));
+}
+
+template <typename T, T FlowData::*Member>
+void convertUnsignedAnyWidth(const char* field, uint16_t width, FlowData& flow) {
+    flow.*Member = static_cast<T>(readBigEndian(field, width));
+}
+
+template <FlowAddress FlowData::*Member>
+void convertIPv4(const char* field, uint16_t, FlowData& flow) {
+    setIPv4(flow.*Member, field);
+}
+
+template <FlowAddress FlowData::*Member>
+void convertIPv6(const char* field, uint16_t, FlowData& flow) {
+    setIPv6(flow.*Member, field);
+}
+
+// Converter for an unsigned FlowData member, specialized for the common widths
+template <typename T, T FlowData::*Member>
+FieldConverter unsignedConverter(uint16_t width) {
+    switch (width) {
+        case 1: return convertUnsigned<T, Member, 1>;
+        case 2: return convertUnsigned<T, Member, 2>;
+        case 4: return convertUnsigned<T, Member, 4>;
+        case 8: return convertUnsigned<T, Member, 8>;
+        default: return convertUnsignedAnyWidth<T, Member>;
+    }
+}
+
+// Well-known exporter templates
+// Each layout lists its (field type, length) pairs; FixedLayoutDecoder turns
+// it into a decoder with all offsets and widths fixed at compile time.
+// Further layouts only need a struct here and an entry in knownLayouts.
+
+// MikroTik RouterOS IPv4 (the exporter in 'sample data income')
+struct MikroTikIPv4Layout {
+    static constexpr size_t count = 26;
+    static constexpr uint16_t fields[count][2] = {
+        {21, 4}, {22, 4}, {2, 4}, {1, 4}, {10, 4}, {14, 4}, {8, 4}, {12, 4}, {4, 1}, {5, 1}, {7, 2}, {11, 2}, {15, 4},
+        {13, 1}, {9, 1}, {6, 1}, {34, 4}, {35, 1}, {80, 6}, {56, 6}, {57, 6}, {81, 6}, {225, 4}, {226, 4}, {227, 2}, {228, 2}
+    };
+};
+constexpr uint16_t MikroTikIPv4Layout::fields[MikroTikIPv4Layout::count][2];
+
+// softflowd IPv4
+struct SoftflowdIPv4Layout {
+    static constexpr size_t count = 14;
+    static constexpr uint16_t fields[count][2] = {
+        {8, 4}, {12, 4}, {21, 4}, {22, 4}, {1, 4}, {2, 4}, {10, 4}, {14, 4}, {7, 2}, {11, 2}, {4, 1}, {6, 1}, {60, 1}, {5, 1}
+    };
+};
+constexpr uint16_t SoftflowdIPv4Layout::fields[SoftflowdIPv4Layout::count][2];
+
+// NetFlow v5 compatible record: Cisco IOS default IPv4 template, also the nProbe default
+struct V5CompatibleLayout {
+    static constexpr size_t count = 18;
+    static constexpr uint16_t fields[count][2] = {
+        {8, 4}, {12, 4}, {15, 4}, {10, 2}, {14, 2}, {2, 4}, {1, 4}, {22, 4}, {21, 4}, {7, 2}, {11, 2}, {6, 1}, {4, 1},
+        {5, 1}, {16, 2}, {17, 2}, {9, 1}, {13, 1}
+    };
+};
+constexpr uint16_t V5CompatibleLayout::fields[V5CompatibleLayout::count][2];
+
+// The same with 4-byte interface indexes and AS numbers (nProbe 7 and later)
+struct V5CompatibleWideLayout {
+    static constexpr size_t count = 18;
+    static constexpr uint16_t fields[count][2] = {
+        {8, 4}, {12, 4}, {15, 4}, {10, 4}, {14, 4}, {2, 4}, {1, 4}, {22, 4}, {21, 4}, {7, 2}, {11, 2}, {6, 1}, {4, 1},
+        {5, 1}, {16, 4}, {17, 4}, {9, 1}, {13, 1}
+    };
+};
+constexpr uint16_t V5CompatibleWideLayout::fields[V5CompatibleWideLayout::count][2];
+
+// Offset of the first field of a type in a layout, -1 if the layout has none
+template <typename Layout>
+constexpr int layoutOffset(uint16_t type) {
+    int offset = 0;
+    for (size_t i = 0; i < Layout::count; ++i) {
+        if (Layout::fields[i][0] == type) return offset;
+        offset += Layout::fields[i][1];
+    }
+    return -1;
+}
+
+template <typename Layout>
+constexpr int layoutWidth(uint16_t type) {
+    for (size_t i = 0; i < Layout::count; ++i) {
+        if (Layout::fields[i][0] == type) return Layout::fields[i][1];
+    }
+    return 0;
+}
+
+// One field at a fixed offset; the specialization for -1 (field absent) compiles to nothing
+template <int Offset, int Width>
+struct FixedField {
+    template <typename T>
+    static void storeUnsigned(const char* record, T& out) { out = static_cast<T>(readBigEndian<Width>(record + Offset)); }
+
+    static void storeIPv4(const char* record, FlowAddress& out) {
+        static_assert(Width == 4, "IPv4 address fields are 4 bytes");
+        setIPv4(out, record + Offset);
+    }
+};
+
+template <int Width>
+struct FixedField<-1, Width> {
+    template <typename T>
+    static void storeUnsigned(const char*, T&) {}
+    static void storeIPv4(const char*, FlowAddress&) {}
+};
+
+template <typename Layout>
+struct FixedLayoutDecoder {
+    static void decode(const char* record, FlowData& flow) {
+        FixedField<layoutOffset<Layout>(8), layoutWidth<Layout>(8)>::storeIPv4(record, flow.SourceIP);
+        FixedField<layoutOffset<Layout>(12), layoutWidth<Layout>(12)>::storeIPv4(record, flow.DestinationIP);
+        FixedField<layoutOffset<Layout>(7), layoutWidth<Layout>(7)>::storeUnsigned(record, flow.SourcePort);
+        FixedField<layoutOffset<Layout>(11), layoutWidth<Layout>(11)>::storeUnsigned(record, flow.DestinationPort);
+        FixedField<layoutOffset<Layout>(4), layoutWidth<Layout>(4)>::storeUnsigned(record, flow.Protocol);
+        FixedField<layoutOffset<Layout>(2), layoutWidth<Layout>(2)>::storeUnsigned(record, flow.PacketCount);
+        FixedField<layoutOffset<Layout>(1), layoutWidth<Layout>(1)>::storeUnsigned(record, flow.ByteCount);
+    }
+};
+
+struct KnownLayout {
+    const char* name;
+    const uint16_t (*fields)[2];
+    size_t count;
+    RecordDecoder decode;
+};
+
+const KnownLayout knownLayouts[] = {
+    { "mikrotik-ipv4", MikroTikIPv4Layout::fields, MikroTikIPv4Layout::count, FixedLayoutDecoder<MikroTikIPv4Layout>::decode },
+    { "softflowd-ipv4", SoftflowdIPv4Layout::fields, SoftflowdIPv4Layout::count, FixedLayoutDecoder<SoftflowdIPv4Layout>::decode },
+    { "v5-compatible", V5CompatibleLayout::fields, V5CompatibleLayout::count, FixedLayoutDecoder<V5CompatibleLayout>::decode },
+    { "v5-compatible-wide", V5CompatibleWideLayout::fields, V5CompatibleWideLayout::count, FixedLayoutDecoder<V5CompatibleWideLayout>::decode },
+};
+const size_t KNOWN_LAYOUT_COUNT = sizeof(knownLayouts) / sizeof(knownLayouts[0]);
+
+// Records decoded per known layout, then by the generic decode plans and by the batch decoder
+const size_t DECODED_GENERIC = KNOWN_LAYOUT_COUNT;
+const size_t DECODED_BATCH = KNOWN_LAYOUT_COUNT + 1;
+std::atomic<uint64_t> decodedRecords[KNOWN_LAYOUT_COUNT + 2];
+
+// Function to find the known layout matching a template, -1 if there is none
+int findKnownLayout(const TemplateFields& fields) {
+    for (size_t i = 0; i < KNOWN_LAYOUT_COUNT; ++i) {
+        const KnownLayout& layout = knownLayouts[i];
+        if (layout.count != fields.size()) {
+            continue;
+        }
+        size_t f = 0;
+        while (f < fields.size() && fields[f].enterprise == 0 &&
+               fields[f].type == layout.fields[f][0] && fields[f].length == layout.fields[f][1]) {
+            ++f;
+        }
+        if (f == fields.size()) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+// Function to compile a NetFlow v9 or IPFIX template into a decode plan
+std::shared_ptr<DecodePlan> compileDecodePlan(const TemplateFields& fields, bool options = false) {
+    auto plan = std::make_shared<DecodePlan>();
+    plan->fields = fields;
+    plan->options = options;
+    size_t offset = 0;
+    for (const auto& field : fields) {
+        DecodeStep step;
+        step.offset = static_cast<uint16_t>(offset);
+        step.width = field.length;
+        step.convert = nullptr;
+        bool isUnsigned = field.length >= 1 && field.length <= 8;
+        // Enterprise-specific elements and options records are not stored
+        switch (field.enterprise != 0 || options ? 0 : field.type) {
+            case 8: // Source IP
+                if (field.length == 4) { step.slot = SLOT_SOURCE_IP; step.convert = convertIPv4<&FlowData::SourceIP>; }
+                break;
+            case 12: // Destination IP
+                if (field.length == 4) { step.slot = SLOT_DESTINATION_IP; step.convert = convertIPv4<&FlowData::DestinationIP>; }
+                break;
+            case 27: // Source IPv6
+                if (field.length == 16) { step.slot = SLOT_SOURCE_IP; step.convert = convertIPv6<&FlowData::SourceIP>; }
+                break;
+            case 28: // Destination IPv6
+                if (field.length == 16) { step.slot = SLOT_DESTINATION_IP; step.convert = convertIPv6<&FlowData::DestinationIP>; }
+                break;
+            case 7: // Source Port
+                if (isUnsigned) { step.slot = SLOT_SOURCE_PORT; step.convert = unsignedConverter<uint16_t, &FlowData::SourcePort>(field.length); }
+                break;
+            case 11: // Destination Port
+                if (isUnsigned) { step.slot = SLOT_DESTINATION_PORT; step.convert = unsignedConverter<uint16_t, &FlowData::DestinationPort>(field.length); }
+                break;
+            case 4: // Protocol
+                if (isUnsigned) { step.slot = SLOT_PROTOCOL; step.convert = unsignedConverter<uint8_t, &FlowData::Protocol>(field.length); }
+                break;
+            case 2: // Packet Count
+                if (isUnsigned) { step.slot = SLOT_PACKET_COUNT; step.convert = unsignedConverter<uint64_t, &FlowData::PacketCount>(field.length); }
+                break;
+            case 1: // Byte Count
+                if (isUnsigned) { step.slot = SLOT_BYTE_COUNT; step.convert = unsignedConverter<uint64_t, &FlowData::ByteCount>(field.length); }
+                break;
+            default:
+                // Ignore other fields
+                break;
+        }
+        if (step.convert) {
+            plan->steps.push_back(step);
+        }
+        FieldWalk walk = { field.length, step.convert };
+        plan->walk.push_back(walk);
+        if (field.length == VARIABLE_LENGTH) {
+            plan->variableLength = true;
+            offset += 1; // Shortest encoding: a single length byte
+        } else {
+            offset += field.length;
+        }
+    }
+    plan->recordLength = offset;
+    if (plan->variableLength) {
+        plan->steps.clear();
+        plan->batch.usable = false;
+        return plan;
+    }
+    plan->walk.clear();
+    plan->knownLayout = options ? -1 : findKnownLayout(fields);
+    if (plan->knownLayout >= 0) {
+        plan->fixedDecoder = knownLayouts[plan->knownLayout].decode;
+    }
+
+    // Batch layout: a later field of the same kind wins, as with the steps.
+    // Fields are gathered as the 4 bytes ending at their last byte, which
+    // must not start before the record; only counters may be 8 bytes wide.
+    BatchLayout& batch = plan->batch;
+    std::fill(batch.offset, batch.offset + SLOT_COUNT, -1);
+    std::fill(batch.width, batch.width + SLOT_COUNT, 0);
+    batch.usable = !plan->steps.empty();
+    for (const DecodeStep& step : plan->steps) {
+        bool counter = step.slot == SLOT_PACKET_COUNT || step.slot == SLOT_BYTE_COUNT;
+        bool gatherable = step.width <= 4 ? step.offset + step.width >= 4 : counter && step.width == 8;
+        batch.usable = batch.usable && gatherable;
+        batch.offset[step.slot] = static_cast<int16_t>(step.offset);
+        batch.width[step.slot] = static_cast<uint8_t>(step.width);
+    }
+    return plan;
+}
+
+size_t DecodePlan::decodeVariable(const char* record, size_t available, FlowData& flow) const {
+    size_t offset = 0;
+    for (const FieldWalk& field : walk) {
+        size_t width = field.length;
+        if (field.length == VARIABLE_LENGTH) {
+            // One length byte, or 255 followed by a 2-byte length (RFC 7011, 7.)
+            if (offset + 1 > available) return 0;
+            width = static_cast<uint8_t>(record[offset++]);
+            if (width == 255) {
+                if (offset + 2 > available) return 0;
+                width = readBigEndian<2>(record + offset);
+                offset += 2;
+            }
+        }
+        if (offset + width > available) return 0;
+        if (field.convert) {
+            field.convert(record + offset, static_cast<uint16_t>(width), flow);
+        }
+        offset += width;
+    }
+    return offset;
+}
+
+// Batch decoding
+// A data flowset is a run of fixed-length records, so each stored field is a
+// strided column: the batch decoder gathers one field from many records at
+// a time, byte-swaps it with a shuffle and writes it to a columnar array.
+// Kernels are chosen at startup by the 'simd' setting and the CPU.
+
+// Decoded flowset, one array per stored field (addresses in host byte order)
+struct FlowColumns {
+    size_t count = 0;
+    std::vector<uint32_t> sourceIP;
+    std::vector<uint32_t> destinationIP;
+    std::vector<uint32_t> sourcePort;
+    std::vector<uint32_t> destinationPort;
+    std::vector<uint32_t> protocol;
+    std::vector<uint64_t> packetCount;
+    std::vector<uint64_t> byteCount;
+
+    void resize(size_t n) {
+        count = n;
+        if (sourceIP.size() < n) {
+            sourceIP.resize(n);
+            destinationIP.resize(n);
+            sourcePort.resize(n);
+            destinationPort.resize(n);
+            protocol.resize(n);
+            packetCount.resize(n);
+            byteCount.resize(n);
+        }
+    }
+
+    // Function to fill a FlowData from one row, leaving fields the template does not have untouched
+    void row(size_t r, const BatchLayout& layout, FlowData& flow) const {
+        if (layout.offset[SLOT_SOURCE_IP] >= 0) {
+            uint32_t address = htonl(sourceIP[r]);
+            setIPv4(flow.SourceIP, &address);
+        }
+        if (layout.offset[SLOT_DESTINATION_IP] >= 0) {
+            uint32_t address = htonl(destinationIP[r]);
+            setIPv4(flow.DestinationIP, &address);
+        }
+        if (layout.offset[SLOT_SOURCE_PORT] >= 0) flow.SourcePort = static_cast<uint16_t>(sourcePort[r]);
+        if (layout.offset[SLOT_DESTINATION_PORT] >= 0) flow.DestinationPort = static_cast<uint16_t>(destinationPort[r]);
+        if (layout.offset[SLOT_PROTOCOL] >= 0) flow.Protocol = static_cast<uint8_t>(protocol[r]);
+        if (layout.offset[SLOT_PACKET_COUNT] >= 0) flow.PacketCount = packetCount[r];
+        if (layout.offset[SLOT_BYTE_COUNT] >= 0) flow.ByteCount = byteCount[r];
+    }
+};
+
+// Gather one field of 'count' records spaced 'stride' bytes apart
+typedef void (*ColumnGather32)(const char* records, size_t stride, size_t count, int offset, int width, uint32_t* out);
+typedef void (*ColumnGather64)(const char* records, size_t stride, size_t count, int offset, int width, uint64_t* out);
+
+struct BatchKernels {
+    const char* name;
+    ColumnGather32 gather32;
+    ColumnGather64 gather64;
+};
+
+inline int loadUnaligned32(const char* p) { int v; std::memcpy(&v, p, 4); return v; }
+inline long long loadUnaligned64(const char* p) { long long v; std::memcpy(&v, p, 8); return v; }
+
+// Mask keeping the low 'width' bytes of a gathered 32-bit word
+inline uint32_t fieldMask32(int width) { return width >= 4 ? 0xFFFFFFFFu : (1u << (8 * width)) - 1; }
+
+void gatherColumn32Scalar(const char* records, size_t stride, size_t count, int offset, int width, uint32_t* out) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = static_cast<uint32_t>(readBigEndian(records + i * stride + offset, width));
+    }
+}
+
+void gatherColumn64Scalar(const char* records, size_t stride, size_t count, int offset, int width, uint64_t* out) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = readBigEndian(records + i * stride + offset, width);
+    }
+}
+
+__attribute__((target("sse4.1")))
+void gatherColumn32SSE4(const char* records, size_t stride, size_t count, int offset, int width, uint32_t* out) {
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m128i mask = _mm_set1_epi32(static_cast<int>(fieldMask32(width)));
+    const char* p = records + offset + width - 4;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4, p += 4 * stride) {
+        __m128i v = _mm_setr_epi32(loadUnaligned32(p), loadUnaligned32(p + stride),
+                                   loadUnaligned32(p + 2 * stride), loadUnaligned32(p + 3 * stride));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_and_si128(_mm_shuffle_epi8(v, swap), mask));
+    }
+    gatherColumn32Scalar(records + i * stride, stride, count - i, offset, width, out + i);
+}
+
+__attribute__((target("sse4.1")))
+void gatherColumn64SSE4(const char* records, size_t stride, size_t count, int offset, int width, uint64_t* out) {
+    size_t i = 0;
+    if (width == 8) {
+        const __m128i swap = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+        const char* p = records + offset;
+        for (; i + 2 <= count; i += 2, p += 2 * stride) {
+            __m128i v = _mm_set_epi64x(loadUnaligned64(p + stride), loadUnaligned64(p));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_shuffle_epi8(v, swap));
+        }
+    } else {
+        const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        const __m128i mask = _mm_set1_epi32(static_cast<int>(fieldMask32(width)));
+        const char* p = records + offset + width - 4;
+        for (; i + 4 <= count; i += 4, p += 4 * stride) {
+            __m128i v = _mm_setr_epi32(loadUnaligned32(p), loadUnaligned32(p + stride),
+                                       loadUnaligned32(p + 2 * stride), loadUnaligned32(p + 3 * stride));
+            v = _mm_and_si128(_mm_shuffle_epi8(v, swap), mask);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_cvtepu32_epi64(v));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 2), _mm_cvtepu32_epi64(_mm_srli_si128(v, 8)));
+        }
+    }
+    gatherColumn64Scalar(records + i * stride, stride, count - i, offset, width, out + i);
+}
+
+__attribute__((target("avx2")))
+void gatherColumn32AVX2(const char* records, size_t stride, size_t count, int offset, int width, uint32_t* out) {
+    const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i mask = _mm256_set1_epi32(static_cast<int>(fieldMask32(width)));
+    const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(static_cast<int>(stride)));
+    const char* p = records + offset + width - 4;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8, p += 8 * stride) {
+        __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(p), index, 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_and_si256(_mm256_shuffle_epi8(v, swap), mask));
+    }
+    gatherColumn32Scalar(records + i * stride, stride, count - i, offset, width, out + i);
+}
+
+__attribute__((target("avx2")))
+void gatherColumn64AVX2(const char* records, size_t stride, size_t count, int offset, int width, uint64_t* out) {
+    size_t i = 0;
+    if (width == 8) {
+        const __m256i swap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                              7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+        const __m128i index = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(static_cast<int>(stride)));
+        const char* p = records + offset;
+        for (; i + 4 <= count; i += 4, p += 4 * stride) {
+            __m256i v = _mm256_i32gather_epi64(reinterpret_cast<const long long*>(p), index, 1);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_shuffle_epi8(v, swap));
+        }
+    } else {
+        const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                              3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        const __m256i mask = _mm256_set1_epi32(static_cast<int>(fieldMask32(width)));
+        const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(static_cast<int>(stride)));
+        const char* p = records + offset + width - 4;
+        for (; i + 8 <= count; i += 8, p += 8 * stride) {
+            __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(p), index, 1);
+            v = _mm256_and_si256(_mm256_shuffle_epi8(v, swap), mask);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu32_epi64(_mm256_castsi256_si128(v)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 4), _mm256_cvtepu32_epi64(_mm256_extracti128_si256(v, 1)));
+        }
+    }
+    gatherColumn64Scalar(records + i * stride, stride, count - i, offset, width, out + i);
+}
+
+const BatchKernels scalarKernels = { "scalar", gatherColumn32Scalar, gatherColumn64Scalar };
+const BatchKernels sse4Kernels = { "sse4", gatherColumn32SSE4, gatherColumn64SSE4 };
+const BatchKernels avx2Kernels = { "avx2", gatherColumn32AVX2, gatherColumn64AVX2 };
+
+// Kernels of the batch decoder; null decodes record by record with the decode plans
+const BatchKernels* batchKernels = nullptr;
+
+// Smallest flowset worth decoding column by column
+const size_t BATCH_MIN_RECORDS = 4;
+
+// Function to choose the batch decoder kernels ('auto', 'avx2', 'sse4' or 'off')
+void selectBatchKernels(const std::string& setting) {
+    __builtin_cpu_init();
+    bool haveAVX2 = __builtin_cpu_supports("avx2");
+    bool haveSSE4 = __builtin_cpu_supports("sse4.1");
+    if (setting == "off") {
+        batchKernels = nullptr;
+    } else if (setting == "auto") {
+        batchKernels = haveAVX2 ? &avx2Kernels : haveSSE4 ? &sse4Kernels : nullptr;
+    } else if (setting == "avx2" || setting == "sse4") {
+        if (!(setting == "avx2" ? haveAVX2 : haveSSE4)) {
+            std::cerr << "CPU does not support " << setting << ", decoding record by record." << std::endl;
+            syslog(LOG_WARNING, "CPU does not support %s, decoding record by record.", setting.c_str());
+            batchKernels = nullptr;
+            return;
+        }
+        batchKernels = setting == "avx2" ? &avx2Kernels : &sse4Kernels;
+    }
+}
+
+// Function to decode 'count' records of a data flowset into columns
+void decodeFlowSetColumns(const BatchKernels& kernels, const DecodePlan& plan, const char* records, size_t count, FlowColumns& columns) {
+    const BatchLayout& layout = plan.batch;
+    size_t stride = plan.recordLength;
+    columns.resize(count);
+    if (layout.offset[SLOT_SOURCE_IP] >= 0) kernels.gather32(records, stride, count, layout.offset[SLOT_SOURCE_IP], layout.width[SLOT_SOURCE_IP], columns.sourceIP.data());
+    if (layout.offset[SLOT_DESTINATION_IP] >= 0) kernels.gather32(records, stride, count, layout.offset[SLOT_DESTINATION_IP], layout.width[SLOT_DESTINATION_IP], columns.destinationIP.data());
+    if (layout.offset[SLOT_SOURCE_PORT] >= 0) kernels.gather32(records, stride, count, layout.offset[SLOT_SOURCE_PORT], layout.width[SLOT_SOURCE_PORT], columns.sourcePort.data());
+    if (layout.offset[SLOT_DESTINATION_PORT] >= 0) kernels.gather32(records, stride, count, layout.offset[SLOT_DESTINATION_PORT], layout.width[SLOT_DESTINATION_PORT], columns.destinationPort.data());
+    if (layout.offset[SLOT_PROTOCOL] >= 0) kernels.gather32(records, stride, count, layout.offset[SLOT_PROTOCOL], layout.width[SLOT_PROTOCOL], columns.protocol.data());
+    if (layout.offset[SLOT_PACKET_COUNT] >= 0) kernels.gather64(records, stride, count, layout.offset[SLOT_PACKET_COUNT], layout.width[SLOT_PACKET_COUNT], columns.packetCount.data());
+    if (layout.offset[SLOT_BYTE_COUNT] >= 0) kernels.gather64(records, stride, count, layout.offset[SLOT_BYTE_COUNT], layout.width[SLOT_BYTE_COUNT], columns.byteCount.data());
+}
+
+// Bounded lock-free single-producer/single-consumer ring carrying raw
+// datagrams from a receive thread to a decode worker. Entries (header with
+// the source address, then the payload) are stored back to back at 8-byte
+// alignment; an entry that does not fit before the end of the buffer is
+// preceded by a wrap marker and stored at the start instead.
+// head and tail are running byte counts; each side caches the other's index
+// and only reloads it when the ring looks full/empty.
+class DatagramRing {
+public:
+    struct Entry {
+        uint32_t length;
+        uint32_t reserved;
+        struct sockaddr_in source;
+        // Followed by the payload
+        const char* payload() const { return reinterpret_cast<const char*>(this + 1); }
+        char* payload() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+private:
+    static const uint32_t WRAP_MARKER = 0xFFFFFFFF;
+
+    std::unique_ptr<uint64_t[]> storage; // Not zeroed: pages are only touched when used
+    size_t capacity;
+    size_t mask;
+
+    // Producer and consumer state on separate cache lines
+    char pad0[64];
+    std::atomic<uint64_t> tail;
+    uint64_t cachedHead;
+    char pad1[64];
+    std::atomic<uint64_t> head;
+    uint64_t cachedTail;
+    char pad2[64];
+
+    static size_t entrySize(size_t length) { return (sizeof(Entry) + length + 7) & ~static_cast<size_t>(7); }
+    Entry* at(uint64_t position) { return reinterpret_cast<Entry*>(reinterpret_cast<char*>(storage.get()) + (position & mask)); }
+
+public:
+    // capacity must be a power of two and at least 128 KiB (two maximum size datagrams)
+    explicit DatagramRing(size_t capacity)
+        : storage(new uint64_t[capacity / sizeof(uint64_t)]), capacity(capacity), mask(capacity - 1),
+          tail(0), cachedHead(0), head(0), cachedTail(0) {}
+
+    // Producer: copy a datagram into the ring, false if there is no room
+    bool push(const char* data, size_t length, const struct sockaddr_in& source) {
+        size_t need = entrySize(length);
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        size_t offset = t & mask;
+        size_t pad = (capacity - offset < need) ? capacity - offset : 0;
+        if (t + pad + need - cachedHead > capacity) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t + pad + need - cachedHead > capacity) {
+                return false;
+            }
+        }
+        if (pad) {
+            at(t)->length = WRAP_MARKER;
+            t += pad;
+        }
+        Entry* entry = at(t);
+        entry->length = static_cast<uint32_t>(length);
+        entry->source = source;
+        std::memcpy(entry->payload(), data, length);
+        tail.store(t + need, std::memory_order_seq_cst); // seq_cst pairs with the worker's sleeping flag
+        return true;
+    }
+
+    // Consumer: oldest entry or nullptr if the ring is empty
+    Entry* front() {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if (h == cachedTail) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h == cachedTail) {
+                return nullptr;
+            }
+        }
+        Entry* entry = at(h);
+        if (entry->length == WRAP_MARKER) {
+            // The producer publishes the marker and the next entry together
+            h += capacity - (h & mask);
+            head.store(h, std::memory_order_release);
+            entry = at(h);
+        }
+        return entry;
+    }
+
+    // Consumer: release the entry returned by front()
+    void pop(const Entry* entry) {
+        head.store(head.load(std::memory_order_relaxed) + entrySize(entry->length), std::memory_order_release);
+    }
+
+    bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_seq_cst); }
+
+    // Bytes currently queued (approximate when read from another thread)
+    size_t usedBytes() const { return static_cast<size_t>(tail.load(std::memory_order_relaxed) - head.load(std::memory_order_relaxed)); }
+    size_t capacityBytes() const { return capacity; }
+};
+
+class DecodeWorker;
+
+struct SondaRuntime;
+
+// One receive socket of a probe with its own decode path (receive thread and database handler)
+struct SondaReceiver {
+    SondaRuntime* sonda = nullptr;
+    int socket_fd = -1;
+    std::unique_ptr<DatabaseHandler> dbHandler;
+
+    // Datagram queue to the decode worker (nullptr: decode on the receive thread)
+    std::unique_ptr<DatagramRing> queue;
+    DecodeWorker* worker = nullptr;
+
+    // Without a queue and with engine = epoll: held by the thread decoding from
+    // the socket, so an idle engine thread can tick the handler in between
+    std::mutex decodeMutex;
+
+    // Statistics
+    std::atomic<uint64_t> datagrams{0};      // Received
+    std::atomic<uint64_t> queued{0};         // Pushed to the queue
+    std::atomic<uint64_t> decoded{0};        // Taken from the queue and decoded
+    std::atomic<uint64_t> queueOverflows{0}; // Dropped because the queue was full
+    std::atomic<uint64_t> queueHighWater{0}; // Largest queue fill seen, in bytes
+};
+
+struct SondaRuntime {
+    SondaConfig config;
+    uint16_t id = 0;                // Index in sondaConfigs, stored as FlowData::ProbeID
+    std::deque<SondaReceiver> receivers;
+
+    // Template state is shared by all receivers of the probe, so it stays
+    // consistent for an exporter whichever socket its packets arrive on
+    std::mutex templateMutex;
+    std::map<TemplateKey, std::shared_ptr<const DecodePlan>> templates; // Compiled on arrival
+};
+
+std::deque<SondaRuntime> sondaRuntimes; // deque: runtimes hold a mutex and are never moved
+
+// Function to create the handler of one sink type
+// SQLite and pooled MySQL/PostgreSQL receivers share writer threads; 'direct' opens an own connection (--checkdb, spooling sink queues)
+std::unique_ptr<DatabaseHandler> createSinkHandler(const std::string& type, bool direct = false) {
+    if (type == "sqlite") {
+        if (direct) {
+            return std::make_unique<SQLiteHandler>(dbConfig);
+        }
+        if (!sqliteWriter) {
+            sqliteWriter.reset(new SQLiteWriter(dbConfig));
+        }
+        return std::make_unique<BatchQueueHandler>(*sqliteWriter, dbConfig.sqlite_batch_size, dbConfig.sqlite_flush_interval);
+    } else if (type == "mysql") {
+        if (direct || dbConfig.mysql_connections == 0) {
+            return std::make_unique<MySQLHandler>(dbConfig);
+        }
+        if (!mysqlPool) {
+            mysqlPool.reset(new MySQLWriterPool(dbConfig));
+        }
+        return std::make_unique<BatchQueueHandler>(*mysqlPool, dbConfig.mysql_batch_size, dbConfig.mysql_flush_interval);
+    } else if (type == "postgres") {
+        if (direct || dbConfig.postgres_connections == 0) {
+            return std::make_unique<PostgresHandler>(dbConfig);
+        }
+        if (!postgresPool) {
+            postgresPool.reset(new PostgresWriterPool(dbConfig));
+        }
+        // Receivers hand over batches of 4096 rows, or what they have after postgres_flush_interval ms
+        return std::make_unique<BatchQueueHandler>(*postgresPool, 4096, dbConfig.postgres_flush_interval);
+    } else if (type == "csv") {
+        if (dbConfig.csv_rotate_interval || dbConfig.csv_compress != "none") {
+            if (!csvWriter) {
+                csvWriter.reset(new CSVFileWriter(dbConfig));
+            }
+            return std::make_unique<CSVHandler>(dbConfig, csvWriter.get());
+        }
+        return std::make_unique<CSVHandler>(dbConfig);
+    } else if (type == "nfcapd") {
+        if (!nfcapdWriter) {
+            nfcapdWriter.reset(new NfcapdFileWriter(dbConfig));
+        }
+        return std::make_unique<NfcapdHandler>(dbConfig, *nfcapdWriter);
+    } else if (type == "native") {
+        if (!nativeWriter) {
+            std::vector<std::string> probeNames;
+            for (const SondaConfig& sonda : sondaConfigs) {
+                probeNames.push_back(sonda.name);
+            }
+            nativeWriter.reset(new NativeSegmentWriter(dbConfig, probeNames));
+        }
+        // Receivers hand over batches of 4096 rows, or what they have after a second
+        return std::make_unique<BatchQueueHandler>(*nativeWriter, 4096, 1000);
+    } else if (type == "arrow") {
+        if (!arrowWriter) {
+            std::vector<std::string> probeNames;
+            for (const SondaConfig& sonda : sondaConfigs) {
+                probeNames.push_back(sonda.name);
+            }
+            arrowWriter.reset(new ArrowFileWriter(dbConfig, probeNames));
+        }
+        return std::make_unique<BatchQueueHandler>(*arrowWriter, 4096, 1000);
+    }
+    std::cerr << "Database type not implemented: " << type << std::endl;
+    syslog(LOG_ERR, "Database type not implemented: %s", type.c_str());
+    return nullptr;
+}
+
+// Function to create a receiver's database handler: the sink's own handler,
+// or with several sinks or a policy other than "block" a FanoutHandler
+// feeding the queue of each sink
+std::unique_ptr<DatabaseHandler> createDatabaseHandler() {
+    std::unique_ptr<DatabaseHandler> handler;
+    if (dbConfig.sinks.size() == 1 && dbConfig.sinks[0].policy == "block") {
+        handler = createSinkHandler(dbConfig.sinks[0].type);
+    } else {
+        if (sinkQueues.empty()) {
+            for (const SinkConfig& sink : dbConfig.sinks) {
+                // A spooling queue writes through its own connection, not a writer pool,
+                // so a failed write reaches the queue and its rows the spool
+                std::unique_ptr<DatabaseHandler> sinkHandler = createSinkHandler(sink.type, sink.policy == "spill");
+                if (!sinkHandler) {
+                    sinkQueues.clear();
+                    return nullptr;
+                }
+                sinkQueues.emplace_back(new SinkQueue(sink, std::move(sinkHandler), dbConfig.sink_spill_path));
+            }
+        }
+        handler = std::make_unique<FanoutHandler>(sinkQueues, dbConfig);
+    }
+    // Each receiver aggregates its own flows before they reach the sinks
+    if (handler && aggregationConfig.key_fields != 0) {
+        handler = std::make_unique<AggregatingHandler>(aggregationConfig, std::move(handler));
+    }
+    return handler;
+}
+
+// Function to set up sockets
+bool setupSockets() {
+    for (auto& sondaConfig : sondaConfigs) {
+        sondaRuntimes.emplace_back();
+        SondaRuntime& runtime = sondaRuntimes.back();
+        runtime.config = sondaConfig;
+        runtime.id = static_cast<uint16_t>(sondaRuntimes.size() - 1);
+
+        bool reusePort = sondaConfig.threads > 1;
+        for (int i = 0; i < sondaConfig.threads; ++i) {
+            int sockfd = createSocket(sondaConfig.port, reusePort);
+            if (sockfd < 0) {
+                std::cerr << "Cannot create socket for probe " << sondaConfig.name << std::endl;
+                syslog(LOG_ERR, "Cannot create socket for probe %s", sondaConfig.name.c_str());
+                return false;
+            }
+
+            runtime.receivers.emplace_back();
+            SondaReceiver& receiver = runtime.receivers.back();
+            receiver.sonda = &runtime;
+            receiver.socket_fd = sockfd;
+            if (queueSizeKiB > 0) {
+                receiver.queue.reset(new DatagramRing(static_cast<size_t>(queueSizeKiB) * 1024));
+            }
+
+            // Create database handler for each receiver
+            receiver.dbHandler = createDatabaseHandler();
+            if (!receiver.dbHandler) {
+                return false;
+            }
+
+            if (!receiver.dbHandler->connect()) {
+                std::cerr << "Cannot connect to database for probe " << sondaConfig.name << std::endl;
+                syslog(LOG_ERR, "Cannot connect to database for probe %s", sondaConfig.name.c_str());
+                return false;
+            }
+        }
+
+        if (reusePort && sondaConfig.steer_by_exporter) {
+            if (attachExporterSteering(runtime.receivers.front().socket_fd, sondaConfig.threads)) {
+                syslog(LOG_INFO, "Probe %s: %d sockets steered by exporter address", sondaConfig.name.c_str(), sondaConfig.threads);
+            }
+        }
+    }
+    return true;
+}
+
+// Function to check database connection (--checkdb parameter)
+bool checkDatabase() {
+    // Every sink listed in 'type' is checked with a connection of its own
+    for (const SinkConfig& sink : dbConfig.sinks) {
+        // Create database handler based on type
+        std::unique_ptr<DatabaseHandler> dbHandler = createSinkHandler(sink.type, true);
+        if (!dbHandler) {
+            return false;
+        }
+
+        // Check connection
+        if (!dbHandler->checkConnection()) {
+            std::cerr << "Database connection failed: " << sink.type << std::endl;
+            syslog(LOG_ERR, "Database connection failed: %s", sink.type.c_str());
+            return false;
+        }
+
+        // Initialize table or file
+        if (!dbHandler->connect()) {
+            std::cerr << "Failed to initialize database: " << sink.type << std::endl;
+            syslog(LOG_ERR, "Failed to initialize database: %s", sink.type.c_str());
+            return false;
+        }
+
+        dbHandler->close();
+    }
+    return true;
+}
+
+// Function to look up the decode plan of a data set's template (null and logged if unknown)
+std::shared_ptr<const DecodePlan> findDecodePlan(SondaRuntime& sonda, const TemplateKey& key) {
+    {
+        std::lock_guard<std::mutex> lock(sonda.templateMutex);
+        auto it = sonda.templates.find(key);
+        if (it != sonda.templates.end()) {
+            return it->second;
+        }
+    }
+    std::cerr << "Unknown template ID: " << key.template_id << std::endl;
+    syslog(LOG_ERR, "Unknown template ID: %d", key.template_id);
+    return nullptr;
+}
+
+// Function to store the flows decoded from one flowset as a single batch
+void storeFlows(SondaReceiver& receiver, FlowData* flows, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        flows[i].ProbeID = receiver.sonda->id;
+    }
+
+    // Insert the flow data into the database
+    if (!receiver.dbHandler->insertFlowBatch(flows, count)) {
+        std::cerr << "Failed to insert flow data into database." << std::endl;
+        syslog(LOG_ERR, "Failed to insert flow data into database.");
+    }
+}
+
+// Function to decode and store the records of a NetFlow v9 data FlowSet or
+// IPFIX Data Set straight from the receive buffer. A remainder shorter than
+// a record is padding.
+void storeDataRecords(SondaReceiver& receiver, const DecodePlan& plan, const char* ptr, size_t length) {
+    if (plan.recordLength == 0 || plan.options) {
+        return;
+    }
+
+    // Flows of the flowset, handed to the database handler together
+    thread_local std::vector<FlowData> flows;
+    flows.clear();
+
+    if (plan.variableLength) {
+        const char* end = ptr + length;
+        while (ptr + plan.recordLength <= end) {
+            FlowData flowData;
+            size_t recordLength = plan.decodeVariable(ptr, end - ptr, flowData);
+            if (recordLength == 0) {
+                std::cerr << "Variable-length record exceeds Set length." << std::endl;
+                syslog(LOG_ERR, "Variable-length record exceeds Set length.");
+                break;
+            }
+            flows.push_back(flowData);
+            ptr += recordLength;
+        }
+        decodedRecords[DECODED_GENERIC].fetch_add(flows.size(), std::memory_order_relaxed);
+        storeFlows(receiver, flows.data(), flows.size());
+        return;
+    }
+
+    size_t recordCount = length / plan.recordLength;
+    bool columnar = batchKernels && plan.batch.usable && recordCount >= BATCH_MIN_RECORDS;
+    size_t decoder = columnar ? DECODED_BATCH : plan.knownLayout >= 0 ? plan.knownLayout : DECODED_GENERIC;
+    decodedRecords[decoder].fetch_add(recordCount, std::memory_order_relaxed);
+
+    // Columns are reused by every flowset this thread decodes
+    thread_local FlowColumns columns;
+    if (columnar) {
+        decodeFlowSetColumns(*batchKernels, plan, ptr, recordCount, columns);
+    }
+    flows.resize(recordCount);
+    for (size_t r = 0; r < recordCount; ++r) {
+        FlowData& flowData = flows[r];
+        flowData = FlowData(); // Fields missing from the template stay unset
+        if (columnar) {
+            columns.row(r, plan.batch, flowData);
+        } else {
+            plan.decode(ptr + r * plan.recordLength, flowData);
+        }
+    }
+    storeFlows(receiver, flows.data(), recordCount);
+}
+
+// Function to process NetFlow v9 data
+void processNetFlowV9Data(char* buffer, ssize_t length, SondaReceiver& receiver, const struct sockaddr_in& exporter) {
+    SondaRuntime& sonda = *receiver.sonda;
+    char* ptr = buffer;
+    if (length < static_cast<ssize_t>(sizeof(NetFlowV9Header))) {
+        std::cerr << "Incomplete NetFlow v9 header." << std::endl;
+        syslog(LOG_ERR, "Incomplete NetFlow v9 header.");
+        return;
+    }
+    NetFlowV9Header* header = reinterpret_cast<NetFlowV9Header*>(ptr);
+
+    ptr += sizeof(NetFlowV9Header);
+    length -= sizeof(NetFlowV9Header);
+
+    TemplateKey key;
+    key.exporter = exporter.sin_addr.s_addr;
+    key.source_id = ntohl(header->source_id);
+
+    while (length > 0) {
+        if (length < 4) {
+            std::cerr << "Incomplete FlowSet header." << std::endl;
+            syslog(LOG_ERR, "Incomplete FlowSet header.");
+            break;
+        }
+
+        NetFlowV9FlowSetHeader* flowsetHeader = reinterpret_cast<NetFlowV9FlowSetHeader*>(ptr);
+        uint16_t flowsetID = ntohs(flowsetHeader->flowset_id);
+        uint16_t flowsetLength = ntohs(flowsetHeader->length);
+
+        ptr += sizeof(NetFlowV9FlowSetHeader);
+        length -= sizeof(NetFlowV9FlowSetHeader);
+
+        if (flowsetLength < sizeof(NetFlowV9FlowSetHeader) || flowsetLength > length + sizeof(NetFlowV9FlowSetHeader)) {
+            std::cerr << "FlowSet length exceeds remaining packet length." << std::endl;
+            syslog(LOG_ERR, "FlowSet length exceeds remaining packet length.");
+            break;
+        }
+
+        size_t flowsetDataLength = flowsetLength - sizeof(NetFlowV9FlowSetHeader);
+
+        if (flowsetID == 0) {
+            // Template FlowSet
+            char* templatePtr = ptr;
+            char* templateEnd = ptr + flowsetDataLength;
+            while (templatePtr + sizeof(NetFlowV9TemplateRecord) <= templateEnd) {
+                NetFlowV9TemplateRecord* templateRecord = reinterpret_cast<NetFlowV9TemplateRecord*>(templatePtr);
+                uint16_t templateID = ntohs(templateRecord->template_id);
+                uint16_t fieldCount = ntohs(templateRecord->field_count);
+
+                templatePtr += sizeof(NetFlowV9TemplateRecord);
+                if (templatePtr + fieldCount * sizeof(NetFlowV9FieldSpecifier) > templateEnd) {
+                    std::cerr << "Template " << templateID << " exceeds FlowSet length." << std::endl;
+                    syslog(LOG_ERR, "Template %d exceeds FlowSet length.", templateID);
+                    break;
+                }
+
+                TemplateFields fields;
+                fields.reserve(fieldCount);
+                for (int i = 0; i < fieldCount; ++i) {
+                    NetFlowV9FieldSpecifier* fieldSpecifier = reinterpret_cast<NetFlowV9FieldSpecifier*>(templatePtr);
+                    TemplateField field;
+                    field.type = ntohs(fieldSpecifier->type);
+                    field.length = ntohs(fieldSpecifier->length);
+                    field.enterprise = 0;
+                    fields.push_back(field);
+
+                    templatePtr += sizeof(NetFlowV9FieldSpecifier);
+                }
+
+                key.template_id = templateID;
+                std::shared_ptr<const DecodePlan> plan = compileDecodePlan(fields);
+                std::lock_guard<std::mutex> lock(sonda.templateMutex);
+                sonda.templates[key] = plan;
+            }
+        } else if (flowsetID > 255) {
+            // Data FlowSet
+            key.template_id = flowsetID;
+            std::shared_ptr<const DecodePlan> plan = findDecodePlan(sonda, key);
+            if (plan) {
+                storeDataRecords(receiver, *plan, ptr, flowsetDataLength);
+            }
+        } else {
+            // Ignore other FlowSet IDs
+        }
+
+        ptr += flowsetDataLength;
+        length -= flowsetDataLength;
+    }
+}
+
+// Function to remove withdrawn IPFIX templates: one template, or all
+// (options) templates of the observation domain when 'all' is set
+void withdrawTemplates(SondaRuntime& sonda, const TemplateKey& key, bool all, bool options) {
+    std::lock_guard<std::mutex> lock(sonda.templateMutex);
+    if (!all) {
+        sonda.templates.erase(key);
+        return;
+    }
+    TemplateKey first = key;
+    first.template_id = 0;
+    for (auto it = sonda.templates.lower_bound(first);
+         it != sonda.templates.end() && it->first.exporter == key.exporter && it->first.source_id == key.source_id;) {
+        if (it->second->options == options) {
+            it = sonda.templates.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Function to parse an IPFIX Template Set (2) or Options Template Set (3)
+void parseIPFIXTemplateSet(SondaRuntime& sonda, TemplateKey key, uint16_t setID, const char* ptr, const char* end) {
+    bool options = setID == 3;
+    while (end - ptr >= static_cast<ssize_t>(sizeof(IPFIXTemplateRecord))) {
+        const IPFIXTemplateRecord* templateRecord = reinterpret_cast<const IPFIXTemplateRecord*>(ptr);
+        uint16_t templateID = ntohs(templateRecord->template_id);
+        uint16_t fieldCount = ntohs(templateRecord->field_count);
+        ptr += sizeof(IPFIXTemplateRecord);
+        key.template_id = templateID;
+
+        // Template Withdrawal: no fields; the Set ID as template ID withdraws all of them
+        if (fieldCount == 0) {
+            if (templateID == setID || templateID > 255) {
+                withdrawTemplates(sonda, key, templateID == setID, options);
+            }
+            continue;
+        }
+        if (templateID < 256) {
+            std::cerr << "Invalid IPFIX template ID: " << templateID << std::endl;
+            syslog(LOG_ERR, "Invalid IPFIX template ID: %d", templateID);
+            return;
+        }
+        if (options) {
+            // Scope field count; scope fields are decoded like the others
+            if (end - ptr < 2) break;
+            ptr += 2;
+        }
+
+        TemplateFields fields;
+        fields.reserve(fieldCount);
+        bool complete = true;
+        for (int i = 0; i < fieldCount && complete; ++i) {
+            if (end - ptr < static_cast<ssize_t>(sizeof(IPFIXFieldSpecifier))) {
+                complete = false;
+                break;
+            }
+            const IPFIXFieldSpecifier* fieldSpecifier = reinterpret_cast<const IPFIXFieldSpecifier*>(ptr);
+            TemplateField field;
+            field.type = ntohs(fieldSpecifier->element_id);
+            field.length = ntohs(fieldSpecifier->length);
+            field.enterprise = 0;
+            ptr += sizeof(IPFIXFieldSpecifier);
+            if (field.type & 0x8000) {
+                if (end - ptr < 4) {
+                    complete = false;
+                    break;
+                }
+                field.type &= 0x7FFF;
+                field.enterprise = static_cast<uint32_t>(readBigEndian<4>(ptr));
+                ptr += 4;
+            }
+            fields.push_back(field);
+        }
+        if (!complete) {
+            std::cerr << "Template " << templateID << " exceeds Set length." << std::endl;
+            syslog(LOG_ERR, "Template %d exceeds Set length.", templateID);
+            return;
+        }
+
+        std::shared_ptr<const DecodePlan> plan = compileDecodePlan(fields, options);
+        std::lock_guard<std::mutex> lock(sonda.templateMutex);
+        sonda.templates[key] = plan;
+    }
+}
+
+// Function to process IPFIX data
+void processIPFIXData(char* buffer, ssize_t length, SondaReceiver& receiver, const struct sockaddr_in& exporter) {
+    SondaRuntime& sonda = *receiver.sonda;
+    if (length < static_cast<ssize_t>(sizeof(IPFIXHeader))) {
+        std::cerr << "Incomplete IPFIX header." << std::endl;
+        syslog(LOG_ERR, "Incomplete IPFIX header.");
+        return;
+    }
+    const IPFIXHeader* header = reinterpret_cast<const IPFIXHeader*>(buffer);
+    uint16_t messageLength = ntohs(header->length);
+    if (messageLength < sizeof(IPFIXHeader) || messageLength > length) {
+        std::cerr << "IPFIX message length does not match datagram length." << std::endl;
+        syslog(LOG_ERR, "IPFIX message length does not match datagram length.");
+        return;
+    }
+
+    TemplateKey key;
+    key.exporter = exporter.sin_addr.s_addr;
+    key.source_id = ntohl(header->observation_domain_id);
+
+    const char* ptr = buffer + sizeof(IPFIXHeader);
+    const char* end = buffer + messageLength;
+    while (ptr < end) {
+        if (end - ptr < static_cast<ssize_t>(sizeof(IPFIXSetHeader))) {
+            std::cerr << "Incomplete Set header." << std::endl;
+            syslog(LOG_ERR, "Incomplete Set header.");
+            break;
+        }
+        const IPFIXSetHeader* setHeader = reinterpret_cast<const IPFIXSetHeader*>(ptr);
+        uint16_t setID = ntohs(setHeader->set_id);
+        uint16_t setLength = ntohs(setHeader->length);
+        if (setLength < sizeof(IPFIXSetHeader) || setLength > end - ptr) {
+            std::cerr << "Set length exceeds remaining message length." << std::endl;
+            syslog(LOG_ERR, "Set length exceeds remaining message length.");
+            break;
+        }
+
+        const char* setData = ptr + sizeof(IPFIXSetHeader);
+        const char* setEnd = ptr + setLength;
+        if (setID == 2 || setID == 3) {
+            parseIPFIXTemplateSet(sonda, key, setID, setData, setEnd);
+        } else if (setID > 255) {
+            key.template_id = setID;
+            std::shared_ptr<const DecodePlan> plan = findDecodePlan(sonda, key);
+            if (plan) {
+                storeDataRecords(receiver, *plan, setData, setEnd - setData);
+            }
+        } else {
+            // Set IDs 0, 1 and 4-255 are not used by IPFIX
+        }
+        ptr = setEnd;
+    }
+}
+
+// Pre-allocated buffers for one recvmmsg() call: one receive buffer, iovec
+// and source address per message, allocated once per receive thread
+struct ReceiveBatch {
+    static const size_t BUFFER_SIZE = 65536;
+
+    std::vector<char> storage;
+    std::vector<struct mmsghdr> msgs;
+    std::vector<struct iovec> iovecs;
+    std::vector<struct sockaddr_in> addrs;
+
+    explicit ReceiveBatch(size_t count)
+        : storage(count * BUFFER_SIZE), msgs(count), iovecs(count), addrs(count) {
+        for (size_t i = 0; i < count; ++i) {
+            iovecs[i].iov_base = &storage[i * BUFFER_SIZE];
+            iovecs[i].iov_len = BUFFER_SIZE;
+            std::memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+        }
+    }
+
+    size_t size() const { return msgs.size(); }
+
+    // msg_namelen is overwritten by the kernel, so it has to be reset before every call
+    void reset() {
+        for (auto& msg : msgs) {
+            msg.msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+    }
+
+    char* buffer(size_t i) { return static_cast<char*>(iovecs[i].iov_base); }
+};
+
+// Function to decode one accepted datagram and store its flows
+void decodeDatagram(SondaReceiver& receiver, char* buffer, ssize_t n, const struct sockaddr_in& cliaddr) {
+    // Process the data
+    uint16_t version = ntohs(*(uint16_t*)buffer);
+    if (version == 9) {
+        processNetFlowV9Data(buffer, n, receiver, cliaddr);
+    } else if (version == 10) {
+        processIPFIXData(buffer, n, receiver, cliaddr);
+    } else {
+        std::cerr << "Unknown NetFlow version: " << version << std::endl;
+        syslog(LOG_ERR, "Unknown NetFlow version: %d", version);
+    }
+}
+
+// Decode worker (receive -> decode/storage pipeline)
+// Each worker owns the consumer side of the datagram queues of a set of probe
+// sockets and runs decoding and the database inserts for them, so a slow
+// insert no longer stalls the socket. An idle worker sleeps on a condition
+// variable; producers only take its mutex when the sleeping flag is set.
+class DecodeWorker {
+private:
+    // Datagrams taken from one queue before moving to the next one
+    static const int MAX_SWEEP = 64;
+
+    std::vector<SondaReceiver*> receivers;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::atomic<bool> sleeping;
+    std::atomic<bool> stopping;
+
+    bool drainQueues() {
+        bool any = false;
+        for (auto* receiver : receivers) {
+            for (int i = 0; i < MAX_SWEEP; ++i) {
+                DatagramRing::Entry* entry = receiver->queue->front();
+                if (!entry) {
+                    break;
+                }
+                decodeDatagram(*receiver, entry->payload(), entry->length, entry->source);
+                receiver->queue->pop(entry);
+                receiver->decoded.fetch_add(1, std::memory_order_relaxed);
+                any = true;
+            }
+        }
+        return any;
+    }
+
+    bool allEmpty() const {
+        for (auto* receiver : receivers) {
+            if (!receiver->queue->empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    DecodeWorker() : sleeping(false), stopping(false) {}
+
+    void addReceiver(SondaReceiver* receiver) {
+        receivers.push_back(receiver);
+        receiver->worker = this;
+    }
+
+    void run() {
+        auto lastTick = std::chrono::steady_clock::now();
+        while (true) {
+            // The handlers are only used by this thread, so their timers run here too
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastTick >= std::chrono::milliseconds(100)) {
+                for (auto* receiver : receivers) {
+                    receiver->dbHandler->tick();
+                }
+                lastTick = now;
+            }
+            if (drainQueues()) {
+                continue;
+            }
+            if (stopping) {
+                break; // Queues are empty and the receive threads have finished
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            sleeping.store(true, std::memory_order_seq_cst);
+            if (allEmpty() && !stopping) {
+                wakeup.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // Producer side: called after a datagram was pushed to one of the queues
+    void notify() {
+        if (sleeping.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            wakeup.notify_one();
+        }
+    }
+
+    // Finish the queued datagrams and exit run()
+    void stop() {
+        stopping = true;
+        std::lock_guard<std::mutex> lock(mutex);
+        wakeup.notify_one();
+    }
+};
+
+// Function to hand one accepted datagram to the decode worker of its socket
+// Called by the single thread receiving on the socket at any time (with the
+// epoll engine the thread may change, but epoll's one-shot re-arm orders it).
+void enqueueDatagram(SondaReceiver& receiver, const char* buffer, size_t n, const struct sockaddr_in& cliaddr) {
+    if (!receiver.queue->push(buffer, n, cliaddr)) {
+        receiver.queueOverflows.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    receiver.queued.fetch_add(1, std::memory_order_relaxed);
+    uint64_t used = receiver.queue->usedBytes();
+    if (used > receiver.queueHighWater.load(std::memory_order_relaxed)) {
+        receiver.queueHighWater.store(used, std::memory_order_relaxed);
+    }
+    receiver.worker->notify();
+}
+
+// Function to filter, log and decode one received datagram
+void processDatagram(SondaReceiver& receiver, char* buffer, ssize_t n, const struct sockaddr_in& cliaddr) {
+    SondaRuntime& sonda = *receiver.sonda;
+    receiver.datagrams.fetch_add(1, std::memory_order_relaxed);
+
+    // Check if the source IP matches the filter address
+    bool accepted = sonda.config.filter_addr == htonl(INADDR_ANY) || sonda.config.filter_addr == cliaddr.sin_addr.s_addr;
+
+    // Display packet information if displayPackets is true
+    if (displayPackets) {
+        char source_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &(cliaddr.sin_addr), source_ip, INET_ADDRSTRLEN);
+        std::cout << "Received packet from " << source_ip << " on port " << sonda.config.port;
+        if (accepted) {
+            std::cout << " [ACCEPTED]" << std::endl;
+        } else {
+            std::cout << " [REJECTED] (Expected source IP: " << sonda.config.filter_address << ")" << std::endl;
+        }
+    }
+
+    // Write raw data to diagnostic file if diagFilePath is set
+    if (!diagFilePath.empty()) {
+        std::lock_guard<std::mutex> lock(diagFileMutex); // Ensure thread safety
+        std::ofstream diagFile(diagFilePath, std::ios::app | std::ios::binary);
+        if (diagFile.is_open()) {
+            diagFile << "Probe: " << sonda.config.name << std::endl;
+            diagFile << "Data: ";
+            // Write data in hexadecimal format
+            for (ssize_t i = 0; i < n; ++i) {
+                diagFile << std::hex << std::setw(2) << std::setfill('0') << (static_cast<unsigned int>(buffer[i]) & 0xFF) << ' ';
+            }
+            diagFile << std::dec << std::endl << std::endl; // Reset to decimal
+            diagFile.close();
+        } else {
+            std::cerr << "Cannot open diagnostic file: " << diagFilePath << std::endl;
+            syslog(LOG_ERR, "Cannot open diagnostic file: %s", diagFilePath.c_str());
+        }
+    }
+
+    if (!accepted || n < 2) {
+        return;
+    }
+
+    if (receiver.queue) {
+        enqueueDatagram(receiver, buffer, n, cliaddr);
+        return;
+    }
+    decodeDatagram(receiver, buffer, n, cliaddr);
+    receiver.dbHandler->tick();
+}
+
+// Function to receive and process data
+// Up to recvBatchSize datagrams are read per recvmmsg() call; MSG_WAITFORONE
+// blocks only until the first one arrives and then takes whatever is queued
+void receiveData(SondaReceiver& receiver) {
+    ReceiveBatch batch(recvBatchSize);
+    while (running) {
+        batch.reset();
+        int received = recvmmsg(receiver.socket_fd, batch.msgs.data(), batch.size(), MSG_WAITFORONE, nullptr);
+        if (received < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Receive timeout: let a handler decoding on this thread write buffered rows
+                if (!receiver.queue) {
+                    receiver.dbHandler->tick();
+                }
+                continue;
+            }
+            perror("Error receiving data");
+            syslog(LOG_ERR, "Error receiving data: %s", strerror(errno));
+            continue;
+        }
+
+        for (int i = 0; i < received; ++i) {
+            processDatagram(receiver, batch.buffer(i), batch.msgs[i].msg_len, batch.addrs[i]);
+        }
+    }
+}
+
+
+// epoll event loop engine (engine = epoll)
+// A fixed pool of engineThreads threads waits on one shared epoll instance
+// holding all probe sockets. Sockets are registered edge-triggered and
+// one-shot, so a ready socket is drained by exactly one thread at a time
+// (in recvmmsg batches, non-blocking) and then re-armed; re-arming reports
+// the socket again if more data arrived meanwhile.
+class EpollReceiveEngine {
+private:
+    // Batches read from one socket before it goes back behind the other ready sockets
+    static const int MAX_DRAIN_BATCHES = 16;
+
+    std::vector<SondaReceiver*> receivers;
+    int epollFd;
+
+    bool arm(size_t index, int op) {
+        struct epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+        ev.data.u64 = index;
+        if (epoll_ctl(epollFd, op, receivers[index]->socket_fd, &ev) < 0) {
+            std::cerr << "epoll_ctl() failed: " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "epoll_ctl() failed: %s", strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    void drain(SondaReceiver& receiver, ReceiveBatch& batch) {
+        std::lock_guard<std::mutex> lock(receiver.decodeMutex);
+        for (int round = 0; round < MAX_DRAIN_BATCHES; ++round) {
+            batch.reset();
+            int received = recvmmsg(receiver.socket_fd, batch.msgs.data(), batch.size(), MSG_DONTWAIT, nullptr);
+            if (received < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    perror("Error receiving data");
+                    syslog(LOG_ERR, "Error receiving data: %s", strerror(errno));
+                }
+                return;
+            }
+
+            for (int i = 0; i < received; ++i) {
+                processDatagram(receiver, batch.buffer(i), batch.msgs[i].msg_len, batch.addrs[i]);
+            }
+            if (static_cast<size_t>(received) < batch.size()) {
+                return; // Socket queue is empty
+            }
+        }
+    }
+
+public:
+    explicit EpollReceiveEngine(const std::vector<SondaReceiver*>& receivers) : receivers(receivers), epollFd(-1) {}
+
+    ~EpollReceiveEngine() {
+        if (epollFd >= 0) ::close(epollFd);
+    }
+
+    bool setup() {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) {
+            std::cerr << "epoll_create1() failed: " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "epoll_create1() failed: %s", strerror(errno));
+            return false;
+        }
+        for (size_t i = 0; i < receivers.size(); ++i) {
+            if (!arm(i, EPOLL_CTL_ADD)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Function to let handlers decoding on the engine threads write buffered
+    // rows of quiet sockets; a socket being drained is skipped
+    void tickIdle() {
+        for (SondaReceiver* receiver : receivers) {
+            if (receiver->queue) {
+                continue; // Ticked by its decode worker
+            }
+            std::unique_lock<std::mutex> lock(receiver->decodeMutex, std::try_to_lock);
+            if (lock.owns_lock()) {
+                receiver->dbHandler->tick();
+            }
+        }
+    }
+
+    // Event loop, run by every thread of the pool
+    void run() {
+        ReceiveBatch batch(recvBatchSize);
+        struct epoll_event events[16];
+        auto lastTick = std::chrono::steady_clock::now();
+        while (running) {
+            int ready = epoll_wait(epollFd, events, 16, 1000); // Wake up once a second to notice shutdown
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastTick >= std::chrono::seconds(1)) {
+                tickIdle();
+                lastTick = now;
+            }
+            if (ready < 0) {
+                if (errno != EINTR) {
+                    std::cerr << "epoll_wait() failed: " << strerror(errno) << std::endl;
+                    syslog(LOG_ERR, "epoll_wait() failed: %s", strerror(errno));
+                }
+                continue;
+            }
+            for (int i = 0; i < ready; ++i) {
+                size_t index = static_cast<size_t>(events[i].data.u64);
+                drain(*receivers[index], batch);
+                arm(index, EPOLL_CTL_MOD);
+            }
+        }
+    }
+};
+
+// io_uring receive engine (engine = io_uring)
+// One engine thread services a group of sockets through a single ring. Every
+// socket has a multishot RECVMSG armed, the kernel picks receive buffers from
+// a provided buffer ring, and a buffer is handed back to the kernel as soon as
+// its datagram has been processed in place (decoded, or copied once into the
+// decode queue), so no intermediate copy is made.
+// Needs Linux 6.0 (multishot recvmsg); setup() submits the receives and
+// fails if the kernel rejects them, and main() falls back to the blocking
+// receive loop.
+class UringReceiveEngine {
+private:
+    static const unsigned RING_ENTRIES = 256;
+    static const unsigned BUFFER_COUNT = 128; // Must be a power of two
+    static const size_t BUFFER_SIZE = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + 65536;
+    static const uint16_t BUFFER_GROUP = 0;
+
+    std::vector<SondaReceiver*> receivers;
+    int ringFd;
+    void* ringMem;
+    size_t ringSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+    struct io_uring_buf_ring* bufRing;
+    size_t bufRingSize;
+    uint16_t bufTail;
+    std::vector<char> buffers;
+    struct msghdr msgTemplate;
+    unsigned toSubmit;
+
+    static int enter(int fd, unsigned submit, unsigned minComplete, unsigned flags, void* arg, size_t argSize) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, minComplete, flags, arg, argSize));
+    }
+
+    struct io_uring_sqe* getSqe() {
+        unsigned tail = *sqTail;
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+            // Submission queue is full, hand the pending entries to the kernel first
+            enter(ringFd, toSubmit, 0, 0, nullptr, 0);
+            toSubmit = 0;
+        }
+        unsigned index = tail & sqMask;
+        sqArray[index] = index;
+        struct io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++toSubmit;
+        return sqe;
+    }
+
+    void armReceive(size_t index) {
+        struct io_uring_sqe* sqe = getSqe();
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = receivers[index]->socket_fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&msgTemplate);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_TRUNC;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+        sqe->user_data = index;
+    }
+
+    char* buffer(uint16_t bid) { return &buffers[bid * BUFFER_SIZE]; }
+
+    void recycleBuffer(uint16_t bid) {
+        // Entries are addressed from the ring base: in C++ the empty struct that
+        // __DECLARE_FLEX_ARRAY puts in front of bufs[] shifts its offset
+        struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(bufRing) + (bufTail & (BUFFER_COUNT - 1));
+        buf->addr = reinterpret_cast<uint64_t>(buffer(bid));
+        buf->len = BUFFER_SIZE;
+        buf->bid = bid;
+        ++bufTail;
+    }
+
+    void handleCompletion(const struct io_uring_cqe& cqe) {
+        size_t index = static_cast<size_t>(cqe.user_data);
+        if (index >= receivers.size()) {
+            return;
+        }
+        SondaReceiver& receiver = *receivers[index];
+
+        if (cqe.res < 0) {
+            // ENOBUFS: all buffers were in use, the receive is re-armed below.
+            // Any other error would come back at once, so the socket is given up.
+            if (cqe.res != -ENOBUFS && cqe.res != -EINTR) {
+                std::cerr << "Receiving on probe " << receiver.sonda->config.name << " stopped: " << strerror(-cqe.res) << std::endl;
+                syslog(LOG_ERR, "Receiving on probe %s stopped: %s", receiver.sonda->config.name.c_str(), strerror(-cqe.res));
+                return;
+            }
+        } else if (cqe.flags & IORING_CQE_F_BUFFER) {
+            uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            char* buf = buffer(bid);
+            struct io_uring_recvmsg_out* out = reinterpret_cast<struct io_uring_recvmsg_out*>(buf);
+            struct sockaddr_in cliaddr;
+            std::memcpy(&cliaddr, buf + sizeof(*out), sizeof(cliaddr));
+            char* payload = buf + sizeof(*out) + msgTemplate.msg_namelen + msgTemplate.msg_controllen;
+
+            if (out->flags & MSG_TRUNC) {
+                std::cerr << "Truncated datagram dropped (" << out->payloadlen << " bytes)." << std::endl;
+                syslog(LOG_ERR, "Truncated datagram dropped (%u bytes).", out->payloadlen);
+            } else {
+                processDatagram(receiver, payload, out->payloadlen, cliaddr);
+            }
+            recycleBuffer(bid);
+        }
+
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            armReceive(index);
+        }
+    }
+
+public:
+    explicit UringReceiveEngine(const std::vector<SondaReceiver*>& receivers)
+        : receivers(receivers), ringFd(-1), ringMem(MAP_FAILED), ringSize(0), sqes(nullptr), sqesSize(0),
+          bufRing(nullptr), bufRingSize(0), bufTail(0), toSubmit(0) {}
+
+    ~UringReceiveEngine() {
+        if (bufRing) munmap(bufRing, bufRingSize);
+        if (sqes) munmap(sqes, sqesSize);
+        if (ringMem != MAP_FAILED) munmap(ringMem, ringSize);
+        if (ringFd >= 0) ::close(ringFd);
+    }
+
+    bool setup() {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+        if (ringFd < 0) {
+            std::cerr << "io_uring_setup() failed: " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "io_uring_setup() failed: %s", strerror(errno));
+            return false;
+        }
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+            std::cerr << "io_uring engine requires a newer kernel." << std::endl;
+            syslog(LOG_ERR, "io_uring engine requires a newer kernel.");
+            return false;
+        }
+
+        size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        ringSize = std::max(sqSize, cqSize);
+        ringMem = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        void* sqesMem = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (ringMem == MAP_FAILED || sqesMem == MAP_FAILED) {
+            std::cerr << "Cannot map io_uring rings: " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot map io_uring rings: %s", strerror(errno));
+            if (sqesMem != MAP_FAILED) munmap(sqesMem, sqesSize);
+            return false;
+        }
+        sqes = static_cast<struct io_uring_sqe*>(sqesMem);
+
+        char* base = static_cast<char*>(ringMem);
+        sqHead = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+        sqEntries = params.sq_entries;
+        sqArray = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(base + params.cq_off.cqes);
+
+        // Provided buffer ring shared with the kernel (page aligned through mmap)
+        bufRingSize = BUFFER_COUNT * sizeof(struct io_uring_buf);
+        void* bufRingMem = mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (bufRingMem == MAP_FAILED) {
+            std::cerr << "Cannot allocate io_uring buffer ring: " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot allocate io_uring buffer ring: %s", strerror(errno));
+            return false;
+        }
+        bufRing = static_cast<struct io_uring_buf_ring*>(bufRingMem);
+
+        struct io_uring_buf_reg reg;
+        std::memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(bufRing);
+        reg.ring_entries = BUFFER_COUNT;
+        reg.bgid = BUFFER_GROUP;
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            std::cerr << "Cannot register io_uring buffer ring: " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "Cannot register io_uring buffer ring: %s", strerror(errno));
+            return false;
+        }
+
+        buffers.resize(BUFFER_COUNT * BUFFER_SIZE);
+        for (unsigned i = 0; i < BUFFER_COUNT; ++i) {
+            recycleBuffer(static_cast<uint16_t>(i));
+        }
+        __atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+
+        // Layout of every completed buffer: io_uring_recvmsg_out, source address, payload
+        std::memset(&msgTemplate, 0, sizeof(msgTemplate));
+        msgTemplate.msg_namelen = sizeof(struct sockaddr_in);
+
+        for (size_t i = 0; i < receivers.size(); ++i) {
+            armReceive(i);
+        }
+
+        // Kernels before 6.0 have the buffer ring but reject multishot recvmsg
+        // when it is submitted; the rejection is already completed on return
+        if (enter(ringFd, toSubmit, 0, 0, nullptr, 0) < 0) {
+            std::cerr << "io_uring_enter() failed: " << strerror(errno) << std::endl;
+            syslog(LOG_ERR, "io_uring_enter() failed: %s", strerror(errno));
+            return false;
+        }
+        toSubmit = 0;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (unsigned head = *cqHead; head != tail; ++head) {
+            if (cqes[head & cqMask].res == -EINVAL) {
+                std::cerr << "io_uring engine requires a newer kernel (multishot recvmsg, Linux 6.0)." << std::endl;
+                syslog(LOG_ERR, "io_uring engine requires a newer kernel (multishot recvmsg, Linux 6.0).");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void run() {
+        struct __kernel_timespec timeout;
+        timeout.tv_sec = 1; // Wake up once a second to notice shutdown
+        timeout.tv_nsec = 0;
+        struct io_uring_getevents_arg arg;
+        std::memset(&arg, 0, sizeof(arg));
+        arg.ts = reinterpret_cast<uint64_t>(&timeout);
+
+        auto lastTick = std::chrono::steady_clock::now();
+        while (running) {
+            int ret = enter(ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+            // This thread alone decodes from its sockets, so it also ticks their
+            // handlers when the sockets are quiet
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastTick >= std::chrono::seconds(1)) {
+                for (SondaReceiver* receiver : receivers) {
+                    if (!receiver->queue) {
+                        receiver->dbHandler->tick();
+                    }
+                }
+                lastTick = now;
+            }
+            if (ret < 0 && errno != EINTR && errno != ETIME && errno != EBUSY) {
+                std::cerr << "io_uring_enter() failed: " << strerror(errno) << std::endl;
+                syslog(LOG_ERR, "io_uring_enter() failed: %s", strerror(errno));
+                continue;
+            }
+            if (ret >= 0) {
+                toSubmit -= std::min<unsigned>(toSubmit, static_cast<unsigned>(ret));
+            }
+
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            while (head != tail) {
+                handleCompletion(cqes[head & cqMask]);
+                ++head;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            __atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+        }
+    }
+};
+
+// Function to start the receive threads for all probe sockets
+// 'threads' runs one blocking receive loop per socket; the other engines spread
+// the sockets round-robin over engineThreads threads. If an engine cannot be
+// set up on this system, the blocking loop is used as a fallback.
+bool startReceiveEngine(std::vector<std::thread>& threads) {
+    std::vector<SondaReceiver*> allReceivers;
+    for (auto& sonda : sondaRuntimes) {
+        for (auto& receiver : sonda.receivers) {
+            allReceivers.push_back(&receiver);
+        }
+    }
+
+    if (receiveEngine == "epoll") {
+        auto engine = std::make_shared<EpollReceiveEngine>(allReceivers);
+        if (engine->setup()) {
+            for (int i = 0; i < engineThreads; ++i) {
+                threads.emplace_back([engine]() { engine->run(); });
+            }
+            syslog(LOG_INFO, "epoll receive engine started with %d thread(s).", engineThreads);
+            return true;
+        }
+        std::cerr << "epoll receive engine unavailable, falling back to receive threads." << std::endl;
+        syslog(LOG_WARNING, "epoll receive engine unavailable, falling back to receive threads.");
+    } else if (receiveEngine == "io_uring") {
+        size_t engineCount = std::min<size_t>(engineThreads, allReceivers.size());
+        std::vector<std::vector<SondaReceiver*>> groups(engineCount);
+        for (size_t i = 0; i < allReceivers.size(); ++i) {
+            groups[i % engineCount].push_back(allReceivers[i]);
+        }
+
+        std::vector<std::shared_ptr<UringReceiveEngine>> engines;
+        bool ready = true;
+        for (auto& group : groups) {
+            engines.push_back(std::make_shared<UringReceiveEngine>(group));
+            if (!engines.back()->setup()) {
+                ready = false;
+                break;
+            }
+        }
+
+        if (ready) {
+            for (auto& engine : engines) {
+                threads.emplace_back([engine]() { engine->run(); });
+            }
+            syslog(LOG_INFO, "io_uring receive engine started with %zu thread(s).", engines.size());
+            return true;
+        }
+        std::cerr << "io_uring receive engine unavailable, falling back to receive threads." << std::endl;
+        syslog(LOG_WARNING, "io_uring receive engine unavailable, falling back to receive threads.");
+    }
+
+    for (auto* receiver : allReceivers) {
+        threads.emplace_back(receiveData, std::ref(*receiver));
+    }
+    return true;
+}
+
+// Function to stop the receive loops on SIGINT/SIGTERM
+void handleSignal(int) {
+    running = false;
+}
+
+std::vector<std::unique_ptr<DecodeWorker>> decodeWorkers;
+
+// Function to start the decode workers and spread the socket queues over them
+void startDecodeWorkers(std::vector<std::thread>& threads) {
+    std::vector<SondaReceiver*> queuedReceivers;
+    for (auto& sonda : sondaRuntimes) {
+        for (auto& receiver : sonda.receivers) {
+            if (receiver.queue) {
+                queuedReceivers.push_back(&receiver);
+            }
+        }
+    }
+    if (queuedReceivers.empty()) {
+        return;
+    }
+
+    size_t workerCount = decodeThreads > 0 ? std::min<size_t>(decodeThreads, queuedReceivers.size()) : queuedReceivers.size();
+    for (size_t i = 0; i < workerCount; ++i) {
+        decodeWorkers.emplace_back(new DecodeWorker());
+    }
+    for (size_t i = 0; i < queuedReceivers.size(); ++i) {
+        decodeWorkers[i % workerCount]->addReceiver(queuedReceivers[i]);
+    }
+    for (auto& worker : decodeWorkers) {
+        DecodeWorker* w = worker.get();
+        threads.emplace_back([w]() { w->run(); });
+    }
+    syslog(LOG_INFO, "Started %zu decode worker(s).", workerCount);
+}
+
+// Function to let the decode workers finish their queues and exit
+void stopDecodeWorkers(std::vector<std::thread>& threads) {
+    for (auto& worker : decodeWorkers) {
+        worker->stop();
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    threads.clear();
+    decodeWorkers.clear();
+}
+
+// Function to report receive and queue statistics of every probe socket
+void logStatistics() {
+    for (auto& sonda : sondaRuntimes) {
+        size_t index = 0;
+        for (auto& receiver : sonda.receivers) {
+            std::ostringstream line;
+            line << "Probe " << sonda.config.name << "[" << index++ << "]:"
+                 << " datagrams=" << receiver.datagrams.load(std::memory_order_relaxed);
+            if (receiver.queue) {
+                uint64_t queued = receiver.queued.load(std::memory_order_relaxed);
+                uint64_t decoded = receiver.decoded.load(std::memory_order_relaxed);
+                line << " queued=" << queued
+                     << " depth=" << (queued > decoded ? queued - decoded : 0)
+                     << " (" << receiver.queue->usedBytes() / 1024 << "/" << receiver.queue->capacityBytes() / 1024
+                     << " KiB, peak " << receiver.queueHighWater.load(std::memory_order_relaxed) / 1024 << " KiB)"
+                     << " overflows=" << receiver.queueOverflows.load(std::memory_order_relaxed);
+            }
+            std::cout << line.str() << std::endl;
+            syslog(LOG_INFO, "%s", line.str().c_str());
+        }
+    }
+
+    if (aggregationConfig.key_fields != 0) {
+        std::ostringstream line;
+        uint64_t flows = aggregationStats.flows.load(std::memory_order_relaxed);
+        uint64_t rows = aggregationStats.rows.load(std::memory_order_relaxed);
+        line << "Aggregation: flows=" << flows << " rows=" << rows;
+        if (rows) {
+            line << " (ratio " << std::fixed << std::setprecision(1) << static_cast<double>(flows) / rows << ")";
+        }
+        line << " entries=" << aggregationStats.entries.load(std::memory_order_relaxed) << "/" << aggregationStats.capacity.load(std::memory_order_relaxed)
+             << " active=" << aggregationStats.activeTimeouts.load(std::memory_order_relaxed)
+             << " inactive=" << aggregationStats.inactiveTimeouts.load(std::memory_order_relaxed)
+             << " evicted=" << aggregationStats.evictions.load(std::memory_order_relaxed);
+        std::cout << line.str() << std::endl;
+        syslog(LOG_INFO, "%s", line.str().c_str());
+    }
+
+    for (auto& sink : sinkQueues) {
+        std::ostringstream line;
+        line << "Sink " << sink->name() << ": rows=" << sink->rows.load(std::memory_order_relaxed)
+             << " batches=" << sink->batches.load(std::memory_order_relaxed)
+             << " queued=" << sink->queued()
+             << " peak=" << sink->queuePeakRows.load(std::memory_order_relaxed)
+             << " lag=" << sink->lagMilliseconds() << " ms (max " << sink->maxLagMilliseconds.load(std::memory_order_relaxed) << " ms)"
+             << " waits=" << sink->producerWaits.load(std::memory_order_relaxed);
+        uint64_t spooled, pending, spoolDropped, spoolBytes;
+        sink->spoolStatus(spooled, pending, spoolDropped, spoolBytes);
+        line << " dropped=" << sink->droppedRows.load(std::memory_order_relaxed) + spoolDropped;
+        if (sink->spooling()) {
+            line << " spooled=" << spooled << " (" << pending << " pending, " << spoolBytes / (1024 * 1024) << " MiB)"
+                 << " replayed=" << sink->replayedRows.load(std::memory_order_relaxed)
+                 << " failures=" << sink->failures.load(std::memory_order_relaxed);
+        }
+        line << " lost=" << sink->lostRows.load(std::memory_order_relaxed);
+        std::cout << line.str() << std::endl;
+        syslog(LOG_INFO, "%s", line.str().c_str());
+    }
+
+    if (sqliteWriter) {
+        std::ostringstream line;
+        uint64_t commits = sqliteWriter->commits.load(std::memory_order_relaxed);
+        uint64_t rows = sqliteWriter->rows.load(std::memory_order_relaxed);
+        line << "SQLite writer: rows=" << rows
+             << " batches=" << sqliteWriter->batches.load(std::memory_order_relaxed)
+             << " commits=" << commits << " (" << (commits ? rows / commits : 0) << " rows/commit)"
+             << " queued=" << sqliteWriter->queued()
+             << " peak=" << sqliteWriter->queuePeakRows.load(std::memory_order_relaxed)
+             << " waits=" << sqliteWriter->producerWaits.load(std::memory_order_relaxed)
+             << " (" << sqliteWriter->waitMicroseconds.load(std::memory_order_relaxed) / 1000 << " ms)";
+        std::cout << line.str() << std::endl;
+        syslog(LOG_INFO, "%s", line.str().c_str());
+    }
+
+    if (mysqlPool) {
+        std::ostringstream line;
+        line << "MySQL pool: connections=" << mysqlPool->connectionsUp.load(std::memory_order_relaxed) << "/" << mysqlPool->connections()
+             << " rows=" << mysqlPool->rows.load(std::memory_order_relaxed)
+             << " batches=" << mysqlPool->batches.load(std::memory_order_relaxed)
+             << " queued=" << mysqlPool->queued()
+             << " peak=" << mysqlPool->queuePeakRows.load(std::memory_order_relaxed)
+             << " in-flight=" << mysqlPool->inFlightBatches.load(std::memory_order_relaxed)
+             << " (" << mysqlPool->inFlightRows.load(std::memory_order_relaxed) << " rows)"
+             << " requeued=" << mysqlPool->requeuedBatches.load(std::memory_order_relaxed)
+             << " lost=" << mysqlPool->lostRows.load(std::memory_order_relaxed)
+             << " reconnects=" << mysqlPool->reconnects.load(std::memory_order_relaxed)
+             << " ping-failures=" << mysqlPool->healthFailures.load(std::memory_order_relaxed)
+             << " waits=" << mysqlPool->producerWaits.load(std::memory_order_relaxed)
+             << " (" << mysqlPool->waitMicroseconds.load(std::memory_order_relaxed) / 1000 << " ms)";
+        std::cout << line.str() << std::endl;
+        syslog(LOG_INFO, "%s", line.str().c_str());
+    }
+
+    uint64_t copies = postgresCopyStats.copies.load(std::memory_order_relaxed);
+    if (copies || postgresCopyStats.failedRows.load(std::memory_order_relaxed)) {
+        std::ostringstream line;
+        line << "PostgreSQL COPY: copies=" << copies
+             << " rows=" << postgresCopyStats.rows.load(std::memory_order_relaxed)
+             << " sent=" << postgresCopyStats.bytes.load(std::memory_order_relaxed) / 1024 << " KiB";
+        if (copies) {
+            line << " commit=" << std::fixed << std::setprecision(1)
+                 << postgresCopyStats.commitMicroseconds.load(std::memory_order_relaxed) / 1000.0 / copies << " ms avg";
+        }
+        line << " failed=" << postgresCopyStats.failedRows.load(std::memory_order_relaxed);
+        std::cout << line.str() << std::endl;
+        syslog(LOG_INFO, "%s", line.str().c_str());
+    }
+    if (postgresPool) {
+        std::ostringstream line;
+        line << "PostgreSQL pool: connections=" << postgresPool->connectionsUp.load(std::memory_order_relaxed) << "/" << postgresPool->connections()
+             << " rows=" << postgresPool->rows.load(std::memory_order_relaxed)
+             << " queued=" << postgresPool->queued()
+             << " peak=" << postgresPool->queuePeakRows.load(std::memory_order_relaxed)
+             << " in-flight=" << postgresPool->inFlightRows.load(std::memory_order_relaxed)
+             << " requeued=" << postgresPool->requeuedRows.load(std::memory_order_relaxed)
+             << " lost=" << postgresPool->lostRows.load(std::memory_order_relaxed)
+             << " reconnects=" << postgresPool->reconnects.load(std::memory_order_relaxed)
+             << " waits=" << postgresPool->producerWaits.load(std::memory_order_relaxed);
+        std::cout << line.str() << std::endl;
+        syslog(LOG_INFO, "%s", line.str().c_str());
+    }
+
+    if (csvWriter) {
+        std::ostringstream line;
+        uint64_t in = csvWriter->bytesIn.load(std::memory_order_relaxed);
+        uint64_t out = csvWriter->bytesOut.load(std::memory_order_relaxed);
+        line << "CSV writer: files=" << csvWriter->files.load(std::memory_order_relaxed)
+             << " text=" << in / 1024 << " KiB written=" << out / 1024 << " KiB";
+        if (out) {
+            line << " (ratio " << std::fixed << std::setprecision(1) << static_cast<double>(in) / out << ")";
+        }
+        line << " queued=" << csvWriter->queued()
+             << " waits=" << csvWriter->producerWaits.load(std::memory_order_relaxed)
+             << " lost=" << csvWriter->lostBytes.load(std::memory_order_relaxed) / 1024 << " KiB";
+        std::cout << line.str() << std::endl;
+        syslog(LOG_INFO, "%s", line.str().c_str());
+    }
+
+    if (nfcapdWriter) {
+        std::ostringstream line;
+        line << "nfcapd writer: files=" << nfcapdWriter->files.load(std::memory_order_relaxed)
+             << " flows=" << nfcapdWriter->flows.load(std::memory_order_relaxed)
+             << " written=" << nfcapdWriter->bytes.load(std::memory_order_relaxed) / 1024 << " KiB"
+             << " queued=" << nfcapdWriter->queued()
+             << " waits=" << nfcapdWriter->producerWaits.load(std::memory_order_relaxed)
+             << " lost=" << nfcapdWriter->lostFlows.load(std::memory_order_relaxed);
+        std::cout << line.str() << std::endl;
+        syslog(LOG_INFO, "%s", line.str().c_str());
+    }
+
+    if (nativeWriter) {
+        std::ostringstream line;
+        uint64_t rows = nativeWriter->rows.load(std::memory_order_relaxed);
+        uint64_t bytes = nativeWriter->bytes.load(std::memory_order_relaxed);
+        line << "Native writer: segments=" << nativeWriter->segments.load(std::memory_order_relaxed)
+             << " blocks=" << nativeWriter->blocks.load(std::memory_order_relaxed)
+             << " rows=" << rows << " written=" << bytes / 1024 << " KiB";
+        if (rows) {
+            line << " (" << std::fixed << std::setprecision(1) << static_cast<double>(bytes) / rows << " bytes/row)";
+        }
+        line << " queued=" << nativeWriter->queued()
+             << " peak=" << nativeWriter->queuePeakRows.load(std::memory_order_relaxed)
+             << " waits=" << nativeWriter->producerWaits.load(std::memory_order_relaxed)
+             << " lost=" << nativeWriter->lostRows.load(std::memory_order_relaxed);
+        std::cout << line.str() << std::endl;
+        syslog(LOG_INFO, "%s", line.str().c_str());
+    }
+    if (arrowWriter) {
+        std::ostringstream line;
+        uint64_t rows = arrowWriter->rows.load(std::memory_order_relaxed);
+        uint64_t bytes = arrowWriter->bytes.load(std::memory_order_relaxed);
+        line << "Arrow writer: files=" << arrowWriter->files.load(std::memory_order_relaxed)
+             << " batches=" << arrowWriter->batches.load(std::memory_order_relaxed)
+             << " rows=" << rows << " written=" << bytes / 1024 << " KiB";
+        if (rows) {
+            line << " (" << std::fixed << std::setprecision(1) << static_cast<double>(bytes) / rows << " bytes/row)";
+        }
+        line << " queued=" << arrowWriter->queued()
+             << " peak=" << arrowWriter->queuePeakRows.load(std::memory_order_relaxed)
+             << " waits=" << arrowWriter->producerWaits.load(std::memory_order_relaxed)
+             << " lost=" << arrowWriter->lostRows.load(std::memory_order_relaxed);
+        std::cout << line.str() << std::endl;
+        syslog(LOG_INFO, "%s", line.str().c_str());
+    }
+
+    uint64_t loads = mysqlLoadStats.loads.load(std::memory_order_relaxed);
+    if (loads) {
+        // Rate since the previous report
+        static uint64_t lastRows = 0;
+        static auto lastReport = std::chrono::steady_clock::now();
+        auto now = std::chrono::steady_clock::now();
+        uint64_t rows = mysqlLoadStats.rows.load(std::memory_order_relaxed);
+        double seconds = std::chrono::duration<double>(now - lastReport).count();
+        std::ostringstream line;
+        line << "MySQL load: rows=" << rows << " rows/s=" << static_cast<uint64_t>(seconds > 0 ? (rows - lastRows) / seconds : 0)
+             << " loads=" << loads
+             << " latency avg=" << mysqlLoadStats.latencyMicroseconds.load(std::memory_order_relaxed) / loads / 1000
+             << " ms max=" << mysqlLoadStats.maxLatencyMicroseconds.load(std::memory_order_relaxed) / 1000 << " ms"
+             << " failed=" << mysqlLoadStats.failedRows.load(std::memory_order_relaxed);
+        std::cout << line.str() << std::endl;
+        syslog(LOG_INFO, "%s", line.str().c_str());
+        lastRows = rows;
+        lastReport = now;
+    }
+
+    // Share of records decoded by each specialized decoder
+    uint64_t total = 0;
+    for (auto& count : decodedRecords) {
+        total += count.load(std::memory_order_relaxed);
+    }
+    if (total > 0) {
+        std::ostringstream line;
+        line << "Decoders:";
+        for (size_t i = 0; i <= DECODED_BATCH; ++i) {
+            uint64_t count = decodedRecords[i].load(std::memory_order_relaxed);
+            std::string name = i < KNOWN_LAYOUT_COUNT ? knownLayouts[i].name : i == DECODED_GENERIC ? "generic" : "batch";
+            if (i == DECODED_BATCH && batchKernels) {
+                name = std::string(batchKernels->name) + "-batch";
+            }
+            line << " " << name << "=" << count
+                 << " (" << std::fixed << std::setprecision(1) << 100.0 * count / total << "%)";
+        }
+        std::cout << line.str() << std::endl;
+        syslog(LOG_INFO, "%s", line.str().c_str());
+    }
+}
+
+// Function to report statistics every statsInterval seconds until shutdown
+void statisticsLoop() {
+    int elapsed = 0;
+    while (running) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        if (++elapsed >= statsInterval) {
+            elapsed = 0;
+            logStatistics();
+        }
+    }
+}
+
+// Benchmarks (--bench=NAME)
+// Each benchmark runs without a configuration file and prints its results to stdout.
+
+// Database handler that only counts the flows it is given
+class CountingHandler : public DatabaseHandler {
+public:
+    uint64_t flows = 0;
+    bool connect() override { return true; }
+    bool insertFlowData(const FlowData&) override { ++flows; return true; }
+    bool insertFlowBatch(const FlowData*, size_t count) override { flows += count; return true; }
+    void close() override {}
+    bool initializeTable() override { return true; }
+    bool checkConnection() override { return true; }
+};
+
+// Synthetic NetFlow v9 export packet of the given size: header and one
+// options template FlowSet (ID 1), which the decoder skips
+std::vector<char> makeBenchmarkPacket(size_t size) {
+    std::vector<char> packet(size, 0);
+    NetFlowV9Header* header = reinterpret_cast<NetFlowV9Header*>(packet.data());
+    header->version = htons(9);
+    NetFlowV9FlowSetHeader* flowset = reinterpret_cast<NetFlowV9FlowSetHeader*>(packet.data() + sizeof(NetFlowV9Header));
+    flowset->flowset_id = htons(1);
+    flowset->length = htons(static_cast<uint16_t>(size - sizeof(NetFlowV9Header)));
+    return packet;
+}
+
+// Receive engines: datagrams/s delivered to processDatagram() over loopback
+bool benchmarkReceive() {
+    const int socketCount = 4;
+    const int basePort = 39055;
+    const size_t datagramsPerSocket = 200000;
+    const unsigned sendBatch = 64;
+    std::vector<char> packet = makeBenchmarkPacket(1400);
+
+    std::cout << "Receive engines: " << socketCount << " sockets, " << datagramsPerSocket
+              << " datagrams of " << packet.size() << " bytes per socket" << std::endl;
+
+    const char* engines[] = { "threads", "epoll", "io_uring" };
+    for (const char* engine : engines) {
+        receiveEngine = engine;
+        engineThreads = 1;
+        running = true;
+
+        for (int i = 0; i < socketCount; ++i) {
+            sondaRuntimes.emplace_back();
+            SondaRuntime& runtime = sondaRuntimes.back();
+            runtime.config.name = "bench" + std::to_string(i);
+            runtime.config.filter_addr = htonl(INADDR_ANY);
+            runtime.config.port = basePort + i;
+            runtime.config.threads = 1;
+            runtime.config.steer_by_exporter = false;
+            runtime.receivers.emplace_back();
+            SondaReceiver& receiver = runtime.receivers.back();
+            receiver.sonda = &runtime;
+            receiver.dbHandler.reset(new CountingHandler()); // The receive loops tick it
+            receiver.socket_fd = createSocket(runtime.config.port);
+            if (receiver.socket_fd < 0) {
+                return false;
+            }
+            int rcvbuf = 8 * 1024 * 1024;
+            setsockopt(receiver.socket_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        }
+
+        std::vector<std::thread> threads;
+        startReceiveEngine(threads);
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> senders;
+        for (int i = 0; i < socketCount; ++i) {
+            senders.emplace_back([&packet, i, basePort, datagramsPerSocket, sendBatch]() {
+                int fd = socket(AF_INET, SOCK_DGRAM, 0);
+                struct sockaddr_in dest;
+                std::memset(&dest, 0, sizeof(dest));
+                dest.sin_family = AF_INET;
+                dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                dest.sin_port = htons(basePort + i);
+                std::vector<struct iovec> iovecs(sendBatch);
+                std::vector<struct mmsghdr> msgs(sendBatch);
+                for (unsigned j = 0; j < sendBatch; ++j) {
+                    iovecs[j].iov_base = const_cast<char*>(packet.data());
+                    iovecs[j].iov_len = packet.size();
+                    std::memset(&msgs[j], 0, sizeof(msgs[j]));
+                    msgs[j].msg_hdr.msg_iov = &iovecs[j];
+                    msgs[j].msg_hdr.msg_iovlen = 1;
+                    msgs[j].msg_hdr.msg_name = &dest;
+                    msgs[j].msg_hdr.msg_namelen = sizeof(dest);
+                }
+                size_t sent = 0;
+                while (sent < datagramsPerSocket) {
+                    int n = sendmmsg(fd, msgs.data(), std::min<size_t>(sendBatch, datagramsPerSocket - sent), 0);
+                    if (n > 0) {
+                        sent += n;
+                    }
+                }
+                ::close(fd);
+            });
+        }
+        for (auto& t : senders) {
+            t.join();
+        }
+
+        // Wait until the receivers stop making progress
+        uint64_t received = 0;
+        auto lastProgress = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - lastProgress < std::chrono::milliseconds(300)) {
+            uint64_t total = 0;
+            for (auto& sonda : sondaRuntimes) {
+                total += sonda.receivers.front().datagrams.load();
+            }
+            if (total != received) {
+                received = total;
+                lastProgress = std::chrono::steady_clock::now();
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        double seconds = std::chrono::duration<double>(lastProgress - start).count();
+
+        running = false;
+        for (auto& t : threads) {
+            t.join();
+        }
+        for (auto& sonda : sondaRuntimes) {
+            ::close(sonda.receivers.front().socket_fd);
+        }
+        sondaRuntimes.clear();
+
+        std::cout << "  " << std::left << std::setw(10) << engine << std::right
+                  << " receive threads: " << threads.size()
+                  << "  received: " << received << "/" << socketCount * datagramsPerSocket
+                  << "  rate: " << std::fixed << std::setprecision(0) << received / seconds << " datagrams/s"
+                  << std::endl;
+    }
+    running = true;
+    return true;
+}
+
+// Template of the MikroTik exporter in 'sample data income' (26 fields, 86 byte records)
+TemplateFields benchmarkTemplate() {
+    const uint16_t spec[][2] = {
+        {21, 4}, {22, 4}, {2, 4}, {1, 4}, {10, 4}, {14, 4}, {8, 4}, {12, 4}, {4, 1}, {5, 1}, {7, 2}, {11, 2}, {15, 4},
+        {13, 1}, {9, 1}, {6, 1}, {34, 4}, {35, 1}, {80, 6}, {56, 6}, {57, 6}, {81, 6}, {225, 4}, {226, 4}, {227, 2}, {228, 2}
+    };
+    TemplateFields fields;
+    for (const auto& f : spec) {
+        TemplateField field;
+        field.type = f[0];
+        field.length = f[1];
+        field.enterprise = 0;
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+// NetFlow v9 template packet and data packet with recordCount pseudo-random records
+void makeBenchmarkV9Packets(const TemplateFields& fields, uint16_t templateID, size_t recordCount,
+                            std::vector<char>& templatePacket, std::vector<char>& dataPacket) {
+    NetFlowV9Header header;
+    std::memset(&header, 0, sizeof(header));
+    header.version = htons(9);
+    header.source_id = htonl(1);
+
+    auto append16 = [](std::vector<char>& out, uint16_t v) { v = htons(v); out.insert(out.end(), (char*)&v, (char*)&v + 2); };
+
+    templatePacket.assign((char*)&header, (char*)&header + sizeof(header));
+    append16(templatePacket, 0);
+    append16(templatePacket, static_cast<uint16_t>(4 + 4 + 4 * fields.size()));
+    append16(templatePacket, templateID);
+    append16(templatePacket, static_cast<uint16_t>(fields.size()));
+    size_t recordLength = 0;
+    for (const auto& field : fields) {
+        append16(templatePacket, field.type);
+        append16(templatePacket, field.length);
+        recordLength += field.length;
+    }
+
+    dataPacket.assign((char*)&header, (char*)&header + sizeof(header));
+    append16(dataPacket, templateID);
+    append16(dataPacket, static_cast<uint16_t>(4 + recordLength * recordCount));
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < recordLength * recordCount; ++i) {
+        seed = seed * 1103515245 + 12345;
+        dataPacket.push_back(static_cast<char>(seed >> 16));
+    }
+}
+
+// IPFIX template message and data message with recordCount pseudo-random
+// records; variable-length fields carry 12 bytes
+void makeBenchmarkIPFIXPackets(const TemplateFields& fields, uint16_t templateID, size_t recordCount,
+                               std::vector<char>& templatePacket, std::vector<char>& dataPacket) {
+    IPFIXHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.version = htons(10);
+    header.observation_domain_id = htonl(1);
+
+    auto append16 = [](std::vector<char>& out, uint16_t v) { v = htons(v); out.insert(out.end(), (char*)&v, (char*)&v + 2); };
+    auto append32 = [](std::vector<char>& out, uint32_t v) { v = htonl(v); out.insert(out.end(), (char*)&v, (char*)&v + 4); };
+    auto setLength16 = [](std::vector<char>& out, size_t at, size_t v) { uint16_t n = htons(static_cast<uint16_t>(v)); std::memcpy(&out[at], &n, 2); };
+
+    templatePacket.assign((char*)&header, (char*)&header + sizeof(header));
+    append16(templatePacket, 2);
+    append16(templatePacket, 0);
+    append16(templatePacket, templateID);
+    append16(templatePacket, static_cast<uint16_t>(fields.size()));
+    for (const auto& field : fields) {
+        append16(templatePacket, field.enterprise ? field.type | 0x8000 : field.type);
+        append16(templatePacket, field.length);
+        if (field.enterprise) {
+            append32(templatePacket, field.enterprise);
+        }
+    }
+    setLength16(templatePacket, sizeof(header) + 2, templatePacket.size() - sizeof(header));
+    setLength16(templatePacket, 2, templatePacket.size());
+
+    dataPacket.assign((char*)&header, (char*)&header + sizeof(header));
+    append16(dataPacket, templateID);
+    append16(dataPacket, 0);
+    uint32_t seed = 12345;
+    for (size_t r = 0; r < recordCount; ++r) {
+        for (const auto& field : fields) {
+            size_t width = field.length;
+            if (field.length == VARIABLE_LENGTH) {
+                width = 12;
+                dataPacket.push_back(static_cast<char>(width));
+            }
+            for (size_t i = 0; i < width; ++i) {
+                seed = seed * 1103515245 + 12345;
+                dataPacket.push_back(static_cast<char>(seed >> 16));
+            }
+        }
+    }
+    setLength16(dataPacket, sizeof(header) + 2, dataPacket.size() - sizeof(header));
+    setLength16(dataPacket, 2, dataPacket.size());
+}
+
+// Previous decoder, kept as the baseline: per-record walk over the template with a switch per field
+size_t decodeFlowSetPerFieldSwitch(const TemplateFields& fields, const char* ptr, size_t flowsetDataLength, DatabaseHandler& handler) {
+    size_t recordLength = 0;
+    for (auto& field : fields) {
+        recordLength += field.length;
+    }
+    size_t records = 0;
+    const char* recordPtr = ptr;
+    while (recordPtr + recordLength <= ptr + flowsetDataLength) {
+        FlowData flowData;
+        size_t offset = 0;
+        for (auto& field : fields) {
+            switch (field.type) {
+                case 8: setIPv4(flowData.SourceIP, recordPtr + offset); break;
+                case 12: setIPv4(flowData.DestinationIP, recordPtr + offset); break;
+                case 7: flowData.SourcePort = ntohs(*(uint16_t*)(recordPtr + offset)); break;
+                case 11: flowData.DestinationPort = ntohs(*(uint16_t*)(recordPtr + offset)); break;
+                case 4: flowData.Protocol = *(uint8_t*)(recordPtr + offset); break;
+                case 2: flowData.PacketCount = ntohl(*(uint32_t*)(recordPtr + offset)); break;
+                case 1: flowData.ByteCount = ntohl(*(uint32_t*)(recordPtr + offset)); break;
+                default: break;
+            }
+            offset += field.length;
+        }
+        handler.insertFlowData(flowData);
+        recordPtr += recordLength;
+        ++records;
+    }
+    return records;
+}
+
+// Decoding a flowset with a decode plan, as processNetFlowV9Data() does
+size_t decodeFlowSetWithPlan(const DecodePlan& plan, const char* ptr, size_t flowsetDataLength, DatabaseHandler& handler) {
+    size_t records = 0;
+    for (const char* recordPtr = ptr; recordPtr + plan.recordLength <= ptr + flowsetDataLength; recordPtr += plan.recordLength) {
+        FlowData flowData;
+        plan.decode(recordPtr, flowData);
+        handler.insertFlowData(flowData);
+        ++records;
+    }
+    return records;
+}
+
+// NetFlow v9 record decoding: records/s of the per-field switch, the compiled
+// plan, the specialized decoder of the layout and the full packet path
+bool benchmarkDecode() {
+    const size_t recordCount = 16; // 16 x 86 bytes fill a 1400 byte export packet
+    const int iterations = 200000;
+    TemplateFields fields = benchmarkTemplate();
+    std::vector<char> templatePacket, dataPacket;
+    makeBenchmarkV9Packets(fields, 256, recordCount, templatePacket, dataPacket);
+    const char* flowset = dataPacket.data() + sizeof(NetFlowV9Header) + sizeof(NetFlowV9FlowSetHeader);
+    size_t flowsetDataLength = dataPacket.size() - sizeof(NetFlowV9Header) - sizeof(NetFlowV9FlowSetHeader);
+
+    std::cout << "NetFlow v9 decoding: " << fields.size() << " field template, " << recordCount << " records per packet" << std::endl;
+
+    CountingHandler counter;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        decodeFlowSetPerFieldSwitch(fields, flowset, flowsetDataLength, counter);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  per-field switch   " << std::fixed << std::setprecision(0) << counter.flows / seconds << " records/s" << std::endl;
+
+    std::shared_ptr<DecodePlan> plan = compileDecodePlan(fields);
+    DecodePlan genericPlan = *plan;
+    genericPlan.fixedDecoder = nullptr;
+    const DecodePlan* plans[] = { &genericPlan, plan.get() };
+    const char* labels[] = { "compiled plan", "specialized" };
+    for (int p = 0; p < 2; ++p) {
+        CountingHandler planCounter;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            decodeFlowSetWithPlan(*plans[p], flowset, flowsetDataLength, planCounter);
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  " << std::left << std::setw(19) << labels[p] << std::right << std::fixed << std::setprecision(0)
+                  << planCounter.flows / seconds << " records/s";
+        if (p == 0) {
+            std::cout << " (" << plan->steps.size() << " of " << fields.size() << " fields kept)";
+        } else if (plan->knownLayout >= 0) {
+            std::cout << " (" << knownLayouts[plan->knownLayout].name << ")";
+        }
+        std::cout << std::endl;
+    }
+
+    // Full processNetFlowV9Data() path
+    sondaRuntimes.emplace_back();
+    SondaRuntime& runtime = sondaRuntimes.back();
+    runtime.config.name = "bench";
+    runtime.receivers.emplace_back();
+    SondaReceiver& receiver = runtime.receivers.back();
+    receiver.sonda = &runtime;
+    receiver.dbHandler.reset(new CountingHandler());
+    CountingHandler& planCounter = static_cast<CountingHandler&>(*receiver.dbHandler);
+    struct sockaddr_in exporter;
+    std::memset(&exporter, 0, sizeof(exporter));
+    exporter.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    processNetFlowV9Data(templatePacket.data(), templatePacket.size(), receiver, exporter);
+
+    // Record by record, then with the batch decoder chosen for this CPU
+    bool sameCount = true;
+    for (int pass = 0; pass < 2; ++pass) {
+        selectBatchKernels(pass == 0 ? "off" : "auto");
+        if (pass == 1 && !batchKernels) {
+            break;
+        }
+        planCounter.flows = 0;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            processNetFlowV9Data(dataPacket.data(), dataPacket.size(), receiver, exporter);
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  packet path        " << std::fixed << std::setprecision(0) << planCounter.flows / seconds << " records/s"
+                  << " (" << (batchKernels ? std::string(batchKernels->name) + " batch" : std::string("per record")) << ")" << std::endl;
+        sameCount = sameCount && planCounter.flows == counter.flows;
+    }
+    selectBatchKernels("off");
+
+    sondaRuntimes.clear();
+    return sameCount;
+}
+
+// Keeps benchmark results alive so the measured loops are not optimized away
+volatile uint64_t benchmarkSink;
+
+// Batch decoder: records/s of each kernel set decoding 16-record flowsets
+// into columns, checked against the scalar kernels and the decode plan
+bool benchmarkBatchDecode() {
+    const size_t recordCount = 16;
+    const int iterations = 1000000;
+    TemplateFields mikrotik = benchmarkTemplate();
+    TemplateFields wideCounters = mikrotik;
+    wideCounters[2].length = 8; // IN_PKTS
+    wideCounters[3].length = 8; // IN_BYTES
+    const TemplateFields* templates[] = { &mikrotik, &wideCounters };
+    const char* templateNames[] = { "4-byte counters", "8-byte counters" };
+
+    __builtin_cpu_init();
+    std::vector<const BatchKernels*> kernels = { &scalarKernels };
+    if (__builtin_cpu_supports("sse4.1")) kernels.push_back(&sse4Kernels);
+    if (__builtin_cpu_supports("avx2")) kernels.push_back(&avx2Kernels);
+
+    std::cout << "Batch decoding into columns: " << recordCount << " records per flowset" << std::endl;
+    for (int t = 0; t < 2; ++t) {
+        std::vector<char> templatePacket, dataPacket;
+        makeBenchmarkV9Packets(*templates[t], 256, recordCount, templatePacket, dataPacket);
+        const char* records = dataPacket.data() + sizeof(NetFlowV9Header) + sizeof(NetFlowV9FlowSetHeader);
+        std::shared_ptr<DecodePlan> plan = compileDecodePlan(*templates[t]);
+        if (!plan->batch.usable) {
+            std::cerr << "Benchmark template cannot be batch decoded." << std::endl;
+            return false;
+        }
+
+        FlowColumns reference;
+        decodeFlowSetColumns(scalarKernels, *plan, records, recordCount, reference);
+        for (size_t r = 0; r < recordCount; ++r) {
+            FlowData fromPlan, fromColumns;
+            plan->decode(records + r * plan->recordLength, fromPlan);
+            reference.row(r, plan->batch, fromColumns);
+            if (std::memcmp(&fromPlan.SourceIP, &fromColumns.SourceIP, sizeof(FlowAddress)) != 0 ||
+                std::memcmp(&fromPlan.DestinationIP, &fromColumns.DestinationIP, sizeof(FlowAddress)) != 0 ||
+                fromPlan.SourcePort != fromColumns.SourcePort || fromPlan.DestinationPort != fromColumns.DestinationPort ||
+                fromPlan.Protocol != fromColumns.Protocol || fromPlan.PacketCount != fromColumns.PacketCount ||
+                fromPlan.ByteCount != fromColumns.ByteCount) {
+                std::cerr << "Batch decoder differs from the decode plan in record " << r << std::endl;
+                return false;
+            }
+        }
+
+        for (const BatchKernels* k : kernels) {
+            FlowColumns columns;
+            uint64_t checksum = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i) {
+                decodeFlowSetColumns(*k, *plan, records, recordCount, columns);
+                checksum += columns.byteCount[i % recordCount];
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            bool same = columns.sourceIP == reference.sourceIP && columns.destinationIP == reference.destinationIP &&
+                        columns.sourcePort == reference.sourcePort && columns.destinationPort == reference.destinationPort &&
+                        columns.protocol == reference.protocol && columns.packetCount == reference.packetCount &&
+                        columns.byteCount == reference.byteCount;
+            std::cout << "  " << templateNames[t] << "  " << std::left << std::setw(7) << k->name << std::right
+                      << std::fixed << std::setprecision(0) << iterations * recordCount / seconds << " records/s" << std::endl;
+            benchmarkSink = checksum;
+            if (!same) {
+                std::cerr << "Kernels " << k->name << " differ from the scalar kernels." << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// IPFIX decoding: records/s through decodeDatagram() for NetFlow v9 and
+// IPFIX with the same template, and IPFIX with variable-length and
+// enterprise-specific fields added
+bool benchmarkIPFIX() {
+    const size_t recordCount = 16;
+    const int iterations = 200000;
+    TemplateFields fixed = benchmarkTemplate();
+    TemplateFields variable = fixed;
+    TemplateField applicationName = { 96, VARIABLE_LENGTH, 0 };
+    TemplateField enterpriseCounter = { 1, 4, 29305 };
+    variable.push_back(applicationName);
+    variable.push_back(enterpriseCounter);
+
+    struct Case {
+        const char* label;
+        int version;
+        const TemplateFields* fields;
+    } cases[] = {
+        { "NetFlow v9", 9, &fixed },
+        { "IPFIX", 10, &fixed },
+        { "IPFIX variable", 10, &variable },
+    };
+
+    selectBatchKernels("auto");
+    std::cout << "IPFIX decoding: " << fixed.size() << " field template, " << recordCount << " records per packet" << std::endl;
+    bool ok = true;
+    for (const Case& c : cases) {
+        std::vector<char> templatePacket, dataPacket;
+        if (c.version == 9) {
+            makeBenchmarkV9Packets(*c.fields, 256, recordCount, templatePacket, dataPacket);
+        } else {
+            makeBenchmarkIPFIXPackets(*c.fields, 256, recordCount, templatePacket, dataPacket);
+        }
+
+        sondaRuntimes.emplace_back();
+        SondaRuntime& runtime = sondaRuntimes.back();
+        runtime.config.name = "bench";
+        runtime.receivers.emplace_back();
+        SondaReceiver& receiver = runtime.receivers.back();
+        receiver.sonda = &runtime;
+        receiver.dbHandler.reset(new CountingHandler());
+        CountingHandler& counter = static_cast<CountingHandler&>(*receiver.dbHandler);
+        struct sockaddr_in exporter;
+        std::memset(&exporter, 0, sizeof(exporter));
+        exporter.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        decodeDatagram(receiver, templatePacket.data(), templatePacket.size(), exporter);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            decodeDatagram(receiver, dataPacket.data(), dataPacket.size(), exporter);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  " << std::left << std::setw(19) << c.label << std::right << std::fixed << std::setprecision(0)
+                  << counter.flows / seconds << " records/s" << std::endl;
+        ok = ok && counter.flows == iterations * recordCount;
+        sondaRuntimes.clear();
+    }
+    selectBatchKernels("off");
+    return ok;
+}
+
+// SQLite sink: rows/s with a transaction per row and with batched
+// transactions, into a scratch database in /tmp (needs sqlite.sql)
+bool benchmarkSQLite() {
+    struct Case {
+        const char* label;
+        int batchSize;
+        int rows;
+    } cases[] = {
+        { "transaction per row", 1, 5000 },
+        { "1000 rows per batch", 1000, 500000 },
+    };
+
+    std::cout << "SQLite inserts (journal_mode=WAL, synchronous=NORMAL)" << std::endl;
+    for (const Case& c : cases) {
+        char path[] = "/tmp/netflow_bench_XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            perror("mkstemp");
+            return false;
+        }
+        ::close(fd);
+
+        DatabaseConfig config;
+        config.sqlite_path = path;
+        config.sqlite_batch_size = c.batchSize;
+        config.sqlite_flush_interval = 1000;
+        config.sqlite_journal_mode = "WAL";
+        config.sqlite_synchronous = "NORMAL";
+        config.sqlite_cache_size = 0;
+        config.sqlite_mmap_size = 0;
+        config.sqlite_queue_rows = 100000;
+        SQLiteHandler handler(config);
+        std::cout.setstate(std::ios::failbit); // Silence the table creation message
+        bool connected = handler.connect();
+        std::cout.clear();
+        if (!connected) {
+            unlink(path);
+            return false;
+        }
+
+        FlowData flow;
+        uint32_t address = htonl(0x0A000001);
+        setIPv4(flow.SourceIP, &address);
+        setIPv4(flow.DestinationIP, &address);
+        flow.Protocol = 6;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = true;
+        for (int i = 0; i < c.rows && ok; ++i) {
+            flow.SourcePort = static_cast<uint16_t>(i);
+            flow.ByteCount = i;
+            ok = handler.insertFlowData(flow);
+        }
+        handler.close();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  " << std::left << std::setw(21) << c.label << std::right << std::fixed << std::setprecision(0)
+                  << c.rows / seconds << " rows/s" << std::endl;
+        unlink(path);
+        unlink((std::string(path) + "-wal").c_str());
+        unlink((std::string(path) + "-shm").c_str());
+        if (!ok) {
+            return false;
+        }
+    }
+
+    // Several probes feeding the shared writer thread
+    const int producers = 4;
+    const int rowsPerProducer = 250000;
+    char path[] = "/tmp/netflow_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return false;
+    }
+    ::close(fd);
+
+    DatabaseConfig config;
+    config.sqlite_path = path;
+    config.sqlite_batch_size = 1000;
+    config.sqlite_flush_interval = 1000;
+    config.sqlite_journal_mode = "WAL";
+    config.sqlite_synchronous = "NORMAL";
+    config.sqlite_cache_size = 0;
+    config.sqlite_mmap_size = 0;
+    config.sqlite_queue_rows = 100000;
+    SQLiteWriter writer(config);
+    std::cout.setstate(std::ios::failbit);
+    bool connected = writer.start();
+    std::cout.clear();
+    if (!connected) {
+        unlink(path);
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&writer, &config, p] {
+            BatchQueueHandler handler(writer, config.sqlite_batch_size, config.sqlite_flush_interval);
+            FlowData flow;
+            uint32_t address = htonl(0x0A000001 + p);
+            setIPv4(flow.SourceIP, &address);
+            setIPv4(flow.DestinationIP, &address);
+            flow.Protocol = 6;
+            for (int i = 0; i < rowsPerProducer; ++i) {
+                flow.SourcePort = static_cast<uint16_t>(i);
+                flow.ByteCount = i;
+                handler.insertFlowData(flow);
+            }
+            handler.close();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    writer.stop();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t commits = writer.commits.load();
+    std::cout << "  " << producers << " producers, 1 writer " << std::fixed << std::setprecision(0)
+              << writer.rows.load() / seconds << " rows/s, " << commits << " commits, "
+              << writer.producerWaits.load() << " producer waits" << std::endl;
+    unlink(path);
+    unlink((std::string(path) + "-wal").c_str());
+    unlink((std::string(path) + "-shm").c_str());
+    return writer.rows.load() == static_cast<uint64_t>(producers) * rowsPerProducer;
+}
+
+// CSV rows/s (--bench=csv) into a file on tmpfs (/dev/shm, or /tmp), with
+// the buffered writer and with the former open/append/close per row
+bool benchmarkCSV() {
+    // The hand-rolled formatters must write what formatAddress() and formatTimestamp() write
+    uint64_t timestamps[] = { 0, 1, 999999999, 1700000000123456789ULL, 1700000000999000000ULL, 4102444799000000000ULL };
+    TimestampWriter timestampWriter;
+    for (uint64_t ns : timestamps) {
+        char expected[32], text[32];
+        *timestampWriter.write(text, ns) = '\0';
+        if (strcmp(formatTimestamp(ns, expected), text) != 0) {
+            std::cerr << "TimestampWriter differs from formatTimestamp(): " << text << " / " << expected << std::endl;
+            return false;
+        }
+    }
+    FlowAddress addresses[4];
+    uint32_t ipv4[] = { htonl(0x00000000), htonl(0xC0A80101), htonl(0xFFFFFFFF) };
+    for (int i = 0; i < 3; ++i) {
+        setIPv4(addresses[i], &ipv4[i]);
+    }
+    uint8_t ipv6[16] = { 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+    setIPv6(addresses[3], ipv6);
+    for (const FlowAddress& address : addresses) {
+        char expected[INET6_ADDRSTRLEN], text[INET6_ADDRSTRLEN];
+        *writeAddress(text, address) = '\0';
+        if (strcmp(formatAddress(address, expected), text) != 0) {
+            std::cerr << "writeAddress() differs from formatAddress(): " << text << " / " << expected << std::endl;
+            return false;
+        }
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "%s/netflow_bench_XXXXXX", access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return false;
+    }
+    ::close(fd);
+    unlink(path);
+
+    FlowData flow;
+    flow.Protocol = 6;
+    flow.DestinationPort = 443;
+    auto setFlow = [&flow](uint32_t i) {
+        uint32_t source = htonl(0x0A000000 + (i & 0xFFFF));
+        uint32_t destination = htonl(0xC0A80000 + (i * 7 & 0xFFFF));
+        setIPv4(flow.SourceIP, &source);
+        setIPv4(flow.DestinationIP, &destination);
+        flow.SourcePort = static_cast<uint16_t>(1024 + i);
+        flow.PacketCount = i % 1000;
+        flow.ByteCount = i * 1500ULL;
+        flow.FlowStart = 1700000000000000000ULL + i * 1000000ULL;
+        flow.FlowEnd = flow.FlowStart + 5000000000ULL;
+    };
+
+    std::cout << "CSV writer (" << path << ")" << std::endl;
+    DatabaseConfig config;
+    config.csv_path = path;
+    config.csv_buffer_size = 1024;
+    config.csv_flush_interval = 1000;
+    config.csv_rotate_interval = 0;
+    config.csv_compress = "none";
+    config.csv_compress_level = 1;
+    const uint32_t rows = 5000000;
+    {
+        CSVHandler handler(config);
+        std::cout.setstate(std::ios::failbit); // Silence the file creation message
+        bool connected = handler.connect();
+        std::cout.clear();
+        if (!connected) {
+            return false;
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < rows; ++i) {
+            setFlow(i);
+            handler.insertFlowData(flow);
+        }
+        handler.close();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        struct stat st;
+        stat(path, &st);
+        std::cout << "  buffered writer        " << std::fixed << std::setprecision(0) << rows / seconds << " rows/s, "
+                  << std::setprecision(1) << st.st_size / seconds / 1e6 << " MB/s" << std::endl;
+        unlink(path);
+    }
+
+    {
+        // Compressed on the writer thread
+        config.csv_rotate_interval = 0;
+        config.csv_compress = "gzip";
+        config.csv_compress_level = 1;
+        CSVFileWriter writer(config);
+        CSVHandler handler(config, &writer);
+        std::cout.setstate(std::ios::failbit);
+        bool connected = handler.connect();
+        std::cout.clear();
+        if (!connected) {
+            return false;
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < rows; ++i) {
+            setFlow(i);
+            handler.insertFlowData(flow);
+        }
+        handler.close();
+        writer.stop();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  gzip level 1 writer    " << std::fixed << std::setprecision(0) << rows / seconds << " rows/s, ratio "
+                  << std::setprecision(1) << static_cast<double>(writer.bytesIn.load()) / writer.bytesOut.load() << std::endl;
+        unlink((std::string(path) + ".gz").c_str());
+    }
+
+    const uint32_t slowRows = 100000;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < slowRows; ++i) {
+        setFlow(i);
+        std::ofstream outFile(path, std::ios::app);
+        char sourceIP[INET6_ADDRSTRLEN], destinationIP[INET6_ADDRSTRLEN], flowStart[32], flowEnd[32];
+        outFile << formatAddress(flow.SourceIP, sourceIP) << ',' << formatAddress(flow.DestinationIP, destinationIP) << ','
+                << flow.SourcePort << ',' << flow.DestinationPort << ',' << static_cast<int>(flow.Protocol) << ','
+                << flow.PacketCount << ',' << flow.ByteCount << ',' << formatTimestamp(flow.FlowStart, flowStart) << ','
+                << formatTimestamp(flow.FlowEnd, flowEnd) << ',' << probeName(flow.ProbeID) << '\n';
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  open/append/close/row  " << std::fixed << std::setprecision(0) << slowRows / seconds << " rows/s" << std::endl;
+    unlink(path);
+    return true;
+}
+
+// nfcapd files (--bench=nfcapd): rows/s through the nfcapd handler and file
+// writer into a directory on tmpfs; the file is then walked block by block
+// and its records are checked against the written rows
+bool benchmarkNfcapd() {
+    char directory[64];
+    snprintf(directory, sizeof(directory), "%s/netflow_bench_XXXXXX", access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp");
+    if (!mkdtemp(directory)) {
+        perror("mkdtemp");
+        return false;
+    }
+
+    auto makeFlow = [](uint32_t i) {
+        FlowData flow;
+        uint32_t source = htonl(0x0A000000 + (i & 0xFFFF));
+        uint32_t destination = htonl(0xC0A80000 + (i * 7 & 0xFFFF));
+        setIPv4(flow.SourceIP, &source);
+        if (i % 10 == 0) {
+            uint8_t ipv6[16] = { 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i) };
+            setIPv6(flow.DestinationIP, ipv6);
+        } else {
+            setIPv4(flow.DestinationIP, &destination);
+        }
+        flow.SourcePort = static_cast<uint16_t>(1024 + i);
+        flow.DestinationPort = 443;
+        flow.Protocol = i % 4 ? 6 : 17;
+        flow.PacketCount = i % 1000;
+        flow.ByteCount = i * 1500ULL;
+        flow.FlowStart = 1700000000000000000ULL + i * 1000000ULL;
+        flow.FlowEnd = flow.FlowStart + 5000000000ULL;
+        return flow;
+    };
+
+    DatabaseConfig config;
+    config.nfcapd_path = directory;
+    config.nfcapd_rotate_interval = 86400; // One file
+    config.nfcapd_flush_interval = 1000;
+    const uint32_t rows = 5000000;
+
+    std::cout << "nfcapd writer (" << directory << ")" << std::endl;
+    uint64_t fileBytes;
+    {
+        NfcapdFileWriter writer(config);
+        NfcapdHandler handler(config, writer);
+        std::cout.setstate(std::ios::failbit); // Silence the start message
+        bool connected = handler.connect();
+        std::cout.clear();
+        if (!connected) {
+            rmdir(directory);
+            return false;
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < rows; ++i) {
+            handler.insertFlowData(makeFlow(i));
+        }
+        handler.close();
+        writer.stop();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fileBytes = writer.bytes.load() + sizeof(NfdumpFileHeader);
+        std::cout << "  write                  " << std::fixed << std::setprecision(0) << rows / seconds << " rows/s, "
+                  << std::setprecision(1) << fileBytes / seconds / 1e6 << " MB/s, "
+                  << static_cast<double>(fileBytes) / rows << " bytes/row" << std::endl;
+    }
+
+    // Walk the finished file as nfdump does
+    std::string path;
+    std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(directory), closedir);
+    while (struct dirent* entry = dir ? readdir(dir.get()) : nullptr) {
+        if (strncmp(entry->d_name, "nfcapd.", 7) == 0) {
+            path = std::string(directory) + "/" + entry->d_name;
+        }
+    }
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    bool ok = content.size() >= sizeof(NfdumpFileHeader);
+    uint32_t next = 0;
+    NfdumpFileHeader header;
+    NfdumpStatRecord stat;
+    memset(&header, 0, sizeof(header));
+    memset(&stat, 0, sizeof(stat));
+    if (ok) {
+        memcpy(&header, content.data(), sizeof(header));
+        ok = header.magic == NFDUMP_MAGIC && header.version == NFDUMP_LAYOUT_VERSION_2 && header.appendixBlocks == 1;
+    }
+    size_t offset = sizeof(NfdumpFileHeader);
+    for (uint32_t b = 0; ok && b < header.numBlocks + header.appendixBlocks; ++b) {
+        NfdumpDataBlock block;
+        if (content.size() - offset < sizeof(block)) {
+            ok = false;
+            break;
+        }
+        memcpy(&block, content.data() + offset, sizeof(block));
+        const char* p = content.data() + offset + sizeof(block);
+        offset += sizeof(block) + block.size;
+        ok = offset <= content.size() && (b < header.numBlocks ? block.type == NFDUMP_DATA_BLOCK_TYPE_3 : offset == header.offAppendix + sizeof(block) + block.size);
+        for (uint32_t r = 0; ok && r < block.numRecords; ++r) {
+            NfdumpRecordHeader record;
+            memcpy(&record, p, sizeof(record));
+            if (record.type == NFDUMP_TYPE_STAT) {
+                memcpy(&stat, p + sizeof(record), sizeof(stat));
+            } else if (record.type == NFDUMP_V3_RECORD) {
+                FlowData expected = makeFlow(next++);
+                NfdumpGenericFlow flow;
+                memcpy(&flow, p + sizeof(NfdumpV3Header) + sizeof(NfdumpElementHeader), sizeof(flow));
+                const char* addresses = p + sizeof(NfdumpV3Header) + sizeof(NfdumpElementHeader) + sizeof(flow) + sizeof(NfdumpElementHeader);
+                // The IPv4 source is the low half of srcAddr[1] in an IPv6 element (IPv4-mapped)
+                uint32_t source, expectedSource;
+                memcpy(&source, addresses + (expected.DestinationIP.version == 6 ? 8 : 0), 4);
+                memcpy(&expectedSource, expected.SourceIP.bytes + 12, 4);
+                ok = flow.msecFirst == expected.FlowStart / 1000000 && flow.inBytes == expected.ByteCount &&
+                     flow.srcPort == expected.SourcePort && flow.proto == expected.Protocol && source == ntohl(expectedSource);
+            }
+            p += record.size;
+        }
     }
-
-    void close() override {
-        // No action needed for CSV on close
+    ok = ok && next == rows && stat.numflows == rows && stat.numflows_tcp + stat.numflows_udp == rows;
+    if (!ok) {
+        std::cerr << "nfcapd file differs from the written rows (row " << next << "): " << path << std::endl;
     }
-};
-
-// Global configuration variables
-DatabaseConfig dbConfig;
-std::vector<SondaConfig> sondaConfigs;
-bool displayPackets = false; // For -d or --display option
-bool enableLogging = false;   // Controlled by 'log' option in .ini file
-std::string diagFilePath;     // For --diag=PATH option
-std::mutex diagFileMutex;     // Mutex for thread-safe writing to diag file
+    std::cout << "  file                   " << header.numBlocks << " blocks, " << stat.numflows << " flows" << std::endl;
+    unlink(path.c_str());
+    rmdir(directory);
+    return ok;
+}
 
-// Function to load configuration
-bool loadConfig(const std::string& filename) {
-    INIParser parser(filename);
-    if (!parser.parse()) {
-        std::cerr << "Failed to parse configuration file." << std::endl;
-        syslog(LOG_ERR, "Failed to parse configuration file: %s", filename.c_str());
+// Native segments (--bench=native): rows/s through the segment writer into
+// a file on tmpfs, size per row, and rows/s read back through the mapping,
+// checked against what was written
+bool benchmarkNative() {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/netflow_bench_XXXXXX", access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
         return false;
     }
+    ::close(fd);
+    unlink(path);
 
-    // Load database configuration
-    dbConfig.type = parser.get("Database", "type", "");
-    dbConfig.sqlite_path = parser.get("Database", "sqlite_path", "");
-    dbConfig.csv_path = parser.get("Database", "csv_path", "");
-    dbConfig.mysql_host = parser.get("Database", "mysql_host", "localhost");
-    dbConfig.mysql_port = parser.getInteger("Database", "mysql_port", 3306);
-    dbConfig.mysql_user = parser.get("Database", "mysql_user", "");
-    dbConfig.mysql_password = parser.get("Database", "mysql_password", "");
-    dbConfig.mysql_database = parser.get("Database", "mysql_database", "");
-
-    // Load general configuration
-    enableLogging = parser.getInteger("General", "log", 0) == 1;
+    // Mostly IPv4 with some IPv6, few protocols and destination ports, many source ports
+    auto makeFlow = [](uint32_t i) {
+        FlowData flow;
+        uint32_t source = htonl(0x0A000000 + (i * 2654435761U >> 16));
+        uint32_t destination = htonl(0xC0A80000 + (i * 7 & 0xFFFF));
+        setIPv4(flow.SourceIP, &source);
+        if (i % 10 == 0) {
+            uint8_t ipv6[16] = { 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i) };
+            setIPv6(flow.DestinationIP, ipv6);
+        } else {
+            setIPv4(flow.DestinationIP, &destination);
+        }
+        static const uint16_t ports[] = { 443, 80, 53, 123, 22, 8080, 993, 25 };
+        flow.SourcePort = static_cast<uint16_t>(1024 + i * 40503U % 60000);
+        flow.DestinationPort = ports[i % 8];
+        flow.Protocol = i % 8 == 2 || i % 8 == 3 ? 17 : 6;
+        flow.PacketCount = 1 + i % 97;
+        flow.ByteCount = flow.PacketCount * (40 + i % 1460);
+        flow.FlowStart = 1700000000000000000ULL + i * 100000ULL;
+        flow.FlowEnd = flow.FlowStart + (i % 30000) * 1000000ULL;
+        flow.ProbeID = static_cast<uint16_t>(i % 3);
+        return flow;
+    };
 
-    // Load probe configurations
-    int sondaCount = parser.getInteger("SondeCount", "count", 0);
-    for (int i = 1; i <= sondaCount; ++i) {
-        std::string section = "Sonda" + std::to_string(i);
-        SondaConfig sonda;
-        sonda.name = parser.get(section, "name", "");
-        sonda.version = parser.get(section, "version", "");
-        sonda.filter_address = parser.get(section, "listen_address", ""); // Use 'listen_address' as 'filter_address'
-        sonda.port = parser.getInteger(section, "port", 0);
+    DatabaseConfig config;
+    config.native_path = path;
+    config.native_rotate_interval = 0;
+    config.native_block_rows = 65536;
+    config.native_queue_rows = 1000000;
+    const uint32_t rows = 5000000;
+    const size_t batchRows = 4096;
 
-        if (sonda.name.empty() || sonda.port == 0) {
-            std::cerr << "Missing data in configuration for " << section << std::endl;
-            syslog(LOG_ERR, "Missing data in configuration for %s", section.c_str());
+    std::cout << "Native segment writer (" << path << ")" << std::endl;
+    uint64_t segmentSize = 0;
+    {
+        NativeSegmentWriter writer(config, { "probe1", "probe2", "probe3" });
+        std::cout.setstate(std::ios::failbit); // Silence the segment creation message
+        bool started = writer.start();
+        std::cout.clear();
+        if (!started) {
             return false;
         }
+        auto start = std::chrono::steady_clock::now();
+        FlowBatch* batch = nullptr;
+        for (uint32_t i = 0; i < rows; ++i) {
+            if (!batch) {
+                batch = new FlowBatch();
+                batch->rows.reserve(batchRows);
+            }
+            batch->rows.push_back(makeFlow(i));
+            if (batch->rows.size() == batchRows) {
+                writer.submit(batch);
+                batch = nullptr;
+            }
+        }
+        if (batch) {
+            writer.submit(batch);
+        }
+        writer.stop();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        struct stat st;
+        stat(path, &st);
+        segmentSize = st.st_size;
+        std::cout << "  write                  " << std::fixed << std::setprecision(0) << rows / seconds << " rows/s, "
+                  << std::setprecision(1) << static_cast<double>(segmentSize) / rows << " bytes/row, "
+                  << writer.blocks.load() << " blocks" << std::endl;
+    }
 
-        sondaConfigs.push_back(sonda);
+    NativeSegmentReader reader;
+    if (!reader.open(path) || !reader.hasFooter() || reader.probes().size() != 3) {
+        std::cerr << "Native segment footer missing or wrong" << std::endl;
+        unlink(path);
+        return false;
+    }
+    std::vector<FlowData> block;
+    uint32_t next = 0;
+    bool same = true;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < reader.blocks().size() && same; ++i) {
+        if (!reader.readBlock(i, block)) {
+            same = false;
+            break;
+        }
+        for (const FlowData& row : block) {
+            FlowData expected = makeFlow(next++);
+            if (std::memcmp(&row.SourceIP, &expected.SourceIP, sizeof(FlowAddress)) != 0 ||
+                std::memcmp(&row.DestinationIP, &expected.DestinationIP, sizeof(FlowAddress)) != 0 ||
+                row.SourcePort != expected.SourcePort || row.DestinationPort != expected.DestinationPort ||
+                row.Protocol != expected.Protocol || row.PacketCount != expected.PacketCount ||
+                row.ByteCount != expected.ByteCount || row.FlowStart != expected.FlowStart ||
+                row.FlowEnd != expected.FlowEnd || row.ProbeID != expected.ProbeID) {
+                same = false;
+                break;
+            }
+        }
     }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!same || next != rows) {
+        std::cerr << "Native segment rows differ from the written rows (row " << next << ")" << std::endl;
+        unlink(path);
+        return false;
+    }
+    std::cout << "  read and check (mmap)  " << std::fixed << std::setprecision(0) << rows / seconds << " rows/s" << std::endl;
 
+    // The same rows as CSV text, for comparison
+    uint64_t csvSize = 0;
+    TimestampWriter timestampWriter;
+    char line[2 * INET6_ADDRSTRLEN + 5 * 20 + 2 * 32 + 16];
+    for (uint32_t i = 0; i < rows; i += 10) {
+        FlowData flow = makeFlow(i);
+        char* p = writeAddress(line, flow.SourceIP);
+        p = writeAddress(p, flow.DestinationIP);
+        p = writeDecimal(p, flow.SourcePort);
+        p = writeDecimal(p, flow.DestinationPort);
+        p = writeDecimal(p, flow.Protocol);
+        p = writeDecimal(p, flow.PacketCount);
+        p = writeDecimal(p, flow.ByteCount);
+        p = timestampWriter.write(p, flow.FlowStart);
+        p = timestampWriter.write(p, flow.FlowEnd);
+        csvSize += (p - line) + 9 + 7; // Separators, newline and the probe name
+    }
+    std::cout << "  CSV for comparison     " << std::fixed << std::setprecision(1) << csvSize / (rows / 10.0) << " bytes/row" << std::endl;
+    unlink(path);
     return true;
 }
 
-// Function to create a socket
-int createSocket(int port) {
-    int sockfd;
-    struct sockaddr_in servaddr;
-
-    // Create socket
-    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-        perror("Error creating socket");
-        syslog(LOG_ERR, "Error creating socket: %s", strerror(errno));
-        return -1;
+// Arrow IPC files (--bench=arrow): rows/s through the Arrow writer into a
+// file on tmpfs and size per row; the file is then checked for the Arrow
+// magic at both ends and a footer of the right size
+bool benchmarkArrow() {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/netflow_bench_XXXXXX", access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return false;
     }
+    ::close(fd);
+    unlink(path);
 
-    // Set address and port
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = htonl(INADDR_ANY); // Bind to all interfaces
-    servaddr.sin_port = htons(port);
+    auto makeFlow = [](uint32_t i) {
+        FlowData flow;
+        uint32_t source = htonl(0x0A000000 + (i & 0xFFFF));
+        uint32_t destination = htonl(0xC0A80000 + (i * 7 & 0xFFFF));
+        setIPv4(flow.SourceIP, &source);
+        setIPv4(flow.DestinationIP, &destination);
+        flow.SourcePort = static_cast<uint16_t>(1024 + i);
+        flow.DestinationPort = 443;
+        flow.Protocol = i % 4 ? 6 : 17;
+        flow.PacketCount = i % 1000;
+        flow.ByteCount = i * 1500ULL;
+        flow.FlowStart = 1700000000000000000ULL + i * 1000000ULL;
+        flow.FlowEnd = flow.FlowStart + 5000000000ULL;
+        flow.ProbeID = static_cast<uint16_t>(i % 3);
+        return flow;
+    };
 
-    // Bind socket to address and port
-    if (bind(sockfd, (const struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
-        perror("Error binding socket");
-        syslog(LOG_ERR, "Error binding socket on port %d: %s", port, strerror(errno));
-        close(sockfd);
-        return -1;
+    DatabaseConfig config;
+    config.arrow_path = path;
+    config.arrow_format = "file";
+    config.arrow_rotate_interval = 0;
+    config.arrow_batch_rows = 65536;
+    config.arrow_queue_rows = 1000000;
+    const uint32_t rows = 5000000;
+    const size_t batchRows = 4096;
+
+    std::cout << "Arrow file writer (" << path << ")" << std::endl;
+    {
+        ArrowFileWriter writer(config, { "probe1", "probe2", "probe3" });
+        std::cout.setstate(std::ios::failbit); // Silence the file creation message
+        bool started = writer.start();
+        std::cout.clear();
+        if (!started) {
+            return false;
+        }
+        auto start = std::chrono::steady_clock::now();
+        FlowBatch* batch = nullptr;
+        for (uint32_t i = 0; i < rows; ++i) {
+            if (!batch) {
+                batch = new FlowBatch();
+                batch->rows.reserve(batchRows);
+            }
+            batch->rows.push_back(makeFlow(i));
+            if (batch->rows.size() == batchRows) {
+                writer.submit(batch);
+                batch = nullptr;
+            }
+        }
+        if (batch) {
+            writer.submit(batch);
+        }
+        writer.stop();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        struct stat st;
+        stat(path, &st);
+        std::cout << "  write                  " << std::fixed << std::setprecision(0) << rows / seconds << " rows/s, "
+                  << std::setprecision(1) << st.st_size / seconds / 1e6 << " MB/s, "
+                  << static_cast<double>(st.st_size) / rows << " bytes/row, "
+                  << writer.batches.load() << " batches" << std::endl;
+        if (writer.rows.load() != rows) {
+            std::cerr << "Arrow writer lost rows: " << writer.rows.load() << " of " << rows << std::endl;
+            unlink(path);
+            return false;
+        }
     }
 
-    return sockfd;
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    int32_t footerSize = 0;
+    bool ok = content.size() > 24 && memcmp(content.data(), "ARROW1\0\0", 8) == 0 &&
+              memcmp(content.data() + content.size() - 6, "ARROW1", 6) == 0;
+    if (ok) {
+        memcpy(&footerSize, content.data() + content.size() - 10, 4);
+        ok = footerSize > 0 && static_cast<size_t>(footerSize) + 18 < content.size();
+    }
+    if (!ok) {
+        std::cerr << "Arrow file is not complete: " << path << std::endl;
+    }
+    std::cout << "  file                   footer " << footerSize << " bytes" << std::endl;
+    unlink(path);
+    return ok;
 }
 
-struct SondaRuntime {
-    SondaConfig config;
-    int socket_fd;
-    std::unique_ptr<DatabaseHandler> dbHandler;
-    std::map<uint16_t, std::vector<NetFlowV9FieldSpecifier>> templates;
-};
-
-std::vector<SondaRuntime> sondaRuntimes;
+// MySQL inserts (--bench=mysql), against the server from the [Database]
+// section of the configuration file. Rows go to a temporary NetFlowData
+// table that shadows the real one and disappears with the connection.
+bool benchmarkMySQL(const std::string& configFile) {
+    if (!loadConfig(configFile)) {
+        return false;
+    }
+    struct Case {
+        const char* label;
+        const char* mode;
+        int batchSize;
+        int rows;
+    } cases[] = {
+        { "INSERT per row", "insert", 1, 5000 },
+        { "1000 rows per INSERT", "insert", 1000, 500000 },
+        { "LOAD DATA, 4 MiB", "load", 1000, 2000000 },
+    };
 
-// Function to set up sockets
-bool setupSockets() {
-    for (auto& sondaConfig : sondaConfigs) {
-        int sockfd = createSocket(sondaConfig.port);
-        if (sockfd < 0) {
-            std::cerr << "Cannot create socket for probe " << sondaConfig.name << std::endl;
-            syslog(LOG_ERR, "Cannot create socket for probe %s", sondaConfig.name.c_str());
+    std::cout << "MySQL inserts (" << dbConfig.mysql_host << ":" << dbConfig.mysql_port << "/" << dbConfig.mysql_database << ")" << std::endl;
+    for (const Case& c : cases) {
+        DatabaseConfig config = dbConfig;
+        config.mysql_mode = c.mode;
+        config.mysql_batch_size = c.batchSize;
+        config.mysql_load_size = 4096;
+        config.mysql_flush_interval = 1000;
+        MySQLHandler handler(config);
+        std::cout.setstate(std::ios::failbit); // Silence the table check message
+        bool connected = handler.connect();
+        std::cout.clear();
+        if (!connected || !handler.execute("CREATE TEMPORARY TABLE NetFlowData LIKE NetFlowData")) {
             return false;
         }
 
-        SondaRuntime runtime;
-        runtime.config = sondaConfig;
-        runtime.socket_fd = sockfd;
-
-        // Create database handler for each probe
-        if (dbConfig.type == "sqlite") {
-            runtime.dbHandler = std::make_unique<SQLiteHandler>(dbConfig.sqlite_path);
-        } else if (dbConfig.type == "mysql") {
-            runtime.dbHandler = std::make_unique<MySQLHandler>(dbConfig);
-        } else if (dbConfig.type == "csv") {
-            runtime.dbHandler = std::make_unique<CSVHandler>(dbConfig.csv_path);
-        } else {
-            std::cerr << "Database type not implemented: " << dbConfig.type << std::endl;
-            syslog(LOG_ERR, "Database type not implemented: %s", dbConfig.type.c_str());
-            return false;
+        FlowData flow;
+        uint32_t address = htonl(0x0A000001);
+        setIPv4(flow.SourceIP, &address);
+        setIPv4(flow.DestinationIP, &address);
+        flow.Protocol = 6;
+        flow.FlowStart = flow.FlowEnd = 1700000000000000000ULL;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = true;
+        for (int i = 0; i < c.rows && ok; ++i) {
+            flow.SourcePort = static_cast<uint16_t>(i);
+            flow.ByteCount = i;
+            ok = handler.insertFlowData(flow);
         }
-
-        if (!runtime.dbHandler->connect()) {
-            std::cerr << "Cannot connect to database for probe " << sondaConfig.name << std::endl;
-            syslog(LOG_ERR, "Cannot connect to database for probe %s", sondaConfig.name.c_str());
+        handler.close();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!ok) {
             return false;
         }
+        std::cout << "  " << std::left << std::setw(21) << c.label << std::right << std::fixed << std::setprecision(0)
+                  << c.rows / seconds << " rows/s";
+        uint64_t loads = mysqlLoadStats.loads.exchange(0);
+        if (loads) {
+            std::cout << ", " << std::setprecision(1) << mysqlLoadStats.latencyMicroseconds.exchange(0) / 1000.0 / loads
+                      << " ms per load";
+        }
+        std::cout << std::endl;
+    }
 
-        sondaRuntimes.push_back(std::move(runtime));
+    // Four probes feeding a writer pool; each worker connection writes to its own temporary table
+    const int producers = 4;
+    const int rowsPerProducer = 250000;
+    DatabaseConfig config = dbConfig;
+    config.mysql_mode = "insert";
+    config.mysql_batch_size = 1000;
+    config.mysql_flush_interval = 1000;
+    config.mysql_connections = 4;
+    config.mysql_queue_rows = 100000;
+    config.mysql_health_interval = 30;
+    MySQLWriterPool pool(config, "CREATE TEMPORARY TABLE NetFlowData LIKE NetFlowData");
+    std::cout.setstate(std::ios::failbit);
+    bool started = pool.start();
+    std::cout.clear();
+    if (!started) {
+        return false;
     }
-    return true;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&pool, &config, p] {
+            BatchQueueHandler handler(pool, config.mysql_batch_size, config.mysql_flush_interval);
+            FlowData flow;
+            uint32_t address = htonl(0x0A000001 + p);
+            setIPv4(flow.SourceIP, &address);
+            setIPv4(flow.DestinationIP, &address);
+            flow.Protocol = 6;
+            flow.FlowStart = flow.FlowEnd = 1700000000000000000ULL;
+            for (int i = 0; i < rowsPerProducer; ++i) {
+                flow.SourcePort = static_cast<uint16_t>(i);
+                flow.ByteCount = i;
+                handler.insertFlowData(flow);
+            }
+            handler.close();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    pool.stop();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  " << producers << " producers, pool of " << config.mysql_connections << " " << std::fixed << std::setprecision(0)
+              << pool.rows.load() / seconds << " rows/s" << std::endl;
+    return pool.rows.load() == static_cast<uint64_t>(producers) * rowsPerProducer;
 }
 
-// Function to check database connection (--checkdb parameter)
-bool checkDatabase() {
-    // Create database handler based on type
-    std::unique_ptr<DatabaseHandler> dbHandler;
-    if (dbConfig.type == "sqlite") {
-        dbHandler = std::make_unique<SQLiteHandler>(dbConfig.sqlite_path);
-    } else if (dbConfig.type == "mysql") {
-        dbHandler = std::make_unique<MySQLHandler>(dbConfig);
-    } else if (dbConfig.type == "csv") {
-        dbHandler = std::make_unique<CSVHandler>(dbConfig.csv_path);
-    } else {
-        std::cerr << "Database type not implemented: " << dbConfig.type << std::endl;
-        syslog(LOG_ERR, "Database type not implemented: %s", dbConfig.type.c_str());
+// PostgreSQL binary COPY (--bench=postgres), against the server from
+// postgres_conninfo in the configuration file. Rows go to a temporary
+// NetFlowData table that shadows the real one and disappears with the
+// connection.
+bool benchmarkPostgres(const std::string& configFile) {
+    if (!loadConfig(configFile)) {
         return false;
     }
+    const char* temporaryTable = "CREATE TEMPORARY TABLE NetFlowData (LIKE NetFlowData INCLUDING ALL)";
+    auto makeFlow = [](uint32_t i, uint32_t producer) {
+        FlowData flow;
+        uint32_t source = htonl(0x0A000000 + producer * 0x10000 + (i & 0xFFFF));
+        uint32_t destination = htonl(0xC0A80000 + (i * 7 & 0xFFFF));
+        setIPv4(flow.SourceIP, &source);
+        setIPv4(flow.DestinationIP, &destination);
+        flow.SourcePort = static_cast<uint16_t>(1024 + i);
+        flow.DestinationPort = 443;
+        flow.Protocol = i % 4 ? 6 : 17;
+        flow.PacketCount = i % 1000;
+        flow.ByteCount = i * 1500ULL;
+        flow.FlowStart = 1700000000000000000ULL + i * 1000000ULL;
+        flow.FlowEnd = flow.FlowStart + 5000000000ULL;
+        return flow;
+    };
 
-    // Check connection
-    if (!dbHandler->checkConnection()) {
-        std::cerr << "Database connection failed." << std::endl;
-        syslog(LOG_ERR, "Database connection failed.");
-        return false;
+    struct Case {
+        const char* label;
+        int copyRows;
+        int rows;
+    } cases[] = {
+        { "COPY of 1000 rows", 1000, 500000 },
+        { "COPY of 100000 rows", 100000, 2000000 },
+    };
+    std::cout << "PostgreSQL binary COPY (" << dbConfig.postgres_conninfo << ")" << std::endl;
+    for (const Case& c : cases) {
+        DatabaseConfig config = dbConfig;
+        config.postgres_copy_rows = c.copyRows;
+        config.postgres_flush_interval = 1000;
+        PostgresHandler handler(config);
+        std::cout.setstate(std::ios::failbit); // Silence the table check message
+        bool connected = handler.connect();
+        std::cout.clear();
+        if (!connected || !handler.execute(temporaryTable)) {
+            return false;
+        }
+        uint64_t before = postgresCopyStats.rows.load();
+        auto start = std::chrono::steady_clock::now();
+        bool ok = true;
+        for (int i = 0; i < c.rows && ok; ++i) {
+            ok = handler.insertFlowData(makeFlow(i, 0));
+        }
+        handler.close();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!ok || postgresCopyStats.rows.load() - before != static_cast<uint64_t>(c.rows)) {
+            return false;
+        }
+        std::cout << "  " << std::left << std::setw(21) << c.label << std::right << std::fixed << std::setprecision(0)
+                  << c.rows / seconds << " rows/s" << std::endl;
     }
 
-    // Initialize table or file
-    if (!dbHandler->connect()) {
-        std::cerr << "Failed to initialize database." << std::endl;
-        syslog(LOG_ERR, "Failed to initialize database.");
+    // Four probes feeding a writer pool; each worker connection writes to its own temporary table
+    const int producers = 4;
+    const int rowsPerProducer = 500000;
+    DatabaseConfig config = dbConfig;
+    config.postgres_connections = 4;
+    config.postgres_copy_rows = 100000;
+    config.postgres_flush_interval = 1000;
+    config.postgres_queue_rows = 1000000;
+    PostgresWriterPool pool(config, temporaryTable);
+    std::cout.setstate(std::ios::failbit);
+    bool started = pool.start();
+    std::cout.clear();
+    if (!started) {
         return false;
     }
-
-    dbHandler->close();
-    return true;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&pool, &config, &makeFlow, p] {
+            BatchQueueHandler handler(pool, 4096, config.postgres_flush_interval);
+            for (int i = 0; i < rowsPerProducer; ++i) {
+                handler.insertFlowData(makeFlow(i, p));
+            }
+            handler.close();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    pool.stop();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  " << producers << " producers, pool of " << config.postgres_connections << " " << std::fixed << std::setprecision(0)
+              << pool.rows.load() / seconds << " rows/s" << std::endl;
+    return pool.rows.load() == static_cast<uint64_t>(producers) * rowsPerProducer;
 }
 
-// Function to process NetFlow v9 data
-void processNetFlowV9Data(char* buffer, ssize_t length, SondaRuntime& sonda) {
-    char* ptr = buffer;
-    NetFlowV9Header* header = reinterpret_cast<NetFlowV9Header*>(ptr);
-
-    ptr += sizeof(NetFlowV9Header);
-    length -= sizeof(NetFlowV9Header);
-
-    uint16_t count = ntohs(header->count);
-
-    while (length > 0) {
-        if (length < 4) {
-            std::cerr << "Incomplete FlowSet header." << std::endl;
-            syslog(LOG_ERR, "Incomplete FlowSet header.");
-            break;
-        }
+// Heap allocations made by the calling thread, for --bench=alloc. They are
+// only counted in the benchmark build (make bench, -DNETFLOW_BENCH_ALLOC),
+// which replaces the global operator new and delete; the daemon keeps the
+// library's own. The replacements are not inlined, so GCC does not match
+// malloc()/free() against new/delete calls.
+thread_local uint64_t heapAllocations = 0;
 
-        NetFlowV9FlowSetHeader* flowsetHeader = reinterpret_cast<NetFlowV9FlowSetHeader*>(ptr);
-        uint16_t flowsetID = ntohs(flowsetHeader->flowset_id);
-        uint16_t flowsetLength = ntohs(flowsetHeader->length);
+#ifdef NETFLOW_BENCH_ALLOC
+const bool countingAllocations = true;
 
-        ptr += sizeof(NetFlowV9FlowSetHeader);
-        length -= sizeof(NetFlowV9FlowSetHeader);
+__attribute__((noinline)) void* operator new(size_t size) {
+    ++heapAllocations;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
 
-        if (flowsetLength > length + sizeof(NetFlowV9FlowSetHeader)) {
-            std::cerr << "FlowSet length exceeds remaining packet length." << std::endl;
-            syslog(LOG_ERR, "FlowSet length exceeds remaining packet length.");
-            break;
-        }
+__attribute__((noinline)) void* operator new[](size_t size) {
+    ++heapAllocations;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
 
-        size_t flowsetDataLength = flowsetLength - sizeof(NetFlowV9FlowSetHeader);
+__attribute__((noinline)) void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    ++heapAllocations;
+    return std::malloc(size ? size : 1);
+}
 
-        if (flowsetID == 0) {
-            // Template FlowSet
-            char* templatePtr = ptr;
-            while (templatePtr < ptr + flowsetDataLength) {
-                NetFlowV9TemplateRecord* templateRecord = reinterpret_cast<NetFlowV9TemplateRecord*>(templatePtr);
-                uint16_t templateID = ntohs(templateRecord->template_id);
-                uint16_t fieldCount = ntohs(templateRecord->field_count);
+__attribute__((noinline)) void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    ++heapAllocations;
+    return std::malloc(size ? size : 1);
+}
 
-                templatePtr += sizeof(NetFlowV9TemplateRecord);
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
 
-                std::vector<NetFlowV9FieldSpecifier> fields;
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
 
-                for (int i = 0; i < fieldCount; ++i) {
-                    NetFlowV9FieldSpecifier* fieldSpecifier = reinterpret_cast<NetFlowV9FieldSpecifier*>(templatePtr);
-                    NetFlowV9FieldSpecifier field;
-                    field.type = ntohs(fieldSpecifier->type);
-                    field.length = ntohs(fieldSpecifier->length);
-                    fields.push_back(field);
+__attribute__((noinline)) void operator delete[](void* p) noexcept {
+    std::free(p);
+}
 
-                    templatePtr += sizeof(NetFlowV9FieldSpecifier);
-                }
+__attribute__((noinline)) void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
 
-                sonda.templates[templateID] = fields;
-            }
-        } else if (flowsetID > 255) {
-            // Data FlowSet
-            uint16_t templateID = flowsetID;
-            if (sonda.templates.find(templateID) == sonda.templates.end()) {
-                std::cerr << "Unknown template ID: " << templateID << std::endl;
-                syslog(LOG_ERR, "Unknown template ID: %d", templateID);
-                ptr += flowsetDataLength;
-                length -= flowsetDataLength;
-                continue;
-            }
+__attribute__((noinline)) void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
 
-            std::vector<NetFlowV9FieldSpecifier>& fields = sonda.templates[templateID];
-            char* recordPtr = ptr;
-            size_t recordLength = 0;
-            for (auto& field : fields) {
-                recordLength += field.length;
-            }
-
-            while (recordPtr + recordLength <= ptr + flowsetDataLength) {
-                FlowData flowData;
-                size_t offset = 0;
-
-                for (auto& field : fields) {
-                    switch (field.type) {
-                        case 8: // Source IP
-                            flowData.SourceIP = inet_ntoa(*(struct in_addr*)(recordPtr + offset));
-                            break;
-                        case 12: // Destination IP
-                            flowData.DestinationIP = inet_ntoa(*(struct in_addr*)(recordPtr + offset));
-                            break;
-                        case 7: // Source Port
-                            flowData.SourcePort = ntohs(*(uint16_t*)(recordPtr + offset));
-                            break;
-                        case 11: // Destination Port
-                            flowData.DestinationPort = ntohs(*(uint16_t*)(recordPtr + offset));
-                            break;
-                        case 4: // Protocol
-                            flowData.Protocol = *(uint8_t*)(recordPtr + offset);
-                            break;
-                        case 2: // Packet Count
-                            flowData.PacketCount = ntohl(*(uint32_t*)(recordPtr + offset));
-                            break;
-                        case 1: // Byte Count
-                            flowData.ByteCount = ntohl(*(uint32_t*)(recordPtr + offset));
-                            break;
-                        case 21: // Flow Start SysUpTime
-                            // Implement time calculation if needed
-                            break;
-                        case 22: // Flow End SysUpTime
-                            // Implement time calculation if needed
-                            break;
-                        default:
-                            // Ignore other fields
-                            break;
-                    }
-                    offset += field.length;
-                }
+__attribute__((noinline)) void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+#else
+const bool countingAllocations = false;
+#endif
 
-                flowData.SourceSond = sonda.config.name;
+// Heap allocations per decoded flow on the packet path (target: none). The
+// first packet warms up the per-thread columns and is not counted.
+bool benchmarkAllocations() {
+    if (!countingAllocations) {
+        std::cerr << "This build does not count allocations; run 'make bench BENCH=alloc'." << std::endl;
+        return false;
+    }
+    const size_t recordCount = 16;
+    const int iterations = 10000;
+    TemplateFields fixed = benchmarkTemplate();
+    TemplateFields variable = fixed;
+    TemplateField applicationName = { 96, VARIABLE_LENGTH, 0 };
+    variable.push_back(applicationName);
 
-                // Insert the flow data into the database
-                if (!sonda.dbHandler->insertFlowData(flowData)) {
-                    std::cerr << "Failed to insert flow data into database." << std::endl;
-                    syslog(LOG_ERR, "Failed to insert flow data into database.");
-                }
+    struct Case {
+        const char* label;
+        int version;
+        const TemplateFields* fields;
+        const char* simd;
+    } cases[] = {
+        { "NetFlow v9", 9, &fixed, "off" },
+        { "NetFlow v9 batch", 9, &fixed, "auto" },
+        { "IPFIX variable", 10, &variable, "off" },
+    };
 
-                recordPtr += recordLength;
-            }
+    std::cout << "Heap allocations per flow: " << recordCount << " records per packet" << std::endl;
+    bool ok = true;
+    for (const Case& c : cases) {
+        std::vector<char> templatePacket, dataPacket;
+        if (c.version == 9) {
+            makeBenchmarkV9Packets(*c.fields, 256, recordCount, templatePacket, dataPacket);
         } else {
-            // Ignore other FlowSet IDs
+            makeBenchmarkIPFIXPackets(*c.fields, 256, recordCount, templatePacket, dataPacket);
         }
+        selectBatchKernels(c.simd);
 
-        ptr += flowsetDataLength;
-        length -= flowsetDataLength;
+        sondaRuntimes.emplace_back();
+        SondaRuntime& runtime = sondaRuntimes.back();
+        runtime.receivers.emplace_back();
+        SondaReceiver& receiver = runtime.receivers.back();
+        receiver.sonda = &runtime;
+        receiver.dbHandler.reset(new CountingHandler());
+        CountingHandler& counter = static_cast<CountingHandler&>(*receiver.dbHandler);
+        struct sockaddr_in exporter;
+        std::memset(&exporter, 0, sizeof(exporter));
+        exporter.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        decodeDatagram(receiver, templatePacket.data(), templatePacket.size(), exporter);
+        decodeDatagram(receiver, dataPacket.data(), dataPacket.size(), exporter);
+
+        counter.flows = 0;
+        uint64_t before = heapAllocations;
+        for (int i = 0; i < iterations; ++i) {
+            decodeDatagram(receiver, dataPacket.data(), dataPacket.size(), exporter);
+        }
+        uint64_t allocations = heapAllocations - before;
+        std::cout << "  " << std::left << std::setw(19) << c.label << std::right << std::fixed << std::setprecision(3)
+                  << static_cast<double>(allocations) / counter.flows << " (" << allocations << " in " << counter.flows << " flows)" << std::endl;
+        ok = ok && counter.flows == iterations * recordCount && allocations == 0;
+        sondaRuntimes.clear();
     }
+    selectBatchKernels("off");
+    return ok;
 }
 
-// Function to process IPFIX data (placeholder)
-void processIPFIXData(char* buffer, ssize_t length, SondaRuntime& sonda) {
-    // Implement IPFIX data processing
-    // Placeholder implementation
-}
+// Flow aggregation: flows/s through AggregatingHandler on 5-tuple keys, once
+// with every key fitting into the cache and once with a cache too small for
+// them, which emits the least recently updated aggregates early
+bool benchmarkAggregation() {
+    const size_t flowCount = 8000000;
+    const size_t batchRows = 32;
 
-// Function to receive and process data
-void receiveData(SondaRuntime& sonda) {
-    char buffer[65536];
-    struct sockaddr_in cliaddr;
-    socklen_t len = sizeof(cliaddr);
-    while (true) {
-        ssize_t n = recvfrom(sonda.socket_fd, buffer, sizeof(buffer), 0, (struct sockaddr*)&cliaddr, &len);
-        if (n < 0) {
-            perror("Error receiving data");
-            syslog(LOG_ERR, "Error receiving data: %s", strerror(errno));
-            continue;
+    // Sums up what reaches the sink
+    class SummingHandler : public DatabaseHandler {
+    public:
+        uint64_t rows = 0;
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        bool connect() override { return true; }
+        bool insertFlowData(const FlowData& data) override { return insertFlowBatch(&data, 1); }
+        bool insertFlowBatch(const FlowData* flows, size_t count) override {
+            rows += count;
+            for (size_t i = 0; i < count; ++i) {
+                packets += flows[i].PacketCount;
+                bytes += flows[i].ByteCount;
+            }
+            return true;
         }
+        void close() override {}
+        bool initializeTable() override { return true; }
+        bool checkConnection() override { return true; }
+    };
 
-        char source_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &(cliaddr.sin_addr), source_ip, INET_ADDRSTRLEN);
+    struct Case {
+        const char* label;
+        size_t keys;
+        int memory;
+    } cases[] = {
+        { "1024 keys, 64 MiB", 1024, 64 },
+        { "65536 keys, 64 MiB", 65536, 64 },
+        { "65536 keys, 1 MiB", 65536, 1 },
+    };
 
-        // Check if the source IP matches the filter address
-        bool accepted = true;
-        if (!sonda.config.filter_address.empty() && sonda.config.filter_address != source_ip) {
-            // Ignore packet from other source
-            accepted = false;
+    std::cout << "Flow aggregation: " << flowCount << " flows on srcip, dstip, srcport, dstport, protocol" << std::endl;
+    for (const Case& c : cases) {
+        std::vector<FlowData> flows(flowCount);
+        uint64_t packets = 0, bytes = 0;
+        uint32_t seed = 12345;
+        for (FlowData& flow : flows) {
+            seed = seed * 1103515245 + 12345;
+            uint32_t key = (seed >> 8) % c.keys;
+            uint32_t source = htonl(0x0A000000 | key);
+            uint32_t destination = htonl(0xC0A80001 + (key & 0xFF));
+            setIPv4(flow.SourceIP, &source);
+            setIPv4(flow.DestinationIP, &destination);
+            flow.SourcePort = static_cast<uint16_t>(1024 + (key & 0x3FF));
+            flow.DestinationPort = 443;
+            flow.Protocol = 6;
+            flow.PacketCount = 1 + (seed & 0x0F);
+            flow.ByteCount = flow.PacketCount * 1400;
+            flow.FlowStart = 1700000000000000000ULL + (seed & 0xFFFF);
+            flow.FlowEnd = flow.FlowStart + 1000000;
+            packets += flow.PacketCount;
+            bytes += flow.ByteCount;
         }
 
-        // Display packet information if displayPackets is true
-        if (displayPackets) {
-            std::cout << "Received packet from " << source_ip << " on port " << sonda.config.port;
-            if (accepted) {
-                std::cout << " [ACCEPTED]" << std::endl;
-            } else {
-                std::cout << " [REJECTED] (Expected source IP: " << sonda.config.filter_address << ")" << std::endl;
-            }
-        }
+        AggregationConfig config;
+        config.key_fields = AGGREGATE_SOURCE_IP | AGGREGATE_DESTINATION_IP | AGGREGATE_SOURCE_PORT | AGGREGATE_DESTINATION_PORT | AGGREGATE_PROTOCOL;
+        config.memory_size = c.memory;
+        SummingHandler* sum = new SummingHandler();
+        uint64_t evictions = aggregationStats.evictions.load();
+        AggregatingHandler aggregator(config, std::unique_ptr<DatabaseHandler>(sum));
 
-        // Write raw data to diagnostic file if diagFilePath is set
-        if (!diagFilePath.empty()) {
-            std::lock_guard<std::mutex> lock(diagFileMutex); // Ensure thread safety
-            std::ofstream diagFile(diagFilePath, std::ios::app | std::ios::binary);
-            if (diagFile.is_open()) {
-                diagFile << "Probe: " << sonda.config.name << std::endl;
-                diagFile << "Data: ";
-                // Write data in hexadecimal format
-                for (ssize_t i = 0; i < n; ++i) {
-                    diagFile << std::hex << std::setw(2) << std::setfill('0') << (static_cast<unsigned int>(buffer[i]) & 0xFF) << ' ';
-                }
-                diagFile << std::dec << std::endl << std::endl; // Reset to decimal
-                diagFile.close();
-            } else {
-                std::cerr << "Cannot open diagnostic file: " << diagFilePath << std::endl;
-                syslog(LOG_ERR, "Cannot open diagnostic file: %s", diagFilePath.c_str());
-            }
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < flowCount; i += batchRows) {
+            aggregator.insertFlowBatch(flows.data() + i, std::min(batchRows, flowCount - i));
         }
+        aggregator.close();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        evictions = aggregationStats.evictions.load() - evictions;
 
-        if (!accepted) {
-            continue;
+        std::cout << "  " << std::left << std::setw(19) << c.label << std::right << std::fixed << std::setprecision(0)
+                  << flowCount / seconds << " flows/s, " << sum->rows << " rows (ratio " << std::setprecision(1)
+                  << static_cast<double>(flowCount) / sum->rows << "), " << evictions << " evicted" << std::endl;
+        if (sum->packets != packets || sum->bytes != bytes || sum->rows < c.keys) {
+            std::cerr << "Aggregated counters differ from the flows." << std::endl;
+            return false;
         }
+    }
+    return true;
+}
 
-        // Process the data
-        uint16_t version = ntohs(*(uint16_t*)buffer);
-        if (version == 9) {
-            processNetFlowV9Data(buffer, n, sonda);
-        } else if (version == 10) {
-            processIPFIXData(buffer, n, sonda);
-        } else {
-            std::cerr << "Unknown NetFlow version: " << version << std::endl;
-            syslog(LOG_ERR, "Unknown NetFlow version: %d", version);
-        }
+// Function to run the benchmark selected with --bench=NAME
+// 'mysql' needs a server and is not part of 'all'; 'alloc' is part of it only
+// in the benchmark build, which counts allocations
+bool runBenchmark(const std::string& name, const std::string& configFile) {
+    bool all = name == "all";
+    bool known = false;
+    if (all || name == "recv") {
+        known = true;
+        if (!benchmarkReceive()) return false;
+    }
+    if (all || name == "decode") {
+        known = true;
+        if (!benchmarkDecode()) return false;
     }
+    if (all || name == "simd") {
+        known = true;
+        if (!benchmarkBatchDecode()) return false;
+    }
+    if (all || name == "ipfix") {
+        known = true;
+        if (!benchmarkIPFIX()) return false;
+    }
+    if ((all && countingAllocations) || name == "alloc") {
+        known = true;
+        if (!benchmarkAllocations()) return false;
+    }
+    if (all || name == "aggregate") {
+        known = true;
+        if (!benchmarkAggregation()) return false;
+    }
+    if (all || name == "sqlite") {
+        known = true;
+        if (!benchmarkSQLite()) return false;
+    }
+    if (all || name == "csv") {
+        known = true;
+        if (!benchmarkCSV()) return false;
+    }
+    if (all || name == "nfcapd") {
+        known = true;
+        if (!benchmarkNfcapd()) return false;
+    }
+    if (all || name == "native") {
+        known = true;
+        if (!benchmarkNative()) return false;
+    }
+    if (all || name == "arrow") {
+        known = true;
+        if (!benchmarkArrow()) return false;
+    }
+    if (name == "mysql") {
+        known = true;
+        if (!benchmarkMySQL(configFile)) return false;
+    }
+    if (name == "postgres") {
+        known = true;
+        if (!benchmarkPostgres(configFile)) return false;
+    }
+    if (!known) {
+        std::cerr << "Unknown benchmark: " << name << std::endl;
+        return false;
+    }
+    return true;
 }
 
 // Function to display version and author information
@@ -811,6 +10123,8 @@ void displayHelp() {
     std::cout << "  --config=PATH         Specify path to configuration file (default: nf_sond.ini)" << std::endl;
     std::cout << "  --checkdb             Check database connection and initialize table if necessary" << std::endl;
     std::cout << "  --diag=PATH           Enable diagnostic logging to the specified file" << std::endl;
+    std::cout << "  --bench=NAME          Run a built-in benchmark and exit (recv, decode, simd, ipfix, alloc, aggregate, sqlite, csv, nfcapd, native, arrow, mysql, postgres, all)" << std::endl;
+    std::cout << "  --dump=PATH           Print a native segment file as CSV and exit" << std::endl;
     std::cout << std::endl;
     std::cout << "The application uses a configuration file to set up database connections and probes." << std::endl;
     std::cout << "Please refer to the documentation for the format of the .ini file." << std::endl;
@@ -820,6 +10134,8 @@ void displayHelp() {
 int main(int argc, char* argv[]) {
     std::string configFile = "nf_sond.ini"; // Default configuration file
     bool checkDbOnly = false;
+    std::string benchmarkName;
+    std::string dumpPath;
 
     // Parse command-line arguments
     for (int i = 1; i < argc; ++i) {
@@ -838,6 +10154,10 @@ int main(int argc, char* argv[]) {
             checkDbOnly = true;
         } else if (arg.find("--diag=") == 0) {
             diagFilePath = arg.substr(7);
+        } else if (arg.find("--bench=") == 0) {
+            benchmarkName = arg.substr(8);
+        } else if (arg.find("--dump=") == 0) {
+            dumpPath = arg.substr(7);
         } else {
             std::cerr << "Unknown argument: " << arg << std::endl;
             displayHelp();
@@ -845,6 +10165,14 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // Benchmarks do not need a configuration file (except 'mysql')
+    if (!benchmarkName.empty()) {
+        return runBenchmark(benchmarkName, configFile) ? 0 : 1;
+    }
+    if (!dumpPath.empty()) {
+        return dumpNativeSegment(dumpPath) ? 0 : 1;
+    }
+
     // Load configuration
     if (!loadConfig(configFile)) {
         if (enableLogging) {
@@ -861,6 +10189,9 @@ int main(int argc, char* argv[]) {
         syslog(LOG_INFO, "NetFlow Collector started.");
     }
 
+    // Choose the batch decoder for this CPU
+    selectBatchKernels(simdSetting);
+
     // If --diag is set, check if the file can be opened
     if (!diagFilePath.empty()) {
         std::ofstream diagFile(diagFilePath, std::ios::app);
@@ -906,11 +10237,23 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    // Start receiving data for each probe
+    // Stop receiving cleanly on SIGINT/SIGTERM
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleSignal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    // Start the decode workers, then receiving data for each probe
+    std::vector<std::thread> workerThreads;
+    startDecodeWorkers(workerThreads);
+
     std::vector<std::thread> threads;
+    startReceiveEngine(threads);
 
-    for (auto& sonda : sondaRuntimes) {
-        threads.emplace_back(receiveData, std::ref(sonda));
+    std::thread statsThread;
+    if (statsInterval > 0) {
+        statsThread = std::thread(statisticsLoop);
     }
 
     // Wait for threads to finish
@@ -918,9 +10261,43 @@ int main(int argc, char* argv[]) {
         t.join();
     }
 
+    // Decode what is still queued before the databases are closed
+    stopDecodeWorkers(workerThreads);
+    if (statsThread.joinable()) {
+        statsThread.join();
+        logStatistics();
+    }
+
     // Close databases
     for (auto& sonda : sondaRuntimes) {
-        sonda.dbHandler->close();
+        for (auto& receiver : sonda.receivers) {
+            receiver.dbHandler->close();
+        }
+    }
+    // Sink queues write into the shared writers, so they stop first
+    for (auto& sink : sinkQueues) {
+        sink->stop();
+    }
+    if (sqliteWriter) {
+        sqliteWriter->stop();
+    }
+    if (mysqlPool) {
+        mysqlPool->stop();
+    }
+    if (postgresPool) {
+        postgresPool->stop();
+    }
+    if (csvWriter) {
+        csvWriter->stop();
+    }
+    if (nfcapdWriter) {
+        nfcapdWriter->stop();
+    }
+    if (nativeWriter) {
+        nativeWriter->stop();
+    }
+    if (arrowWriter) {
+        arrowWriter->stop();
     }
 
     if (enableLogging) {
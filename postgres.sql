@@ -0,0 +1,13 @@
+CREATE TABLE NetFlowData (
+    FlowID BIGINT GENERATED ALWAYS AS IDENTITY PRIMARY KEY,
+    SourceIP INET,
+    DestinationIP INET,
+    SourcePort INTEGER NOT NULL,
+    DestinationPort INTEGER NOT NULL,
+    Protocol SMALLINT NOT NULL,
+    PacketCount BIGINT NOT NULL,
+    ByteCount BIGINT NOT NULL,
+    FlowStart TIMESTAMPTZ,
+    FlowEnd TIMESTAMPTZ,
+    SourceSond VARCHAR(50) NOT NULL
+);